@@ -10,6 +10,7 @@
 
 #include "Netran.h"
 #include "Serialization.h"
+#include "StringDictionary.h"
 
 namespace Distributed
 {
@@ -170,6 +171,15 @@ namespace Distributed
     }
 
     static const Netran::Address GENERIC_CONNECTION = "";
+
+    /**
+     * The replace key of the unreliable method invocations on the same object and method, so only the latest queued one is transmitted
+     */
+    static inline uint64_t ComposeReplaceKey(ObjectID objID, const String& signature)
+    {
+        uint64_t key = ( objID * 0x9e3779b97f4a7c15ULL ) ^ std::hash<String>()(signature);
+        return key != 0 ? key : 1; // NB: 0 means no replacement
+    }
     
     class IDistributedObject
     {
@@ -247,7 +257,7 @@ namespace Distributed
             if ( it != m_boundObjects.end() )
             {
                 String signature;
-                SERIALIZE(s, signature);
+                SERIALIZE_P(s, signature, "dictionary");
 
                 // The implementation of the method would use GetInvokeConnection to retrieve the connID for use
                 it->second->SetInvokeConnection(connID);
@@ -301,6 +311,10 @@ namespace Distributed
     static const MessageType MESSAGE_DELETE_OBJECT = 2;
     static const MessageType MESSAGE_UPDATE_OBJECT = 3;
     static const MessageType MESSAGE_INVOKE_METHOD = 4;
+    static const MessageType MESSAGE_ACKNOWLEDGE_STRINGS = 5;
+    static const MessageType MESSAGE_DEFINE_STRINGS = 6;
+
+    static const uint64_t REPLACE_KEY_ACKNOWLEDGE_STRINGS = ~0ULL;
 
     class DistributedObjectSystemConnection : public Netran::IConnection::IListener
     {
@@ -324,6 +338,7 @@ namespace Distributed
 
             if (pobj)
             {
+                StringDictionaryScope strings(m_outgoingStrings);
                 Buffer buffer;
                 SerializationOutputWrapperType output( DataPolicyContainerWrapper::Singleton(), buffer );
                 ISerializationType& s = output;
@@ -337,7 +352,13 @@ namespace Distributed
                     return false;
                 }
 
-                m_connection->Send(buffer, true);
+                output.Flush();
+
+                // NB: everything else about the object depends on its creation, so it preempts the queued traffic
+                if ( m_connection->Send(buffer, true, Netran::Priority::CRITICAL) )
+                {
+                    strings.Commit();
+                }
             }
 
             m_spawnedObjects.insert(objID);
@@ -352,6 +373,7 @@ namespace Distributed
             {
                 m_spawnedObjects.erase(it);
 
+                StringDictionaryScope strings(m_outgoingStrings);
                 Buffer buffer;
                 SerializationOutputWrapperType output( DataPolicyContainerWrapper::Singleton(), buffer );
                 ISerializationType& s = output;
@@ -360,7 +382,11 @@ namespace Distributed
                 SERIALIZE(s, msgType);
                 SERIALIZE(s, objID);
 
-                m_connection->Send(buffer, true);
+                output.Flush();
+                if ( m_connection->Send(buffer, true) )
+                {
+                    strings.Commit();
+                }
 
                 return true;
             }
@@ -369,23 +395,35 @@ namespace Distributed
         }
 
         template <typename M>
-        bool InvokeRemoteMethod(ObjectID objID, const String& signature, M m, typename MemberFunctionTraits<M>::As&& args, bool reliable)
+        bool InvokeRemoteMethod(ObjectID objID, const String& signature, M m, typename MemberFunctionTraits<M>::As&& args, bool reliable, Netran::Priority priority = Netran::Priority::NORMAL, bool replaceable = false)
         {
+            StringDictionaryScope strings(m_outgoingStrings, reliable); // NB: the unreliable invocations only refer to the acknowledged strings
             Buffer buffer;
             SerializationOutputWrapperType output( DataPolicyContainerWrapper::Singleton(), buffer );
+            output.Reserve( m_sizeHints.Get(signature) ); // NB: the invocations of a method tend to be of similar sizes
             ISerializationType& s = output; // TODO: why an explicit cast is needed here??
 
             MessageType msgType = MESSAGE_INVOKE_METHOD;
             SERIALIZE(s, msgType);
             SERIALIZE(s, objID);
-            SERIALIZE(s, const_cast<String&>(signature));
+            SERIALIZE_P(s, const_cast<String&>(signature), "dictionary");
 
             if ( !ArgumentsSerializer<M>(s, args)() )
             {
                 return false;
             }
 
-            m_connection->Send(buffer, reliable);
+            output.Flush();
+            m_sizeHints.Update( signature, BYTES2BITS(buffer.size()) );
+            if ( m_connection->Send( buffer, reliable, priority, replaceable ? ComposeReplaceKey(objID, signature) : 0 ) )
+            {
+                strings.Commit(); // NB: the signature defined for a failed or dropped invocation is taken back
+            }
+
+            if ( m_outgoingStrings.HasPending() )
+            {
+                DefineStrings();
+            }
 
             return true;
         }
@@ -393,6 +431,7 @@ namespace Distributed
     protected:
         void OnIncomingData(Buffer&& buffer) override
         {
+            StringDictionaryScope strings(m_incomingStrings);
             SerializationInputWrapperType input( DataPolicyContainerWrapper::Singleton(), buffer );
             ISerializationType& s = input;
             MessageType msgType = MESSAGE_INVALID_TYPE;
@@ -419,9 +458,68 @@ namespace Distributed
                 m_owner.get().ProcessInvokeMethod( m_connection->GetRemoteAddress(), s );
                 break;
 
+            case MESSAGE_ACKNOWLEDGE_STRINGS:
+                ProcessAcknowledgeStrings(s);
+                break;
+
+            case MESSAGE_DEFINE_STRINGS:
+                strings.SerializePending(s);
+                break;
+
             default:
                 break;
             }
+
+            if ( strings.HasDefinitions() )
+            {
+                AcknowledgeStrings();
+            }
+        }
+
+        // the strings met undefined by the unreliable invocations are defined reliably, so they are referred to by ID once acknowledged
+        void DefineStrings()
+        {
+            StringDictionaryScope strings(m_outgoingStrings);
+            Buffer buffer;
+            SerializationOutputWrapperType output( DataPolicyContainerWrapper::Singleton(), buffer );
+            ISerializationType& s = output;
+
+            MessageType msgType = MESSAGE_DEFINE_STRINGS;
+            if ( !::Serialize(s, msgType) || !strings.SerializePending(s) )
+            {
+                return;
+            }
+
+            output.Flush();
+            if ( m_connection->Send(buffer, true, Netran::Priority::HIGH) )
+            {
+                strings.Commit();
+            }
+        }
+
+        // NB: the acknowledgements go unreliably, each one superseding the queued one; a lost one is made up for by the next definition
+        void AcknowledgeStrings()
+        {
+            Buffer buffer;
+            SerializationOutputWrapperType output( DataPolicyContainerWrapper::Singleton(), buffer );
+            ISerializationType& s = output;
+
+            MessageType msgType = MESSAGE_ACKNOWLEDGE_STRINGS;
+            U32 count = m_incomingStrings.GetNumDefined();
+            ::Serialize(s, msgType);
+            ::Serialize(s, count);
+
+            output.Flush();
+            m_connection->Send(buffer, false, Netran::Priority::HIGH, REPLACE_KEY_ACKNOWLEDGE_STRINGS);
+        }
+
+        bool ProcessAcknowledgeStrings(ISerializationType& s)
+        {
+            U32 count = 0;
+            SERIALIZE(s, count);
+
+            m_outgoingStrings.Acknowledge(count);
+            return true;
         }
 
         virtual bool ProcessCreateObject(ISerializationType&) { return true; }
@@ -432,6 +530,11 @@ namespace Distributed
         DistributedObjectSystemBase::ref m_owner;
 
         std::unordered_set<ObjectID> m_spawnedObjects;
+
+        SerializationSizeHints<String> m_sizeHints; // of the method invocations, by signature
+
+        StringDictionary m_outgoingStrings; // the strings sent on the connection, e.g. the RMI signatures
+        StringDictionary m_incomingStrings;
     };
 
     class DistributedObjectSystemServer : public DistributedObjectSystemBase, public Netran::IServer::IListener
@@ -527,15 +630,16 @@ namespace Distributed
         // All: InvokeRemoteMethod({}, true, objID, COMPOSE_SIGNATURE(MyDistributedObject, DoSomething), {arg1, arg2, arg3}, false);
         // All but one: InvokeRemoteMethod({connID}, true, objID, COMPOSE_SIGNATURE(MyDistributedObject, DoSomething), {arg1, arg2, arg3}, false);
         // One: InvokeRemoteMethod({connID}, false, objID, COMPOSE_SIGNATURE(MyDistributedObject, DoSomething), {arg1, arg2, arg3}, false);
+        // the optional priority selects the outgoing priority class; replaceable unreliable invocations only keep the latest queued one per object and method
         template <typename M>
-        void InvokeRemoteMethod(const std::unordered_set<Netran::Address>& connIDs, bool except, ObjectID objID, const String& signature, M m, typename MemberFunctionTraits<M>::As&& args, bool reliable)
+        void InvokeRemoteMethod(const std::unordered_set<Netran::Address>& connIDs, bool except, ObjectID objID, const String& signature, M m, typename MemberFunctionTraits<M>::As&& args, bool reliable, Netran::Priority priority = Netran::Priority::NORMAL, bool replaceable = false)
         {
             if (!except)
             {
                 for (auto& connID : connIDs)
                 {
                     auto it = m_connections.find(connID);
-                    it->second.InvokeRemoteMethod(objID, signature, m, std::move(args), reliable);
+                    it->second.InvokeRemoteMethod(objID, signature, m, std::move(args), reliable, priority, replaceable);
                 }
             }
             else
@@ -544,7 +648,7 @@ namespace Distributed
                 {
                     if ( connIDs.find(connection.first) == connIDs.end() )
                     {
-                        connection.second.InvokeRemoteMethod(objID, signature, m, std::move(args), reliable);
+                        connection.second.InvokeRemoteMethod(objID, signature, m, std::move(args), reliable, priority, replaceable);
                     }
                 }
             }
@@ -622,11 +726,11 @@ namespace Distributed
         }
 
         template <typename M>
-        void InvokeRemoteMethod(ObjectID objID, const String& signature, M m, typename MemberFunctionTraits<M>::As&& args, bool reliable)
+        void InvokeRemoteMethod(ObjectID objID, const String& signature, M m, typename MemberFunctionTraits<M>::As&& args, bool reliable, Netran::Priority priority = Netran::Priority::NORMAL, bool replaceable = false)
         {
             if (m_connection)
             {
-                m_connection->InvokeRemoteMethod(objID, signature, m, std::move(args), reliable);
+                m_connection->InvokeRemoteMethod(objID, signature, m, std::move(args), reliable, priority, replaceable);
             }
         }
 
@@ -687,7 +791,7 @@ public:
     template <typename M>                                                               \
     static bool StaticRegisterMethod(const String& signature, M m)                      \
     {                                                                                   \
-        static_method_registry().emplace(signature,                                     \
+        static_method_registry().emplace(String::Intern(signature),                     \
             std::bind(Distributed::StaticInvoke<M>, m,                                  \
                 std::placeholders::_1, std::placeholders::_2));                         \
         return true;                                                                    \
@@ -7,6 +7,10 @@
 
 #include <iostream>
 #include "GameEngineSystem.h"
+#include "GeometricQuantization.h"
+
+FORCE_LINK_DATA_POLICY_CLASS(BoundedVectorF64Policy);
+FORCE_LINK_DATA_POLICY_CLASS(StringDictionaryPolicy);
 
 RMI_REGISTER_METHOD(Entity, UpdatePhysics);
 RMI_REGISTER_METHOD(Entity, SetAutonomous);
@@ -32,14 +36,35 @@ RMI_IMPLEMENT_METHOD(Entity, UpdatePhysics, const Vec3& pos, double yaw, U64 tim
     const auto& server = m_engine.ServerCast();
     if (server)
     {
-        server->InvokeRemoteMethod( {GetInvokeConnection()}, true, GetID(), RMI_COMPOSE_SIGNATURE(Entity, UpdatePhysics), {pos, yaw, 0}, false );
+        server->InvokeRemoteMethod( {GetInvokeConnection()}, true, GetID(), RMI_COMPOSE_SIGNATURE(Entity, UpdatePhysics), {pos, yaw, 0}, false, Netran::Priority::HIGH, true );
     }
     return true;
 }
 
 RMI_REGISTER_METHOD(MasterObject, ClientRequestLogin);
 RMI_REGISTER_METHOD(MasterObject, ServerSetupDone);
-RMI_REGISTER_METHOD(MasterObject, KeepAlive);
+
+void Engine::LoadDataPolicies()
+{
+    static bool s_loaded = false;
+    if (s_loaded)
+    {
+        return;
+    }
+    s_loaded = true;
+
+    typedef IMetadataProcessor::Element Element;
+
+    // NB: the world spans +/- 4096 units horizontally (2mm precision) and +/- 256 vertically, the yaw is in degrees
+    Element position = { "policy", { {"name", "position"}, {"class", "BoundedVectorF64Policy"} }, {
+        { "X", { {"min", "-4096"}, {"max", "4096"}, {"nbits", "22"} } },
+        { "Y", { {"min", "-256"}, {"max", "256"}, {"nbits", "18"} } },
+        { "Z", { {"min", "-4096"}, {"max", "4096"}, {"nbits", "22"} } },
+    } };
+    Element yaw = { "policy", { {"name", "yaw"}, {"class", "AngleF64Policy"} }, { { "angle", { {"min", "0"}, {"max", "360"}, {"nbits", "12"} } } } };
+
+    DataPolicyContainerPreloadType::Singleton().LoadPolicies( MetadataProcessorInline( {position, yaw} ) );
+}
 
 void Engine::Tick()
 {
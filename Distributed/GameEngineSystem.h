@@ -27,9 +27,9 @@ struct Vec3
 
     bool Serialize(ISerializationType& s)
     {
-        SERIALIZE(s, x);
-        SERIALIZE(s, y);
-        SERIALIZE(s, z);
+        SERIALIZE_PT(s, x, "position", "X");
+        SERIALIZE_PT(s, y, "position", "Y");
+        SERIALIZE_PT(s, z, "position", "Z");
         return true;
     }
 };
@@ -52,7 +52,7 @@ public:
     bool Serialize(ISerializationType& s) override
     {
         SERIALIZE(s, m_pos);
-        SERIALIZE(s, m_yaw);
+        SERIALIZE_P(s, m_yaw, "yaw");
         return true;
     }
 
@@ -106,7 +106,11 @@ typedef std::unique_ptr< ClientEngine, NoDelete<ClientEngine> > ClientEnginePtr;
 class Engine
 {
 public:
-    Engine() {}
+    Engine()
+    {
+        LoadDataPolicies();
+    }
+
     ~Engine() {}
 
     void SetServer(ServerEnginePtr server)
@@ -171,6 +175,9 @@ public:
     void Tick();
 
 protected:
+    // the quantization of the entity states (the bounds of the world, etc.)
+    static void LoadDataPolicies();
+
     virtual void OnEntityCreated(Entity::weak_ptr entity) = 0;
     virtual void OnEntityDeleted(Entity::weak_ptr entity) = 0;
 
@@ -208,11 +215,6 @@ public:
         return true;
     }
 
-    RMI_DECLARE_METHOD(KeepAlive)
-    {
-        return true;
-    }
-
 private:
     std::unique_ptr< ServerEngine, NoDelete<ServerEngine> > m_server;
     std::unique_ptr< ClientEngine, NoDelete<ClientEngine> > m_client;
@@ -237,13 +239,7 @@ public:
         // TODO: collect the current snapshot of the entities (pos/rot) and invoke the RPC (UpdatePhysics) of each entity on all the connections
         // for now, the server just relays the UpdatePhysics call to all the other connections inside Entity::UpdatePhysics
 
-        // Keep alive ...
-        // since this RMI is reliable, any dead connection would timeout - we don't need the clients to send us back anything!
-        if ( m_keepAliveTimer.GetElapsedMilliseconds(false) > 1000.f )
-        {
-            InvokeRemoteMethod({}, true, Distributed::MASTER_OBJECT, RMI_COMPOSE_SIGNATURE(MasterObject, KeepAlive), {}, true);
-            m_keepAliveTimer.Reset();
-        }
+        // NB: no keep alive needed here, Netran heartbeats the idle connections and times out the dead ones (IConnection::SetIdleTimeout)
     }
 
     ~ServerEngine()
@@ -272,8 +268,8 @@ private:
         // mark as autonomous locally
         m_connections[connID].autonomousObjects.insert(objID);
 
-        // mark as autonomous remotely (reliable messages are always ordered, so this RMI should happen *after* the entity is created on the client side)
-        InvokeRemoteMethod({connID}, false, objID, RMI_COMPOSE_SIGNATURE(Entity, SetAutonomous), {true}, true);
+        // mark as autonomous remotely (reliable messages are always ordered, and the critical ones are queued in order as well, so this RMI should happen *after* the entity is created on the client side)
+        InvokeRemoteMethod({connID}, false, objID, RMI_COMPOSE_SIGNATURE(Entity, SetAutonomous), {true}, true, Netran::Priority::CRITICAL);
     }
 
     void OnConnectionDeleted(const Netran::Address& connID) override
@@ -309,8 +305,6 @@ private:
 
     Engine& m_engine;
     MasterObject m_master;
-
-    Netran::Timer m_keepAliveTimer;
 };
 
 class ClientEngine : public Distributed::DistributedObjectSystemClient
@@ -333,7 +327,7 @@ public:
         auto autonomous = m_engine.GetAutonomousEntity();
         if (autonomous)
         {
-            InvokeRemoteMethod( autonomous->GetID(), RMI_COMPOSE_SIGNATURE(Entity, UpdatePhysics), { autonomous->GetPosition(), autonomous->GetRotation(), 0}, false );
+            InvokeRemoteMethod( autonomous->GetID(), RMI_COMPOSE_SIGNATURE(Entity, UpdatePhysics), { autonomous->GetPosition(), autonomous->GetRotation(), 0}, false, Netran::Priority::HIGH, true );
         }
         // Render the entities at their interpolated position
     }
@@ -47,6 +47,12 @@ namespace Netran {
             return std::chrono::high_resolution_clock::now().time_since_epoch() / std::chrono::milliseconds(1);
         }
 
+        // monotonic milliseconds, wrapping around every ~49 days; only the (unsigned) differences are meaningful
+        static uint32_t Milliseconds()
+        {
+            return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+        }
+
     private:
         std::chrono::high_resolution_clock::time_point m_start;
     };
@@ -66,6 +72,28 @@ namespace Netran {
 
     typedef std::string Address;
 
+    /**
+     * The priority classes of the outgoing messages of a connection
+     * CRITICAL messages preempt everything else (strict priority); the other classes share the bandwidth by weighted fair queuing
+     */
+    enum class Priority
+    {
+        CRITICAL,
+        HIGH,
+        NORMAL,
+        BULK,
+        MAXNUM
+    };
+
+    /**
+     * The datagram I/O backends; IO_URING falls back to SOCKETS on the systems without io_uring support
+     */
+    enum class Backend
+    {
+        SOCKETS,    // the BSD socket API, one syscall per datagram (or per segmented batch)
+        IO_URING,   // linux io_uring, multishot receive into a provided buffer ring and batched submissions of the sends of a tick
+    };
+
     /**
      * The connection interface
      */
@@ -94,17 +122,41 @@ namespace Netran {
         virtual void Close() = 0;
 
         /**
-         * This method sends the data to the other side of the connection
+         * This method sends the data to the other side of the connection, with the NORMAL priority
+         * Returns false if the data is dropped, i.e. the connection is not established
          */
-        virtual void Send(const Buffer& data, bool reliable) = 0;
+        virtual bool Send(const Buffer& data, bool reliable) = 0;
 
         /**
-         * This method retrieves the remote address in the form of "<ipaddr>:<port>"
+         * This method queues the data for the other side of the connection with the given priority; the queued messages are transmitted on the next tick
+         * An unreliable message with a non zero replace key replaces the queued (not yet transmitted) message of the same key, so only the latest state goes out
+         * Returns false if the data is dropped, i.e. the connection is not established
+         */
+        virtual bool Send(const Buffer& data, bool reliable, Priority priority, uint64_t replace_key = 0) = 0;
+
+        /**
+         * Limits the outgoing bandwidth of the scheduled messages, in bytes per second; 0 means unlimited
+         */
+        virtual void SetBandwidthLimit(float limit) = 0;
+
+        /**
+         * This method retrieves the remote address in the form of "<ipv4>:<port>" or "[<ipv6>]:<port>"
          */
         virtual const Address& GetRemoteAddress() const = 0;
 
         /**
-         * Get Round Trip Time, in milliseconds
+         * The connection is considered broken (and the corresponding callback fired) when nothing arrives from the other side for this long, in milliseconds; 0 disables the detection
+         * An established connection sends heartbeats only when it has sent nothing else for a while, so an idle peer stays alive with the default (10 seconds)
+         */
+        virtual void SetIdleTimeout(float timeout) = 0;
+
+        /**
+         * Get the time since anything was last received from the other side, in milliseconds
+         */
+        virtual float GetIdleTime() const = 0;
+
+        /**
+         * Get Round Trip Time, in milliseconds; smoothed from the timestamps echoed by the other side on every packet
          */
         virtual float GetRTT() const = 0;
 
@@ -124,9 +176,9 @@ namespace Netran {
         typedef std::unique_ptr<IServer> ptr;
 
         /**
-         * This static method creates a new instance of the server within the process
+         * This static method creates a new instance of the server within the process, over the given datagram backend
          */
-        static ptr CreateInstance();
+        static ptr CreateInstance(Backend backend = Backend::SOCKETS);
 
         /**
          * The connection event listener, mostly for handling connection creation and deletion events
@@ -145,7 +197,7 @@ namespace Netran {
         virtual void Setup(IListener::ptr listener) = 0;
 
         /**
-         * Starts the server up and binds it to a local address in the form of "<ipaddr>:<port>"
+         * Starts the server up and binds it to a local address in the form of "<ipv4>:<port>" or "[<ipv6>]:<port>"; ":<port>" binds a dual-stack socket to all the interfaces
          * If successful, the server is listening and accepting incoming connections
          * Returns true when the startup is successful; false otherwise
          */
@@ -5,123 +5,307 @@
 //  Created by Lin Luo on 05/01/2015.
 //
 
-#include "IDatagram.h"
+#include "DatagramUnix.h"
 
-#include <sstream>
-#include <sys/socket.h>
-#include <netinet/in.h>
+#include <cstring>
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
 
 namespace Netran
 {
-    // the output ipv4 and port are all in network byte order
-    static inline void parse_address(const Address& addr, in_addr* ipv4, uint16_t* port)
+    DatagramUnix::DatagramUnix()
+        : m_socket(-1)
+        , m_family(AF_UNSPEC)
+        , m_buffer(MAX_PACKET_SIZE)
+        , m_gso(false)
+        , m_gro(false)
+        , m_pending_offset(0)
+        , m_pending_segsize(0)
     {
-        ipv4->s_addr = 0;
-        *port = 0;
+    }
 
-        size_t p = addr.find(':');
-        if (p != Address::npos)
-            *port = htons( std::stoi(addr.substr(p + 1).c_str()) );
-        ipv4->s_addr = inet_addr( addr.substr(0, p).c_str() );
+    DatagramUnix::~DatagramUnix()
+    {
+        DatagramUnix::Term();
     }
 
-    // the input ipv4 and port are all in the network byte order
-    static inline void make_address(Address& addr, in_addr ipv4, uint16_t port)
+    void DatagramUnix::Init(const Address& addr, const Options& options)
     {
-        std::stringstream ss;
-        ss << inet_ntoa(ipv4) << ":" << ntohs(port);
-        addr = ss.str();
+        DatagramUnix::Term();
+
+        Endpoint local;
+        if ( !Endpoint::Parse(addr, local) )
+            return;
+
+        // NB: the wildcard address prefers a dual-stack IPv6 socket, so both IPv4 and IPv6 peers can be reached with the same socket;
+        // should IPv6 be unavailable (or the dual mode is refused), fall back to a plain IPv4 socket
+        if ( local.IsUnspecified() && options.dualstack && open(AF_INET6, options) )
+        {
+            int v6only = 0;
+            if ( setsockopt(m_socket, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only)) != 0 )
+                DatagramUnix::Term();
+        }
+
+        if ( m_socket == -1 && !open(local.GetFamily() == AF_INET6 ? AF_INET6 : AF_INET, options) )
+            return;
+
+        sockaddr_storage ss;
+        socklen_t slen = local.ToSockAddr(m_family, ss);
+        bind(m_socket, (sockaddr*)&ss, slen);
     }
-    
-    static const size_t MAX_PACKET_SIZE = 8 * 1024;
-    
-    class DatagramUnix : public IDatagram
+
+    void DatagramUnix::Term()
     {
-    public:
-        DatagramUnix()
-            : m_socket(-1)
-            , m_buffer(MAX_PACKET_SIZE)
-            , m_nbytes(0)
+        if (m_socket != -1)
         {
-            memset(&m_sain, 0, sizeof(m_sain));
+            close(m_socket);
         }
+        m_socket = -1;
+        m_family = AF_UNSPEC;
+        m_gso = false;
+        m_gro = false;
+        m_pending.clear();
+        m_pending_offset = 0;
+    }
+
+    void DatagramUnix::Send(const Endpoint& ep, const Buffer& data)
+    {
+        sockaddr_storage ss;
+        socklen_t slen = ep.ToSockAddr(m_family, ss);
+        if (slen == 0)
+            return; // e.g. an IPv6 peer through an IPv4 only socket
 
-        ~DatagramUnix()
+        send(ss, slen, data.data(), data.size(), 0);
+    }
+
+    bool DatagramUnix::Recv(Endpoint& ep, Buffer& data)
+    {
+        // NB: a GRO coalesced datagram is handed out segment by segment, so the callers of Recv always see the original datagrams
+        if ( m_pending_offset >= m_pending.size() )
         {
-            Term();
+            if ( !recv(m_pending_ep, m_pending, m_pending_segsize) )
+                return false;
+            m_pending_offset = 0;
         }
 
-        void Init(const Address& addr)
+        size_t size = std::min( m_pending_segsize, m_pending.size() - m_pending_offset );
+        ep = m_pending_ep;
+        data.assign( m_pending.begin() + m_pending_offset, m_pending.begin() + m_pending_offset + size );
+        m_pending_offset += size;
+        return true;
+    }
+
+    bool DatagramUnix::IsSegmentationSupported() const
+    {
+        return m_gso;
+    }
+
+    void DatagramUnix::SendSegmented(const Endpoint& ep, const Buffer& data, size_t segsize)
+    {
+        if ( !m_gso || data.size() <= segsize || segsize == 0 )
         {
-            Term();
-
-            m_socket = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
-
-            int flags = 0;
-            if (-1 == (flags = fcntl(m_socket, F_GETFL, 0)))
-                flags = 0;
-            fcntl(m_socket, F_SETFL, flags | O_NONBLOCK);
-
-            in_addr ipv4 = {0};
-            uint16_t port = 0;
-            parse_address(addr, &ipv4, &port);
-            memset(&m_sain, 0, sizeof(m_sain));
-            m_sain.sin_family = AF_INET;
-            m_sain.sin_addr = ipv4;
-            m_sain.sin_port = port;
-            bind(m_socket, (sockaddr*)&m_sain, sizeof(m_sain));
+            IDatagram::SendSegmented(ep, data, segsize);
+            return;
         }
 
-        void Term()
+        sockaddr_storage ss;
+        socklen_t slen = ep.ToSockAddr(m_family, ss);
+        if (slen == 0)
+            return;
+
+        // NB: the segments are bounded by the kernel limits, larger buffers go out in several batches
+        const size_t batch = std::max( std::min( MAX_SEGMENTS, MAX_UDP_PAYLOAD / segsize ), (size_t)1 ) * segsize;
+        for (size_t offset = 0; offset < data.size(); offset += batch)
         {
-            close(m_socket);
-            m_socket = -1;
+            size_t size = std::min( batch, data.size() - offset );
+            if ( !send(ss, slen, &data[offset], size, size > segsize ? segsize : 0) )
+            {
+                // the device (or the route) refuses segmentation offload, stop trying and send the remaining segments one by one
+                m_gso = false;
+                IDatagram::SendSegmented( ep, Buffer( data.begin() + offset, data.end() ), segsize );
+                return;
+            }
+        }
+    }
+
+    bool DatagramUnix::RecvSegmented(Endpoint& ep, Buffer& data, std::vector<size_t>& segments)
+    {
+        segments.clear();
+
+        size_t segsize = 0;
+        if ( m_pending_offset < m_pending.size() )
+        {
+            // NB: the remainder of a coalesced datagram partially consumed by Recv
+            ep = m_pending_ep;
+            data.assign( m_pending.begin() + m_pending_offset, m_pending.end() );
+            segsize = m_pending_segsize;
+            m_pending.clear();
+            m_pending_offset = 0;
+        }
+        else if ( !recv(ep, data, segsize) )
+        {
+            return false;
         }
 
-        void Send(const Address& addr, const Buffer& data)
+        for (size_t offset = 0; offset < data.size(); offset += segsize)
         {
-            in_addr ipv4 = {0};
-            uint16_t port = 0;
-            parse_address(addr, &ipv4, &port);
-
-            sockaddr_in sain;
-            memset(&sain, 0, sizeof(sain));
-            sain.sin_family = AF_INET;
-            sain.sin_addr = ipv4;
-            sain.sin_port = port;
-            sendto(m_socket, (const char*)&data[0], (int)data.size(), 0, (sockaddr*)&sain, sizeof(sain));
+            segments.push_back( std::min( segsize, data.size() - offset ) );
         }
+        return true;
+    }
 
-        bool Recv(Address& addr, Buffer& data)
+    bool DatagramUnix::send(const sockaddr_storage& ss, socklen_t slen, const Byte* data, size_t size, size_t segsize)
+    {
+        if (segsize == 0)
         {
-            sockaddr_in sain;
-            memset(&sain, 0, sizeof(sain));
-            socklen_t slen = sizeof(sain);
-            ssize_t ret = recvfrom(m_socket, m_buffer.data(), m_buffer.size(), 0, (sockaddr*)&sain, &slen);
-            if (ret == -1)
-                return false; // in case of no data or other errors
-
-            make_address(addr, sain.sin_addr, sain.sin_port);
-            data.resize(ret);
-            memcpy(&data[0], &m_buffer[0], ret);
+            sendto(m_socket, (const char*)data, (int)size, 0, (const sockaddr*)&ss, slen);
             return true;
         }
 
-    private:
-        typedef int SOCKET;
-        SOCKET m_socket;
+#if NETRAN_UDP_OFFLOAD
+        iovec iov;
+        iov.iov_base = (void*)data;
+        iov.iov_len = size;
+
+        char control[CMSG_SPACE(sizeof(uint16_t))];
+        memset(control, 0, sizeof(control));
 
-        sockaddr_in m_sain;
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = (void*)&ss;
+        msg.msg_namelen = slen;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
 
-        Buffer m_buffer;
-        size_t m_nbytes;
-    };
+        cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_UDP;
+        cm->cmsg_type = UDP_SEGMENT;
+        cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        *(uint16_t*)CMSG_DATA(cm) = (uint16_t)segsize;
 
-    IDatagram::ptr IDatagram::CreateInstance()
+        return sendmsg(m_socket, &msg, 0) != -1 || ( errno != EIO && errno != EINVAL && errno != ENOPROTOOPT );
+#else
+        return false;
+#endif
+    }
+
+    bool DatagramUnix::recv(Endpoint& ep, Buffer& data, size_t& segsize)
     {
+        sockaddr_storage ss;
+        socklen_t slen = sizeof(ss);
+
+#if NETRAN_UDP_OFFLOAD
+        iovec iov;
+        iov.iov_base = m_buffer.data();
+        iov.iov_len = m_buffer.size();
+
+        char control[CMSG_SPACE(sizeof(int))];
+
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &ss;
+        msg.msg_namelen = slen;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t ret = recvmsg(m_socket, &msg, 0);
+        if (ret == -1)
+            return false; // in case of no data or other errors
+        slen = msg.msg_namelen;
+
+        segsize = ret;
+        for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO)
+            {
+                segsize = *(int*)CMSG_DATA(cm);
+            }
+        }
+#else
+        ssize_t ret = recvfrom(m_socket, m_buffer.data(), m_buffer.size(), 0, (sockaddr*)&ss, &slen);
+        if (ret == -1)
+            return false; // in case of no data or other errors
+
+        segsize = ret;
+#endif
+
+        if ( !ep.FromSockAddr((const sockaddr*)&ss, slen) )
+            return false;
+
+        if (segsize == 0)
+            segsize = 1; // NB: an empty datagram; keeps the segment iteration finite
+
+        data.assign( m_buffer.begin(), m_buffer.begin() + ret );
+        return true;
+    }
+
+    bool DatagramUnix::open(int family, const Options& options)
+    {
+        m_socket = socket(family, SOCK_DGRAM, IPPROTO_UDP);
+        if (m_socket == -1)
+            return false;
+
+        m_family = family;
+
+        int flags = 0;
+        if (-1 == (flags = fcntl(m_socket, F_GETFL, 0)))
+            flags = 0;
+        fcntl(m_socket, F_SETFL, flags | O_NONBLOCK);
+
+        // NB: the kernel may clamp (or double, on linux) the requested sizes; large servers need to raise net.core.rmem_max/wmem_max accordingly
+        if (options.rcvbuf > 0)
+            setsockopt(m_socket, SOL_SOCKET, SO_RCVBUF, &options.rcvbuf, sizeof(options.rcvbuf));
+        if (options.sndbuf > 0)
+            setsockopt(m_socket, SOL_SOCKET, SO_SNDBUF, &options.sndbuf, sizeof(options.sndbuf));
+
+#if defined(IP_MTU_DISCOVER) && defined(IPV6_MTU_DISCOVER)
+        int pmtud = options.pmtud ? IP_PMTUDISC_DO : IP_PMTUDISC_DONT;
+        setsockopt(m_socket, IPPROTO_IP, IP_MTU_DISCOVER, &pmtud, sizeof(pmtud));
+        if (family == AF_INET6)
+        {
+            int pmtud6 = options.pmtud ? IPV6_PMTUDISC_DO : IPV6_PMTUDISC_DONT;
+            setsockopt(m_socket, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &pmtud6, sizeof(pmtud6));
+        }
+#elif defined(IP_DONTFRAG)
+        int dontfrag = options.pmtud ? 1 : 0;
+        setsockopt(m_socket, IPPROTO_IP, IP_DONTFRAG, &dontfrag, sizeof(dontfrag));
+#if defined(IPV6_DONTFRAG)
+        if (family == AF_INET6)
+            setsockopt(m_socket, IPPROTO_IPV6, IPV6_DONTFRAG, &dontfrag, sizeof(dontfrag));
+#endif
+#endif
+
+#if NETRAN_UDP_OFFLOAD
+        // GSO is probed by querying the socket option, GRO is simply turned on; a coalesced receive needs the full sized buffer
+        int segment = 0;
+        socklen_t len = sizeof(segment);
+        m_gso = getsockopt(m_socket, SOL_UDP, UDP_SEGMENT, &segment, &len) == 0;
+
+        int gro = 1;
+        m_gro = setsockopt(m_socket, SOL_UDP, UDP_GRO, &gro, sizeof(gro)) == 0;
+        m_buffer.resize(m_gro ? MAX_COALESCED_SIZE : MAX_PACKET_SIZE);
+#endif
+
+        return true;
+    }
+
+    IDatagram::ptr IDatagram::CreateInstance(Backend backend)
+    {
+        if (backend == Backend::IO_URING)
+        {
+            IDatagram::ptr datagram = CreateDatagramUring();
+            if (datagram)
+            {
+                return datagram;
+            }
+        }
+
         return IDatagram::ptr( new DatagramUnix() );
     }
 }
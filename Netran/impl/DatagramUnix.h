@@ -0,0 +1,85 @@
+//
+//  DatagramUnix.h
+//  Netran
+//
+//  Created by Lin Luo on 05/01/2015.
+//
+
+#ifndef Netran_DatagramUnix_h
+#define Netran_DatagramUnix_h
+
+#include "IDatagram.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#if defined(__linux__) && defined(UDP_SEGMENT) && defined(UDP_GRO)
+#define NETRAN_UDP_OFFLOAD 1
+#endif
+
+namespace Netran
+{
+    static const size_t MAX_PACKET_SIZE = 8 * 1024;
+    static const size_t MAX_COALESCED_SIZE = 64 * 1024; // a GRO coalesced datagram is bounded by the maximum udp payload
+    static const size_t MAX_SEGMENTS = 64; // UDP_MAX_SEGMENTS of older kernels
+    static const size_t MAX_UDP_PAYLOAD = 65507; // a GSO send is bounded by the maximum udp payload as well (ipv4)
+
+    /**
+     * The datagram implementation over the BSD socket API
+     * The actual socket I/O goes through the send/recv hooks, so other backends can reuse the socket setup and the segmentation logic
+     */
+    class DatagramUnix : public IDatagram
+    {
+    public:
+        DatagramUnix();
+        ~DatagramUnix();
+
+        void Init(const Address& addr, const Options& options) override;
+
+        void Term() override;
+
+        void Send(const Endpoint& ep, const Buffer& data) override;
+
+        bool Recv(Endpoint& ep, Buffer& data) override;
+
+        bool IsSegmentationSupported() const override;
+
+        void SendSegmented(const Endpoint& ep, const Buffer& data, size_t segsize) override;
+
+        bool RecvSegmented(Endpoint& ep, Buffer& data, std::vector<size_t>& segments) override;
+
+    protected:
+        // sends one datagram, or a batch of segsize sized datagrams when segsize is not 0; returns false if the segmentation offload is refused
+        virtual bool send(const sockaddr_storage& ss, socklen_t slen, const Byte* data, size_t size, size_t segsize);
+
+        // receives one datagram, possibly coalesced by GRO, in which case segsize is the size of the individual segments (the last one could be shorter)
+        virtual bool recv(Endpoint& ep, Buffer& data, size_t& segsize);
+
+        typedef int SOCKET;
+        SOCKET m_socket;
+
+        int m_family; // the family of the socket, AF_INET6 for dual-stack sockets
+
+        Buffer m_buffer;
+
+        bool m_gso;
+        bool m_gro;
+
+    private:
+        bool open(int family, const Options& options);
+
+        // the coalesced datagram being handed out by Recv, one segment at a time
+        Buffer m_pending;
+        Endpoint m_pending_ep;
+        size_t m_pending_offset;
+        size_t m_pending_segsize;
+    };
+
+    /**
+     * Creates the io_uring backed datagram; returns nullptr if io_uring is not supported by the system
+     */
+    IDatagram::ptr CreateDatagramUring();
+}
+
+#endif
@@ -0,0 +1,566 @@
+//
+//  DatagramUring.cpp
+//  Netran
+//
+//  Created by Lin Luo on 05/01/2015.
+//
+
+#include "DatagramUnix.h"
+
+#include <cstring>
+#include <deque>
+#include <errno.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#endif
+
+#if defined(__linux__) && defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup) // NB: the multishot receive (and the provided buffer rings) came with linux 6.0
+#define NETRAN_IO_URING 1
+#endif
+
+namespace Netran
+{
+#if NETRAN_IO_URING
+
+    static const unsigned NUM_SQ_ENTRIES = 256;
+    static const unsigned NUM_CQ_ENTRIES = 4096;
+    static const unsigned NUM_SEND_SLOTS = 256;
+    static const unsigned NUM_RECV_BUFFERS = 64; // NB: must be a power of 2; running out of buffers only costs a re-arm, the datagrams wait in the socket
+    static const size_t SIZE_RECV_BUFFER = MAX_COALESCED_SIZE + 256; // room for a GRO coalesced datagram, the io_uring_recvmsg_out header, the source address and the GRO control message
+    static const uint16_t RECV_BUFFER_GROUP = 0;
+
+    // the kinds of the submissions, in the higher 32 bits of the user data
+    static const uint64_t KIND_RECV = 1ULL << 32;
+    static const uint64_t KIND_SEND = 2ULL << 32;
+    static const uint64_t KIND_CANCEL = 3ULL << 32;
+
+    static const size_t MAXNUM_TERM_WAITS = 1024;
+
+    /**
+     * The datagram implementation over linux io_uring
+     * Incoming datagrams are received by a single multishot recvmsg into a provided buffer ring, so no syscall is involved on the receiving path;
+     * outgoing datagrams are queued as sendmsg submissions and handed over to the kernel in one io_uring_enter per tick (Flush)
+     * The socket setup is inherited from DatagramUnix, which is also the fallback should the multishot receive be refused at runtime
+     */
+    class DatagramUring : public DatagramUnix
+    {
+    public:
+        DatagramUring()
+            : m_ring(-1)
+            , m_sq_ptr(MAP_FAILED), m_sq_size(0)
+            , m_cq_ptr(MAP_FAILED), m_cq_size(0)
+            , m_sqes(nullptr), m_sqes_size(0)
+            , m_sq_tail(0), m_to_submit(0)
+            , m_br(nullptr), m_br_size(0), m_br_tail(0)
+            , m_armed(false), m_terminating(false)
+            , m_slots(NUM_SEND_SLOTS)
+        {
+            if ( !setup() )
+            {
+                teardown();
+            }
+        }
+
+        ~DatagramUring()
+        {
+            Term();
+            teardown();
+        }
+
+        bool IsAvailable() const
+        {
+            return m_ring != -1;
+        }
+
+        void Init(const Address& addr, const Options& options) override
+        {
+            Term();
+
+            DatagramUnix::Init(addr, options);
+            if (m_socket == -1)
+                return;
+
+            memset(&m_recv_msg, 0, sizeof(m_recv_msg));
+            m_recv_msg.msg_namelen = sizeof(sockaddr_storage);
+            m_recv_msg.msg_controllen = m_gro ? CMSG_SPACE(sizeof(int)) : 0;
+
+            arm();
+        }
+
+        void Term() override
+        {
+            if (m_socket != -1)
+            {
+                // the pending sends are handed over, then the multishot receive is cancelled; the socket must not be closed while the ring still refers to it
+                m_terminating = true;
+
+                if (m_armed)
+                {
+                    io_uring_sqe* sqe = get_sqe();
+                    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                    sqe->fd = -1;
+                    sqe->addr = KIND_RECV;
+                    sqe->user_data = KIND_CANCEL;
+                    commit_sqe();
+                }
+
+                for (size_t count = 0; count < MAXNUM_TERM_WAITS && ( m_armed || m_free_slots.size() < NUM_SEND_SLOTS ); ++count)
+                {
+                    enter(1);
+                    reap();
+                }
+
+                m_terminating = false;
+                m_received.clear();
+            }
+
+            DatagramUnix::Term();
+        }
+
+        void Flush() override
+        {
+            if (m_to_submit > 0)
+            {
+                enter(0);
+            }
+        }
+
+    protected:
+        bool send(const sockaddr_storage& ss, socklen_t slen, const Byte* data, size_t size, size_t segsize) override
+        {
+            size_t index = acquire_slot();
+
+            Slot& slot = m_slots[index];
+            slot.ss = ss;
+            slot.data.assign(data, data + size);
+            slot.segmented = segsize != 0;
+
+            slot.iov.iov_base = slot.data.data();
+            slot.iov.iov_len = slot.data.size();
+
+            memset(&slot.msg, 0, sizeof(slot.msg));
+            slot.msg.msg_name = &slot.ss;
+            slot.msg.msg_namelen = slen;
+            slot.msg.msg_iov = &slot.iov;
+            slot.msg.msg_iovlen = 1;
+
+            if (segsize != 0)
+            {
+                memset(slot.control, 0, sizeof(slot.control));
+                slot.msg.msg_control = slot.control;
+                slot.msg.msg_controllen = sizeof(slot.control);
+
+                cmsghdr* cm = CMSG_FIRSTHDR(&slot.msg);
+                cm->cmsg_level = SOL_UDP;
+                cm->cmsg_type = UDP_SEGMENT;
+                cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                *(uint16_t*)CMSG_DATA(cm) = (uint16_t)segsize;
+            }
+
+            io_uring_sqe* sqe = get_sqe();
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = m_socket;
+            sqe->addr = (uint64_t)(uintptr_t)&slot.msg;
+            sqe->len = 1;
+            sqe->user_data = KIND_SEND | index;
+            commit_sqe();
+
+            // NB: a refused segmentation offload is only known on completion, which turns GSO off for the following sends
+            return true;
+        }
+
+        bool recv(Endpoint& ep, Buffer& data, size_t& segsize) override
+        {
+            if ( !m_armed && m_received.empty() )
+            {
+                return DatagramUnix::recv(ep, data, segsize);
+            }
+
+            if ( m_received.empty() )
+            {
+                reap();
+            }
+
+            if ( m_received.empty() )
+            {
+                return false;
+            }
+
+            Received& received = m_received.front();
+            ep = received.ep;
+            data = std::move(received.data);
+            segsize = received.segsize;
+            m_received.pop_front();
+            return true;
+        }
+
+    private:
+        bool setup()
+        {
+            io_uring_params params;
+            memset(&params, 0, sizeof(params));
+            params.flags = IORING_SETUP_CQSIZE;
+            params.cq_entries = NUM_CQ_ENTRIES;
+
+            m_ring = (int)syscall(__NR_io_uring_setup, NUM_SQ_ENTRIES, &params);
+            if (m_ring < 0)
+            {
+                m_ring = -1;
+                return false; // ENOSYS on kernels without io_uring, EPERM when disabled by the administrator or the sandbox
+            }
+
+            // the submission and completion rings
+            m_sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+            m_cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            if (params.features & IORING_FEAT_SINGLE_MMAP)
+            {
+                m_sq_size = m_cq_size = std::max(m_sq_size, m_cq_size);
+            }
+
+            m_sq_ptr = mmap(nullptr, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQ_RING);
+            if (m_sq_ptr == MAP_FAILED)
+                return false;
+
+            if (params.features & IORING_FEAT_SINGLE_MMAP)
+            {
+                m_cq_ptr = m_sq_ptr;
+            }
+            else
+            {
+                m_cq_ptr = mmap(nullptr, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_CQ_RING);
+                if (m_cq_ptr == MAP_FAILED)
+                    return false;
+            }
+
+            m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+            void* sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQES);
+            if (sqes == MAP_FAILED)
+                return false;
+            m_sqes = (io_uring_sqe*)sqes;
+
+            Byte* sq = (Byte*)m_sq_ptr;
+            m_sq_head = (uint32_t*)(sq + params.sq_off.head);
+            m_sq_ktail = (uint32_t*)(sq + params.sq_off.tail);
+            m_sq_mask = *(uint32_t*)(sq + params.sq_off.ring_mask);
+            m_sq_entries = *(uint32_t*)(sq + params.sq_off.ring_entries);
+            m_sq_array = (uint32_t*)(sq + params.sq_off.array);
+            m_sq_tail = *m_sq_ktail;
+
+            Byte* cq = (Byte*)m_cq_ptr;
+            m_cq_head = (uint32_t*)(cq + params.cq_off.head);
+            m_cq_tail = (uint32_t*)(cq + params.cq_off.tail);
+            m_cq_mask = *(uint32_t*)(cq + params.cq_off.ring_mask);
+            m_cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+            // the opcodes in use must be supported
+            Buffer probe( sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op) );
+            io_uring_probe* p = (io_uring_probe*)probe.data();
+            if ( syscall(__NR_io_uring_register, m_ring, IORING_REGISTER_PROBE, p, 256) < 0 )
+                return false;
+            if ( p->last_op < IORING_OP_SENDMSG || !(p->ops[IORING_OP_SENDMSG].flags & IO_URING_OP_SUPPORTED) || !(p->ops[IORING_OP_RECVMSG].flags & IO_URING_OP_SUPPORTED) )
+                return false;
+
+            // the provided buffer ring, with the receive buffers handed over once and for all; they are recycled as soon as the datagrams are copied out
+            m_br_size = NUM_RECV_BUFFERS * sizeof(io_uring_buf);
+            void* br = mmap(nullptr, m_br_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (br == MAP_FAILED)
+                return false;
+            m_br = (io_uring_buf*)br;
+
+            io_uring_buf_reg reg;
+            memset(&reg, 0, sizeof(reg));
+            reg.ring_addr = (uint64_t)(uintptr_t)m_br;
+            reg.ring_entries = NUM_RECV_BUFFERS;
+            reg.bgid = RECV_BUFFER_GROUP;
+            if ( syscall(__NR_io_uring_register, m_ring, IORING_REGISTER_PBUF_RING, &reg, 1) < 0 )
+                return false;
+
+            m_recv_buffers.resize(NUM_RECV_BUFFERS * SIZE_RECV_BUFFER);
+            for (uint16_t bid = 0; bid < NUM_RECV_BUFFERS; ++bid)
+            {
+                provide(bid);
+            }
+
+            memset(&m_recv_msg, 0, sizeof(m_recv_msg));
+
+            for (size_t i = 0; i < NUM_SEND_SLOTS; ++i)
+            {
+                m_free_slots.push_back(i);
+            }
+
+            return true;
+        }
+
+        void teardown()
+        {
+            if (m_ring != -1)
+            {
+                close(m_ring);
+                m_ring = -1;
+            }
+            if (m_br != nullptr)
+            {
+                munmap(m_br, m_br_size);
+                m_br = nullptr;
+            }
+            if (m_sqes != nullptr)
+            {
+                munmap(m_sqes, m_sqes_size);
+                m_sqes = nullptr;
+            }
+            if (m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr)
+            {
+                munmap(m_cq_ptr, m_cq_size);
+            }
+            m_cq_ptr = MAP_FAILED;
+            if (m_sq_ptr != MAP_FAILED)
+            {
+                munmap(m_sq_ptr, m_sq_size);
+                m_sq_ptr = MAP_FAILED;
+            }
+        }
+
+        io_uring_sqe* get_sqe()
+        {
+            // NB: the submission queue is full, hand the queued entries over first
+            if ( m_sq_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_sq_entries )
+            {
+                enter(0);
+            }
+
+            uint32_t index = m_sq_tail & m_sq_mask;
+            io_uring_sqe* sqe = &m_sqes[index];
+            memset(sqe, 0, sizeof(io_uring_sqe));
+            m_sq_array[index] = index;
+            return sqe;
+        }
+
+        void commit_sqe()
+        {
+            ++m_sq_tail;
+            ++m_to_submit;
+            __atomic_store_n(m_sq_ktail, m_sq_tail, __ATOMIC_RELEASE);
+        }
+
+        void enter(unsigned min_complete)
+        {
+            unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+            long ret = syscall(__NR_io_uring_enter, m_ring, m_to_submit, min_complete, flags, nullptr, 0);
+            if (ret > 0)
+            {
+                m_to_submit -= std::min( (unsigned)ret, m_to_submit );
+            }
+        }
+
+        void provide(uint16_t bid)
+        {
+            // NB: the ring is addressed as a plain array; the tail overlays the reserved field of the first entry (io_uring_buf_ring::bufs is
+            // a flexible array member which C++ compilers may place differently)
+            io_uring_buf* buf = &m_br[m_br_tail & (NUM_RECV_BUFFERS - 1)];
+            buf->addr = (uint64_t)(uintptr_t)&m_recv_buffers[bid * SIZE_RECV_BUFFER];
+            buf->len = SIZE_RECV_BUFFER;
+            buf->bid = bid;
+            ++m_br_tail;
+            __atomic_store_n(&m_br[0].resv, m_br_tail, __ATOMIC_RELEASE);
+        }
+
+        void arm()
+        {
+            io_uring_sqe* sqe = get_sqe();
+            sqe->opcode = IORING_OP_RECVMSG;
+            sqe->fd = m_socket;
+            sqe->addr = (uint64_t)(uintptr_t)&m_recv_msg;
+            sqe->len = 1;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = RECV_BUFFER_GROUP;
+            sqe->user_data = KIND_RECV;
+            commit_sqe();
+
+            m_armed = true;
+            enter(0);
+        }
+
+        size_t acquire_slot()
+        {
+            while ( m_free_slots.empty() )
+            {
+                enter(1);
+                reap();
+            }
+
+            size_t index = m_free_slots.back();
+            m_free_slots.pop_back();
+            return index;
+        }
+
+        void reap()
+        {
+            uint32_t head = *m_cq_head;
+            uint32_t tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+
+            bool rearm = false;
+            for (; head != tail; ++head)
+            {
+                const io_uring_cqe& cqe = m_cqes[head & m_cq_mask];
+
+                switch (cqe.user_data & 0xffffffff00000000ULL)
+                {
+                    case KIND_RECV:
+                        if (cqe.flags & IORING_CQE_F_BUFFER)
+                        {
+                            uint16_t bid = (uint16_t)(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                            if (cqe.res > 0)
+                            {
+                                received( &m_recv_buffers[bid * SIZE_RECV_BUFFER], (size_t)cqe.res );
+                            }
+                            provide(bid);
+                        }
+                        if ( !(cqe.flags & IORING_CQE_F_MORE) )
+                        {
+                            // NB: the multishot receive stops when running out of buffers (ENOBUFS), or when cancelled; anything else falls back to the plain recvmsg
+                            m_armed = false;
+                            rearm = cqe.res >= 0 || cqe.res == -ENOBUFS;
+                        }
+                        break;
+
+                    case KIND_SEND:
+                    {
+                        size_t index = (size_t)(cqe.user_data & 0xffffffffULL);
+                        if ( m_slots[index].segmented && ( cqe.res == -EIO || cqe.res == -EINVAL || cqe.res == -ENOPROTOOPT ) )
+                        {
+                            m_gso = false;
+                        }
+                        m_free_slots.push_back(index);
+                        break;
+                    }
+
+                    default:
+                        break;
+                }
+            }
+
+            __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+
+            if (rearm && !m_terminating && m_socket != -1)
+            {
+                arm();
+            }
+        }
+
+        void received(const Byte* buffer, size_t size)
+        {
+            const io_uring_recvmsg_out* out = (const io_uring_recvmsg_out*)buffer;
+            if ( size < sizeof(io_uring_recvmsg_out) || (out->flags & MSG_TRUNC) )
+                return;
+
+            const Byte* name = buffer + sizeof(io_uring_recvmsg_out);
+            const Byte* control = name + m_recv_msg.msg_namelen;
+            const Byte* payload = control + m_recv_msg.msg_controllen;
+            if ( payload + out->payloadlen > buffer + size )
+                return;
+
+            Endpoint ep;
+            if ( !ep.FromSockAddr( (const sockaddr*)name, std::min( (socklen_t)out->namelen, m_recv_msg.msg_namelen ) ) )
+                return;
+
+            // the GRO segment size, if the datagram is coalesced
+            size_t segsize = out->payloadlen;
+            if (out->controllen > 0)
+            {
+                msghdr msg;
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_control = (void*)control;
+                msg.msg_controllen = std::min( (size_t)out->controllen, (size_t)m_recv_msg.msg_controllen );
+                for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm))
+                {
+                    if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO)
+                    {
+                        segsize = *(int*)CMSG_DATA(cm);
+                    }
+                }
+            }
+
+            m_received.push_back( Received() );
+            m_received.back().ep = ep;
+            m_received.back().data.assign(payload, payload + out->payloadlen);
+            m_received.back().segsize = std::max( segsize, (size_t)1 ); // NB: an empty datagram; keeps the segment iteration finite
+        }
+
+        int m_ring;
+
+        void* m_sq_ptr;
+        size_t m_sq_size;
+        void* m_cq_ptr;
+        size_t m_cq_size;
+        io_uring_sqe* m_sqes;
+        size_t m_sqes_size;
+
+        uint32_t* m_sq_head;
+        uint32_t* m_sq_ktail;
+        uint32_t* m_sq_array;
+        uint32_t m_sq_mask;
+        uint32_t m_sq_entries;
+        uint32_t m_sq_tail; // the local tail, including the entries not yet submitted
+        unsigned m_to_submit;
+
+        uint32_t* m_cq_head;
+        uint32_t* m_cq_tail;
+        uint32_t m_cq_mask;
+        io_uring_cqe* m_cqes;
+
+        io_uring_buf* m_br; // the provided buffer ring
+        size_t m_br_size;
+        uint16_t m_br_tail;
+        Buffer m_recv_buffers;
+
+        msghdr m_recv_msg; // the multishot receive template, refers to the lengths of the name and the control data only
+        bool m_armed;
+        bool m_terminating;
+
+        struct Received
+        {
+            Endpoint ep;
+            Buffer data;
+            size_t segsize;
+        };
+        std::deque<Received> m_received;
+
+        // the in flight sendmsg submissions, which must stay valid until completed
+        struct Slot
+        {
+            sockaddr_storage ss;
+            msghdr msg;
+            iovec iov;
+            char control[CMSG_SPACE(sizeof(uint16_t))];
+            Buffer data;
+            bool segmented;
+        };
+        std::vector<Slot> m_slots;
+        std::vector<size_t> m_free_slots;
+    };
+
+    IDatagram::ptr CreateDatagramUring()
+    {
+        std::unique_ptr<DatagramUring> datagram( new DatagramUring() );
+        if ( !datagram->IsAvailable() )
+        {
+            return nullptr;
+        }
+        return IDatagram::ptr( datagram.release() );
+    }
+
+#else
+
+    IDatagram::ptr CreateDatagramUring()
+    {
+        return nullptr;
+    }
+
+#endif
+}
+
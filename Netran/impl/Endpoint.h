@@ -0,0 +1,273 @@
+//
+//  Endpoint.h
+//  Netran
+//
+//  Created by Lin Luo on 05/01/2015.
+//
+
+#ifndef Netran_Endpoint_h
+#define Netran_Endpoint_h
+
+#include "Netran.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+namespace Netran
+{
+    /**
+     * The binary representation of a remote (or local) socket address, either IPv4 or IPv6
+     * The textual Address is only used at the API boundary; the datagram layer and the connection lookups work on Endpoints,
+     * so no per packet formatting/parsing is involved; IPv4-mapped IPv6 addresses (::ffff:a.b.c.d), as reported by dual-stack
+     * sockets, are always normalized to plain IPv4, so the same peer always maps to the same Endpoint regardless of the socket
+     */
+    class Endpoint
+    {
+    public:
+        Endpoint()
+        {
+            memset(this, 0, sizeof(Endpoint));
+        }
+
+        /**
+         * Parses "<ipv4>:<port>", "[<ipv6>]:<port>" or "<hostname>:<port>"; an empty host ("", ":<port>", "*:<port>") denotes the unspecified (wildcard) address
+         * Returns false if the address cannot be resolved
+         */
+        static bool Parse(const Address& addr, Endpoint& ep)
+        {
+            ep = Endpoint();
+
+            std::string host = addr;
+            uint16_t port = 0;
+
+            // NB: a bare IPv6 address (more than one colon, no brackets) carries no port
+            size_t p = addr.rfind(':');
+            bool bracketed = !addr.empty() && addr[0] == '[';
+            if ( p != Address::npos && ( bracketed ? p > 0 && addr[p - 1] == ']' : addr.find(':') == p ) )
+            {
+                port = (uint16_t)std::strtoul( addr.c_str() + p + 1, nullptr, 10 );
+                host = addr.substr(0, p);
+            }
+
+            if ( host.size() >= 2 && host.front() == '[' && host.back() == ']' )
+            {
+                host = host.substr(1, host.size() - 2);
+            }
+
+            ep.m_port = htons(port);
+
+            if ( host.empty() || host == "*" )
+            {
+                ep.m_family = AF_UNSPEC;
+                return true;
+            }
+
+            if ( inet_pton(AF_INET, host.c_str(), ep.m_addr) == 1 )
+            {
+                ep.m_family = AF_INET;
+                return true;
+            }
+
+            if ( inet_pton(AF_INET6, host.c_str(), ep.m_addr) == 1 )
+            {
+                ep.m_family = AF_INET6;
+                ep.Normalize();
+                return true;
+            }
+
+            // NB: not a numeric address, so resolve it (blocking, but only done for Host/Connect/Kick, never per packet)
+            addrinfo hints;
+            memset(&hints, 0, sizeof(hints));
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_DGRAM;
+            hints.ai_protocol = IPPROTO_UDP;
+
+            addrinfo* result = nullptr;
+            if ( getaddrinfo(host.c_str(), nullptr, &hints, &result) != 0 || result == nullptr )
+            {
+                return false;
+            }
+
+            bool r = ep.FromSockAddr(result->ai_addr, result->ai_addrlen);
+            ep.m_port = htons(port);
+            freeaddrinfo(result);
+            return r;
+        }
+
+        /**
+         * Formats the endpoint back into the "<ipv4>:<port>" or "[<ipv6>]:<port>" form
+         */
+        Address ToAddress() const
+        {
+            char host[INET6_ADDRSTRLEN] = {0};
+            char port[8] = {0};
+            snprintf( port, sizeof(port), "%u", (unsigned)ntohs(m_port) );
+
+            switch (m_family)
+            {
+                case AF_INET:
+                    inet_ntop(AF_INET, m_addr, host, sizeof(host));
+                    return Address(host) + ":" + port;
+
+                case AF_INET6:
+                    inet_ntop(AF_INET6, m_addr, host, sizeof(host));
+                    return "[" + Address(host) + "]:" + port;
+
+                default:
+                    return Address(":") + port;
+            }
+        }
+
+        bool FromSockAddr(const sockaddr* sa, socklen_t len)
+        {
+            *this = Endpoint();
+
+            if ( sa->sa_family == AF_INET && len >= (socklen_t)sizeof(sockaddr_in) )
+            {
+                const sockaddr_in* sin = reinterpret_cast<const sockaddr_in*>(sa);
+                m_family = AF_INET;
+                m_port = sin->sin_port;
+                memcpy(m_addr, &sin->sin_addr, sizeof(sin->sin_addr));
+                return true;
+            }
+
+            if ( sa->sa_family == AF_INET6 && len >= (socklen_t)sizeof(sockaddr_in6) )
+            {
+                const sockaddr_in6* sin6 = reinterpret_cast<const sockaddr_in6*>(sa);
+                m_family = AF_INET6;
+                m_port = sin6->sin6_port;
+                m_scope = sin6->sin6_scope_id;
+                memcpy(m_addr, &sin6->sin6_addr, sizeof(sin6->sin6_addr));
+                Normalize();
+                return true;
+            }
+
+            return false;
+        }
+
+        /**
+         * Fills in a socket address suitable for a socket of the given family; IPv4 endpoints are mapped (::ffff:a.b.c.d) for dual-stack IPv6 sockets
+         * Returns the length of the socket address, 0 if the endpoint cannot be reached through a socket of this family
+         */
+        socklen_t ToSockAddr(int family, sockaddr_storage& ss) const
+        {
+            memset(&ss, 0, sizeof(ss));
+
+            if (family == AF_INET)
+            {
+                if (m_family == AF_INET6)
+                {
+                    return 0;
+                }
+
+                sockaddr_in* sin = reinterpret_cast<sockaddr_in*>(&ss);
+                sin->sin_family = AF_INET;
+                sin->sin_port = m_port;
+                memcpy(&sin->sin_addr, m_addr, sizeof(sin->sin_addr)); // NB: all zeros (INADDR_ANY) for the unspecified endpoint
+                return sizeof(sockaddr_in);
+            }
+
+            if (family == AF_INET6)
+            {
+                sockaddr_in6* sin6 = reinterpret_cast<sockaddr_in6*>(&ss);
+                sin6->sin6_family = AF_INET6;
+                sin6->sin6_port = m_port;
+                sin6->sin6_scope_id = m_scope;
+                if (m_family == AF_INET)
+                {
+                    sin6->sin6_addr.s6_addr[10] = 0xff;
+                    sin6->sin6_addr.s6_addr[11] = 0xff;
+                    memcpy(&sin6->sin6_addr.s6_addr[12], m_addr, 4);
+                }
+                else
+                {
+                    memcpy(&sin6->sin6_addr, m_addr, sizeof(sin6->sin6_addr)); // NB: all zeros (in6addr_any) for the unspecified endpoint
+                }
+                return sizeof(sockaddr_in6);
+            }
+
+            return 0;
+        }
+
+        int GetFamily() const
+        {
+            return m_family;
+        }
+
+        uint16_t GetPort() const
+        {
+            return ntohs(m_port);
+        }
+
+        bool IsUnspecified() const
+        {
+            return m_family == AF_UNSPEC;
+        }
+
+        bool operator==(const Endpoint& rhs) const
+        {
+            return m_family == rhs.m_family && m_port == rhs.m_port && m_scope == rhs.m_scope && memcmp(m_addr, rhs.m_addr, sizeof(m_addr)) == 0;
+        }
+
+        bool operator!=(const Endpoint& rhs) const
+        {
+            return !(*this == rhs);
+        }
+
+        size_t Hash() const
+        {
+            // FNV-1a over the packed representation; NB: padding bytes are always zeroed by the constructor
+            static const uint64_t InitialFNV = 14695981039346656037ULL;
+            static const uint64_t FNVMultiple = 1099511628211ULL;
+
+            uint64_t hash = InitialFNV;
+            const Byte* p = reinterpret_cast<const Byte*>(this);
+            for (size_t i = 0; i < sizeof(Endpoint); ++i)
+            {
+                hash ^= p[i];
+                hash *= FNVMultiple;
+            }
+            return (size_t)hash;
+        }
+
+    private:
+        void Normalize()
+        {
+            static const Byte V4MAPPED_PREFIX[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+
+            if ( m_family == AF_INET6 && memcmp(m_addr, V4MAPPED_PREFIX, sizeof(V4MAPPED_PREFIX)) == 0 )
+            {
+                Byte ipv4[4];
+                memcpy(ipv4, &m_addr[12], 4);
+                memset(m_addr, 0, sizeof(m_addr));
+                memcpy(m_addr, ipv4, 4);
+                m_family = AF_INET;
+                m_scope = 0;
+            }
+        }
+
+        uint32_t m_scope;   // IPv6 scope id (link local addresses)
+        uint16_t m_family;  // AF_INET, AF_INET6 or AF_UNSPEC (wildcard)
+        uint16_t m_port;    // network byte order
+        Byte m_addr[16];    // network byte order; IPv4 uses the first 4 bytes
+    };
+}
+
+namespace std
+{
+    template <>
+    struct hash<Netran::Endpoint>
+    {
+        size_t operator()(const Netran::Endpoint& ep) const
+        {
+            return ep.Hash();
+        }
+    };
+}
+
+#endif
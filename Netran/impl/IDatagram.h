@@ -9,6 +9,9 @@
 #define Netran_IDatagram_h
 
 #include "Netran.h"
+#include "Endpoint.h"
+
+#include <algorithm>
 
 namespace Netran
 {
@@ -20,12 +23,26 @@ namespace Netran
         typedef std::unique_ptr<IDatagram> ptr;
         typedef std::unique_ptr< IDatagram, NoDelete<IDatagram> > weak_ptr;
 
-        static ptr CreateInstance();
+        static ptr CreateInstance(Backend backend = Backend::SOCKETS);
+
+        /**
+         * The socket tuning options
+         */
+        struct Options
+        {
+            int rcvbuf;     // SO_RCVBUF in bytes, 0 keeps the system default
+            int sndbuf;     // SO_SNDBUF in bytes, 0 keeps the system default
+            bool dualstack; // prefer an IPv6 socket accepting IPv4 peers as well (IPV6_V6ONLY off) when binding to the wildcard address
+            bool pmtud;     // set the don't fragment bit and let the kernel discover the path MTU (IP_PMTUDISC_DO), otherwise fragmentation is allowed
+
+            Options() : rcvbuf(0), sndbuf(0), dualstack(true), pmtud(false) {}
+        };
 
         /**
-         * Initializes the datagram socket
+         * Initializes the datagram socket, and binds it to the local address ("" or ":<port>" denote the wildcard address)
+         * The socket family follows the local address; the wildcard address gets a dual-stack socket when possible, IPv4 otherwise
          */
-        virtual void Init(const Address& addr = "") = 0;
+        virtual void Init(const Address& addr = "", const Options& options = Options()) = 0;
 
         /**
          * Terminates the datagram socket
@@ -35,12 +52,52 @@ namespace Netran
         /**
          * Sends the data to the socket layer without delays
          */
-        virtual void Send(const Address& addr, const Buffer& data) = 0;
+        virtual void Send(const Endpoint& ep, const Buffer& data) = 0;
 
         /**
          * Attempts to receive an incoming datagram, returns true if one packet is successfully received, false otherwise
          */
-        virtual bool Recv(Address& addr, Buffer& data) = 0;
+        virtual bool Recv(Endpoint& ep, Buffer& data) = 0;
+
+        /**
+         * Hands the datagrams buffered by Send over to the system; called once per tick, the backends sending right away leave it empty
+         */
+        virtual void Flush() {}
+
+        /**
+         * Returns true if the segmentation offload (GSO/GRO) is available, so a segmented send costs a single trip through the socket layer
+         */
+        virtual bool IsSegmentationSupported() const
+        {
+            return false;
+        }
+
+        /**
+         * Sends a contiguous buffer of equally sized datagrams (segsize bytes each, except for the last one which could be shorter) to the same endpoint
+         * The fallback implementation sends the segments one by one
+         */
+        virtual void SendSegmented(const Endpoint& ep, const Buffer& data, size_t segsize)
+        {
+            Buffer segment;
+            for (size_t offset = 0; offset < data.size(); offset += segsize)
+            {
+                segment.assign( data.begin() + offset, data.begin() + std::min(offset + segsize, data.size()) );
+                Send(ep, segment);
+            }
+        }
+
+        /**
+         * Attempts to receive a batch of coalesced datagrams from the same endpoint, the sizes of the individual datagrams are returned in segments
+         * The fallback implementation receives a single datagram
+         */
+        virtual bool RecvSegmented(Endpoint& ep, Buffer& data, std::vector<size_t>& segments)
+        {
+            segments.clear();
+            if ( !Recv(ep, data) )
+                return false;
+            segments.push_back( data.size() );
+            return true;
+        }
 
         virtual ~IDatagram() {}
     };
@@ -6,6 +6,7 @@
 //
 
 #include <cassert>
+#include <cstring>
 
 #include "NetranImpl.h"
 
@@ -50,12 +51,24 @@ bool Connection::Less::operator ()(uint16_t s1, uint16_t s2) const
     return lt(s1, s2);
 }
 
+// the time of the current tick, refreshed when entering the connections (Tick, Connect and Close), so the packets don't read the clock one by one
+static uint32_t s_now = 0;
+
+// the 16 bits timestamp of the packets; 0 is reserved for "none"
+static inline uint16_t timestamp(uint32_t now)
+{
+    uint16_t ts = (uint16_t)now;
+    return ts != 0 ? ts : 1;
+}
+
 struct Header
 {
 	uint16_t seqnum; // sequence number of this packet
 	uint16_t acknum; // acknowledgment
 	uint16_t pflags; // higher order byte denotes rwnd, lower order byte denotes packet flags (reliability, acknowledgment, etc.)
 	uint16_t length; // length of the following data in bytes
+	uint16_t tsval;  // the sender's timestamp, in milliseconds (16 bits wrapping), 0 for none
+	uint16_t tsecr;  // the latest tsval received by the sender, advanced by the time it was held there, 0 for none
 };
 
 static const uint16_t FLAG_ALL = 0x00ff;
@@ -63,19 +76,34 @@ static const uint16_t FLAG_RLB = 0x0001; // reliable
 static const uint16_t FLAG_ACK = 0x0002; // acknowledgment
 static const uint16_t FLAG_SYN = 0x0004; // synchronization
 static const uint16_t FLAG_RST = 0x0008; // reset
-static const uint16_t FLAG_PIN = 0x0010; // ping
-static const uint16_t FLAG_PON = 0x0020; // pong
+static const uint16_t FLAG_PIN = 0x0010; // heartbeat
+static const uint16_t FLAG_PON = 0x0020; // reserved (formerly pong, the heartbeats are echoed by the timestamps of any packet)
 static const uint16_t FLAG_BWP = 0x0040; // bandwidth polling
 static const uint16_t FLAG_BWR = 0x0080; // bandwidth report
 
 #define RETX_INTERVAL 500.0 // retransmission interval, in milliseconds
 #define RETX_COUNT 120 // retransmission count
 
-#define PING_TIMEOUT 1000.0 // milliseconds
-#define BANDWIDTH_ESTIMATION_TIMEOUT 1000.0 // milliseconds
+#define HEARTBEAT_INTERVAL 1000 // a heartbeat goes out when nothing else is sent for this long, in milliseconds
+#define IDLE_TIMEOUT 10000.0 // the default idle timeout, in milliseconds
+#define BANDWIDTH_ESTIMATION_TIMEOUT 10000.0 // milliseconds
+
+#define RTT_SMOOTHING 0.125f // the gain of the rtt moving average
+#define MAX_RTT_SAMPLE 30000 // larger samples come from stale echoes (or wrapped timestamps), in milliseconds
 
 static const size_t MAXNUM_PACKETS_PER_CYCLE = 256;
 static const size_t SIZE_BW_POLL = 512;
+static const int SERVER_SOCKET_BUFFER_SIZE = 4 * 1024 * 1024;
+
+// the weighted fair queuing of the non critical priority classes: each round a class may send weight * PRIORITY_QUANTUM bytes
+static const int32_t PRIORITY_WEIGHTS[(size_t)Priority::MAXNUM] = {0, 8, 4, 1};
+static const int32_t PRIORITY_QUANTUM = 1200;
+
+#define BANDWIDTH_BURST 50.0 // the token bucket depth of the bandwidth limit, in milliseconds worth of bytes
+static const float MIN_BANDWIDTH_BURST = 1500.0f;
+
+static const size_t MAXNUM_COALESCED_SEGMENTS = 64;
+static const size_t MAXSIZE_COALESCED = 65507;
 
 Connection::Connection(bool master) :
 m_master(master),
@@ -86,12 +114,19 @@ m_reliable_outgoing_sequence(0),
 m_reliable_lowest_acceptable_sequence(0),
 m_reliable_latest_legal_ack(0),
 m_reliable_duplicated_ack_count(0),
-m_ping_time(0.0),
-m_ping_timeout(0.0),
-m_ping_timestamp(0.0),
+m_rtt(0.0),
+m_ts_recent(0),
+m_ts_recent_time(0),
+m_last_send_time(0),
+m_last_recv_time(0),
+m_idle_timeout(IDLE_TIMEOUT),
 m_bandwidth(0.0),
 m_bandwidth_timeout(0.0),
-m_bandwidth_timestamp(0.0)
+m_bandwidth_tsval(0),
+m_bandwidth_limit(0.0),
+m_bandwidth_tokens(0.0),
+m_coalesced_segsize(0),
+m_coalesced_count(0)
 {
     m_fsm[(size_t)State::STATE_CLOSED] = &Connection::state_closed;
     m_fsm[(size_t)State::STATE_LISTEN] = &Connection::state_listen;
@@ -128,6 +163,7 @@ void Connection::reset(bool broken)
     m_socket.reset();
     m_listener.reset();
     m_raddr.resize(0);
+    m_rep = Endpoint();
     m_state = State::STATE_CLOSED;
     m_unreliable_outgoing_sequence = 0;
     m_unreliable_incoming_sequence = 0;
@@ -138,12 +174,25 @@ void Connection::reset(bool broken)
     m_reliable_lowest_acceptable_sequence = 0;
     m_reliable_latest_legal_ack = 0;
     m_reliable_duplicated_ack_count = 0;
-    m_ping_time = 0.0;
-    m_ping_timeout = 0.0;
-    m_ping_timestamp = 0.0;
+    m_rtt = 0.0;
+    m_ts_recent = 0;
+    m_ts_recent_time = 0;
+    m_last_send_time = 0;
+    m_last_recv_time = 0;
     m_bandwidth = 0.0;
     m_bandwidth_timeout = 0.0;
-    m_bandwidth_timestamp = 0.0;
+    m_bandwidth_tsval = 0;
+    for (auto& queue : m_queues)
+    {
+        queue.messages.clear();
+        queue.front_id = 0;
+        queue.deficit = 0;
+    }
+    m_replaceable.clear();
+    m_bandwidth_tokens = 0.0;
+    m_coalesced.resize(0);
+    m_coalesced_segsize = 0;
+    m_coalesced_count = 0;
 }
 
 void Connection::Listen(ServerPtr server)
@@ -168,11 +217,21 @@ void Connection::Connect(const Address& raddr, ClientPtr client)
         return;
     }
 
-    m_raddr = raddr;
-
     m_socket = IDatagram::weak_ptr( client->m_socket.get() );
     m_client = std::move(client);
 
+    if ( !Endpoint::Parse(raddr, m_rep) || m_rep.IsUnspecified() )
+    {
+        m_client->m_listener->OnConnectComplete(nullptr);
+
+        reset();
+        return;
+    }
+
+    m_raddr = m_rep.ToAddress();
+
+    s_now = Timer::Milliseconds();
+
     time_t t;
     time(&t);
     uint16_t isn = (uint16_t)t;
@@ -184,7 +243,8 @@ void Connection::Connect(const Address& raddr, ClientPtr client)
     header->pflags = FLAG_RLB | FLAG_SYN;
     header->length = 0;
 
-    m_socket->Send(raddr, packet);
+    stamp(packet);
+    m_socket->Send(m_rep, packet);
 
     m_reliable_retransmission_queue.emplace( std::piecewise_construct, std::forward_as_tuple(header->seqnum), std::forward_as_tuple(RETX_INTERVAL, RETX_COUNT, std::move(packet)) );
 
@@ -212,7 +272,11 @@ void Connection::Close()
     }
     else
     {
-        send_reset(m_raddr);
+        s_now = Timer::Milliseconds();
+
+        flush();
+        send_reset(m_rep);
+        m_socket->Flush();
     }
 
     reset();
@@ -229,13 +293,142 @@ void Connection::Setup(IListener::ptr listener)
     }
 }
 
-void Connection::Send(const Buffer& data, bool reliable)
+bool Connection::Send(const Buffer& data, bool reliable)
+{
+    return Send(data, reliable, Priority::NORMAL, 0);
+}
+
+bool Connection::Send(const Buffer& data, bool reliable, Priority priority, uint64_t replace_key)
+{
+    if (m_state != State::STATE_ESTABED)
+    {
+        return false;
+    }
+
+    size_t p = std::min( (size_t)priority, (size_t)Priority::MAXNUM - 1 );
+
+    if (!reliable && replace_key != 0)
+    {
+        // NB: the replacement keeps the queue position of the stale message, so a frequently updated key isn't starved
+        auto it = m_replaceable.find(replace_key);
+        if ( it != m_replaceable.end() )
+        {
+            MessageQueue& queue = m_queues[it->second.priority];
+            queue.messages[it->second.id - queue.front_id].data = data;
+            return true;
+        }
+
+        MessageQueue& queue = m_queues[p];
+        m_replaceable.emplace( replace_key, QueuedMessage{ p, queue.front_id + queue.messages.size() } );
+    }
+    else
+    {
+        replace_key = 0;
+    }
+
+    m_queues[p].messages.push_back( Message{ data, reliable, replace_key } );
+    return true;
+}
+
+void Connection::SetBandwidthLimit(float limit)
+{
+    m_bandwidth_limit = std::max(limit, 0.0f);
+    m_bandwidth_tokens = std::max( m_bandwidth_limit * (float)BANDWIDTH_BURST / 1000.0f, MIN_BANDWIDTH_BURST );
+}
+
+void Connection::SetIdleTimeout(float timeout)
+{
+    m_idle_timeout = std::max(timeout, 0.0f);
+}
+
+float Connection::GetIdleTime() const
+{
+    if (m_state != State::STATE_ESTABED)
+    {
+        return 0.0f;
+    }
+
+    return (float)(Timer::Milliseconds() - m_last_recv_time);
+}
+
+void Connection::schedule(float elapsed)
 {
     if (m_state != State::STATE_ESTABED)
     {
         return;
     }
 
+    const bool limited = m_bandwidth_limit > 0.0f;
+    if (limited)
+    {
+        float burst = std::max( m_bandwidth_limit * (float)BANDWIDTH_BURST / 1000.0f, MIN_BANDWIDTH_BURST );
+        m_bandwidth_tokens = std::min( m_bandwidth_tokens + m_bandwidth_limit * elapsed / 1000.0f, burst );
+    }
+
+    // NB: a message is sent as long as there is any token left, the bucket goes negative instead of blocking on messages larger than the burst
+
+    // 1. critical messages, strict priority
+    MessageQueue& critical = m_queues[(size_t)Priority::CRITICAL];
+    while ( !critical.messages.empty() && ( !limited || m_bandwidth_tokens > 0.0f ) )
+    {
+        dequeue(critical);
+    }
+
+    // 2. the rest, deficit round robin weighted by priority; the deficits carry over to the next tick when running out of bandwidth
+    bool active = true;
+    while ( active && ( !limited || m_bandwidth_tokens > 0.0f ) )
+    {
+        active = false;
+
+        for (size_t p = (size_t)Priority::CRITICAL + 1; p < (size_t)Priority::MAXNUM; ++p)
+        {
+            MessageQueue& queue = m_queues[p];
+            if ( queue.messages.empty() )
+            {
+                queue.deficit = 0;
+                continue;
+            }
+
+            queue.deficit += PRIORITY_WEIGHTS[p] * PRIORITY_QUANTUM;
+            while ( !queue.messages.empty() && (int32_t)queue.messages.front().data.size() <= queue.deficit && ( !limited || m_bandwidth_tokens > 0.0f ) )
+            {
+                queue.deficit -= (int32_t)queue.messages.front().data.size();
+                dequeue(queue);
+            }
+
+            if ( queue.messages.empty() )
+            {
+                queue.deficit = 0;
+            }
+            else
+            {
+                active = true;
+            }
+        }
+    }
+}
+
+void Connection::dequeue(MessageQueue& queue)
+{
+    Message& message = queue.messages.front();
+    if (message.replace_key != 0)
+    {
+        m_replaceable.erase(message.replace_key);
+    }
+
+    transmit(message.data, message.reliable);
+
+    if (m_bandwidth_limit > 0.0f)
+    {
+        m_bandwidth_tokens -= sizeof(Header) + message.data.size();
+    }
+
+    queue.messages.pop_front();
+    ++queue.front_id;
+}
+
+void Connection::transmit(const Buffer& data, bool reliable)
+{
     Buffer packet( sizeof(Header) + data.size() );
     Header* header = reinterpret_cast<Header*>(&packet[0]);
 
@@ -253,7 +446,7 @@ void Connection::Send(const Buffer& data, bool reliable)
     header->acknum = 0;
     header->length = data.size();
     memcpy( header + 1, &data[0], data.size() );
-    m_socket->Send(m_raddr, packet);
+    send_packet(packet);
 
     if (reliable)
     {
@@ -268,7 +461,13 @@ void Connection::Kick(const Address& raddr)
         return;
     }
 
-    auto it = m_children.find(raddr);
+    Endpoint rep;
+    if ( !Endpoint::Parse(raddr, rep) )
+    {
+        return;
+    }
+
+    auto it = m_children.find(rep);
     if (it != m_children.end())
     {
         it->second->Close();
@@ -292,7 +491,11 @@ void Connection::check_timeout(float elapsed) // milliseconds
                 return;
             }
 
-            m_socket->Send(m_raddr, info.buffer);
+            send_packet(info.buffer);
+            if (m_bandwidth_limit > 0.0f)
+            {
+                m_bandwidth_tokens -= info.buffer.size(); // NB: the retransmissions are never held back, but they do consume the bandwidth
+            }
 
             info.timeout = RETX_INTERVAL;
             --info.count;
@@ -305,21 +508,23 @@ void Connection::check_timeout(float elapsed) // milliseconds
 
     if (m_state == State::STATE_ESTABED)
     {
-        if (m_ping_timeout <= elapsed)
-        {
-            m_ping_timestamp = Timer::Now();
-            send_ping(m_raddr, m_ping_timestamp);
+        uint32_t now = s_now;
 
-            m_ping_timeout = PING_TIMEOUT;
+        if ( m_idle_timeout > 0.0f && (float)(now - m_last_recv_time) >= m_idle_timeout )
+        {
+            reset(true);
+            return;
         }
-        else
+
+        // NB: the data, acks and retransmissions carry the timestamps already, so a busy link never needs a heartbeat
+        if ( now - m_last_send_time >= HEARTBEAT_INTERVAL )
         {
-            m_ping_timeout -= elapsed;
+            send_heartbeat(m_rep);
         }
 
         if (m_bandwidth_timeout <= elapsed)
         {
-            send_bw_poll(m_raddr, Timer::Now());
+            send_bw_poll(m_rep);
 
             m_bandwidth_timeout = BANDWIDTH_ESTIMATION_TIMEOUT;
         }
@@ -330,49 +535,122 @@ void Connection::check_timeout(float elapsed) // milliseconds
     }
 }
 
-void Connection::send_bw_poll(const Address& raddr, float timestamp)
+void Connection::send_packet(Buffer& packet)
+{
+    stamp(packet);
+
+    if ( !m_socket->IsSegmentationSupported() )
+    {
+        m_socket->Send(m_rep, packet);
+        return;
+    }
+
+    // NB: a run continues as long as the packets are of the same size; a shorter packet can still join, but it terminates the run
+    bool joinable = !m_coalesced.empty()
+        && packet.size() <= m_coalesced_segsize
+        && m_coalesced.size() == m_coalesced_count * m_coalesced_segsize
+        && m_coalesced_count < MAXNUM_COALESCED_SEGMENTS
+        && m_coalesced.size() + packet.size() <= MAXSIZE_COALESCED;
+
+    if (!joinable)
+    {
+        flush();
+        m_coalesced_segsize = packet.size();
+    }
+
+    m_coalesced.insert( m_coalesced.end(), packet.begin(), packet.end() );
+    ++m_coalesced_count;
+}
+
+void Connection::flush()
+{
+    if ( m_coalesced.empty() )
+    {
+        return;
+    }
+
+    if (m_coalesced_count == 1)
+    {
+        m_socket->Send(m_rep, m_coalesced);
+    }
+    else
+    {
+        m_socket->SendSegmented(m_rep, m_coalesced, m_coalesced_segsize);
+    }
+
+    m_coalesced.resize(0);
+    m_coalesced_count = 0;
+}
+
+void Connection::stamp(Buffer& packet)
+{
+    uint32_t now = s_now;
+
+    Header* header = reinterpret_cast<Header*>(&packet[0]);
+    header->tsval = timestamp(now);
+    header->tsecr = m_ts_recent != 0 ? timestamp( m_ts_recent + (now - m_ts_recent_time) ) : 0;
+
+    m_last_send_time = now;
+}
+
+void Connection::receive_timestamps(uint16_t tsval, uint16_t tsecr)
+{
+    uint32_t now = s_now;
+
+    if (tsval != 0)
+    {
+        m_ts_recent = tsval;
+        m_ts_recent_time = now;
+    }
+
+    if (tsecr != 0)
+    {
+        uint16_t sample = (uint16_t)now - tsecr; // NB: the hold time on the other side is already accounted into the echo
+        if (sample <= MAX_RTT_SAMPLE)
+        {
+            m_rtt = m_rtt > 0.0f ? m_rtt + RTT_SMOOTHING * (sample - m_rtt) : (float)sample;
+        }
+    }
+
+    m_last_recv_time = now;
+}
+
+void Connection::send_bw_poll(const Endpoint& rep)
 {
     Buffer packet(SIZE_BW_POLL);
     Header* header = reinterpret_cast<Header*>(&packet[0]);
-    *(float*)header = timestamp; // NB: float is 32 bits
     header->length = SIZE_BW_POLL - sizeof(Header);
     header->pflags = FLAG_BWP | 0x0000;
-    m_socket->Send(raddr, packet);
+    stamp(packet); // NB: both packets of the pair carry the same tsval, which identifies the pair on the other side
+    m_socket->Send(rep, packet);
     header->pflags = FLAG_BWP | 0x0100;
-    m_socket->Send(raddr, packet);
+    m_socket->Send(rep, packet);
 }
 
-void Connection::send_bw_rslt(const Address& raddr, float bandwidth)
+void Connection::send_bw_rslt(const Endpoint& rep, float bandwidth)
 {
     Buffer packet( sizeof(Header) );
     Header* header = reinterpret_cast<Header*>(&packet[0]);
-    *(float*)header = bandwidth;
+    *(float*)header = bandwidth; // NB: float is 32 bits, in place of seqnum and acknum
     header->pflags = FLAG_BWR;
     header->length = 0;
-    m_socket->Send(raddr, packet);
+    stamp(packet);
+    m_socket->Send(rep, packet);
 }
 
-void Connection::send_ping(const Address& raddr, float timestamp)
+void Connection::send_heartbeat(const Endpoint& rep)
 {
     Buffer packet( sizeof(Header) );
     Header* header = reinterpret_cast<Header*>(&packet[0]);
-    *(float*)header = timestamp;
+    header->seqnum = 0;
+    header->acknum = 0;
     header->pflags = FLAG_PIN;
     header->length = 0;
-    m_socket->Send(raddr, packet);
-}
-
-void Connection::send_pong(const Address& raddr, float timestamp)
-{
-    Buffer packet( sizeof(Header) );
-    Header* header = reinterpret_cast<Header*>(&packet[0]);
-    *(float*)header = timestamp;
-    header->pflags = FLAG_PON;
-    header->length = 0;
-    m_socket->Send(raddr, packet);
+    stamp(packet);
+    m_socket->Send(rep, packet);
 }
 
-void Connection::send_reset(const Address& raddr)
+void Connection::send_reset(const Endpoint& rep)
 {
     Buffer packet( sizeof(Header) );
     Header* header = reinterpret_cast<Header*>(&packet[0]);
@@ -380,10 +658,11 @@ void Connection::send_reset(const Address& raddr)
     header->acknum = 0;
     header->pflags = FLAG_RST;
     header->length = 0;
-    m_socket->Send(raddr, packet);
+    stamp(packet);
+    m_socket->Send(rep, packet);
 }
 
-void Connection::send_ack(const Address& raddr, uint16_t acknum)
+void Connection::send_ack(const Endpoint& rep, uint16_t acknum)
 {
     Buffer packet( sizeof(Header) );
     Header* header = reinterpret_cast<Header*>(&packet[0]);
@@ -391,7 +670,8 @@ void Connection::send_ack(const Address& raddr, uint16_t acknum)
     header->acknum = acknum;
     header->pflags = FLAG_ACK;
     header->length = 0;
-    m_socket->Send(raddr, packet);
+    stamp(packet);
+    m_socket->Send(rep, packet);
 }
 
 void Connection::Tick()
@@ -401,19 +681,21 @@ void Connection::Tick()
         return;
     }
 
+    s_now = Timer::Milliseconds();
+
     // 1. incoming packets
     for (size_t count = 0; count < MAXNUM_PACKETS_PER_CYCLE; ++count)
     {
         Buffer packet;
-        Address raddr;
-        if ( !m_socket->Recv(raddr, packet) )
+        Endpoint rep;
+        if ( !m_socket->Recv(rep, packet) )
             break;
         if ( packet.size() < sizeof(Header) )
             continue; // malicious?
         Header* header = reinterpret_cast<Header*>(&packet[0]);
         if ( sizeof(Header) + header->length != packet.size() )
             continue; // malicious?
-        (this->*m_fsm[(size_t)m_state])( raddr, std::move(packet) );
+        (this->*m_fsm[(size_t)m_state])( rep, std::move(packet) );
         if (m_state == State::STATE_CLOSED)
             return; // this could happen as a result of handling incoming packets
     }
@@ -429,6 +711,8 @@ void Connection::Tick()
 
             Connection::ptr& connection = it->second;
             connection->check_timeout(elapsed);
+            connection->schedule(elapsed);
+            connection->flush();
             if (connection->m_state == State::STATE_CLOSED)
             {
                 m_children.erase(it);
@@ -438,25 +722,33 @@ void Connection::Tick()
     else
     {
         check_timeout(elapsed);
+        schedule(elapsed);
+        flush();
+    }
+
+    // 3. hand the outgoing packets of this tick over to the system
+    if (m_socket)
+    {
+        m_socket->Flush(); // NB: the client master resets (dropping the socket) when the connection times out
     }
 }
 
-void Connection::state_closed(const Address& raddr, Buffer&& packet)
+void Connection::state_closed(const Endpoint& rep, Buffer&& packet)
 {
     const Header* header = reinterpret_cast<const Header*>(&packet[0]);
     if ( (header->pflags & FLAG_RST) == 0 )
-        send_reset(raddr);
+        send_reset(rep);
 }
 
-void Connection::state_listen(const Address& raddr, Buffer&& packet)
+void Connection::state_listen(const Endpoint& rep, Buffer&& packet)
 {
     if (!m_master) return;
 
-    auto it = m_children.find(raddr);
+    auto it = m_children.find(rep);
     if (it != m_children.end())
     {
         Connection* connection = it->second.get();
-        (connection->*connection->m_fsm[(size_t)connection->m_state])(raddr, std::move(packet));
+        (connection->*connection->m_fsm[(size_t)connection->m_state])(rep, std::move(packet));
         if (connection->m_state == State::STATE_CLOSED)
         {
             m_children.erase(it);
@@ -469,18 +761,20 @@ void Connection::state_listen(const Address& raddr, Buffer&& packet)
         {
             if ( (header->pflags & FLAG_RST) == 0 )
             {
-                send_reset(raddr);
+                send_reset(rep);
             }
         }
         else
         {
-            auto r = m_children.emplace( raddr, ptr(new Connection(false)) );
+            auto r = m_children.emplace( rep, ptr(new Connection(false)) );
             auto& connection = r.first->second;
             connection->m_server.reset( m_server.get() );
             connection->m_socket.reset( m_socket.get() );
-            connection->m_raddr = raddr;
+            connection->m_raddr = rep.ToAddress();
+            connection->m_rep = rep;
             connection->m_unreliable_incoming_sequence = header->seqnum;
             connection->m_reliable_lowest_acceptable_sequence = header->seqnum + 1;
+            connection->receive_timestamps(header->tsval, header->tsecr);
 
             time_t t;
             time(&t);
@@ -492,7 +786,8 @@ void Connection::state_listen(const Address& raddr, Buffer&& packet)
             hdr->acknum = header->seqnum + 1;
             hdr->pflags = FLAG_RLB | FLAG_SYN | FLAG_ACK;
             hdr->length = 0;
-            m_socket->Send(raddr, pkt);
+            connection->stamp(pkt);
+            m_socket->Send(rep, pkt);
 
             connection->m_reliable_retransmission_queue.emplace( std::piecewise_construct, std::forward_as_tuple(hdr->seqnum), std::forward_as_tuple(RETX_INTERVAL, RETX_COUNT, std::move(pkt)) );
 
@@ -503,7 +798,7 @@ void Connection::state_listen(const Address& raddr, Buffer&& packet)
     }
 }
 
-void Connection::state_synsent(const Address& raddr, Buffer&& packet)
+void Connection::state_synsent(const Endpoint& rep, Buffer&& packet)
 {
     // the connection in question must be the client master
     if (!m_master || !m_client) return;
@@ -515,21 +810,21 @@ void Connection::state_synsent(const Address& raddr, Buffer&& packet)
         if (header->pflags & FLAG_RST)
             throw -1;
 
-        if (m_raddr != raddr)
+        if (m_rep != rep)
         {
-            send_reset(raddr);
+            send_reset(rep);
             throw -1;
         }
 
         if ( (header->pflags & FLAG_ALL) != (FLAG_RLB | FLAG_SYN | FLAG_ACK) )
         {
-            send_reset(raddr);
+            send_reset(rep);
             throw -1;
         }
 
         if ( !eq(header->acknum, m_reliable_outgoing_sequence) )
         {
-            send_reset(raddr);
+            send_reset(rep);
             throw -1;
         }
     }
@@ -542,6 +837,7 @@ void Connection::state_synsent(const Address& raddr, Buffer&& packet)
     }
 
     m_reliable_latest_legal_ack = header->acknum;
+    receive_timestamps(header->tsval, header->tsecr);
 
     assert( m_reliable_retransmission_queue.size() == 1 );
     m_reliable_retransmission_queue.erase( m_reliable_retransmission_queue.begin() );
@@ -549,14 +845,14 @@ void Connection::state_synsent(const Address& raddr, Buffer&& packet)
     m_unreliable_incoming_sequence = header->seqnum;
     m_reliable_lowest_acceptable_sequence = header->seqnum + 1;
 
-    send_ack(raddr, m_reliable_lowest_acceptable_sequence);
+    send_ack(rep, m_reliable_lowest_acceptable_sequence);
 
     m_state = State::STATE_ESTABED;
 
     m_client->m_listener->OnConnectComplete( IConnection::ptr(this) );
 }
 
-void Connection::state_synrcvd(const Address& raddr, Buffer&& packet)
+void Connection::state_synrcvd(const Endpoint& rep, Buffer&& packet)
 {
     const Header* header = reinterpret_cast<const Header*>(&packet[0]);
 
@@ -571,12 +867,13 @@ void Connection::state_synrcvd(const Address& raddr, Buffer&& packet)
 
     if (header->acknum != m_reliable_outgoing_sequence)
     {
-        send_reset(raddr);
+        send_reset(rep);
         reset(true);
         return;
     }
 
     m_reliable_latest_legal_ack = header->acknum;
+    receive_timestamps(header->tsval, header->tsecr);
 
     assert( m_reliable_retransmission_queue.size() == 1 );
     m_reliable_retransmission_queue.erase( m_reliable_retransmission_queue.begin() );
@@ -586,12 +883,12 @@ void Connection::state_synrcvd(const Address& raddr, Buffer&& packet)
     m_server->m_listener->OnCreateConnection( IConnection::ptr(this) );
 }
 
-void Connection::state_estabed(const Address& raddr, Buffer&& packet)
+void Connection::state_estabed(const Endpoint& rep, Buffer&& packet)
 {
-    if (m_master && m_raddr != raddr)
+    if (m_master && m_rep != rep)
     {
         // the master client connection receives a packet not destined correctly
-        send_reset(raddr);
+        send_reset(rep);
         return;
     }
 
@@ -603,19 +900,11 @@ void Connection::state_estabed(const Address& raddr, Buffer&& packet)
         return;
     }
 
-    if (header->pflags & FLAG_PIN)
-    {
-        send_pong(raddr, *(float*)header);
-        return;
-    }
+    // NB: any packet from the other side keeps the connection alive and samples the rtt, heartbeats carry nothing else
+    receive_timestamps(header->tsval, header->tsecr);
 
-    if (header->pflags & FLAG_PON)
+    if (header->pflags & FLAG_PIN)
     {
-        float timestamp = *(float*)header;
-        if (m_ping_timestamp == timestamp)
-        {
-            m_ping_time = Timer::Now() - m_ping_timestamp;
-        }
         return;
     }
 
@@ -623,15 +912,15 @@ void Connection::state_estabed(const Address& raddr, Buffer&& packet)
     {
         if ( (header->pflags & 0xff00) == 0x0000 )
         {
-            m_bandwidth_timestamp = *(float*)header;
+            m_bandwidth_tsval = header->tsval;
             m_timer_bw.Reset();
         }
         else if ( (header->pflags & 0xff00) == 0x0100 )
         {
-            if ( m_bandwidth_timestamp == *(float*)header )
+            if ( m_bandwidth_tsval != 0 && m_bandwidth_tsval == header->tsval )
             {
                 float bandwidth = SIZE_BW_POLL / m_timer_bw.GetElapsedMilliseconds() * 1000.0f; // Bytes per second
-                send_bw_rslt(raddr, bandwidth);
+                send_bw_rslt(rep, bandwidth);
             }
         }
         return;
@@ -651,7 +940,7 @@ void Connection::state_estabed(const Address& raddr, Buffer&& packet)
         if ( gt(header->acknum, m_reliable_outgoing_sequence) )
         {
             // ACK beyond realistic sequence
-            send_reset(raddr);
+            send_reset(rep);
             reset(true);
             return;
         }
@@ -659,8 +948,9 @@ void Connection::state_estabed(const Address& raddr, Buffer&& packet)
         // fast retransmit
         if ( eq(header->acknum, m_reliable_latest_legal_ack) && !m_reliable_retransmission_queue.empty() && ++m_reliable_duplicated_ack_count >= 3 )
         {
-            const Buffer& pkt = m_reliable_retransmission_queue.begin()->second.buffer;
-            m_socket->Send(raddr, pkt);
+            Buffer& pkt = m_reliable_retransmission_queue.begin()->second.buffer;
+            stamp(pkt);
+            m_socket->Send(rep, pkt);
 
             m_reliable_duplicated_ack_count = 0;
 
@@ -722,7 +1012,7 @@ void Connection::state_estabed(const Address& raddr, Buffer&& packet)
             m_reliable_lowest_acceptable_sequence = current;
         }
 
-        send_ack(raddr, m_reliable_lowest_acceptable_sequence);
+        send_ack(rep, m_reliable_lowest_acceptable_sequence);
     }
     else // unreliable packet
     {
@@ -748,7 +1038,7 @@ const Address& Connection::GetRemoteAddress() const
 
 float Connection::GetRTT() const
 {
-    return m_ping_time;
+    return m_rtt;
 }
 
 float Connection::GetBandwidth() const
@@ -756,8 +1046,8 @@ float Connection::GetBandwidth() const
     return m_bandwidth;
 }
 
-Server::Server() :
-m_socket( IDatagram::CreateInstance() ),
+Server::Server(Backend backend) :
+m_socket( IDatagram::CreateInstance(backend) ),
 m_master( new Connection(true) )
 {
 }
@@ -773,7 +1063,11 @@ void Server::Setup(IListener::ptr listener)
 
 void Server::Host(const Address& local)
 {
-    m_socket->Init(local);
+    // NB: a server multiplexes all the connections over one socket, so the default socket buffers overflow easily under bursts
+    IDatagram::Options options;
+    options.rcvbuf = SERVER_SOCKET_BUFFER_SIZE;
+    options.sndbuf = SERVER_SOCKET_BUFFER_SIZE;
+    m_socket->Init(local, options);
     m_master->Listen( ServerPtr(this) );
 }
 
@@ -796,9 +1090,9 @@ void Server::Shutdown()
     m_socket = nullptr;
 }
 
-IServer::ptr IServer::CreateInstance()
+IServer::ptr IServer::CreateInstance(Backend backend)
 {
-    return IServer::ptr( new Server() );
+    return IServer::ptr( new Server(backend) );
 }
 
 Client::Client() :
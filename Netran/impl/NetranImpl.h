@@ -35,7 +35,15 @@ namespace Netran
 
         void Close() override;
 
-        void Send(const Buffer& data, bool reliable) override;
+        bool Send(const Buffer& data, bool reliable) override;
+
+        bool Send(const Buffer& data, bool reliable, Priority priority, uint64_t replace_key) override;
+
+        void SetBandwidthLimit(float limit) override;
+
+        void SetIdleTimeout(float timeout) override;
+
+        float GetIdleTime() const override;
 
         const Address& GetRemoteAddress() const override;
 
@@ -54,7 +62,7 @@ namespace Netran
         Timer m_timer;
         Timer m_timer_bw;
 
-        typedef std::unordered_map<Address, ptr> ConnectionsMap;
+        typedef std::unordered_map<Endpoint, ptr> ConnectionsMap;
         ConnectionsMap m_children;
 
         ServerPtr m_server;
@@ -63,7 +71,8 @@ namespace Netran
 
         IListener::ptr m_listener;
 
-        Address m_raddr;
+        Address m_raddr; // the textual form of m_rep, only for GetRemoteAddress
+        Endpoint m_rep;
 
         enum class State {STATE_CLOSED, STATE_LISTEN, STATE_SYNRCVD, STATE_SYNSENT, STATE_ESTABED, STATE_MAXNUM};
         State m_state;
@@ -98,13 +107,17 @@ namespace Netran
         typedef std::map<uint16_t, RetransmissionInfo, Less> RetransmissionQueue;
         RetransmissionQueue m_reliable_retransmission_queue;
 
-        float m_ping_time; // rtt
-        float m_ping_timeout;
-        float m_ping_timestamp;
+        // liveness and rtt: every outgoing packet carries a timestamp (tsval) and echoes the latest one received (tsecr), adjusted by the time it was held
+        float m_rtt; // smoothed
+        uint16_t m_ts_recent; // the latest tsval received, 0 for none
+        uint32_t m_ts_recent_time; // when m_ts_recent is received, Timer::Milliseconds
+        uint32_t m_last_send_time;
+        uint32_t m_last_recv_time;
+        float m_idle_timeout; // milliseconds, 0 for no idle detection
 
         float m_bandwidth;
         float m_bandwidth_timeout;
-        float m_bandwidth_timestamp;
+        uint16_t m_bandwidth_tsval; // the tsval of the bandwidth polling pair being received
 
         uint16_t m_reliable_outgoing_sequence;
         uint16_t m_reliable_lowest_acceptable_sequence;
@@ -118,14 +131,51 @@ namespace Netran
         typedef std::map<uint16_t, Buffer, Less> ReassemblyList; // NB: the packet list is sequence number ordered
         ReassemblyList m_reliable_reassembly_list;
 
-        typedef void (Connection::*StateMachineMethod)(const Address& raddr, Buffer&& data);
+        // the outgoing scheduler: one queue per priority class, the messages are transmitted (and the reliable ones sequenced) when dequeued
+        struct Message
+        {
+            Buffer data;
+            bool reliable;
+            uint64_t replace_key;
+        };
+
+        struct MessageQueue
+        {
+            std::deque<Message> messages;
+            uint64_t front_id;  // the id of the front message; ids increase monotonically, so a message is located by (id - front_id)
+            int32_t deficit;    // the deficit round robin counter, in bytes
+
+            MessageQueue()
+                : front_id(0)
+                , deficit(0)
+            {}
+        };
+
+        struct QueuedMessage
+        {
+            size_t priority;
+            uint64_t id;
+        };
+
+        MessageQueue m_queues[(size_t)Priority::MAXNUM];
+        std::unordered_map<uint64_t, QueuedMessage> m_replaceable; // replace key => the queued message
+
+        float m_bandwidth_limit; // bytes per second, 0 for unlimited
+        float m_bandwidth_tokens;
+
+        // outgoing data packets of the current tick, coalesced into runs of equally sized datagrams for the segmented send
+        Buffer m_coalesced;
+        size_t m_coalesced_segsize;
+        size_t m_coalesced_count;
+
+        typedef void (Connection::*StateMachineMethod)(const Endpoint& rep, Buffer&& data);
         StateMachineMethod m_fsm[(size_t)State::STATE_MAXNUM];
 
-        void state_closed(const Address& raddr, Buffer&& data);
-        void state_listen(const Address& raddr, Buffer&& data);
-        void state_synrcvd(const Address& raddr, Buffer&& data);
-        void state_synsent(const Address& raddr, Buffer&& data);
-        void state_estabed(const Address& raddr, Buffer&& data);
+        void state_closed(const Endpoint& rep, Buffer&& data);
+        void state_listen(const Endpoint& rep, Buffer&& data);
+        void state_synrcvd(const Endpoint& rep, Buffer&& data);
+        void state_synsent(const Endpoint& rep, Buffer&& data);
+        void state_estabed(const Endpoint& rep, Buffer&& data);
 
         // This function resets the connection; when broken is false, the reset is considered to be active (initiated locally),
         // thus no callback notification to the user layer; when it is true, the reset is considered to be passive, and inside
@@ -138,15 +188,28 @@ namespace Netran
         void reset(bool broken = false);
 
         void check_timeout(float elapsed);
+
+        // dequeues the scheduled messages for transmission, within the bandwidth limit
+        void schedule(float elapsed);
+        void dequeue(MessageQueue& queue);
+        void transmit(const Buffer& data, bool reliable);
+
+        // sends a data packet, deferring it to the end of the tick when the socket could batch it with the neighbouring ones
+        void send_packet(Buffer& packet);
+        void flush();
+
+        // fills in the timestamps of an outgoing packet; all the packets of a connection are stamped right before they go out (retransmissions included)
+        void stamp(Buffer& packet);
+        // takes the timestamps of an incoming packet, sampling the rtt from the echo
+        void receive_timestamps(uint16_t tsval, uint16_t tsecr);
+
+        void send_heartbeat(const Endpoint& rep);
         
-        void send_ping(const Address& raddr, float timestamp);
-        void send_pong(const Address& raddr, float timestamp);
-        
-        void send_bw_poll(const Address& raddr, float timestamp);
-        void send_bw_rslt(const Address& raddr, float bandwidth);
+        void send_bw_poll(const Endpoint& rep);
+        void send_bw_rslt(const Endpoint& rep, float bandwidth);
         
-        void send_ack(const Address& raddr, uint16_t acknum);
-        void send_reset(const Address& raddr);
+        void send_ack(const Endpoint& rep, uint16_t acknum);
+        void send_reset(const Endpoint& rep);
     };
 
     class Server : public IServer
@@ -154,7 +217,7 @@ namespace Netran
         friend class Connection;
 
     public:
-        Server();
+        Server(Backend backend);
         ~Server();
 
         void Setup(IListener::ptr listener) override;
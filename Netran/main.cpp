@@ -0,0 +1,368 @@
+//
+//  main.cpp
+//  Netran
+//
+//  Created by Lin Luo on 05/01/2015.
+//
+
+#include <iostream>
+#include <cassert>
+#include <cstring>
+
+#include <chrono>
+#include <thread>
+
+#include "NetranImpl.h"
+
+using namespace Netran;
+
+static const size_t NUM_PACKETS = 200000;
+static const size_t SIZE_PACKET = 1200;
+static const size_t SIZE_BATCH = 32; // e.g. the relays of one tick to one client
+
+static float ElapsedMilliseconds(std::chrono::high_resolution_clock::time_point start)
+{
+    return std::chrono::duration_cast< std::chrono::duration< float, std::ratio<1, 1000> > >(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+static void Report(const char* name, size_t npackets, size_t nbytes, float ms)
+{
+    std::cout << name << ": " << npackets << " packets, " << nbytes / ms / 1000.0f << " MB/s, " << npackets / ms * 1000.0f << " packets/s, took: " << ms << " ms" << std::endl;
+}
+
+static const char* BackendName(Backend backend)
+{
+    return backend == Backend::IO_URING ? "io_uring" : "sockets";
+}
+
+// sends NUM_PACKETS over loopback in batches, draining the receiver after each batch, either one datagram at a time or segmented
+static void BenchmarkDatagram(Backend backend, bool segmented)
+{
+    IDatagram::Options options;
+    options.rcvbuf = 4 * 1024 * 1024;
+    options.sndbuf = 4 * 1024 * 1024;
+
+    IDatagram::ptr receiver = IDatagram::CreateInstance(backend);
+    receiver->Init("127.0.0.1:7301", options);
+
+    IDatagram::ptr sender = IDatagram::CreateInstance(backend);
+    sender->Init("127.0.0.1:7302", options);
+
+    Endpoint destination;
+    Endpoint::Parse("127.0.0.1:7301", destination);
+
+    if ( segmented && !sender->IsSegmentationSupported() )
+    {
+        std::cout << "Segmentation offload is not supported, falling back to the per segment send" << std::endl;
+    }
+
+    Buffer packet(SIZE_PACKET, 0x5a);
+    Buffer batch(SIZE_PACKET * SIZE_BATCH, 0x5a);
+
+    Endpoint source;
+    Buffer data;
+    std::vector<size_t> segments;
+
+    size_t npackets = 0;
+    size_t nbytes = 0;
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    for (size_t sent = 0; sent < NUM_PACKETS; sent += SIZE_BATCH)
+    {
+        if (segmented)
+        {
+            sender->SendSegmented(destination, batch, SIZE_PACKET);
+            sender->Flush();
+
+            while ( receiver->RecvSegmented(source, data, segments) )
+            {
+                npackets += segments.size();
+                nbytes += data.size();
+            }
+        }
+        else
+        {
+            for (size_t i = 0; i < SIZE_BATCH; ++i)
+            {
+                sender->Send(destination, packet);
+            }
+            sender->Flush();
+
+            while ( receiver->Recv(source, data) )
+            {
+                ++npackets;
+                nbytes += data.size();
+            }
+        }
+    }
+
+    std::cout << BackendName(backend) << " ";
+    Report(segmented ? "Datagram segmented" : "Datagram per packet", npackets, nbytes, ElapsedMilliseconds(start));
+
+    sender->Term();
+    receiver->Term();
+}
+
+struct ServerListener : IServer::IListener, IConnection::IListener
+{
+    size_t npackets;
+    size_t nbytes;
+
+    ServerListener() : npackets(0), nbytes(0) {}
+
+    void OnCreateConnection(IConnection::ptr connection) override
+    {
+        connection->Setup( IConnection::IListener::ptr(this) );
+    }
+
+    void OnDeleteConnection(IConnection::ptr connection) override
+    {
+    }
+
+    void OnIncomingData(Buffer&& data) override
+    {
+        ++npackets;
+        nbytes += data.size();
+    }
+};
+
+struct ClientListener : IClient::IListener
+{
+    IConnection* connection;
+
+    ClientListener() : connection(nullptr) {}
+
+    void OnConnectComplete(IConnection::ptr connection_) override
+    {
+        connection = connection_.get();
+    }
+
+    void OnConnectionBroken() override
+    {
+        connection = nullptr;
+    }
+};
+
+// the end to end unreliable throughput through the connections, which coalesce the sends of a tick automatically when the socket supports it
+static void BenchmarkConnection(Backend backend)
+{
+    IServer::ptr server = IServer::CreateInstance(backend);
+    ServerListener server_listener;
+    server->Setup( IServer::IListener::ptr(&server_listener) );
+    server->Host("127.0.0.1:7303");
+
+    IClient::ptr client = IClient::CreateInstance();
+    ClientListener client_listener;
+    client->Setup( IClient::IListener::ptr(&client_listener) );
+    client->Connect("127.0.0.1:7303");
+
+    while (!client_listener.connection)
+    {
+        client->Tick();
+        server->Tick();
+    }
+
+    Buffer data(SIZE_PACKET - 12, 0x5a); // NB: leaves room for the packet header
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    for (size_t sent = 0; sent < NUM_PACKETS; sent += SIZE_BATCH)
+    {
+        for (size_t i = 0; i < SIZE_BATCH; ++i)
+        {
+            client_listener.connection->Send(data, false);
+        }
+
+        client->Tick();
+        server->Tick();
+    }
+
+    std::cout << BackendName(backend) << " ";
+    Report("Connection", server_listener.npackets, server_listener.nbytes, ElapsedMilliseconds(start));
+
+    client->Shutdown();
+    server->Shutdown();
+}
+
+struct RecordingListener : IServer::IListener, IConnection::IListener
+{
+    std::vector<Buffer> messages;
+
+    void OnCreateConnection(IConnection::ptr connection) override
+    {
+        connection->Setup( IConnection::IListener::ptr(this) );
+    }
+
+    void OnDeleteConnection(IConnection::ptr connection) override
+    {
+    }
+
+    void OnIncomingData(Buffer&& data) override
+    {
+        messages.push_back( std::move(data) );
+    }
+};
+
+// under a bandwidth limit, the critical message preempts the queued bulk ones, and only the latest of the replaceable updates goes out
+static void TestPriorityScheduling()
+{
+    IServer::ptr server = IServer::CreateInstance();
+    RecordingListener server_listener;
+    server->Setup( IServer::IListener::ptr(&server_listener) );
+    server->Host("127.0.0.1:7304");
+
+    IClient::ptr client = IClient::CreateInstance();
+    ClientListener client_listener;
+    client->Setup( IClient::IListener::ptr(&client_listener) );
+    client->Connect("127.0.0.1:7304");
+
+    while (!client_listener.connection)
+    {
+        client->Tick();
+        server->Tick();
+    }
+
+    IConnection* connection = client_listener.connection;
+    connection->SetBandwidthLimit(200000.0f);
+
+    static const size_t NUM_BULK = 50;
+    static const size_t NUM_UPDATES = 100;
+    static const uint64_t UPDATE_KEY = 42;
+
+    for (size_t i = 0; i < NUM_BULK; ++i)
+    {
+        connection->Send(Buffer(1000, 'B'), true, Priority::BULK);
+    }
+
+    for (size_t i = 0; i < NUM_UPDATES; ++i)
+    {
+        connection->Send(Buffer(1, (Byte)i), false, Priority::NORMAL, UPDATE_KEY);
+    }
+
+    connection->Send(Buffer(1, 'C'), true, Priority::CRITICAL);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    while ( server_listener.messages.size() < NUM_BULK + 2 && ElapsedMilliseconds(start) < 5000.0f )
+    {
+        client->Tick();
+        server->Tick();
+        std::this_thread::sleep_for( std::chrono::milliseconds(1) );
+    }
+
+    size_t nbulk = 0;
+    size_t nupdates = 0;
+    for (const Buffer& message : server_listener.messages)
+    {
+        if ( message.size() == 1000 )
+        {
+            ++nbulk;
+        }
+        else if ( message[0] != 'C' )
+        {
+            assert( message[0] == NUM_UPDATES - 1 );
+            ++nupdates;
+        }
+    }
+
+    assert( !server_listener.messages.empty() && server_listener.messages.front().size() == 1 && server_listener.messages.front()[0] == 'C' );
+    assert( nbulk == NUM_BULK );
+    assert( nupdates == 1 );
+
+    std::cout << "Priority scheduling: " << server_listener.messages.size() << " messages delivered, took: " << ElapsedMilliseconds(start) << " ms" << std::endl;
+
+    client->Shutdown();
+    server->Shutdown();
+}
+
+struct LivenessListener : IServer::IListener
+{
+    IConnection* connection;
+    bool deleted;
+
+    LivenessListener() : connection(nullptr), deleted(false) {}
+
+    void OnCreateConnection(IConnection::ptr connection_) override
+    {
+        connection = connection_.get();
+    }
+
+    void OnDeleteConnection(IConnection::ptr connection_) override
+    {
+        connection = nullptr;
+        deleted = true;
+    }
+};
+
+// an idle but live connection is kept up by the heartbeats alone, and a peer that goes silent is detected by the idle timeout
+static void TestIdleTimeout()
+{
+    static const float IDLE_TIMEOUT = 1500.0f;
+
+    IServer::ptr server = IServer::CreateInstance();
+    LivenessListener server_listener;
+    server->Setup( IServer::IListener::ptr(&server_listener) );
+    server->Host("127.0.0.1:7305");
+
+    IClient::ptr client = IClient::CreateInstance();
+    ClientListener client_listener;
+    client->Setup( IClient::IListener::ptr(&client_listener) );
+    client->Connect("127.0.0.1:7305");
+
+    while (!client_listener.connection || !server_listener.connection)
+    {
+        client->Tick();
+        server->Tick();
+    }
+
+    server_listener.connection->SetIdleTimeout(IDLE_TIMEOUT);
+    client_listener.connection->SetIdleTimeout(IDLE_TIMEOUT);
+
+    // 1. both sides ticking, nothing sent by the application
+    auto start = std::chrono::high_resolution_clock::now();
+    while ( ElapsedMilliseconds(start) < 2.0f * IDLE_TIMEOUT )
+    {
+        client->Tick();
+        server->Tick();
+        std::this_thread::sleep_for( std::chrono::milliseconds(10) );
+    }
+
+    assert( client_listener.connection && server_listener.connection && !server_listener.deleted );
+    assert( server_listener.connection->GetIdleTime() < IDLE_TIMEOUT );
+
+    // 2. the client goes silent
+    start = std::chrono::high_resolution_clock::now();
+    while ( !server_listener.deleted && ElapsedMilliseconds(start) < 2.0f * IDLE_TIMEOUT )
+    {
+        server->Tick();
+        std::this_thread::sleep_for( std::chrono::milliseconds(10) );
+    }
+
+    assert( server_listener.deleted );
+
+    std::cout << "Idle timeout: the silent peer is dropped after " << ElapsedMilliseconds(start) << " ms" << std::endl;
+
+    client->Shutdown();
+    server->Shutdown();
+}
+
+static void TestDatagramThroughput()
+{
+    for (Backend backend : {Backend::SOCKETS, Backend::IO_URING})
+    {
+        BenchmarkDatagram(backend, false);
+        BenchmarkDatagram(backend, true);
+        BenchmarkConnection(backend);
+    }
+}
+
+int main(int argc, const char * argv[])
+{
+    TestPriorityScheduling();
+
+    TestIdleTimeout();
+
+    TestDatagramThroughput();
+
+    return 0;
+}
@@ -0,0 +1,257 @@
+//
+//  Arena.h
+//  SerializationFramework
+//
+//  Created by Lin Luo on 05/01/2015.
+//
+
+#ifndef SerializationFramework_Arena_h
+#define SerializationFramework_Arena_h
+
+#include "Types.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// A monotonic (bump) allocator, for the object graphs that are built and thrown away as a whole, e.g. a decoded MetaStruct
+//
+// The allocations made within an ArenaScope come from its arena, through ArenaAllocator (the containers) and ArenaNew (the single
+// objects, owned by an ArenaPtr); the destructors are still run as usual, but releasing the memory is a no-op, it all goes back at
+// once when the arena is reset or destroyed. Outside of any scope, the same allocations simply go to the heap.
+// NB: the arena has to outlive the objects allocated from it, so it is declared before them, e.g.
+//     Arena arena;
+//     ArenaScope scope(arena);
+//     S s;
+//     s.Serialize(input);
+
+class Arena
+{
+public:
+    static const size_t N_BLOCK = 64 * 1024; // the default block size, the larger allocations get their own block
+
+    Arena(size_t blockSize = N_BLOCK)
+        : m_blockSize(blockSize)
+        , m_block(0)
+        , m_cursor(nullptr)
+        , m_end(nullptr)
+        , m_nbytes(0)
+    {
+    }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* Allocate(size_t size, size_t align)
+    {
+        Byte* p = m_cursor ? Align(m_cursor, align) : nullptr;
+        if ( !p || size > (size_t)(m_end - p) )
+        {
+            p = Align( Grow(size + align - 1), align );
+        }
+
+        m_cursor = p + size;
+        m_nbytes += size;
+        return p;
+    }
+
+    // rewinds to the first block, keeping all the blocks for reuse, so a steady stream of messages eventually allocates nothing
+    // NB: the objects allocated from the arena must have been destroyed by then
+    void Reset()
+    {
+        m_block = 0;
+        m_cursor = m_blocks.empty() ? nullptr : m_blocks[0].data.get();
+        m_end = m_blocks.empty() ? nullptr : m_cursor + m_blocks[0].size;
+        m_nbytes = 0;
+    }
+
+    // the bytes allocated since the last reset
+    size_t GetNumBytes() const
+    {
+        return m_nbytes;
+    }
+
+    // the arena of the innermost scope of the thread, nullptr if none
+    static Arena* Current()
+    {
+        return Top();
+    }
+
+private:
+    friend class ArenaScope;
+
+    struct Block
+    {
+        std::unique_ptr<Byte[]> data;
+        size_t size;
+    };
+
+    static Arena*& Top()
+    {
+        static thread_local Arena* s_top = nullptr;
+        return s_top;
+    }
+
+    static Byte* Align(Byte* p, size_t align)
+    {
+        return (Byte*)( ((uintptr_t)p + align - 1) & ~(uintptr_t)(align - 1) );
+    }
+
+    Byte* Grow(size_t size)
+    {
+        // the next retained block that is large enough, or a new one
+        if ( !m_blocks.empty() )
+        {
+            ++m_block;
+        }
+        while ( m_block < m_blocks.size() && m_blocks[m_block].size < size )
+        {
+            ++m_block;
+        }
+
+        if ( m_block >= m_blocks.size() )
+        {
+            Block block;
+            block.size = std::max(size, m_blockSize);
+            block.data.reset( new Byte[block.size] );
+            m_blocks.push_back( std::move(block) );
+            m_block = m_blocks.size() - 1;
+        }
+
+        m_cursor = m_blocks[m_block].data.get();
+        m_end = m_cursor + m_blocks[m_block].size;
+        return m_cursor;
+    }
+
+    const size_t m_blockSize;
+    std::vector<Block> m_blocks;
+    size_t m_block; // the block being allocated from
+    Byte* m_cursor;
+    Byte* m_end;
+    size_t m_nbytes;
+};
+
+// Makes the arena the current one of the thread, for the lifetime of the scope; nullptr makes the allocations go to the heap
+class ArenaScope
+{
+public:
+    ArenaScope(Arena* arena)
+        : m_previous( Arena::Top() )
+    {
+        Arena::Top() = arena;
+    }
+
+    ArenaScope(Arena& arena)
+        : ArenaScope(&arena)
+    {
+    }
+
+    ~ArenaScope()
+    {
+        Arena::Top() = m_previous;
+    }
+
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+
+private:
+    Arena* const m_previous;
+};
+
+// The allocator of the containers, bound to the current arena when constructed (the heap if none); the copies of a container are
+// bound to the arena current at the time of the copy, while the moves keep their arena
+template <typename T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    ArenaAllocator()
+        : m_arena( Arena::Current() )
+    {
+    }
+
+    template <typename X>
+    ArenaAllocator(const ArenaAllocator<X>& rhs)
+        : m_arena( rhs.GetArena() )
+    {
+    }
+
+    T* allocate(size_t n)
+    {
+        return m_arena ? (T*)m_arena->Allocate( n * sizeof(T), alignof(T) ) : (T*)::operator new( n * sizeof(T) );
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        if (!m_arena)
+        {
+            ::operator delete(p);
+        }
+    }
+
+    ArenaAllocator select_on_container_copy_construction() const
+    {
+        return ArenaAllocator();
+    }
+
+    Arena* GetArena() const
+    {
+        return m_arena;
+    }
+
+    template <typename X>
+    bool operator==(const ArenaAllocator<X>& rhs) const
+    {
+        return m_arena == rhs.GetArena();
+    }
+
+    template <typename X>
+    bool operator!=(const ArenaAllocator<X>& rhs) const
+    {
+        return m_arena != rhs.GetArena();
+    }
+
+private:
+    Arena* m_arena;
+};
+
+// The deleter of the single objects made by ArenaNew, which only gives the memory back to the heap if it came from there
+template <typename T>
+struct ArenaDelete
+{
+    bool arena;
+
+    ArenaDelete(bool arena_ = false)
+        : arena(arena_)
+    {
+    }
+
+    void operator()(T* p) const
+    {
+        if (arena)
+        {
+            p->~T();
+        }
+        else
+        {
+            delete p;
+        }
+    }
+};
+
+template <typename T>
+using ArenaPtr = std::unique_ptr< T, ArenaDelete<T> >;
+
+template <typename T, typename... Xs>
+static inline ArenaPtr<T> ArenaNew(Xs&&... xs)
+{
+    Arena* arena = Arena::Current();
+    if (arena)
+    {
+        return ArenaPtr<T>( new( arena->Allocate( sizeof(T), alignof(T) ) ) T( std::forward<Xs>(xs)... ), ArenaDelete<T>(true) );
+    }
+
+    return ArenaPtr<T>( new T( std::forward<Xs>(xs)... ), ArenaDelete<T>(false) );
+}
+
+#endif
@@ -10,17 +10,32 @@
 
 #include "Types.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 // This is a reference counted, size-tracked and null-terminated, shared, immutable string implementation
 // m_buffer is a pointer rather than an std::vector (for automatic memory management) because the shared
 // buffer can probably be "pointed to" by multiple String instances - NO String instance actually "owns"
 // the buffer, thus preventing usage of any ownership enforcing RAII scheme here - the buffer allocation
 // and deallocation have to be explicit!
+// The strings up to N_SMALL characters are kept inline, without any allocation, the longer ones go into the shared buffer; the
+// interned strings (see Intern) share one buffer per distinct string, which lives as long as the process and is not even reference
+// counted, so they are copied across threads freely, and compare by pointer. The hash is computed once per instance, and copied over.
 class String
 {
 public:
+    static const size_t N_SMALL = 22;
+
     String()
-        : m_buffer(nullptr)
+        : m_tag(0)
+        , m_hash(0)
     {
+        m_small[0] = '\0';
     }
 
     String(const char* str, size_t len)
@@ -31,8 +46,17 @@ public:
             return;
         }
 
+        if (len <= N_SMALL)
+        {
+            memcpy(m_small, str, len);
+            m_small[len] = '\0';
+            m_tag = (U8)len;
+            return;
+        }
+
         m_buffer = AllocateBuffer(len);
         memcpy(&m_buffer[2], str, len);
+        m_tag = TAG_SHARED;
     }
 
     String(const char* str)
@@ -41,18 +65,24 @@ public:
     }
 
     String(const String& rhs)
-        : m_buffer(rhs.m_buffer)
+        : m_tag(rhs.m_tag)
+        , m_hash(rhs.m_hash)
     {
-        if (m_buffer)
+        memcpy( m_small, rhs.m_small, sizeof(m_small) ); // NB: the pointer to the shared buffer as well
+        if (m_tag == TAG_SHARED)
         {
             ++m_buffer[0];
         }
     }
 
     String(String&& rhs)
-        : m_buffer(rhs.m_buffer)
+        : m_tag(rhs.m_tag)
+        , m_hash(rhs.m_hash)
     {
-        rhs.m_buffer = nullptr;
+        memcpy( m_small, rhs.m_small, sizeof(m_small) );
+        rhs.m_tag = 0;
+        rhs.m_hash = 0;
+        rhs.m_small[0] = '\0';
     }
 
     void operator=(const char* str)
@@ -63,14 +93,20 @@ public:
 
     void operator=(const String& rhs)
     {
-        this->Release();
-        new(this) String(rhs);
+        if (this != &rhs)
+        {
+            this->Release();
+            new(this) String(rhs);
+        }
     }
 
     void operator=(String&& rhs)
     {
-        this->Release();
-        new(this) String( std::move(rhs) );
+        if (this != &rhs)
+        {
+            this->Release();
+            new(this) String( std::move(rhs) );
+        }
     }
 
     bool operator==(const char* s) const
@@ -80,17 +116,46 @@ public:
 
     bool operator==(const String& rhs) const
     {
-        return m_buffer == rhs.m_buffer || strcmp( data(), rhs.data() ) == 0;
+        // NB: an inline string never equals a shared one, as they differ in length
+        if ( m_tag != rhs.m_tag && ( m_tag <= N_SMALL || rhs.m_tag <= N_SMALL ) )
+        {
+            return false;
+        }
+
+        if ( m_tag > N_SMALL )
+        {
+            if ( m_buffer == rhs.m_buffer )
+            {
+                return true;
+            }
+
+            if ( m_tag == TAG_INTERNED && rhs.m_tag == TAG_INTERNED )
+            {
+                return false;
+            }
+        }
+
+        if ( m_hash && rhs.m_hash && m_hash != rhs.m_hash )
+        {
+            return false;
+        }
+
+        return size() == rhs.size() && memcmp( data(), rhs.data(), size() ) == 0;
+    }
+
+    bool operator!=(const String& rhs) const
+    {
+        return !(*this == rhs);
     }
 
     const char* data() const
     {
-        return m_buffer ? (char*)&m_buffer[2] : "";
+        return m_tag > N_SMALL ? (char*)&m_buffer[2] : m_small;
     }
 
     size_t size() const
     {
-        return m_buffer ? m_buffer[1] : 0;
+        return m_tag > N_SMALL ? m_buffer[1] : m_tag;
     }
 
     const char* c_str() const
@@ -100,9 +165,43 @@ public:
 
     bool empty() const
     {
-        return m_buffer == nullptr;
+        return m_tag == 0;
+    }
+
+    bool interned() const
+    {
+        return m_tag == TAG_INTERNED;
     }
 
+    // FNV-1a, cached
+    size_t hash() const
+    {
+        if (m_hash == 0)
+        {
+            m_hash = Hash( data(), size() );
+        }
+        return m_hash;
+    }
+
+    static size_t Hash(const char* p, size_t len)
+    {
+        static const size_t InitialFNV = 2166136261U;
+        static const size_t FNVMultiple = 16777619;
+
+        size_t hash = InitialFNV;
+        for (const char* end = p + len; p != end; ++p)
+        {
+            hash ^= *p;
+            hash *= FNVMultiple;
+        }
+
+        return hash;
+    }
+
+    // the interned instance of the string, added to the process wide table if it is not there yet; the inline strings are already
+    // allocation free, so they are returned as they are
+    static inline String Intern(const String& s);
+
     ~String()
     {
         Release();
@@ -110,16 +209,19 @@ public:
 
 protected:
     friend class BitStreamInput;
+    friend class StringTable;
     inline bool BuildFrom(const class BitStreamInput&);
 
     void Release()
     {
-        if (m_buffer && --m_buffer[0] == 0)
+        if (m_tag == TAG_SHARED && --m_buffer[0] == 0)
         {
             delete[] m_buffer;
         }
 
-        m_buffer = nullptr;
+        m_tag = 0;
+        m_hash = 0;
+        m_small[0] = '\0';
     }
 
     static size_t* AllocateBuffer(size_t sl)
@@ -134,29 +236,99 @@ protected:
     }
 
 private:
-    size_t* m_buffer;
+    static const U8 TAG_SHARED = 0xfe;   // m_buffer, reference counted
+    static const U8 TAG_INTERNED = 0xff; // m_buffer, owned by the StringTable
+
+    union
+    {
+        size_t* m_buffer;
+        char m_small[N_SMALL + 1];
+    };
+    U8 m_tag; // the length of the inline string, or one of the TAGs
+    mutable size_t m_hash; // 0 if not computed yet
 };
 
-namespace std
+// The table of the interned strings, by hash
+class StringTable
 {
-    template <>
-    struct hash<String>
+public:
+    static StringTable& Singleton()
     {
-        size_t operator()(const String& s) const
+        static StringTable s_singleton;
+        return s_singleton;
+    }
+
+    String Intern(const String& s)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        String interned;
+        if ( Find( s.data(), s.size(), s.hash(), interned ) )
         {
-            static const size_t InitialFNV = 2166136261U;
-            static const size_t FNVMultiple = 16777619;
+            return interned;
+        }
+
+        // NB: the buffer is never released, which is what makes the interned strings safe to share
+        interned.m_buffer = String::AllocateBuffer( s.size() );
+        memcpy( &interned.m_buffer[2], s.data(), s.size() );
+        interned.m_tag = String::TAG_INTERNED;
+        interned.m_hash = s.hash();
 
-            size_t hash = InitialFNV;
+        m_strings.emplace( interned.m_hash, interned );
+        m_size = m_strings.size();
+        return interned;
+    }
 
-            const char* p = s.data();
-            while (*p != '\0')
+    // looks the characters up, e.g. the ones being decoded, without making a String of them
+    bool Find(const char* p, size_t len, String& s)
+    {
+        if (m_size == 0)
+        {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return Find( p, len, String::Hash(p, len), s );
+    }
+
+private:
+    StringTable()
+        : m_size(0)
+    {
+    }
+
+    bool Find(const char* p, size_t len, size_t hash, String& s) const
+    {
+        auto range = m_strings.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if ( it->second.size() == len && memcmp( it->second.data(), p, len ) == 0 )
             {
-                hash ^= *p++;
-                hash *= FNVMultiple;
+                s = it->second;
+                return true;
             }
+        }
+        return false;
+    }
+
+    std::mutex m_mutex;
+    std::unordered_multimap<size_t, String> m_strings;
+    std::atomic<size_t> m_size; // NB: read without the lock, so the lookups cost nothing until something is interned
+};
+
+inline String String::Intern(const String& s)
+{
+    return s.size() > N_SMALL ? StringTable::Singleton().Intern(s) : s;
+}
 
-            return hash;
+namespace std
+{
+    template <>
+    struct hash<String>
+    {
+        size_t operator()(const String& s) const
+        {
+            return s.hash();
         }
     };
 }
@@ -167,9 +339,13 @@ namespace std
 
 static inline bool IsBigEndian()
 {
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__)
+    return __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__; // NB: known at compile time, so the byte swaps of the bit streams are branch free
+#else
     static __U u = 0x80000000U;
     static bool r = *(U8*)&u == 0x80;
     return r;
+#endif
 }
 
 static inline U8 ReverseByteOrder(U8 u8)
@@ -193,6 +369,27 @@ static inline U64 ReverseByteOrder(U64 u64)
         (u64 & 0x000000ff00000000LL) >> 8 | (u64 & 0x0000ff0000000000LL) >> 24 | (u64 & 0x00ff000000000000LL) >> 40 | u64 >> 56;
 }
 
+// the number of effective bits of u, 0 for 0, with the bit scan instruction where available
+static inline size_t GetNumEffectiveBits(U64 u)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return u ? 64 - __builtin_clzll(u) : 0;
+#else
+    static const size_t N[] = {0,1,2,2,3,3,3,3,4,4,4,4,4,4,4,4}; // the lookup table for number of effective bits of 0 ~ 15
+
+    size_t r = 0;
+    for (size_t shift = 32; shift >= 4; shift >>= 1)
+    {
+        if (u >> shift)
+        {
+            r += shift;
+            u >>= shift;
+        }
+    }
+    return r + N[u];
+#endif
+}
+
 template <typename T>
 struct Integral;
 
@@ -201,18 +398,7 @@ struct Integral<U8>
 {
     static const size_t N_PREFIX_BITS = 3;
 
-    static size_t GetNumEffectiveBits(U8 u)
-    {
-        static const size_t N[] = {0,1,2,2,3,3,3,3,4,4,4,4,4,4,4,4}; // the lookup table for number of effective bits of 0 ~ 15
-
-        size_t r = 0;
-        if (u >> 4)
-        {
-            r += 4;
-            u >>= 4;
-        }
-        return r + N[u];
-    }
+    static size_t GetNumEffectiveBits(U8 u) { return ::GetNumEffectiveBits(u); }
 };
 
 template <>
@@ -220,16 +406,7 @@ struct Integral<U16>
 {
     static const size_t N_PREFIX_BITS = 4;
 
-    static size_t GetNumEffectiveBits(U16 u)
-    {
-        size_t r = 0;
-        if (u >> 8)
-        {
-            r += 8;
-            u >>= 8;
-        }
-        return r + Integral<U8>::GetNumEffectiveBits((U8)u);
-    }
+    static size_t GetNumEffectiveBits(U16 u) { return ::GetNumEffectiveBits(u); }
 };
 
 template <>
@@ -237,16 +414,7 @@ struct Integral<U32>
 {
     static const size_t N_PREFIX_BITS = 5;
 
-    static size_t GetNumEffectiveBits(U32 u)
-    {
-        size_t r = 0;
-        if (u >> 16)
-        {
-            r += 16;
-            u >>= 16;
-        }
-        return r + Integral<U16>::GetNumEffectiveBits((U16)u);
-    }
+    static size_t GetNumEffectiveBits(U32 u) { return ::GetNumEffectiveBits(u); }
 };
 
 template <>
@@ -254,16 +422,7 @@ struct Integral<U64>
 {
     static const size_t N_PREFIX_BITS = 6;
 
-    static size_t GetNumEffectiveBits(U64 u)
-    {
-        size_t r = 0;
-        if (u >> 32)
-        {
-            r += 32;
-            u >>= 32;
-        }
-        return r + Integral<U32>::GetNumEffectiveBits((U32)u);
-    }
+    static size_t GetNumEffectiveBits(U64 u) { return ::GetNumEffectiveBits(u); }
 };
 
 template <typename I, typename = void>
@@ -315,24 +474,363 @@ U Absolute(U u)
     return Combine( Sign(u), u );
 }
 
+// The bit order on the wire: an integer of nbits goes out from its least significant byte, each byte from its most significant bit,
+// and the trailing partial byte holds the lowest (nbits % 8) bits of its byte; ToWireOrder turns it into a plain (right aligned)
+// bit string, so the bit streams only need to deal with the big-endian bit strings, nbits at a time
+static inline U64 ToWireOrder(U64 u, size_t nbits)
+{
+    size_t nbytes = nbits >> 3;
+    size_t rbits = nbits & 7;
+    U64 head = nbytes ? ReverseByteOrder(u) >> (64 - BYTES2BITS(nbytes)) : 0;
+    U64 tail = rbits ? (u >> BYTES2BITS(nbytes)) & ((1U << rbits) - 1) : 0;
+    return head << rbits | tail;
+}
+
+static inline U64 FromWireOrder(U64 bits, size_t nbits)
+{
+    size_t nbytes = nbits >> 3;
+    size_t rbits = nbits & 7;
+    U64 head = nbytes ? ReverseByteOrder( (bits >> rbits) << (64 - BYTES2BITS(nbytes)) ) : 0;
+    U64 tail = rbits ? (bits & ((1U << rbits) - 1)) << BYTES2BITS(nbytes) : 0;
+    return head | tail;
+}
+
+// The values per batch of BitStreamOutput::WriteBatch / BitStreamInput::ReadBatch
+static const size_t N_BATCH = 64;
+
+// The batch kernels of ToWireOrder / FromWireOrder, for count values of the same nbits (1 ~ sizeof(U) * 8); the U32s go 4 or 8
+// at a time through SSE2, AVX2 or NEON when available, the same shifts and byte swaps as above, with the branches on nbytes and
+// rbits turned into shifts by 32 (which give 0 in SIMD), and the others through the scalar loops
+template <typename U>
+static inline void ToWireOrder(const U in[], U out[], size_t count, size_t nbits)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        out[i] = (U)ToWireOrder(in[i], nbits);
+    }
+}
+
+template <typename U>
+static inline void FromWireOrder(const U in[], U out[], size_t count, size_t nbits)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        out[i] = (U)FromWireOrder(in[i], nbits);
+    }
+}
+
+#if defined(__AVX2__)
+
+static inline __m256i ReverseByteOrder(__m256i x)
+{
+    static const __m256i s_shuffle = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12, 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    return _mm256_shuffle_epi8(x, s_shuffle);
+}
+
+template <>
+inline void ToWireOrder<U32>(const U32 in[], U32 out[], size_t count, size_t nbits)
+{
+    size_t nbytes = nbits >> 3;
+    size_t rbits = nbits & 7;
+    __m128i hshift = _mm_cvtsi32_si128( (int)(32 - BYTES2BITS(nbytes)) );
+    __m128i tshift = _mm_cvtsi32_si128( (int)BYTES2BITS(nbytes) );
+    __m128i rshift = _mm_cvtsi32_si128( (int)rbits );
+    __m256i rmask = _mm256_set1_epi32( (int)((1U << rbits) - 1) );
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i u = _mm256_loadu_si256( (const __m256i*)(in + i) );
+        __m256i head = _mm256_srl_epi32( ReverseByteOrder(u), hshift );
+        __m256i tail = _mm256_and_si256( _mm256_srl_epi32(u, tshift), rmask );
+        _mm256_storeu_si256( (__m256i*)(out + i), _mm256_or_si256( _mm256_sll_epi32(head, rshift), tail ) );
+    }
+
+    for (; i < count; ++i)
+    {
+        out[i] = (U32)ToWireOrder(in[i], nbits);
+    }
+}
+
+template <>
+inline void FromWireOrder<U32>(const U32 in[], U32 out[], size_t count, size_t nbits)
+{
+    size_t nbytes = nbits >> 3;
+    size_t rbits = nbits & 7;
+    __m128i hshift = _mm_cvtsi32_si128( (int)(32 - BYTES2BITS(nbytes)) );
+    __m128i tshift = _mm_cvtsi32_si128( (int)BYTES2BITS(nbytes) );
+    __m128i rshift = _mm_cvtsi32_si128( (int)rbits );
+    __m256i rmask = _mm256_set1_epi32( (int)((1U << rbits) - 1) );
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i bits = _mm256_loadu_si256( (const __m256i*)(in + i) );
+        __m256i head = ReverseByteOrder( _mm256_sll_epi32( _mm256_srl_epi32(bits, rshift), hshift ) );
+        __m256i tail = _mm256_sll_epi32( _mm256_and_si256(bits, rmask), tshift );
+        _mm256_storeu_si256( (__m256i*)(out + i), _mm256_or_si256(head, tail) );
+    }
+
+    for (; i < count; ++i)
+    {
+        out[i] = (U32)FromWireOrder(in[i], nbits);
+    }
+}
+
+#elif defined(__SSE2__)
+
+static inline __m128i ReverseByteOrder(__m128i x)
+{
+    x = _mm_or_si128( _mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8) ); // the bytes of each 16 bits, then the 16 bits halves
+    return _mm_shufflehi_epi16( _mm_shufflelo_epi16(x, 0xb1), 0xb1 );
+}
+
+template <>
+inline void ToWireOrder<U32>(const U32 in[], U32 out[], size_t count, size_t nbits)
+{
+    size_t nbytes = nbits >> 3;
+    size_t rbits = nbits & 7;
+    __m128i hshift = _mm_cvtsi32_si128( (int)(32 - BYTES2BITS(nbytes)) );
+    __m128i tshift = _mm_cvtsi32_si128( (int)BYTES2BITS(nbytes) );
+    __m128i rshift = _mm_cvtsi32_si128( (int)rbits );
+    __m128i rmask = _mm_set1_epi32( (int)((1U << rbits) - 1) );
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i u = _mm_loadu_si128( (const __m128i*)(in + i) );
+        __m128i head = _mm_srl_epi32( ReverseByteOrder(u), hshift );
+        __m128i tail = _mm_and_si128( _mm_srl_epi32(u, tshift), rmask );
+        _mm_storeu_si128( (__m128i*)(out + i), _mm_or_si128( _mm_sll_epi32(head, rshift), tail ) );
+    }
+
+    for (; i < count; ++i)
+    {
+        out[i] = (U32)ToWireOrder(in[i], nbits);
+    }
+}
+
+template <>
+inline void FromWireOrder<U32>(const U32 in[], U32 out[], size_t count, size_t nbits)
+{
+    size_t nbytes = nbits >> 3;
+    size_t rbits = nbits & 7;
+    __m128i hshift = _mm_cvtsi32_si128( (int)(32 - BYTES2BITS(nbytes)) );
+    __m128i tshift = _mm_cvtsi32_si128( (int)BYTES2BITS(nbytes) );
+    __m128i rshift = _mm_cvtsi32_si128( (int)rbits );
+    __m128i rmask = _mm_set1_epi32( (int)((1U << rbits) - 1) );
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i bits = _mm_loadu_si128( (const __m128i*)(in + i) );
+        __m128i head = ReverseByteOrder( _mm_sll_epi32( _mm_srl_epi32(bits, rshift), hshift ) );
+        __m128i tail = _mm_sll_epi32( _mm_and_si128(bits, rmask), tshift );
+        _mm_storeu_si128( (__m128i*)(out + i), _mm_or_si128(head, tail) );
+    }
+
+    for (; i < count; ++i)
+    {
+        out[i] = (U32)FromWireOrder(in[i], nbits);
+    }
+}
+
+#elif defined(__ARM_NEON)
+
+template <>
+inline void ToWireOrder<U32>(const U32 in[], U32 out[], size_t count, size_t nbits)
+{
+    size_t nbytes = nbits >> 3;
+    size_t rbits = nbits & 7;
+    int32x4_t hshift = vdupq_n_s32( -(int)(32 - BYTES2BITS(nbytes)) ); // NB: the negative shifts are the right shifts
+    int32x4_t tshift = vdupq_n_s32( -(int)BYTES2BITS(nbytes) );
+    int32x4_t rshift = vdupq_n_s32( (int)rbits );
+    uint32x4_t rmask = vdupq_n_u32( (1U << rbits) - 1 );
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        uint32x4_t u = vld1q_u32(in + i);
+        uint32x4_t head = vshlq_u32( vreinterpretq_u32_u8( vrev32q_u8( vreinterpretq_u8_u32(u) ) ), hshift );
+        uint32x4_t tail = vandq_u32( vshlq_u32(u, tshift), rmask );
+        vst1q_u32( out + i, vorrq_u32( vshlq_u32(head, rshift), tail ) );
+    }
+
+    for (; i < count; ++i)
+    {
+        out[i] = (U32)ToWireOrder(in[i], nbits);
+    }
+}
+
+template <>
+inline void FromWireOrder<U32>(const U32 in[], U32 out[], size_t count, size_t nbits)
+{
+    size_t nbytes = nbits >> 3;
+    size_t rbits = nbits & 7;
+    int32x4_t hshift = vdupq_n_s32( (int)(32 - BYTES2BITS(nbytes)) );
+    int32x4_t tshift = vdupq_n_s32( (int)BYTES2BITS(nbytes) );
+    int32x4_t rshift = vdupq_n_s32( -(int)rbits );
+    uint32x4_t rmask = vdupq_n_u32( (1U << rbits) - 1 );
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        uint32x4_t bits = vld1q_u32(in + i);
+        uint32x4_t head = vreinterpretq_u32_u8( vrev32q_u8( vreinterpretq_u8_u32( vshlq_u32( vshlq_u32(bits, rshift), hshift ) ) ) );
+        uint32x4_t tail = vshlq_u32( vandq_u32(bits, rmask), tshift );
+        vst1q_u32( out + i, vorrq_u32(head, tail) );
+    }
+
+    for (; i < count; ++i)
+    {
+        out[i] = (U32)FromWireOrder(in[i], nbits);
+    }
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Chunked I/O
+//
+// The bit streams work over one contiguous buffer, unless they are given a sink (output) or a source (input), in which case the
+// buffer is a window of a fixed size into the stream: the output hands its bytes over to the sink whenever the window fills up, and
+// the input refills its window from the source whenever it runs out, so the memory stays bounded however long the stream is; the
+// only exception are the fields larger than the window, which are either passed straight through (the bytes of a String or a
+// Buffer), or have the window grown to hold them (an in place read, see BitStreamInput::ReadInPlace). See ChunkedStream.h for the
+// sinks and the sources of the files, the memory mapped files and the chains of chunks.
+
+static const size_t N_CHUNK = 64 * 1024; // the default window size of the chunked streams
+
+class IBitStreamSink
+{
+public:
+    virtual ~IBitStreamSink() {}
+
+    // takes the bytes over, false on an error
+    virtual bool Write(const Byte data[], size_t nbytes) = 0;
+};
+
+class IBitStreamSource
+{
+public:
+    virtual ~IBitStreamSource() {}
+
+    // reads up to nbytes, returns the number of bytes read, 0 at the end (or on an error)
+    virtual size_t Read(Byte data[], size_t nbytes) = 0;
+};
+
 class BitStreamOutput
 {
 public:
     BitStreamOutput(Buffer& output)
-        : m_output(output)
+        : m_output(&output)
+        , m_sink(nullptr)
+        , m_good(true)
         , m_nbits(0)
+        , m_nbytes(0)
+        , m_scratch(0)
+        , m_nscratch(0)
     {
         //
     }
 
+    // a counting stream, which goes through the same writes but only keeps track of the bit offset, e.g. to measure a serialization
+    BitStreamOutput()
+        : m_output(nullptr)
+        , m_sink(nullptr)
+        , m_good(true)
+        , m_nbits(0)
+        , m_nbytes(0)
+        , m_scratch(0)
+        , m_nscratch(0)
+    {
+        //
+    }
+
+    // a chunked stream, which hands its bytes over to the sink a window of chunkSize bytes at a time
+    BitStreamOutput(IBitStreamSink& sink, size_t chunkSize = N_CHUNK)
+        : m_output(&m_window)
+        , m_sink(&sink)
+        , m_good(true)
+        , m_nbits(0)
+        , m_nbytes(0)
+        , m_scratch(0)
+        , m_nscratch(0)
+    {
+        m_window.resize( std::max( chunkSize, (size_t)64 ) );
+    }
+
+    ~BitStreamOutput()
+    {
+        if (m_sink)
+        {
+            Close();
+        }
+        else
+        {
+            Flush();
+        }
+    }
+
+    // the chunked stream: pads the last bits to the byte boundary and hands everything over to the sink, which ends the stream;
+    // false if the sink has failed at any point
+    bool Close()
+    {
+        if (m_sink)
+        {
+            size_t nbytes = BITS2BYTES(m_nscratch);
+            Grow(nbytes);
+            Store(m_scratch, nbytes);
+            m_nbytes += nbytes;
+            Drain();
+
+            m_scratch = 0;
+            m_nscratch = 0;
+            m_sink = nullptr;
+            m_output = nullptr; // NB: any further writes are only counted
+        }
+        return m_good;
+    }
+
     size_t GetBitOffset() const
     {
         return m_nbits;
     }
 
+    // The bits are accumulated in a 64 bits scratch word and committed to the buffer a word at a time, so the buffer is only
+    // up to date (and sized to the bits written so far) after Flush; the writing can continue after a flush
+    // NB: a chunked stream hands the committed bytes over to the sink, the pending bits wait for the next ones (or Close)
+    void Flush()
+    {
+        if (!m_output) return;
+
+        if (m_sink)
+        {
+            Drain();
+            return;
+        }
+
+        size_t nbytes = BITS2BYTES(m_nscratch);
+        Grow(nbytes);
+        Store(m_scratch, nbytes);
+        m_output->resize(m_nbytes + nbytes);
+    }
+
+    // makes room for nbits more bits up front, so writing them does not have to grow the buffer (e.g. sized by a counting stream)
+    void Reserve(size_t nbits)
+    {
+        if (!m_output || m_sink) return;
+
+        size_t nbytes = BITS2BYTES(m_nscratch + nbits);
+        if (m_nbytes + nbytes > m_output->size())
+        {
+            m_output->resize(m_nbytes + nbytes);
+        }
+    }
+
     void Write(bool value)
     {
-        WriteBit(value ? 0x01 : 0x00);
+        WriteBits(value ? 0x01 : 0x00, 1);
     }
 
     template < typename I, typename = typename std::enable_if< std::is_integral<I>::value && !std::is_same<I, bool>::value >::type >
@@ -361,64 +859,120 @@ public:
         Writer<I>::Write(*this, i, nbits);
     }
 
-protected:
-    void WriteBytesAligned(const Byte buffer[], size_t nbytes)
+    // writes the values of nbits each, the same as writing them one by one; the full width values are copied over as they are
+    // when the stream is at a byte boundary, since the wire order of an integer is its little-endian byte order, the others are
+    // turned into their wire order N_BATCH at a time by the batch kernels, then packed as many as fit into each 64 bits write
+    template < typename U, typename = typename std::enable_if< std::is_integral<U>::value && std::is_unsigned<U>::value && !std::is_same<U, bool>::value >::type >
+    void WriteBatch(const U values[], size_t count, size_t nbits)
     {
-        if (nbytes == 0) return;
+        nbits = std::min( nbits, sizeof(U) * 8 );
+        if (nbits == 0) return;
 
-        size_t sz = m_output.size();
-        m_output.resize(sz + nbytes);
-        memcpy(&m_output[sz], buffer, nbytes);
+        if ( nbits == sizeof(U) * 8 && (m_nbits & 7) == 0 && !IsBigEndian() )
+        {
+            WriteBytesAligned( (const Byte*)values, count * sizeof(U) );
+            return;
+        }
 
-        m_nbits = BITS2BOUNDARY(m_nbits);
-        m_nbits += BYTES2BITS(nbytes);
+        size_t npacked = 64 / nbits; // the values per write
+        U wire[N_BATCH];
+        for (size_t i = 0; i < count; i += N_BATCH)
+        {
+            size_t n = std::min(count - i, N_BATCH);
+            ToWireOrder(values + i, wire, n, nbits);
+
+            for (size_t j = 0; j < n; j += npacked)
+            {
+                size_t m = std::min(n - j, npacked);
+                U64 bits = wire[j];
+                for (size_t k = 1; k < m; ++k)
+                {
+                    bits = bits << nbits | wire[j + k]; // NB: only when nbits <= 32
+                }
+                WriteBits( bits, m * nbits );
+            }
+        }
     }
 
-    void WriteBits(Byte buffer[], size_t nbits)
+    // LEB128, starting at the next byte boundary: 7 bits per byte from the lowest ones, the high bit set on all the bytes but the last
+    // NB: it is less dense than the bit packed integers, but the bytes are decoded without any bit shuffling
+    void WriteVarint(U64 u)
     {
-        if (nbits == 0) return;
-
-        m_output.resize( BITS2BYTES(m_nbits + nbits) );
+        Byte bytes[10];
+        size_t n = 0;
+        while (u >= 0x80)
+        {
+            bytes[n++] = (Byte)(u | 0x80);
+            u >>= 7;
+        }
+        bytes[n++] = (Byte)u;
 
-        size_t lastByteIndex = BITS2BYTES(nbits) - 1;
-        buffer[lastByteIndex] <<= (8 - nbits % 8) % 8;
+        WriteBytesAligned(bytes, n);
+    }
 
-        size_t rsh = m_nbits % 8;
-        size_t lsh = 8 - rsh;
+protected:
+    void WriteBytesAligned(const Byte buffer[], size_t nbytes)
+    {
+        if (nbytes == 0) return;
 
-        Byte* p = buffer;
-        Byte* e = buffer + BITS2BYTES(nbits);
+        // NB: the pending bits are padded to the byte boundary and committed, the bytes are then copied over as they are
+        size_t npending = BITS2BYTES(m_nscratch);
+        if (m_sink)
+        {
+            // the bytes go straight through, bypassing the window
+            Grow(npending);
+            Store(m_scratch, npending);
+            m_nbytes += npending;
+            Drain();
+            m_good = m_sink->Write(buffer, nbytes) && m_good;
+        }
+        else
+        {
+            if (m_output)
+            {
+                Grow(npending + nbytes);
+                Store(m_scratch, npending);
+                memcpy(m_output->data() + m_nbytes + npending, buffer, nbytes);
+            }
 
-        Byte data = *p++;
-        Byte mask = 0xff << lsh;
+            m_nbytes += npending + nbytes;
+        }
 
-        size_t writeIndex = m_nbits >> 3;
-        size_t endIndex = BITS2BYTES(m_nbits + nbits) - 1;
+        m_scratch = 0;
+        m_nscratch = 0;
 
-        m_output[writeIndex] = (m_output[writeIndex] & mask) | (data >> rsh);
+        m_nbits = BITS2BOUNDARY(m_nbits);
+        m_nbits += BYTES2BITS(nbytes);
+    }
 
-        while (++writeIndex <= endIndex)
+    // writes the lowest nbits (1 ~ 64) of bits, the higher bits must be 0
+    void WriteBits(U64 bits, size_t nbits)
+    {
+        size_t nfree = 64 - m_nscratch; // 1 ~ 64
+        if (nbits < nfree)
         {
-            Byte next = p < e ? *p++ : 0;
-            m_output[writeIndex] = (data << lsh) | (next >> rsh);
-            data = next;
+            m_scratch |= bits << (nfree - nbits);
+            m_nscratch += nbits;
         }
+        else
+        {
+            size_t nover = nbits - nfree; // 0 ~ 63
+            m_scratch |= bits >> nover;
 
-        m_nbits += nbits;
-    }
+            if (m_output)
+            {
+                Grow(8);
+                Store(m_scratch, 8);
+            }
+            m_nbytes += 8;
 
-    void WriteBit(Byte bit)
-    {
-        if (m_nbits % 8 == 0)
-        {
-            m_output.resize( m_output.size() + 1 );
+            m_scratch = nover ? bits << (64 - nover) : 0;
+            m_nscratch = nover;
         }
 
-        m_output.back() |= (bit & 0x01) << (8 - m_nbits % 8 - 1);
-        
-        ++m_nbits;
+        m_nbits += nbits;
     }
-    
+
     template <typename T, typename = void>
     struct Writer;
 
@@ -428,11 +982,20 @@ protected:
         static void Write(BitStreamOutput& stream, U u)
         {
             // NB: the number of effective bits ranges from 1 to sizeof(U) * 8; to represent it with N_PREFIX_BITS, the range has to be adjusted to 0 ~ sizeof(U) * 8 - 1!
-            U8 nbits = u == 0 ? (U8)0 : (U8)Integral<U>::GetNumEffectiveBits(u) - 1; // NB: it costs 1 bit to write '0'!
-            size_t n = nbits + 1;
-            stream.WriteBits( (Byte*)&nbits, Integral<U>::N_PREFIX_BITS );
+            size_t n = u == 0 ? 1 : Integral<U>::GetNumEffectiveBits(u); // NB: it costs 1 bit to write '0'!
+            U64 prefix = n - 1;
+            U64 payload = ToWireOrder(u, n);
 
-            Write(stream, u, n);
+            // the prefix and the payload go in one write, unless they exceed the 64 bits (only the widest U64s)
+            if ( sizeof(U) < 8 || Integral<U>::N_PREFIX_BITS + n <= 64 )
+            {
+                stream.WriteBits( prefix << n | payload, Integral<U>::N_PREFIX_BITS + n );
+            }
+            else
+            {
+                stream.WriteBits( prefix, Integral<U>::N_PREFIX_BITS );
+                stream.WriteBits( payload, n );
+            }
         }
 
         static void Write(BitStreamOutput& stream, U u, size_t nbits)
@@ -442,12 +1005,9 @@ protected:
                 nbits = sizeof(U) * 8;
             }
 
-            if ( IsBigEndian() )
-            {
-                u = ReverseByteOrder(u);
-            }
+            if (nbits == 0) return;
 
-            stream.WriteBits( (Byte*)&u, nbits );
+            stream.WriteBits( ToWireOrder(u, nbits), nbits );
         }
     };
 
@@ -457,7 +1017,7 @@ protected:
         static void Write(BitStreamOutput& stream, I i)
         {
             typename std::make_unsigned<I>::type u = i;
-            stream.WriteBit( (Byte)Sign(u) );
+            stream.WriteBits( Sign(u), 1 );
             Writer< typename std::make_unsigned<I>::type >::Write( stream, Absolute(u) );
         }
 
@@ -472,29 +1032,99 @@ protected:
     // NB: Non-integral types are supported through data policies
 
 private:
-    Buffer& m_output;
-    size_t m_nbits;
+    // makes room for nbytes more bytes past the committed ones; the buffer grows geometrically, and is trimmed by Flush, while the
+    // window of a chunked stream is drained to the sink instead (nbytes <= 8)
+    void Grow(size_t nbytes)
+    {
+        if (m_nbytes + nbytes > m_output->size())
+        {
+            if (m_sink)
+            {
+                Drain();
+                return;
+            }
+            m_output->resize( std::max( m_output->size() * 2, m_nbytes + nbytes + 64 ) );
+        }
+    }
+
+    // hands the committed bytes of the window over to the sink
+    void Drain()
+    {
+        if (m_nbytes > 0)
+        {
+            m_good = m_sink->Write(m_output->data(), m_nbytes) && m_good;
+            m_nbytes = 0;
+        }
+    }
+
+    // stores the leading nbytes (0 ~ 8) of the word past the committed bytes, without committing them
+    void Store(U64 word, size_t nbytes)
+    {
+        if ( !IsBigEndian() )
+        {
+            word = ReverseByteOrder(word);
+        }
+
+        memcpy(m_output->data() + m_nbytes, &word, nbytes);
+    }
+
+    Buffer* m_output;       // nullptr for a counting stream, m_window for a chunked one
+    IBitStreamSink* m_sink; // of a chunked stream
+    Buffer m_window;
+    bool m_good;        // whether the sink has taken all the bytes so far
+    size_t m_nbits;     // the total number of bits written
+    size_t m_nbytes;    // the number of bytes committed to m_output
+    U64 m_scratch;      // the pending bits, from the most significant one
+    size_t m_nscratch;  // the number of the pending bits, 0 ~ 63
 };
 
 class BitStreamInput
 {
 public:
     BitStreamInput(const Buffer& input)
-        : m_input(input)
+        : m_data( input.data() )
+        , m_size( input.size() )
+        , m_nbits(0)
+        , m_source(nullptr)
+        , m_base(0)
+        , m_chunkSize(0)
+    {
+        //
+    }
+
+    // over the bytes of a buffer in place, e.g. a field of a serialized message (see LazyView.h)
+    BitStreamInput(const Byte* data, size_t size)
+        : m_data(data)
+        , m_size(size)
         , m_nbits(0)
+        , m_source(nullptr)
+        , m_base(0)
+        , m_chunkSize(0)
+    {
+        //
+    }
+
+    // a chunked stream, which reads from the source a window of chunkSize bytes at a time
+    BitStreamInput(IBitStreamSource& source, size_t chunkSize = N_CHUNK)
+        : m_data(nullptr)
+        , m_size(0)
+        , m_nbits(0)
+        , m_source(&source)
+        , m_base(0)
+        , m_chunkSize( std::max( chunkSize, (size_t)64 ) )
     {
         //
     }
 
     size_t GetBitOffset() const
     {
-        return m_nbits;
+        return BYTES2BITS(m_base) + m_nbits;
     }
 
     bool Read(bool& value) const
     {
-        Byte bit = 0x00;
-        bool r = ReadBit(bit);
+        U64 bit = 0;
+        bool r = ReadBits(bit, 1);
         value = bit == 0x01;
         return r;
     }
@@ -527,27 +1157,121 @@ public:
         return Reader<I>::Read(*this, i, nbits);
     }
 
+    // see BitStreamOutput::WriteBatch
+    template < typename U, typename = typename std::enable_if< std::is_integral<U>::value && std::is_unsigned<U>::value && !std::is_same<U, bool>::value >::type >
+    bool ReadBatch(U values[], size_t count, size_t nbits) const
+    {
+        nbits = std::min( nbits, sizeof(U) * 8 );
+        if (nbits == 0) return true;
+
+        if ( nbits == sizeof(U) * 8 && (m_nbits & 7) == 0 && !IsBigEndian() )
+        {
+            return ReadBytesAligned( (Byte*)values, count * sizeof(U) );
+        }
+
+        size_t npacked = 64 / nbits;
+        U64 mask = nbits < 64 ? ((U64)1 << nbits) - 1 : ~(U64)0;
+        U wire[N_BATCH];
+        for (size_t i = 0; i < count; i += N_BATCH)
+        {
+            size_t n = std::min(count - i, N_BATCH);
+            for (size_t j = 0; j < n; j += npacked)
+            {
+                size_t m = std::min(n - j, npacked);
+                U64 bits = 0;
+                if ( !ReadBits(bits, m * nbits) )
+                {
+                    return false;
+                }
+
+                for (size_t k = m; k-- > 1; bits >>= nbits) // NB: only when nbits <= 32
+                {
+                    wire[j + k] = (U)(bits & mask);
+                }
+                wire[j] = (U)(bits & mask);
+            }
+
+            FromWireOrder(wire, values + i, n, nbits);
+        }
+
+        return true;
+    }
+
+    // see BitStreamOutput::WriteVarint
+    bool ReadVarint(U64& u) const
+    {
+        Require(1 + 10);
+        size_t byteIndex = BITS2BYTES(m_nbits);
+        size_t end = std::min( m_size, byteIndex + 10 );
+
+        U64 r = 0;
+        for (size_t i = byteIndex, shift = 0; i < end; ++i, shift += 7)
+        {
+            r |= (U64)(m_data[i] & 0x7f) << shift;
+            if ( (m_data[i] & 0x80) == 0 )
+            {
+                u = r;
+                m_nbits = BYTES2BITS(i + 1);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // the bytes of a String or a Buffer, referenced in the input rather than copied out of it
+    // NB: with a chunked stream, they are referenced in the window, which they stay in until the next read
+    bool ReadInPlace(const Byte*& data, size_t& size) const
+    {
+        U32 sz = 0;
+        if ( !Read(sz) )
+        {
+            return false;
+        }
+
+        Require(1 + sz);
+        size_t byteIndex = sz > 0 ? BITS2BYTES(m_nbits) : m_nbits >> 3; // NB: the empty ones are not aligned, see ReadBytesAligned
+        if ( byteIndex + sz > m_size )
+        {
+            return false;
+        }
+
+        data = m_data + byteIndex;
+        size = sz;
+        if (sz > 0)
+        {
+            m_nbits = BYTES2BITS(byteIndex + sz);
+        }
+
+        return true;
+    }
+
 protected:
     friend class String;
     friend class ScopedBitStreamInputOffset;
 
     void SetBitOffset(size_t offset) const
     {
-        m_nbits = offset; // XXX: very dangerous operation, for internal use ONLY!
+        m_nbits = offset - BYTES2BITS(m_base); // XXX: very dangerous operation, for internal use ONLY! (within the window of a chunked stream)
     }
 
     bool ReadBytesAligned(Byte buffer[], size_t nbytes) const
     {
         if (nbytes == 0) return true;
 
+        if (nbytes < m_chunkSize)
+        {
+            Require(1 + nbytes);
+        }
+
         size_t byteIndex = BITS2BYTES(m_nbits);
 
-        if ( byteIndex + nbytes > m_input.size() )
+        if ( byteIndex + nbytes > m_size )
         {
-            return false;
+            return m_source ? ReadBytesThrough(buffer, nbytes) : false;
         }
 
-        memcpy(buffer, &m_input[byteIndex], nbytes);
+        memcpy(buffer, &m_data[byteIndex], nbytes);
 
         m_nbits = BITS2BOUNDARY(m_nbits);
         m_nbits += BYTES2BITS(nbytes);
@@ -555,56 +1279,51 @@ protected:
         return true;
     }
 
-    bool ReadBits(Byte buffer[], size_t nbits) const
+    // reads nbits (1 ~ 64) into the lowest bits of bits
+    // NB: there is no state to refill, every read loads the 64 bits window at the current byte, so the offset can be moved freely
+    // the next 64 bits without reading them, at least 57 of them are valid (the bits past the end of the input are 0)
+    U64 Peek() const
     {
-        if (nbits == 0) return true;
+        Require(8);
+        size_t byteIndex = m_nbits >> 3;
+        return byteIndex < m_size ? Load(byteIndex) << (m_nbits & 7) : 0;
+    }
 
-        if ( m_nbits + nbits > m_input.size() * 8 )
+    bool Skip(size_t nbits) const
+    {
+        Require( BITS2BYTES( (m_nbits & 7) + nbits ) );
+        if ( m_nbits + nbits > m_size * 8 )
         {
             return false;
         }
 
-        size_t lsh = m_nbits % 8;
-        size_t rsh = 8 - lsh;
-
-        size_t readIndex = m_nbits >> 3;
-        size_t endIndex = BITS2BYTES(m_nbits + nbits) - 1;
-
-        Byte* p = buffer;
-        Byte* e = buffer + BITS2BYTES(nbits);
-
-        Byte data = m_input[readIndex];
-
-        while (p < e)
-        {
-            Byte next = ++readIndex <= endIndex ? m_input[readIndex] : 0;
-            *p++ = (data << lsh) | (next >> rsh);
-            data = next;
-        }
-
-        size_t lastByteIndex = BITS2BYTES(nbits) - 1;
-        buffer[lastByteIndex] >>= (8 - nbits % 8) % 8;
-
         m_nbits += nbits;
-
         return true;
     }
 
-    bool ReadBit(Byte& bit) const
+    bool ReadBits(U64& bits, size_t nbits) const
     {
-        if ( m_nbits + 1 > m_input.size() * 8 )
+        Require(9);
+        if ( m_nbits + nbits > m_size * 8 )
         {
             return false;
         }
 
-        size_t readIndex = m_nbits >> 3;
-        bit = (m_input[readIndex] >> (8 - m_nbits % 8 - 1)) & 0x01;
-        
-        ++m_nbits;
-        
+        size_t byteIndex = m_nbits >> 3;
+        size_t offset = m_nbits & 7;
+
+        U64 word = Load(byteIndex) << offset;
+        if (offset + nbits > 64)
+        {
+            word |= m_data[byteIndex + 8] >> (8 - offset); // NB: only when reading more than 57 bits, and the byte is there as checked above
+        }
+        bits = word >> (64 - nbits);
+
+        m_nbits += nbits;
+
         return true;
     }
-    
+
     template <typename T, typename = void>
     struct Reader;
 
@@ -613,8 +1332,23 @@ protected:
     {
         static bool Read(const BitStreamInput& stream, U& u)
         {
-            U8 nbits = 0;
-            if ( stream.ReadBits( (Byte*)&nbits, Integral<U>::N_PREFIX_BITS ) )
+            // the prefix and the payload come from one window, which is sure to hold 57 bits, so all but the U64s fit
+            static const size_t P = Integral<U>::N_PREFIX_BITS;
+            if ( sizeof(U) < 8 )
+            {
+                U64 window = stream.Peek();
+                size_t n = (size_t)(window >> (64 - P)) + 1;
+                if ( !stream.Skip(P + n) )
+                {
+                    return false;
+                }
+
+                u = (U)FromWireOrder( (window << P) >> (64 - n), n );
+                return true;
+            }
+
+            U64 nbits = 0;
+            if ( stream.ReadBits( nbits, P ) )
             {
                 return Read(stream, u, (size_t)nbits + 1);
             }
@@ -629,13 +1363,12 @@ protected:
                 nbits = sizeof(U) * 8;
             }
 
-            if ( stream.ReadBits( (Byte*)&u, nbits ) )
-            {
-                if ( IsBigEndian() )
-                {
-                    u = ReverseByteOrder(u);
-                }
+            if (nbits == 0) return true;
 
+            U64 bits = 0;
+            if ( stream.ReadBits( bits, nbits ) )
+            {
+                u = (U)FromWireOrder(bits, nbits);
                 return true;
             }
 
@@ -648,13 +1381,13 @@ protected:
     {
         static bool Read(const BitStreamInput& stream, I& i)
         {
-            Byte sign = 0;
-            if ( stream.ReadBit(sign) )
+            U64 sign = 0;
+            if ( stream.ReadBits(sign, 1) )
             {
                 typename std::make_unsigned<I>::type u = 0;
                 if ( Reader< typename std::make_unsigned<I>::type >::Read(stream, u) )
                 {
-                    typename std::make_unsigned<I>::type s = sign;
+                    typename std::make_unsigned<I>::type s = (typename std::make_unsigned<I>::type)sign;
                     i = Combine(s, u);
                     return true;
                 }
@@ -680,8 +1413,98 @@ protected:
     // NB: Non-integral types are supported through data policies
 
 private:
-    const Buffer& m_input;
-    mutable size_t m_nbits;
+    // loads the 8 bytes from byteIndex as a big-endian word, the bytes past the end of the input are read as 0
+    U64 Load(size_t byteIndex) const
+    {
+        U64 word = 0;
+        if (byteIndex + 8 <= m_size)
+        {
+            memcpy(&word, &m_data[byteIndex], 8);
+        }
+        else
+        {
+            memcpy(&word, &m_data[byteIndex], m_size - byteIndex);
+        }
+
+        return IsBigEndian() ? word : ReverseByteOrder(word);
+    }
+
+    // makes sure the nbytes from the current byte are in the window, as far as the source goes; a no-op without a source
+    void Require(size_t nbytes) const
+    {
+        if ( (m_nbits >> 3) + nbytes > m_size && m_source )
+        {
+            Refill(nbytes);
+        }
+    }
+
+    // drops the bytes read so far from the window, then fills it up from the source
+    void Refill(size_t nbytes) const
+    {
+        size_t byteIndex = m_nbits >> 3;
+        size_t nkept = m_size - byteIndex;
+        if ( m_window.size() < std::max(nbytes, m_chunkSize) )
+        {
+            m_window.resize( std::max(nbytes, m_chunkSize) ); // NB: only larger than a chunk for an in place read of a larger field
+        }
+        if (nkept > 0)
+        {
+            memmove( m_window.data(), m_data + byteIndex, nkept );
+        }
+
+        m_base += byteIndex;
+        m_nbits -= BYTES2BITS(byteIndex);
+        m_data = m_window.data();
+        m_size = nkept;
+
+        while ( m_size < m_window.size() )
+        {
+            size_t n = m_source->Read( m_window.data() + m_size, m_window.size() - m_size );
+            if (n == 0)
+            {
+                break;
+            }
+            m_size += n;
+        }
+    }
+
+    // an aligned read past the window: what is left of the window, then the rest straight from the source
+    bool ReadBytesThrough(Byte buffer[], size_t nbytes) const
+    {
+        size_t byteIndex = BITS2BYTES(m_nbits);
+        size_t nwindow = byteIndex < m_size ? m_size - byteIndex : 0;
+        if (nwindow > 0)
+        {
+            memcpy(buffer, m_data + byteIndex, nwindow);
+        }
+
+        size_t nread = nwindow;
+        while (nread < nbytes)
+        {
+            size_t n = m_source->Read(buffer + nread, nbytes - nread);
+            if (n == 0)
+            {
+                return false;
+            }
+            nread += n;
+        }
+
+        // the window is emptied, past the bytes read through
+        m_base += byteIndex + nbytes;
+        m_nbits = 0;
+        m_size = 0;
+        return true;
+    }
+
+    mutable const Byte* m_data;
+    mutable size_t m_size;
+    mutable size_t m_nbits; // from the start of m_data
+
+    // the chunked stream
+    IBitStreamSource* const m_source;
+    mutable Buffer m_window;
+    mutable size_t m_base; // the bytes of the stream before the window
+    size_t m_chunkSize;
 };
 
 class ScopedBitStreamInputOffset
@@ -706,6 +1529,8 @@ private:
 
 inline bool String::BuildFrom(const BitStreamInput& stream)
 {
+    static const size_t N_LOOKUP = 256; // the longest strings looked up in the StringTable
+
     U32 sl = 0;
     if ( stream.Read(sl) )
     {
@@ -714,11 +1539,34 @@ inline bool String::BuildFrom(const BitStreamInput& stream)
             this->Release();
             return true;
         }
+
+        // the inline and interned strings are decoded without any allocation
+        if (sl <= N_LOOKUP)
+        {
+            char chars[N_LOOKUP];
+            if ( !stream.ReadBytesAligned( (Byte*)chars, sl ) )
+            {
+                return false;
+            }
+
+            String interned;
+            if ( sl > N_SMALL && StringTable::Singleton().Find(chars, sl, interned) )
+            {
+                *this = std::move(interned);
+            }
+            else
+            {
+                *this = String(chars, sl);
+            }
+            return true;
+        }
+
         size_t* buffer = AllocateBuffer(sl);
         if ( stream.ReadBytesAligned( (Byte*)&buffer[2], sl ) )
         {
             this->Release();
             m_buffer = buffer;
+            m_tag = TAG_SHARED;
             return true;
         }
         delete[] buffer;
@@ -0,0 +1,243 @@
+//
+//  ChunkedStream.h
+//  SerializationFramework
+//
+//  Created by Lin Luo on 05/01/2015.
+//
+
+#ifndef SerializationFramework_ChunkedStream_h
+#define SerializationFramework_ChunkedStream_h
+
+#include "BitStream.h"
+
+#include <cstdio>
+#include <deque>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// The sinks and the sources of the chunked bit streams (see BitStream.h), e.g. to persist and load a large world snapshot without
+// holding the whole of its encoding in memory:
+//     FileSink sink("snapshot.bin");
+//     SerializationOutputWrapperType output(container, sink);
+//     snapshot.Serialize(output);
+//     bool ok = output.Close();
+
+// A file written from the start
+class FileSink : public IBitStreamSink
+{
+public:
+    FileSink(const char* path)
+        : m_file( fopen(path, "wb") )
+    {
+    }
+
+    ~FileSink()
+    {
+        if (m_file)
+        {
+            fclose(m_file);
+        }
+    }
+
+    FileSink(const FileSink&) = delete;
+    FileSink& operator=(const FileSink&) = delete;
+
+    bool IsOpen() const
+    {
+        return m_file != nullptr;
+    }
+
+    virtual bool Write(const Byte data[], size_t nbytes) override
+    {
+        return m_file && fwrite(data, 1, nbytes, m_file) == nbytes;
+    }
+
+private:
+    FILE* const m_file;
+};
+
+// A file read from the start
+class FileSource : public IBitStreamSource
+{
+public:
+    FileSource(const char* path)
+        : m_file( fopen(path, "rb") )
+    {
+    }
+
+    ~FileSource()
+    {
+        if (m_file)
+        {
+            fclose(m_file);
+        }
+    }
+
+    FileSource(const FileSource&) = delete;
+    FileSource& operator=(const FileSource&) = delete;
+
+    bool IsOpen() const
+    {
+        return m_file != nullptr;
+    }
+
+    virtual size_t Read(Byte data[], size_t nbytes) override
+    {
+        return m_file ? fread(data, 1, nbytes, m_file) : 0;
+    }
+
+private:
+    FILE* const m_file;
+};
+
+// A file mapped into memory read only, which is read in place (without a window of its own), the pages being brought in and
+// evicted by the system as needed:
+//     MappedFile file("snapshot.bin");
+//     SerializationInputWrapperType input( container, file.data(), file.size() );
+class MappedFile
+{
+public:
+    MappedFile(const char* path)
+        : m_data(nullptr)
+        , m_size(0)
+    {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+        {
+            return;
+        }
+
+        struct stat st;
+        if ( fstat(fd, &st) == 0 && st.st_size > 0 )
+        {
+            void* p = mmap( nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+            if (p != MAP_FAILED)
+            {
+                madvise( p, (size_t)st.st_size, MADV_SEQUENTIAL );
+                m_data = (const Byte*)p;
+                m_size = (size_t)st.st_size;
+            }
+        }
+        close(fd); // NB: the mapping holds on to the file
+    }
+
+    ~MappedFile()
+    {
+        if (m_data)
+        {
+            munmap( (void*)m_data, m_size );
+        }
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // NB: an empty file is not mapped, and reads as such
+    bool IsOpen() const
+    {
+        return m_data != nullptr;
+    }
+
+    const Byte* data() const
+    {
+        return m_data;
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+private:
+    const Byte* m_data;
+    size_t m_size;
+};
+
+// A chain of fixed size chunks, written at the back and read from the front, e.g. the queue of a socket being sent as it is encoded;
+// the chunks read through are released (the last one kept for reuse), so the memory follows the bytes in flight, never having to be
+// contiguous nor to be copied over as it grows
+class ChunkChain : public IBitStreamSink, public IBitStreamSource
+{
+public:
+    ChunkChain(size_t chunkSize = N_CHUNK)
+        : m_chunkSize(chunkSize)
+        , m_head(0)
+        , m_tail(chunkSize)
+        , m_size(0)
+    {
+    }
+
+    ChunkChain(const ChunkChain&) = delete;
+    ChunkChain& operator=(const ChunkChain&) = delete;
+
+    virtual bool Write(const Byte data[], size_t nbytes) override
+    {
+        while (nbytes > 0)
+        {
+            if (m_tail == m_chunkSize)
+            {
+                m_chunks.push_back( m_spare ? std::move(m_spare) : std::unique_ptr<Byte[]>( new Byte[m_chunkSize] ) );
+                m_tail = 0;
+            }
+
+            size_t n = std::min(nbytes, m_chunkSize - m_tail);
+            memcpy(m_chunks.back().get() + m_tail, data, n);
+            m_tail += n;
+            m_size += n;
+            data += n;
+            nbytes -= n;
+        }
+        return true;
+    }
+
+    virtual size_t Read(Byte data[], size_t nbytes) override
+    {
+        size_t nread = 0;
+        while ( nread < nbytes && m_size > 0 )
+        {
+            size_t end = m_chunks.size() == 1 ? m_tail : m_chunkSize;
+            size_t n = std::min(nbytes - nread, end - m_head);
+            memcpy(data + nread, m_chunks.front().get() + m_head, n);
+            m_head += n;
+            m_size -= n;
+            nread += n;
+
+            if (m_head == end)
+            {
+                if (m_chunks.size() == 1)
+                {
+                    m_tail = m_chunkSize; // NB: the next write starts a chunk afresh
+                }
+                m_spare = std::move( m_chunks.front() );
+                m_chunks.pop_front();
+                m_head = 0;
+            }
+        }
+        return nread;
+    }
+
+    // the bytes written and not read yet
+    size_t GetNumBytes() const
+    {
+        return m_size;
+    }
+
+    size_t GetNumChunks() const
+    {
+        return m_chunks.size();
+    }
+
+private:
+    const size_t m_chunkSize;
+    std::deque< std::unique_ptr<Byte[]> > m_chunks;
+    std::unique_ptr<Byte[]> m_spare;
+    size_t m_head; // the read offset into the front chunk
+    size_t m_tail; // the write offset into the back chunk
+    size_t m_size;
+};
+
+#endif
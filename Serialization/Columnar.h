@@ -0,0 +1,765 @@
+//
+//  Columnar.h
+//  SerializationFramework
+//
+//  Created by Lin Luo on 05/01/2015.
+//
+
+#ifndef SerializationFramework_Columnar_h
+#define SerializationFramework_Columnar_h
+
+#include "Serialization.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Columnar (struct of arrays) encoding of the containers of records
+//
+// Columnar<C> is a drop-in for a container C of records with a Serialize member, e.g. Columnar< std::deque<Tile> >. The records are
+// serialized through ColumnarSerialization, which files each value into the column of its field, the field being told apart by the
+// offset of the value within the record (the member structs included); the values outside of the record, e.g. the sizes and the
+// elements of the nested containers, go to one column per type, in order. On the wire, the fields are numbered in the order they
+// are first serialized, so the encoding does not depend on the layout of the record (the compiler, the ABI, the members added). Each column then goes with the smallest of its encodings:
+// bit packed against its minimum, delta (IDs, timestamps), run-length (states) or dictionary (small enums, repeated strings).
+// The decoding replays the Serialize of the records over the decoded columns, numbering the fields the same way.
+// NB: the data policies of the fields (SERIALIZE_P) are not applied within the records
+
+class ColumnSet
+{
+public:
+    static const U32 FIELD_OUTSIDE = ~0U;       // the column of the values of a type outside of the record
+    static const size_t N_MAX_DICTIONARY = 256; // the dictionary encoding only goes up to this many distinct values
+
+    enum Encoding
+    {
+        ENCODING_PACKED,
+        ENCODING_DELTA,
+        ENCODING_RUN_LENGTH,
+        ENCODING_DICTIONARY,
+    };
+
+    // the numbers are kept as 64 bits patterns: the integers sign extended, the floating points as they are
+    struct Column
+    {
+        std::vector<U64> numbers;
+        std::vector<String> strings;
+        std::vector<Buffer> buffers;
+        size_t cursor;
+
+        Column() : cursor(0) {}
+    };
+
+    typedef std::pair<U32, U8> Key; // the number of the field and the index of its type
+
+    Column& Get(const Key& key)
+    {
+        return m_columns[key];
+    }
+
+    Column* Find(const Key& key)
+    {
+        auto it = m_columns.find(key);
+        return it != m_columns.end() ? &it->second : nullptr;
+    }
+
+    void Write(BitStreamOutput& stream, U32 nrecords) const
+    {
+        stream.Write(nrecords);
+        stream.Write( (U32)m_columns.size() );
+        for (const auto& column : m_columns)
+        {
+            stream.Write(column.first.first);
+            stream.Write(column.first.second);
+
+            const Column& c = column.second;
+            if ( !c.strings.empty() )
+            {
+                WriteStrings(stream, c.strings);
+            }
+            else if ( !c.buffers.empty() )
+            {
+                stream.Write( (U32)c.buffers.size() );
+                for (const auto& b : c.buffers)
+                {
+                    stream.Write(b);
+                }
+            }
+            else
+            {
+                WriteNumbers(stream, c.numbers);
+            }
+        }
+    }
+
+    // NB: the kind of a column (numbers, strings or buffers) comes with the type of its key
+    bool Read(const BitStreamInput& stream, U32& nrecords, U8 stringType, U8 bufferType)
+    {
+        m_columns.clear();
+
+        U32 ncolumns = 0;
+        if ( !stream.Read(nrecords) || !stream.Read(ncolumns) )
+        {
+            return false;
+        }
+
+        for (U32 i = 0; i < ncolumns; ++i)
+        {
+            Key key;
+            if ( !stream.Read(key.first) || !stream.Read(key.second) )
+            {
+                return false;
+            }
+
+            Column& c = m_columns[key];
+            if (key.second == stringType)
+            {
+                if ( !ReadStrings(stream, c.strings) )
+                {
+                    return false;
+                }
+            }
+            else if (key.second == bufferType)
+            {
+                U32 sz = 0;
+                if ( !stream.Read(sz) )
+                {
+                    return false;
+                }
+                c.buffers.resize(sz);
+                for (auto& b : c.buffers)
+                {
+                    if ( !stream.Read(b) )
+                    {
+                        return false;
+                    }
+                }
+            }
+            else if ( !ReadNumbers(stream, c.numbers) )
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+private:
+    static size_t Width(U64 range)
+    {
+        size_t nbits = 0;
+        while ( nbits < 64 && (range >> nbits) != 0 )
+        {
+            ++nbits;
+        }
+        return nbits;
+    }
+
+    // against the minimum, in as many bits as the range takes
+    static void WritePacked(BitStreamOutput& stream, const std::vector<U64>& values)
+    {
+        I64 mn = 0, mx = 0;
+        if ( !values.empty() )
+        {
+            mn = mx = (I64)values[0];
+            for (U64 u : values)
+            {
+                mn = std::min(mn, (I64)u);
+                mx = std::max(mx, (I64)u);
+            }
+        }
+
+        size_t nbits = Width( (U64)mx - (U64)mn );
+        stream.Write(mn);
+        stream.Write( (U8)nbits, 7 );
+
+        U64 residuals[N_BATCH];
+        for (size_t i = 0; i < values.size(); i += N_BATCH)
+        {
+            size_t n = std::min( values.size() - i, N_BATCH );
+            for (size_t j = 0; j < n; ++j)
+            {
+                residuals[j] = values[i + j] - (U64)mn;
+            }
+            stream.WriteBatch(residuals, n, nbits);
+        }
+    }
+
+    static bool ReadPacked(const BitStreamInput& stream, size_t count, std::vector<U64>& values)
+    {
+        I64 mn = 0;
+        U8 nbits = 0;
+        if ( !stream.Read(mn) || !stream.Read(nbits, 7) || nbits > 64 )
+        {
+            return false;
+        }
+
+        values.assign(count, 0);
+        if ( !stream.ReadBatch( values.data(), count, nbits ) )
+        {
+            return false;
+        }
+
+        for (U64& u : values)
+        {
+            u += (U64)mn;
+        }
+        return true;
+    }
+
+    static void WriteNumbers(BitStreamOutput& stream, const std::vector<U64>& values, Encoding encoding)
+    {
+        stream.Write( (U8)encoding, 2 );
+        stream.Write( (U32)values.size() );
+        if ( values.empty() )
+        {
+            return;
+        }
+
+        switch (encoding)
+        {
+        case ENCODING_PACKED:
+            WritePacked(stream, values);
+            break;
+
+        case ENCODING_DELTA:
+            {
+                std::vector<U64> deltas( values.size() - 1 );
+                for (size_t i = 1; i < values.size(); ++i)
+                {
+                    deltas[i - 1] = values[i] - values[i - 1];
+                }
+                stream.Write( (I64)values[0] );
+                WritePacked(stream, deltas);
+            }
+            break;
+
+        case ENCODING_RUN_LENGTH:
+            {
+                std::vector<U64> runs, lengths;
+                for (size_t i = 0; i < values.size(); ++i)
+                {
+                    if ( i == 0 || values[i] != runs.back() )
+                    {
+                        runs.push_back( values[i] );
+                        lengths.push_back(0);
+                    }
+                    ++lengths.back();
+                }
+                stream.Write( (U32)runs.size() );
+                WritePacked(stream, runs);
+                WritePacked(stream, lengths);
+            }
+            break;
+
+        case ENCODING_DICTIONARY:
+            {
+                std::unordered_map<U64, U64> indices;
+                std::vector<U64> distinct, coded( values.size() );
+                for (size_t i = 0; i < values.size(); ++i)
+                {
+                    auto it = indices.find( values[i] );
+                    if ( it == indices.end() )
+                    {
+                        it = indices.emplace( values[i], distinct.size() ).first;
+                        distinct.push_back( values[i] );
+                    }
+                    coded[i] = it->second;
+                }
+                stream.Write( (U32)distinct.size() );
+                WritePacked(stream, distinct);
+                stream.WriteBatch( coded.data(), coded.size(), Width( distinct.size() - 1 ) );
+            }
+            break;
+        }
+    }
+
+    // the smallest of the encodings, measured over a counting stream
+    static void WriteNumbers(BitStreamOutput& stream, const std::vector<U64>& values)
+    {
+        std::vector<U64> distinct(values);
+        std::sort( distinct.begin(), distinct.end() );
+        distinct.erase( std::unique( distinct.begin(), distinct.end() ), distinct.end() );
+
+        Encoding best = ENCODING_PACKED;
+        size_t nbest = ~(size_t)0;
+        for (int e = ENCODING_PACKED; e <= ENCODING_DICTIONARY; ++e)
+        {
+            if ( e == ENCODING_DICTIONARY && distinct.size() > N_MAX_DICTIONARY )
+            {
+                continue;
+            }
+
+            BitStreamOutput counter;
+            WriteNumbers( counter, values, (Encoding)e );
+            if ( counter.GetBitOffset() < nbest )
+            {
+                nbest = counter.GetBitOffset();
+                best = (Encoding)e;
+            }
+        }
+
+        WriteNumbers(stream, values, best);
+    }
+
+    static bool ReadNumbers(const BitStreamInput& stream, std::vector<U64>& values)
+    {
+        U8 encoding = 0;
+        U32 sz = 0;
+        if ( !stream.Read(encoding, 2) || !stream.Read(sz) )
+        {
+            return false;
+        }
+
+        values.clear();
+        if (sz == 0)
+        {
+            return true;
+        }
+
+        switch (encoding)
+        {
+        case ENCODING_PACKED:
+            return ReadPacked(stream, sz, values);
+
+        case ENCODING_DELTA:
+            {
+                I64 first = 0;
+                if ( !stream.Read(first) || !ReadPacked(stream, sz - 1, values) )
+                {
+                    return false;
+                }
+                values.insert( values.begin(), (U64)first );
+                for (size_t i = 1; i < values.size(); ++i)
+                {
+                    values[i] += values[i - 1];
+                }
+            }
+            return true;
+
+        case ENCODING_RUN_LENGTH:
+            {
+                U32 nruns = 0;
+                std::vector<U64> runs, lengths;
+                if ( !stream.Read(nruns) || !ReadPacked(stream, nruns, runs) || !ReadPacked(stream, nruns, lengths) )
+                {
+                    return false;
+                }
+                for (size_t i = 0; i < nruns; ++i)
+                {
+                    if ( lengths[i] > sz - values.size() )
+                    {
+                        return false;
+                    }
+                    values.insert( values.end(), (size_t)lengths[i], runs[i] );
+                }
+            }
+            return values.size() == sz;
+
+        case ENCODING_DICTIONARY:
+            {
+                U32 ndistinct = 0;
+                std::vector<U64> distinct;
+                if ( !stream.Read(ndistinct) || ndistinct == 0 || ndistinct > N_MAX_DICTIONARY || !ReadPacked(stream, ndistinct, distinct) )
+                {
+                    return false;
+                }
+
+                values.assign(sz, 0);
+                if ( !stream.ReadBatch( values.data(), sz, Width(ndistinct - 1) ) )
+                {
+                    return false;
+                }
+                for (U64& u : values)
+                {
+                    if (u >= ndistinct)
+                    {
+                        return false;
+                    }
+                    u = distinct[u];
+                }
+            }
+            return true;
+        }
+
+        return false;
+    }
+
+    // as they are, or a dictionary of the distinct strings if that is smaller
+    static void WriteStrings(BitStreamOutput& stream, const std::vector<String>& strings)
+    {
+        std::unordered_map<String, U64> indices;
+        std::vector<String> distinct;
+        std::vector<U64> coded( strings.size() );
+        for (size_t i = 0; i < strings.size(); ++i)
+        {
+            auto it = indices.find( strings[i] );
+            if ( it == indices.end() )
+            {
+                it = indices.emplace( strings[i], distinct.size() ).first;
+                distinct.push_back( strings[i] );
+            }
+            coded[i] = it->second;
+        }
+
+        bool dictionary = distinct.size() <= N_MAX_DICTIONARY && distinct.size() < strings.size();
+        stream.Write(dictionary);
+        stream.Write( (U32)strings.size() );
+        if (!dictionary)
+        {
+            for (const auto& s : strings)
+            {
+                stream.Write(s);
+            }
+            return;
+        }
+
+        stream.Write( (U32)distinct.size() );
+        for (const auto& s : distinct)
+        {
+            stream.Write(s);
+        }
+        stream.WriteBatch( coded.data(), coded.size(), Width( distinct.size() - 1 ) );
+    }
+
+    static bool ReadStrings(const BitStreamInput& stream, std::vector<String>& strings)
+    {
+        bool dictionary = false;
+        U32 sz = 0;
+        if ( !stream.Read(dictionary) || !stream.Read(sz) )
+        {
+            return false;
+        }
+
+        strings.resize(sz);
+        if (!dictionary)
+        {
+            for (auto& s : strings)
+            {
+                if ( !stream.Read(s) )
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        U32 ndistinct = 0;
+        if ( !stream.Read(ndistinct) || ndistinct == 0 || ndistinct > N_MAX_DICTIONARY )
+        {
+            return false;
+        }
+
+        std::vector<String> distinct(ndistinct);
+        for (auto& s : distinct)
+        {
+            if ( !stream.Read(s) )
+            {
+                return false;
+            }
+        }
+
+        std::vector<U64> coded(sz, 0);
+        if ( !stream.ReadBatch( coded.data(), sz, Width(ndistinct - 1) ) )
+        {
+            return false;
+        }
+        for (size_t i = 0; i < sz; ++i)
+        {
+            if (coded[i] >= ndistinct)
+            {
+                return false;
+            }
+            strings[i] = distinct[ coded[i] ];
+        }
+        return true;
+    }
+
+    std::map<Key, Column> m_columns; // NB: ordered, so both ends go through the columns in the same order
+};
+
+// The ISerialization filing the values of the records into the columns, or taking them back from there
+template <typename TL>
+class ColumnarSerializationBase;
+
+template <typename... Ts>
+class ColumnarSerializationBase< TypeList<Ts...> > : public ISerialization< TypeList<Ts...> >
+{
+public:
+    virtual bool IsReading() const { return m_reading; }
+
+    // the record being serialized, the values within it are told apart by their offsets
+    void SetRecord(const void* record, size_t size)
+    {
+        m_record = (const Byte*)record;
+        if (size != m_size)
+        {
+            m_size = size;
+            m_slots.assign( (size + 1) * sizeof...(Ts), nullptr );
+            m_fields.assign( size, (U32)ColumnSet::FIELD_OUTSIDE ); // NB: a copy, not binding (odr-using) FIELD_OUTSIDE
+            m_nfields = 0;
+        }
+    }
+
+    bool ReadColumns(const BitStreamInput& stream, U32& nrecords)
+    {
+        return m_columns->Read( stream, nrecords, (U8)TypeListTypeIndex< String, TypeList<Ts...> >::value, (U8)TypeListTypeIndex< Buffer, TypeList<Ts...> >::value );
+    }
+
+    void WriteColumns(BitStreamOutput& stream, U32 nrecords) const
+    {
+        m_columns->Write(stream, nrecords);
+    }
+
+protected:
+    ColumnarSerializationBase()
+        : m_columns(nullptr)
+        , m_reading(false)
+        , m_record(nullptr)
+        , m_size(0)
+        , m_nfields(0)
+    {}
+
+    void Setup(ColumnSet& columns, bool reading)
+    {
+        m_columns = &columns;
+        m_reading = reading;
+    }
+
+    virtual BitStreamOutput& GetBitStreamOutputImpl() const { throw -1; }
+    virtual const BitStreamInput& GetBitStreamInputImpl() const { throw -1; }
+    virtual DataPolicyContainer< TypeList<Ts...> >& GetDataPolicyContainerImpl() const { throw -1; }
+
+    template <typename T>
+    bool Transfer(T& v)
+    {
+        static const size_t TYPE = TypeListTypeIndex< T, TypeList<Ts...> >::value;
+
+        ptrdiff_t offset = (const Byte*)&v - m_record;
+        bool inside = offset >= 0 && (size_t)offset < m_size;
+
+        // NB: the columns of the fields are looked up once per container
+        ColumnSet::Column*& slot = m_slots[ (inside ? (size_t)offset : m_size) * sizeof...(Ts) + TYPE ];
+        if (!slot)
+        {
+            // NB: the decoding replays the same sequence of values, so it numbers the fields the same way
+            U32 field = ColumnSet::FIELD_OUTSIDE;
+            if (inside)
+            {
+                U32& number = m_fields[(size_t)offset];
+                if (number == ColumnSet::FIELD_OUTSIDE)
+                {
+                    number = m_nfields++;
+                }
+                field = number;
+            }
+
+            ColumnSet::Key key( field, (U8)TYPE );
+            slot = m_reading ? m_columns->Find(key) : &m_columns->Get(key);
+        }
+
+        if (!m_reading)
+        {
+            Push(*slot, v);
+            return true;
+        }
+
+        return slot && Pop(*slot, v);
+    }
+
+private:
+    template <typename T>
+    static typename std::enable_if< std::is_integral<T>::value >::type Push(ColumnSet::Column& column, const T& v)
+    {
+        column.numbers.push_back( std::is_signed<T>::value ? (U64)(I64)v : (U64)v );
+    }
+
+    static void Push(ColumnSet::Column& column, const F32& v)
+    {
+        U32 u = 0;
+        std::memcpy( &u, &v, sizeof(u) );
+        column.numbers.push_back(u);
+    }
+
+    static void Push(ColumnSet::Column& column, const F64& v)
+    {
+        U64 u = 0;
+        std::memcpy( &u, &v, sizeof(u) );
+        column.numbers.push_back(u);
+    }
+
+    static void Push(ColumnSet::Column& column, const String& v)
+    {
+        column.strings.push_back(v);
+    }
+
+    static void Push(ColumnSet::Column& column, const Buffer& v)
+    {
+        column.buffers.push_back(v);
+    }
+
+    template <typename T>
+    static typename std::enable_if< std::is_integral<T>::value, bool >::type Pop(ColumnSet::Column& column, T& v)
+    {
+        if ( column.cursor >= column.numbers.size() )
+        {
+            return false;
+        }
+        v = (T)column.numbers[column.cursor++];
+        return true;
+    }
+
+    static bool Pop(ColumnSet::Column& column, bool& v)
+    {
+        if ( column.cursor >= column.numbers.size() )
+        {
+            return false;
+        }
+        v = column.numbers[column.cursor++] != 0;
+        return true;
+    }
+
+    static bool Pop(ColumnSet::Column& column, F32& v)
+    {
+        if ( column.cursor >= column.numbers.size() )
+        {
+            return false;
+        }
+        U32 u = (U32)column.numbers[column.cursor++];
+        std::memcpy( &v, &u, sizeof(u) );
+        return true;
+    }
+
+    static bool Pop(ColumnSet::Column& column, F64& v)
+    {
+        if ( column.cursor >= column.numbers.size() )
+        {
+            return false;
+        }
+        std::memcpy( &v, &column.numbers[column.cursor++], sizeof(v) );
+        return true;
+    }
+
+    static bool Pop(ColumnSet::Column& column, String& v)
+    {
+        if ( column.cursor >= column.strings.size() )
+        {
+            return false;
+        }
+        v = column.strings[column.cursor++];
+        return true;
+    }
+
+    static bool Pop(ColumnSet::Column& column, Buffer& v)
+    {
+        if ( column.cursor >= column.buffers.size() )
+        {
+            return false;
+        }
+        v = std::move( column.buffers[column.cursor++] );
+        return true;
+    }
+
+    ColumnSet* m_columns;
+    bool m_reading;
+
+    const Byte* m_record;
+    size_t m_size;
+    std::vector<ColumnSet::Column*> m_slots; // by offset (m_size for the outside) and type
+    std::vector<U32> m_fields; // the numbers of the fields by offset, in the order they are first serialized
+    U32 m_nfields;
+};
+
+template <typename T, class TL, class Base>
+struct ColumnarSerializationNode;
+
+template <typename T, class Base, typename... Ts>
+struct ColumnarSerializationNode< T, TypeList<Ts...>, Base > : public Base
+{
+    virtual bool Serialize(T& v, const String& policy, const String& tag)
+    {
+        return Base::Transfer(v);
+    }
+
+    virtual bool Serialize(T& v, PolicyHandle policy, const String& tag)
+    {
+        return Base::Transfer(v);
+    }
+};
+
+template <typename TL>
+class ColumnarSerialization;
+
+template <typename... Ts>
+class ColumnarSerialization< TypeList<Ts...> > : public Inherit< TypeList<Ts...>, TypeList<>, ColumnarSerializationNode, ColumnarSerializationBase< TypeList<Ts...> > >
+{
+public:
+    ColumnarSerialization(ColumnSet& columns, bool reading)
+    {
+        this->Setup(columns, reading);
+    }
+};
+
+typedef ColumnarSerialization<CoreSerializationTypes> ColumnarSerializationType;
+
+// The container of records, serialized column by column (as a Buffer)
+template <typename C>
+class Columnar : public C
+{
+public:
+    using C::C;
+
+    Columnar() {}
+
+    Columnar(const C& c)
+        : C(c)
+    {}
+
+    bool Serialize(ISerializationType& s)
+    {
+        ColumnSet columns;
+        ColumnarSerializationType c( columns, s.IsReading() );
+        Buffer blob;
+
+        if ( !s.IsReading() )
+        {
+            for (auto& record : *this)
+            {
+                c.SetRecord( &record, sizeof(record) );
+                if ( !record.Serialize(c) )
+                {
+                    return false;
+                }
+            }
+
+            {
+                BitStreamOutput stream(blob);
+                c.WriteColumns( stream, (U32)this->size() );
+            }
+
+            SERIALIZE(s, blob);
+            return true;
+        }
+
+        SERIALIZE(s, blob);
+
+        BitStreamInput stream(blob);
+        U32 nrecords = 0;
+        if ( !c.ReadColumns(stream, nrecords) )
+        {
+            return false;
+        }
+
+        this->clear();
+        this->resize(nrecords);
+        for (auto& record : *this)
+        {
+            c.SetRecord( &record, sizeof(record) );
+            if ( !record.Serialize(c) )
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+};
+
+#endif
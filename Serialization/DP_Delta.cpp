@@ -0,0 +1,27 @@
+//
+//  DP_Delta.cpp
+//  SerializationFramework
+//
+//  Created by Lin Luo on 05/01/2015.
+//
+
+#include "DeltaPolicy.h"
+
+DEFINE_DATA_POLICY_CREATOR(F64, DeltaF64Policy);
+DEFINE_DATA_POLICY_CREATOR(F32, DeltaF32Policy);
+DEFINE_DATA_POLICY_CREATOR(I64, DeltaI64Policy);
+DEFINE_DATA_POLICY_CREATOR(U64, DeltaU64Policy);
+DEFINE_DATA_POLICY_CREATOR(I32, DeltaI32Policy);
+DEFINE_DATA_POLICY_CREATOR(U32, DeltaU32Policy);
+DEFINE_DATA_POLICY_CREATOR(I16, DeltaI16Policy);
+DEFINE_DATA_POLICY_CREATOR(U16, DeltaU16Policy);
+
+// NB: the same name for all the types, each type has its own policies
+DEFINE_DATA_POLICY(delta, DeltaF64Policy);
+DEFINE_DATA_POLICY(delta, DeltaF32Policy);
+DEFINE_DATA_POLICY(delta, DeltaI64Policy);
+DEFINE_DATA_POLICY(delta, DeltaU64Policy);
+DEFINE_DATA_POLICY(delta, DeltaI32Policy);
+DEFINE_DATA_POLICY(delta, DeltaU32Policy);
+DEFINE_DATA_POLICY(delta, DeltaI16Policy);
+DEFINE_DATA_POLICY(delta, DeltaU16Policy);
@@ -0,0 +1,15 @@
+//
+//  DP_Geometric.cpp
+//  SerializationFramework
+//
+//  Created by Lin Luo on 05/01/2015.
+//
+
+#include "GeometricQuantization.h"
+
+DEFINE_DATA_POLICY_CREATOR(F64, BoundedVectorF64Policy);
+DEFINE_DATA_POLICY_CREATOR(F32, BoundedVectorF32Policy);
+DEFINE_DATA_POLICY_CREATOR(F64, AngleF64Policy);
+DEFINE_DATA_POLICY_CREATOR(F32, AngleF32Policy);
+DEFINE_DATA_POLICY_CREATOR(F64, QuaternionF64Policy);
+DEFINE_DATA_POLICY_CREATOR(F32, QuaternionF32Policy);
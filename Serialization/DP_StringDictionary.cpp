@@ -0,0 +1,12 @@
+//
+//  DP_StringDictionary.cpp
+//  SerializationFramework
+//
+//  Created by Lin Luo on 05/01/2015.
+//
+
+#include "StringDictionary.h"
+
+DEFINE_DATA_POLICY_CREATOR(String, StringDictionaryPolicy);
+
+DEFINE_DATA_POLICY(dictionary, StringDictionaryPolicy);
@@ -5,8 +5,9 @@
 //  Created by Lin Luo on 05/01/2015.
 //
 
-#include "Serialization.h"
+#include "StringDictionary.h"
 
+// NB: within a StringDictionaryScope, the strings go through the dictionary instead, which spans the messages
 class UniqueStringPolicy : public IDataPolicy<String>
 {
 public:
@@ -16,6 +17,12 @@ public:
 
     virtual bool Read(const BitStreamInput& stream, String& s, const String& tag) override
     {
+        StringDictionaryScope* scope = StringDictionaryScope::Current();
+        if (scope)
+        {
+            return scope->Read(stream, s);
+        }
+
         bool cached = false;
         if ( stream.Read(cached) )
         {
@@ -48,6 +55,13 @@ public:
 
     virtual void Write(BitStreamOutput& stream, const String& s, const String& tag) override
     {
+        StringDictionaryScope* scope = StringDictionaryScope::Current();
+        if (scope)
+        {
+            scope->Write(stream, s);
+            return;
+        }
+
         auto it = m_writeCache.find(s);
         bool cached = it != m_writeCache.end();
         stream.Write(cached);
@@ -0,0 +1,310 @@
+//
+//  DeltaPolicy.h
+//  SerializationFramework
+//
+//  Created by Lin Luo on 05/01/2015.
+//
+
+#ifndef SerializationFramework_DeltaPolicy_h
+#define SerializationFramework_DeltaPolicy_h
+
+#include "Serialization.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Delta compression of the numeric fields against a baseline snapshot acknowledged by the receiver
+//
+// A DeltaContext holds the state of one stream of snapshots (e.g. an object on a connection) on either end. The serialization of
+// a snapshot is wrapped in a DeltaScope on that context; within the scope, each field serialized with a delta policy is encoded as
+// a "changed" bit, followed by the zigzag delta of its quantized value against the same field of the baseline if changed. The
+// fields are matched with their baseline by their order in the scope, so a snapshot always has to serialize the same fields.
+// The first delta field of a snapshot carries its sequence number and baseline, so the receiver can decode it as long as it still
+// has the baseline, which is guaranteed by only using the snapshots acknowledged back by the receiver (DeltaContext::Acknowledge).
+// Outside of any scope, the delta policies encode the values against 0.
+
+class DeltaContext
+{
+public:
+    static const size_t N_HISTORY = 32; // the snapshots kept as possible baselines
+
+    DeltaContext()
+        : m_sequence(0)
+        , m_acknowledged(0)
+    {}
+
+    // sender: the receiver has got the snapshot of the sequence, so it becomes the baseline of the following ones
+    void Acknowledge(U32 sequence)
+    {
+        if ( sequence > m_acknowledged && m_history.find(sequence) != m_history.end() )
+        {
+            m_acknowledged = sequence;
+            m_history.erase( m_history.begin(), m_history.find(sequence) );
+        }
+    }
+
+    // receiver: the latest snapshot received, to be acknowledged back to the sender
+    U32 GetLatestSequence() const
+    {
+        return m_sequence;
+    }
+
+private:
+    friend class DeltaScope;
+
+    typedef std::vector<I64> Values; // the quantized values of the fields, in order
+
+    const Values* Find(U32 sequence) const
+    {
+        auto it = m_history.find(sequence);
+        return it != m_history.end() ? &it->second : nullptr;
+    }
+
+    void Store(U32 sequence, Values&& values)
+    {
+        m_history[sequence] = std::move(values);
+        while (m_history.size() > N_HISTORY)
+        {
+            m_history.erase( m_history.begin() );
+        }
+    }
+
+    std::map<U32, Values> m_history;
+    U32 m_sequence;     // sender: the last snapshot written; receiver: the latest snapshot received
+    U32 m_acknowledged; // sender: the baseline
+};
+
+class DeltaScope
+{
+public:
+    DeltaScope(DeltaContext& context, bool reading)
+        : m_context(context)
+        , m_reading(reading)
+        , m_failed(false)
+        , m_sequence(0)
+        , m_baselineSequence(0)
+        , m_baseline(nullptr)
+        , m_cursor(0)
+        , m_previous( Top() )
+    {
+        if (!m_reading)
+        {
+            m_sequence = ++m_context.m_sequence;
+            m_baseline = m_context.Find(m_context.m_acknowledged);
+            m_baselineSequence = m_baseline ? m_context.m_acknowledged : 0;
+        }
+
+        Top() = this;
+    }
+
+    ~DeltaScope()
+    {
+        Top() = m_previous;
+
+        if ( m_failed || m_cursor == 0 )
+        {
+            return;
+        }
+
+        if (m_reading)
+        {
+            if ( m_sequence > m_context.m_sequence )
+            {
+                m_context.m_sequence = m_sequence;
+            }
+
+            // NB: the sender never goes back past a baseline it has used
+            m_context.m_history.erase( m_context.m_history.begin(), m_context.m_history.lower_bound(m_baselineSequence) );
+        }
+
+        m_context.Store( m_sequence, std::move(m_values) );
+    }
+
+    // the innermost scope of the thread, nullptr if none
+    static DeltaScope* Current()
+    {
+        return Top();
+    }
+
+    // called by the delta policies for each of their fields; begins the snapshot with its first field, and gives the baseline value
+    I64 Next(BitStreamOutput& stream)
+    {
+        if (m_cursor == 0)
+        {
+            stream.Write(m_sequence);
+            stream.Write( m_baseline ? m_sequence - m_baselineSequence : (U32)0 );
+        }
+
+        return Baseline();
+    }
+
+    bool Next(const BitStreamInput& stream, I64& base)
+    {
+        if (m_cursor == 0)
+        {
+            U32 distance = 0;
+            if ( !stream.Read(m_sequence) || !stream.Read(distance) )
+            {
+                m_failed = true;
+                return false;
+            }
+
+            m_baselineSequence = distance ? m_sequence - distance : 0;
+            m_baseline = distance ? m_context.Find(m_baselineSequence) : nullptr;
+            if ( distance && !m_baseline )
+            {
+                m_failed = true; // NB: only an unacknowledged baseline can be missing, which is a protocol error
+                return false;
+            }
+        }
+
+        base = Baseline();
+        return true;
+    }
+
+    void Record(I64 q)
+    {
+        m_values.push_back(q);
+        ++m_cursor;
+    }
+
+    void Fail()
+    {
+        m_failed = true;
+    }
+
+private:
+    static DeltaScope*& Top()
+    {
+        static thread_local DeltaScope* s_top = nullptr;
+        return s_top;
+    }
+
+    I64 Baseline() const
+    {
+        return m_baseline && m_cursor < m_baseline->size() ? (*m_baseline)[m_cursor] : 0;
+    }
+
+    DeltaContext& m_context;
+    const bool m_reading;
+    bool m_failed;
+
+    U32 m_sequence;
+    U32 m_baselineSequence;
+    const DeltaContext::Values* m_baseline;
+
+    size_t m_cursor;
+    DeltaContext::Values m_values;
+
+    DeltaScope* const m_previous;
+};
+
+// The delta policies of the numeric types; the floating point values are quantized with the given precision, e.g.
+// { "policy", { {"name", "position"}, {"class", "DeltaF64Policy"} }, { { "delta", { {"precision", "0.01"} } } } }
+template <typename T>
+class DeltaPolicy : public IDataPolicy<T>
+{
+public:
+    DeltaPolicy(const IMetadataProcessor::Elements& elements)
+        : m_precision(0.001)
+    {
+        for (const auto& element : elements)
+        {
+            auto it = element.attributes.find("precision");
+            if ( element.name == "delta" && it != element.attributes.end() )
+            {
+                m_precision = std::strtod( it->second.c_str(), nullptr );
+            }
+        }
+    }
+
+    virtual bool Read(const BitStreamInput& stream, T& v, const String& tag) override
+    {
+        DeltaScope* scope = DeltaScope::Current();
+
+        I64 base = 0;
+        if ( scope && !scope->Next(stream, base) )
+        {
+            return false;
+        }
+
+        bool changed = false;
+        U64 zigzag = 0;
+        if ( !stream.Read(changed) || ( changed && !stream.Read(zigzag) ) )
+        {
+            if (scope)
+            {
+                scope->Fail();
+            }
+            return false;
+        }
+
+        // NB: the delta is taken modulo 2^64 (see Write)
+        I64 q = (I64)( (U64)base + ( (zigzag >> 1) ^ ( (U64)0 - (zigzag & 1) ) ) );
+        v = Dequantize(q);
+
+        if (scope)
+        {
+            scope->Record(q);
+        }
+
+        return true;
+    }
+
+    virtual void Write(BitStreamOutput& stream, const T& v, const String& tag) override
+    {
+        DeltaScope* scope = DeltaScope::Current();
+
+        // NB: the delta is taken modulo 2^64, so it cannot overflow (e.g. the U64 values past 2^63, or the large I64 jumps), and is
+        // zigzagged as a two's complement one
+        I64 q = Quantize(v);
+        U64 delta = (U64)q - (U64)( scope ? scope->Next(stream) : 0 );
+
+        stream.Write(delta != 0);
+        if (delta != 0)
+        {
+            stream.Write( (U64)( (delta << 1) ^ ( (U64)0 - (delta >> 63) ) ) );
+        }
+
+        if (scope)
+        {
+            scope->Record(q);
+        }
+    }
+
+private:
+    template <typename X = T>
+    typename std::enable_if< std::is_floating_point<X>::value, I64 >::type Quantize(X x) const
+    {
+        return (I64)std::llround(x / m_precision);
+    }
+
+    template <typename X = T>
+    typename std::enable_if< std::is_integral<X>::value, I64 >::type Quantize(X x) const
+    {
+        return (I64)x;
+    }
+
+    template <typename X = T>
+    typename std::enable_if< std::is_floating_point<X>::value, X >::type Dequantize(I64 q) const
+    {
+        return (X)(q * m_precision);
+    }
+
+    template <typename X = T>
+    typename std::enable_if< std::is_integral<X>::value, X >::type Dequantize(I64 q) const
+    {
+        return (X)q;
+    }
+
+    F64 m_precision;
+};
+
+typedef DeltaPolicy<F64> DeltaF64Policy;
+typedef DeltaPolicy<F32> DeltaF32Policy;
+typedef DeltaPolicy<I64> DeltaI64Policy;
+typedef DeltaPolicy<U64> DeltaU64Policy;
+typedef DeltaPolicy<I32> DeltaI32Policy;
+typedef DeltaPolicy<U32> DeltaU32Policy;
+typedef DeltaPolicy<I16> DeltaI16Policy;
+typedef DeltaPolicy<U16> DeltaU16Policy;
+
+#endif
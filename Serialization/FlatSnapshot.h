@@ -0,0 +1,745 @@
+//
+//  FlatSnapshot.h
+//  SerializationFramework
+//
+//  Created by Lin Luo on 05/01/2015.
+//
+
+#ifndef SerializationFramework_FlatSnapshot_h
+#define SerializationFramework_FlatSnapshot_h
+
+#include "LazyView.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Flat snapshots
+//
+// A flat snapshot lays the values of an object out by its structure (see ISerialization::BeginObject), in an image that is read
+// in place, e.g. straight out of a memory mapped file (see MappedFile), without any decoding: an object is a table of 8 bytes slots,
+// one per value serialized, in order; the slot of a value of a core type holds it as it is (the floating point ones bit for bit,
+// regardless of the policies), that of a String or a Buffer refers to its bytes, that of an object to its table, and that of an
+// array of objects to the offsets of their tables. All the references are offsets into the image, so it is relocatable, and checked
+// against its size by the accessors (FlatTable, FlatArray), so an image coming from anywhere is safe to read.
+// The layout, all in little-endian, 8 bytes aligned:
+//     header: U32 magic, U32 root (the offset of the table of the root object), U64 size (of the image)
+//     table:  U32 the number of slots, U32 0, the slots
+//     slot:   a bool or an integer, sign extended; a F32 or a F64, bit for bit; a String or a Buffer, an object or an array of
+//             objects: U32 the offset (of the bytes, the table, or the array), U32 the size (of the bytes or the array, 0 for a table)
+//     array:  U32 the offsets of the tables of the elements
+// The bytes of the Strings are followed by a '\0', not counted in their size. The offsets being U32, an image is at most 4 GiB
+// (FlatSnapshot::N_MAX_SIZE), and the output fails past that.
+// NB: the slots are positional, so a conditional value (CONDITIONAL_SERIALIZE) shifts the slots that follow it when present
+
+static const U32 FLAT_SNAPSHOT_MAGIC = 0x54414c46; // "FLAT"
+
+class FlatArray;
+
+// The table of an object in the image
+class FlatTable
+{
+public:
+    FlatTable()
+        : m_image(nullptr)
+        , m_size(0)
+        , m_offset(0)
+        , m_nslots(0)
+    {
+    }
+
+    size_t GetNumSlots() const
+    {
+        return m_nslots;
+    }
+
+    template < typename T, typename = typename std::enable_if< std::is_arithmetic<T>::value >::type >
+    bool Get(size_t slot, T& v) const
+    {
+        U64 bits = 0;
+        if ( !GetSlot(slot, bits) )
+        {
+            return false;
+        }
+
+        FromSlot(bits, v);
+        return true;
+    }
+
+    // a String or a Buffer, in place
+    bool Get(size_t slot, BytesView& bytes) const
+    {
+        U64 bits = 0;
+        if ( !GetSlot(slot, bits) || !Check( (U32)bits, bits >> 32 ) )
+        {
+            return false;
+        }
+
+        bytes = BytesView( m_image + (U32)bits, (size_t)(bits >> 32) );
+        return true;
+    }
+
+    bool Get(size_t slot, FlatTable& table) const
+    {
+        U64 bits = 0;
+        return GetSlot(slot, bits) && table.Open( m_image, m_size, (U32)bits );
+    }
+
+    inline bool Get(size_t slot, FlatArray& array) const;
+
+private:
+    friend class FlatArray;
+    friend class FlatSnapshot;
+
+    bool Open(const Byte* image, size_t size, size_t offset)
+    {
+        U32 nslots = 0;
+        if ( (offset & 7) != 0 || offset + 8 > size )
+        {
+            return false;
+        }
+
+        memcpy( &nslots, image + offset, sizeof(nslots) );
+        nslots = FromLittleEndian(nslots);
+        if ( (size - offset - 8) / 8 < nslots )
+        {
+            return false;
+        }
+
+        m_image = image;
+        m_size = size;
+        m_offset = offset;
+        m_nslots = nslots;
+        return true;
+    }
+
+    bool Check(size_t offset, size_t nbytes) const
+    {
+        return offset <= m_size && nbytes <= m_size - offset;
+    }
+
+    bool GetSlot(size_t slot, U64& bits) const
+    {
+        if (slot >= m_nslots)
+        {
+            return false;
+        }
+
+        memcpy( &bits, m_image + m_offset + 8 + slot * 8, sizeof(bits) );
+        bits = FromLittleEndian(bits);
+        return true;
+    }
+
+    static U32 FromLittleEndian(U32 u)
+    {
+        return IsBigEndian() ? (U32)( ReverseByteOrder( (U64)u ) >> 32 ) : u;
+    }
+
+    static U64 FromLittleEndian(U64 u)
+    {
+        return IsBigEndian() ? ReverseByteOrder(u) : u;
+    }
+
+    template <typename I>
+    static typename std::enable_if< std::is_integral<I>::value >::type FromSlot(U64 bits, I& i)
+    {
+        i = (I)bits;
+    }
+
+    static void FromSlot(U64 bits, F32& f)
+    {
+        U32 u = (U32)bits;
+        memcpy( &f, &u, sizeof(f) );
+    }
+
+    static void FromSlot(U64 bits, F64& f)
+    {
+        memcpy( &f, &bits, sizeof(f) );
+    }
+
+    const Byte* m_image;
+    size_t m_size;
+    size_t m_offset;
+    size_t m_nslots;
+};
+
+// An array of objects in the image
+class FlatArray
+{
+public:
+    FlatArray()
+        : m_image(nullptr)
+        , m_size(0)
+        , m_offset(0)
+        , m_count(0)
+    {
+    }
+
+    size_t size() const
+    {
+        return m_count;
+    }
+
+    bool Get(size_t index, FlatTable& table) const
+    {
+        if (index >= m_count)
+        {
+            return false;
+        }
+
+        U32 offset = 0;
+        memcpy( &offset, m_image + m_offset + index * 4, sizeof(offset) );
+        return table.Open( m_image, m_size, FlatTable::FromLittleEndian(offset) );
+    }
+
+private:
+    friend class FlatTable;
+
+    bool Open(const Byte* image, size_t size, size_t offset, size_t count)
+    {
+        if ( offset > size || (size - offset) / 4 < count )
+        {
+            return false;
+        }
+
+        m_image = image;
+        m_size = size;
+        m_offset = offset;
+        m_count = count;
+        return true;
+    }
+
+    const Byte* m_image;
+    size_t m_size;
+    size_t m_offset;
+    size_t m_count;
+};
+
+inline bool FlatTable::Get(size_t slot, FlatArray& array) const
+{
+    U64 bits = 0;
+    return GetSlot(slot, bits) && array.Open( m_image, m_size, (U32)bits, (size_t)(bits >> 32) );
+}
+
+// A snapshot image, e.g. a memory mapped file
+class FlatSnapshot
+{
+public:
+    static const size_t N_HEADER = 16;
+    static const size_t N_MAX_SIZE = 0xffffffff; // the offsets are U32
+
+    // checks the header, false if it is not a snapshot of the size
+    bool Open(const Byte* image, size_t size)
+    {
+        U32 magic = 0, root = 0;
+        U64 sz = 0;
+        if (size < N_HEADER)
+        {
+            return false;
+        }
+
+        memcpy( &magic, image, 4 );
+        memcpy( &root, image + 4, 4 );
+        memcpy( &sz, image + 8, 8 );
+        if ( FlatTable::FromLittleEndian(magic) != FLAT_SNAPSHOT_MAGIC || FlatTable::FromLittleEndian(sz) != size )
+        {
+            return false;
+        }
+
+        return m_root.Open( image, size, FlatTable::FromLittleEndian(root) );
+    }
+
+    const FlatTable& GetRoot() const
+    {
+        return m_root;
+    }
+
+private:
+    FlatTable m_root;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// The serializations to and from the images; the objects are laid out, or materialized, through their Serialize as usual, so
+// a type that serializes gets a snapshot for free:
+//     Buffer image;
+//     FlatSnapshotOutputType output(image);
+//     output.Write(md);
+// ...
+//     FlatSnapshotInputType input;
+//     bool ok = input.Open( file.data(), file.size() ) && input.Read(md);
+
+template <typename TL>
+class FlatSnapshotOutputBase;
+
+template <typename... Ts>
+class FlatSnapshotOutputBase< TypeList<Ts...> > : public ISerialization< TypeList<Ts...> >
+{
+public:
+    virtual bool IsReading() const { return false; }
+
+    template <typename T>
+    bool Write(T& root)
+    {
+        m_image->assign(FlatSnapshot::N_HEADER, 0);
+        m_depth = 0;
+        m_root = 0;
+        if ( !::Serialize(*this, root) || m_depth != 0 || m_image->size() > FlatSnapshot::N_MAX_SIZE )
+        {
+            return false;
+        }
+
+        Patch<U32>(0, FLAT_SNAPSHOT_MAGIC);
+        Patch<U32>(4, m_root);
+        Patch<U64>( 8, m_image->size() );
+        return true;
+    }
+
+    virtual bool BeginObject()
+    {
+        Push(false);
+        return true;
+    }
+
+    virtual bool EndObject()
+    {
+        if ( m_depth == 0 || m_frames[m_depth - 1].array )
+        {
+            return false;
+        }
+
+        Frame& frame = m_frames[m_depth - 1];
+        U32 offset = 0;
+        if ( !Append<U32>( (U32)frame.slots.size(), offset ) || !Append<U32>(0) )
+        {
+            return false;
+        }
+        for (U64 slot : frame.slots)
+        {
+            if ( !Append<U64>(slot) )
+            {
+                return false;
+            }
+        }
+
+        --m_depth;
+        if (m_depth == 0)
+        {
+            m_root = offset;
+        }
+        else if (m_frames[m_depth - 1].array)
+        {
+            m_frames[m_depth - 1].elements.push_back(offset);
+        }
+        else
+        {
+            m_frames[m_depth - 1].slots.push_back(offset);
+        }
+        return true;
+    }
+
+    virtual bool BeginArray(U32& size)
+    {
+        if ( m_depth == 0 || m_frames[m_depth - 1].array )
+        {
+            return false;
+        }
+
+        Push(true);
+        return true;
+    }
+
+    virtual bool EndArray()
+    {
+        if ( m_depth == 0 || !m_frames[m_depth - 1].array )
+        {
+            return false;
+        }
+
+        Frame& frame = m_frames[m_depth - 1];
+        U32 offset = 0;
+        if ( !GetOffset(offset) )
+        {
+            return false;
+        }
+        for (U32 element : frame.elements)
+        {
+            if ( !Append<U32>(element) )
+            {
+                return false;
+            }
+        }
+        Align();
+
+        --m_depth;
+        m_frames[m_depth - 1].slots.push_back( offset | (U64)frame.elements.size() << 32 );
+        return true;
+    }
+
+protected:
+    void Setup(Buffer& image)
+    {
+        m_image = &image;
+        m_depth = 0;
+        m_root = 0;
+    }
+
+    // the value of a core type, into the slot of the current object
+    bool Transfer(const String& s)
+    {
+        return Transfer( (const Byte*)s.data(), s.size(), true );
+    }
+
+    bool Transfer(const Buffer& b)
+    {
+        return Transfer( b.data(), b.size(), false );
+    }
+
+    bool Transfer(F32 f)
+    {
+        U32 u = 0;
+        memcpy( &u, &f, sizeof(u) );
+        return Put(u);
+    }
+
+    bool Transfer(F64 f)
+    {
+        U64 u = 0;
+        memcpy( &u, &f, sizeof(u) );
+        return Put(u);
+    }
+
+    template < typename I, typename = typename std::enable_if< std::is_integral<I>::value >::type >
+    bool Transfer(I i)
+    {
+        return Put( (U64)(I64)i ); // NB: sign extended
+    }
+
+    virtual BitStreamOutput& GetBitStreamOutputImpl() const { throw -1; }
+    virtual const BitStreamInput& GetBitStreamInputImpl() const { throw -1; }
+    virtual DataPolicyContainer< TypeList<Ts...> >& GetDataPolicyContainerImpl() const { throw -1; }
+
+private:
+    struct Frame
+    {
+        bool array;
+        std::vector<U64> slots;
+        std::vector<U32> elements;
+    };
+
+    void Push(bool array)
+    {
+        if ( m_depth == m_frames.size() )
+        {
+            m_frames.emplace_back();
+        }
+
+        Frame& frame = m_frames[m_depth++];
+        frame.array = array;
+        frame.slots.clear();
+        frame.elements.clear();
+    }
+
+    bool Put(U64 slot)
+    {
+        if ( m_depth == 0 || m_frames[m_depth - 1].array )
+        {
+            return false; // NB: only the objects have values of their own
+        }
+
+        m_frames[m_depth - 1].slots.push_back(slot);
+        return true;
+    }
+
+    bool Transfer(const Byte* data, size_t size, bool terminated)
+    {
+        U32 offset = 0;
+        if ( !GetOffset(offset) || size > FlatSnapshot::N_MAX_SIZE )
+        {
+            return false;
+        }
+        m_image->insert(m_image->end(), data, data + size);
+        if (terminated)
+        {
+            m_image->push_back(0);
+        }
+        Align();
+
+        return Put( offset | (U64)size << 32 );
+    }
+
+    // the offset of what comes next, false once the image has grown past the U32 offsets
+    bool GetOffset(U32& offset) const
+    {
+        if ( m_image->size() > FlatSnapshot::N_MAX_SIZE )
+        {
+            return false;
+        }
+
+        offset = (U32)m_image->size();
+        return true;
+    }
+
+    template <typename U>
+    bool Append(U u, U32& offset)
+    {
+        if ( !GetOffset(offset) )
+        {
+            return false;
+        }
+
+        m_image->resize( (size_t)offset + sizeof(U) );
+        Patch<U>(offset, u);
+        return true;
+    }
+
+    template <typename U>
+    bool Append(U u)
+    {
+        U32 offset = 0;
+        return Append<U>(u, offset);
+    }
+
+    template <typename U>
+    void Patch(size_t offset, U u)
+    {
+        for (size_t i = 0; i < sizeof(U); ++i, u >>= 8) // NB: little-endian whatever the host
+        {
+            (*m_image)[offset + i] = (Byte)u;
+        }
+    }
+
+    void Align()
+    {
+        m_image->resize( ( m_image->size() + 7 ) & ~(size_t)7, 0 );
+    }
+
+    Buffer* m_image;
+    std::vector<Frame> m_frames; // the open objects and arrays, reused
+    size_t m_depth;
+    U32 m_root;
+};
+
+template <typename TL>
+class FlatSnapshotInputBase;
+
+template <typename... Ts>
+class FlatSnapshotInputBase< TypeList<Ts...> > : public ISerialization< TypeList<Ts...> >
+{
+public:
+    static const size_t N_MAX_DEPTH = 256; // NB: the offsets of a damaged image may well go round in circles
+
+    virtual bool IsReading() const { return true; }
+
+    bool Open(const Byte* image, size_t size)
+    {
+        return m_snapshot.Open(image, size);
+    }
+
+    // materializes the root object
+    template <typename T>
+    bool Read(T& root)
+    {
+        m_depth = 0;
+        m_started = false;
+        return ::Serialize(*this, root) && m_depth == 0;
+    }
+
+    virtual bool BeginObject()
+    {
+        if (m_depth >= N_MAX_DEPTH)
+        {
+            return false;
+        }
+
+        FlatTable table;
+        if (!m_started)
+        {
+            table = m_snapshot.GetRoot();
+            m_started = true;
+        }
+        else if ( m_depth == 0 )
+        {
+            return false;
+        }
+        else
+        {
+            Frame& parent = m_frames[m_depth - 1];
+            bool ok = parent.array ? parent.elements.Get(parent.cursor++, table) : parent.table.Get(parent.cursor++, table);
+            if (!ok)
+            {
+                return false;
+            }
+        }
+
+        Frame& frame = Push(false);
+        frame.table = table;
+        return true;
+    }
+
+    virtual bool EndObject()
+    {
+        if ( m_depth == 0 || m_frames[m_depth - 1].array )
+        {
+            return false;
+        }
+
+        --m_depth;
+        return true;
+    }
+
+    virtual bool BeginArray(U32& size)
+    {
+        if ( m_depth == 0 || m_depth >= N_MAX_DEPTH || m_frames[m_depth - 1].array )
+        {
+            return false;
+        }
+
+        Frame& parent = m_frames[m_depth - 1];
+        FlatArray array;
+        if ( !parent.table.Get(parent.cursor++, array) )
+        {
+            return false;
+        }
+
+        size = (U32)array.size();
+        Frame& frame = Push(true);
+        frame.elements = array;
+        return true;
+    }
+
+    virtual bool EndArray()
+    {
+        if ( m_depth == 0 || !m_frames[m_depth - 1].array )
+        {
+            return false;
+        }
+
+        --m_depth;
+        return true;
+    }
+
+protected:
+    void Setup()
+    {
+        m_depth = 0;
+        m_started = false;
+    }
+
+    bool Transfer(String& s)
+    {
+        BytesView bytes;
+        if ( !Get(bytes) )
+        {
+            return false;
+        }
+
+        s = bytes.ToString();
+        return true;
+    }
+
+    bool Transfer(Buffer& b)
+    {
+        BytesView bytes;
+        if ( !Get(bytes) )
+        {
+            return false;
+        }
+
+        b.assign(bytes.data, bytes.data + bytes.size);
+        return true;
+    }
+
+    template < typename T, typename = typename std::enable_if< std::is_arithmetic<T>::value >::type >
+    bool Transfer(T& v)
+    {
+        return Get(v);
+    }
+
+    virtual BitStreamOutput& GetBitStreamOutputImpl() const { throw -1; }
+    virtual const BitStreamInput& GetBitStreamInputImpl() const { throw -1; }
+    virtual DataPolicyContainer< TypeList<Ts...> >& GetDataPolicyContainerImpl() const { throw -1; }
+
+private:
+    struct Frame
+    {
+        bool array;
+        FlatTable table;
+        FlatArray elements;
+        size_t cursor;
+    };
+
+    Frame& Push(bool array)
+    {
+        if ( m_depth == m_frames.size() )
+        {
+            m_frames.emplace_back();
+        }
+
+        Frame& frame = m_frames[m_depth++];
+        frame.array = array;
+        frame.cursor = 0;
+        return frame;
+    }
+
+    template <typename T>
+    bool Get(T& v)
+    {
+        if ( m_depth == 0 || m_frames[m_depth - 1].array )
+        {
+            return false;
+        }
+
+        Frame& frame = m_frames[m_depth - 1];
+        return frame.table.Get(frame.cursor++, v);
+    }
+
+    FlatSnapshot m_snapshot;
+    std::vector<Frame> m_frames;
+    size_t m_depth;
+    bool m_started;
+};
+
+template <typename T, class TL, class Base>
+struct FlatSnapshotNode;
+
+template <typename T, class Base, typename... Ts>
+struct FlatSnapshotNode< T, TypeList<Ts...>, Base > : public Base
+{
+    virtual bool Serialize(T& v, const String& policy, const String& tag)
+    {
+        return Base::Transfer(v);
+    }
+
+    virtual bool Serialize(T& v, PolicyHandle policy, const String& tag)
+    {
+        return Base::Transfer(v);
+    }
+};
+
+template <typename TL>
+class FlatSnapshotOutput;
+
+template <typename... Ts>
+class FlatSnapshotOutput< TypeList<Ts...> > : public Inherit< TypeList<Ts...>, TypeList<>, FlatSnapshotNode, FlatSnapshotOutputBase< TypeList<Ts...> > >
+{
+public:
+    FlatSnapshotOutput(Buffer& image)
+    {
+        this->Setup(image);
+    }
+};
+
+template <typename TL>
+class FlatSnapshotInput;
+
+template <typename... Ts>
+class FlatSnapshotInput< TypeList<Ts...> > : public Inherit< TypeList<Ts...>, TypeList<>, FlatSnapshotNode, FlatSnapshotInputBase< TypeList<Ts...> > >
+{
+public:
+    FlatSnapshotInput()
+    {
+        this->Setup();
+    }
+};
+
+typedef FlatSnapshotOutput<CoreSerializationTypes> FlatSnapshotOutputType;
+typedef FlatSnapshotInput<CoreSerializationTypes> FlatSnapshotInputType;
+
+#endif
@@ -0,0 +1,283 @@
+//
+//  GeometricQuantization.h
+//  SerializationFramework
+//
+//  Created by Lin Luo on 05/01/2015.
+//
+
+#ifndef SerializationFramework_GeometricQuantization_h
+#define SerializationFramework_GeometricQuantization_h
+
+#include "Serialization.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Geometric quantizations, on top of UniformQuantization, and the data policies using them
+// The policies are configured with the metadata elements, the attributes being "min", "max" and "nbits" (see the sketch in Serialization.h)
+
+template <typename T>
+static inline T MetadataAttribute(const IMetadataProcessor::Element& element, const char* name, T dflt)
+{
+    auto it = element.attributes.find(name);
+    return it != element.attributes.end() ? (T)std::strtod( it->second.c_str(), nullptr ) : dflt;
+}
+
+// Angles wrap around the period [mn, mx), so any angle is encoded, and the values close to mx are close to mn as well
+template <typename T>
+class AngleQuantization
+{
+public:
+    // NB: nbits is clamped to 63, the steps being counted in a U64
+    AngleQuantization(T mn, T mx, size_t nbits)
+        : m_mn(mn)
+        , m_period(mx - mn)
+        , m_nbits( std::min( nbits, (size_t)63 ) )
+        , m_nsteps( (U64)1 << m_nbits )
+    {}
+
+    bool Read(const BitStreamInput& stream, T& v, const String& tag) const
+    {
+        U64 quantized = 0;
+        if ( stream.Read(quantized, m_nbits) )
+        {
+            v = m_mn + (T)( (double)quantized / m_nsteps * m_period );
+            return true;
+        }
+
+        return false;
+    }
+
+    void Write(BitStreamOutput& stream, T v, const String& tag) const
+    {
+        double t = (double)(v - m_mn) / m_period;
+        t -= std::floor(t);
+
+        U64 quantized = (U64)std::llround(t * m_nsteps) & (m_nsteps - 1); // NB: rounding up to the period wraps to 0
+        stream.Write(quantized, m_nbits);
+    }
+
+private:
+    const T m_mn;
+    const T m_period;
+    const size_t m_nbits;
+    const U64 m_nsteps;
+};
+
+// Unit quaternions, as the index of the largest component (2 bits) and the other three, which lie within +/- 1/sqrt(2)
+// NB: q and -q are the same rotation, so the largest component is made positive and recovered from the unit length
+template <typename T>
+class SmallestThreeQuantization
+{
+public:
+    SmallestThreeQuantization(size_t nbits)
+        : m_q( (T)-M_SQRT1_2, (T)M_SQRT1_2, nbits )
+    {}
+
+    bool Read(const BitStreamInput& stream, T q[4]) const
+    {
+        U8 largest = 0;
+        if ( !stream.Read(largest, 2) )
+        {
+            return false;
+        }
+
+        T sum = 0;
+        for (size_t i = 0; i < 4; ++i)
+        {
+            if (i != largest)
+            {
+                if ( !m_q.Read(stream, q[i], String()) )
+                {
+                    return false;
+                }
+                sum += q[i] * q[i];
+            }
+        }
+
+        q[largest] = std::sqrt( std::max( (T)0, (T)1 - sum ) );
+        return true;
+    }
+
+    void Write(BitStreamOutput& stream, const T q[4]) const
+    {
+        U8 largest = 0;
+        for (U8 i = 1; i < 4; ++i)
+        {
+            if ( std::fabs(q[i]) > std::fabs(q[largest]) )
+            {
+                largest = i;
+            }
+        }
+
+        T sign = q[largest] < 0 ? (T)-1 : (T)1;
+
+        stream.Write(largest, 2);
+        for (size_t i = 0; i < 4; ++i)
+        {
+            if (i != largest)
+            {
+                m_q.Write(stream, sign * q[i], String());
+            }
+        }
+    }
+
+private:
+    const UniformQuantization< T, typename std::conditional< sizeof(T) <= 4, U32, U64 >::type > m_q;
+};
+
+// Bounded vectors, with a range and bit budget per axis; the axes are the child elements, selected by the tag of the fields, e.g.
+// { "policy", { {"name", "position"}, {"class", "BoundedVectorF64Policy"} }, { { "X", { {"min", "-4096"}, {"max", "4096"}, {"nbits", "20"} } }, ... } }
+// NB: the fields of the other tags go with the default policy
+template <typename T>
+class BoundedVectorPolicy : public IDataPolicy<T>
+{
+public:
+    BoundedVectorPolicy(const IMetadataProcessor::Elements& elements)
+    {
+        for (const auto& element : elements)
+        {
+            size_t nbits = MetadataAttribute<size_t>(element, "nbits", sizeof(T) * 8);
+            m_axes.emplace( std::piecewise_construct, std::forward_as_tuple(element.name),
+                std::forward_as_tuple( MetadataAttribute<T>(element, "min", -1), MetadataAttribute<T>(element, "max", 1), std::min(nbits, sizeof(Q) * 8) ) );
+        }
+    }
+
+    virtual bool Read(const BitStreamInput& stream, T& v, const String& tag) override
+    {
+        auto it = m_axes.find(tag);
+        return it != m_axes.end() ? it->second.Read(stream, v, tag) : m_default.Read(stream, v, tag);
+    }
+
+    virtual void Write(BitStreamOutput& stream, const T& v, const String& tag) override
+    {
+        auto it = m_axes.find(tag);
+        if ( it != m_axes.end() )
+        {
+            it->second.Write(stream, v, tag);
+        }
+        else
+        {
+            m_default.Write(stream, v, tag);
+        }
+    }
+
+private:
+    typedef typename std::conditional< sizeof(T) <= 4, U32, U64 >::type Q;
+
+    std::unordered_map< String, UniformQuantization<T, Q> > m_axes;
+    DataPolicyDefault<T> m_default;
+};
+
+// Angles with wraparound, over [min, max) (degrees by default), e.g.
+// { "policy", { {"name", "yaw"}, {"class", "AngleF64Policy"} }, { { "angle", { {"min", "0"}, {"max", "360"}, {"nbits", "10"} } } } }
+template <typename T>
+class AnglePolicy : public IDataPolicy<T>
+{
+public:
+    AnglePolicy(const IMetadataProcessor::Elements& elements)
+        : m_q( Attribute(elements, "min", 0), Attribute(elements, "max", 360), (size_t)Attribute(elements, "nbits", 16) )
+    {}
+
+    virtual bool Read(const BitStreamInput& stream, T& v, const String& tag) override
+    {
+        return m_q.Read(stream, v, tag);
+    }
+
+    virtual void Write(BitStreamOutput& stream, const T& v, const String& tag) override
+    {
+        m_q.Write(stream, v, tag);
+    }
+
+private:
+    static T Attribute(const IMetadataProcessor::Elements& elements, const char* name, T dflt)
+    {
+        for (const auto& element : elements)
+        {
+            if (element.name == "angle")
+            {
+                return MetadataAttribute<T>(element, name, dflt);
+            }
+        }
+        return dflt;
+    }
+
+    const AngleQuantization<T> m_q;
+};
+
+// Unit quaternions, encoded with the smallest three; the components are serialized as separate fields, tagged "X", "Y", "Z" and "W",
+// which have to come in this order: the quaternion is written with its last component, and read with its first one, e.g.
+// { "policy", { {"name", "rotation"}, {"class", "QuaternionF32Policy"} }, { { "quaternion", { {"nbits", "9"} } } } }
+template <typename T>
+class QuaternionPolicy : public IDataPolicy<T>
+{
+public:
+    QuaternionPolicy(const IMetadataProcessor::Elements& elements)
+        : m_q( Bits(elements) )
+        , m_next(0)
+    {
+        std::fill(m_components, m_components + 4, (T)0);
+    }
+
+    virtual bool Read(const BitStreamInput& stream, T& v, const String& tag) override
+    {
+        if ( m_next == 0 && !m_q.Read(stream, m_components) )
+        {
+            return false;
+        }
+
+        v = m_components[Index(tag)];
+        m_next = (m_next + 1) % 4;
+        return true;
+    }
+
+    virtual void Write(BitStreamOutput& stream, const T& v, const String& tag) override
+    {
+        m_components[Index(tag)] = v;
+        m_next = (m_next + 1) % 4;
+        if (m_next == 0)
+        {
+            m_q.Write(stream, m_components);
+        }
+    }
+
+    virtual void Reset() override
+    {
+        m_next = 0;
+    }
+
+private:
+    static size_t Bits(const IMetadataProcessor::Elements& elements)
+    {
+        for (const auto& element : elements)
+        {
+            if (element.name == "quaternion")
+            {
+                return MetadataAttribute<size_t>(element, "nbits", 12);
+            }
+        }
+        return 12;
+    }
+
+    static size_t Index(const String& tag)
+    {
+        switch ( tag.empty() ? 'W' : tag.c_str()[0] )
+        {
+            case 'X': return 0;
+            case 'Y': return 1;
+            case 'Z': return 2;
+            default: return 3;
+        }
+    }
+
+    const SmallestThreeQuantization<T> m_q;
+    T m_components[4];
+    size_t m_next;
+};
+
+typedef BoundedVectorPolicy<F64> BoundedVectorF64Policy;
+typedef BoundedVectorPolicy<F32> BoundedVectorF32Policy;
+typedef AnglePolicy<F64> AngleF64Policy;
+typedef AnglePolicy<F32> AngleF32Policy;
+typedef QuaternionPolicy<F64> QuaternionF64Policy;
+typedef QuaternionPolicy<F32> QuaternionF32Policy;
+
+#endif
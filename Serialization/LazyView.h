@@ -0,0 +1,268 @@
+//
+//  LazyView.h
+//  SerializationFramework
+//
+//  Created by Lin Luo on 05/01/2015.
+//
+
+#ifndef SerializationFramework_LazyView_h
+#define SerializationFramework_LazyView_h
+
+#include "Serialization.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Zero-copy lazy decoding
+//
+// Decoding a message materializes all of it, every String, Buffer and object, while the receiver often only looks at a field or two
+// (e.g. to route on an ID). BytesView references the bytes of a String or a Buffer in the input buffer instead of copying them out;
+// Lazy<T> is a length-prefixed field, encoded as a Buffer of its own, which the reader steps over at once and decodes on demand right
+// out of the input buffer; and SerializationView reads a buffer field by field, skipping over the ones it has no interest in.
+// NB: the views reference the input buffer, which has to outlive them and stay put (e.g. not be resized); they do not keep the policy
+// container of the serialization they were read from, so a Lazy is decoded with the container given then (Decode, Get)
+
+// The bytes of a String or a Buffer (of the default policy), in place
+struct BytesView
+{
+    const Byte* data;
+    size_t size;
+
+    BytesView()
+        : data(nullptr)
+        , size(0)
+    {
+    }
+
+    BytesView(const Byte* data_, size_t size_)
+        : data(data_)
+        , size(size_)
+    {
+    }
+
+    bool empty() const
+    {
+        return size == 0;
+    }
+
+    String ToString() const
+    {
+        return String( (const char*)data, size );
+    }
+
+    Buffer ToBuffer() const
+    {
+        return Buffer(data, data + size);
+    }
+
+    bool operator==(const String& s) const
+    {
+        return s.size() == size && ( size == 0 || memcmp(s.data(), data, size) == 0 );
+    }
+
+    bool operator!=(const String& s) const
+    {
+        return !(*this == s);
+    }
+};
+
+// A field encoded in a nested serialization, and prefixed with its length (the wire format of a Buffer), so that the reader steps over
+// it without decoding it; the value is then decoded on first access, out of the bytes referenced in the input. A Lazy that is written
+// out again before being decoded (e.g. relayed) goes as the same bytes, without ever being decoded.
+// NB: the value is decoded apart from the rest of the message, so it is not to go through the stateful policies or the scopes that
+// depend on the order of the fields (e.g. DeltaScope, StringDictionaryScope, MetaSchemaScope); nor is it supported within Columnar
+template <typename T>
+class Lazy
+{
+public:
+    Lazy()
+        : m_decoded(true)
+    {
+    }
+
+    Lazy(const T& value)
+        : m_value(value)
+        , m_decoded(true)
+    {
+    }
+
+    Lazy(T&& value)
+        : m_value( std::move(value) )
+        , m_decoded(true)
+    {
+    }
+
+    Lazy& operator=(const T& value)
+    {
+        m_value = value;
+        m_decoded = true;
+        return *this;
+    }
+
+    Lazy& operator=(T&& value)
+    {
+        m_value = std::move(value);
+        m_decoded = true;
+        return *this;
+    }
+
+    // whether the value has been decoded (or set) yet
+    bool IsDecoded() const
+    {
+        return m_decoded;
+    }
+
+    // the encoded value in the input, empty unless it has been read
+    const BytesView& GetBytes() const
+    {
+        return m_bytes;
+    }
+
+    // decodes the value if not yet, with the policies of the container (e.g. that of the serialization it has been read from), false if
+    // it does not decode
+    bool Decode(DataPolicyContainer<CoreSerializationTypes>& container)
+    {
+        if (m_decoded)
+        {
+            return true;
+        }
+
+        BitStreamInput stream(m_bytes.data, m_bytes.size);
+        SerializationInput<CoreSerializationTypes> input(container, stream, false);
+        if ( !::Serialize(input, m_value) )
+        {
+            return false;
+        }
+
+        m_decoded = true;
+        return true;
+    }
+
+    // the value, decoded on first access; throws if it does not decode
+    T& Get(DataPolicyContainer<CoreSerializationTypes>& container)
+    {
+        if ( !Decode(container) )
+        {
+            throw -1;
+        }
+        return m_value;
+    }
+
+    bool Serialize(ISerializationType& s)
+    {
+        if ( s.IsReading() )
+        {
+            const Byte* data = nullptr;
+            size_t size = 0;
+            if ( !s.GetBitStreamInput().ReadInPlace(data, size) )
+            {
+                return false;
+            }
+
+            m_value = T();
+            m_bytes = BytesView(data, size);
+            m_decoded = false;
+            return true;
+        }
+
+        Buffer blob;
+        if (m_decoded)
+        {
+            BitStreamOutput stream(blob);
+            SerializationOutput<CoreSerializationTypes> output(s.GetDataPolicyContainer(), stream, false);
+            if ( !::Serialize(output, m_value) )
+            {
+                return false;
+            }
+        }
+        else
+        {
+            blob = m_bytes.ToBuffer();
+        }
+
+        SERIALIZE(s, blob);
+        return true;
+    }
+
+private:
+    T m_value;
+
+    BytesView m_bytes;
+    bool m_decoded;
+};
+
+// Reads a serialized buffer, or a part of it, one field at a time; the fields are read in their order, like with SerializationInput,
+// and the ones not of interest are skipped over with as little decoding as their encoding allows
+template <typename TL>
+class SerializationView;
+
+template <typename... Ts>
+class SerializationView< TypeList<Ts...> >
+{
+public:
+    SerializationView(DataPolicyContainer< TypeList<Ts...> >& container, const Buffer& buffer, bool reset = true)
+        : m_stream(buffer)
+        , m_input(container, m_stream, reset)
+    {}
+
+    SerializationView(DataPolicyContainer< TypeList<Ts...> >& container, const BytesView& bytes, bool reset = true)
+        : m_stream(bytes.data, bytes.size)
+        , m_input(container, m_stream, reset)
+    {}
+
+    operator SerializationInput< TypeList<Ts...> >&()
+    {
+        return m_input;
+    }
+
+    template < typename T, typename = typename std::enable_if< TypeListContainsType< T, TypeList<Ts...> >::value >::type >
+    bool Read(T& v, const String& policy = "")
+    {
+        return ::Serialize(m_input, v, policy);
+    }
+
+    template < class C, typename = typename std::enable_if< !TypeListContainsType< C, TypeList<Ts...> >::value >::type >
+    bool Read(C& o)
+    {
+        return ::Serialize(m_input, o);
+    }
+
+    // a String or a Buffer of the default policy, in place
+    bool Read(BytesView& bytes)
+    {
+        return m_stream.ReadInPlace(bytes.data, bytes.size);
+    }
+
+    // NB: the Strings and Buffers of the default policy are skipped over in place, and the Lazy fields without being decoded;
+    // anything else is decoded and thrown away
+    template < typename T, typename = typename std::enable_if< TypeListContainsType< T, TypeList<Ts...> >::value >::type >
+    bool Skip(const String& policy = "")
+    {
+        if ( policy.empty() && ( std::is_same<T, String>::value || std::is_same<T, Buffer>::value ) )
+        {
+            BytesView bytes;
+            return Read(bytes);
+        }
+
+        T v = T();
+        return Read(v, policy);
+    }
+
+    template < class C, typename = typename std::enable_if< !TypeListContainsType< C, TypeList<Ts...> >::value >::type, typename = void >
+    bool Skip()
+    {
+        C o;
+        return Read(o);
+    }
+
+    size_t GetBitOffset() const
+    {
+        return m_stream.GetBitOffset();
+    }
+
+private:
+    BitStreamInput m_stream;
+    SerializationInput< TypeList<Ts...> > m_input;
+};
+
+typedef SerializationView<CoreSerializationTypes> SerializationViewType;
+
+#endif
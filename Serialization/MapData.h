@@ -0,0 +1,683 @@
+//
+//  MapData.h
+//  SerializationFramework
+//
+//  Created by Lin Luo on 05/01/2015.
+//
+
+#ifndef SerializationFramework_MapData_h
+#define SerializationFramework_MapData_h
+
+#include "Serialization.h"
+
+////////////////////////////////////////////////////////////////////////////////////
+// MapData below is the C++ serializable representation
+// In real world use case, this is constructed by parsing a PHP zval (zend_parse_parameter), Python PyObject (PyArg_ParseTuple), or Lua State on their respective C API side
+// There should be a PHP/Python/Lua version of the MapData represented in their respective native (PHP/Python/Lua/Etc.) format, and translated to the C++ MapData here
+//
+// Taking PHP as an example:
+//
+// A PHP C (zend) extension is created which expose two functions to the PHP code (this is probably *not* legal PHP code):
+//
+// $BinaryBlob = EncodeMapData($MapData);
+// $MapData = DecodeMapData($BinaryBlob);
+//
+// where $MapData is a native PHP construct which follows the MapData C++ definition (this is the translation protocol between PHP and C++)
+// The implementation of the C zend extension would carry the form similar to:
+// PHP_FUNCTION(EncodeMapData): which parses the PHP zval and convert it to C++ MapData for serialization
+// PHP_FUNCTION(DecodeMapData): which constructs a C++ MapData from a binary stream, and convert to a PHP variable.
+// And note that there is only one shared serialization code path, which means that the binary stream is conmpact and efficient to encode/decode
+
+// For demonstration purposes below, we just use the Setup function to feed some fake data in
+struct MapData
+{
+    struct March
+    {
+        U64 user_id;
+        U32 empire_id;
+        U32 city_id;
+        U32 army_id;
+
+        U32 dest_province_id;
+        U32 dest_chunk_id;
+        U32 dest_tile_id;
+        U32 from_province_id;
+        U32 from_chunk_id;
+        U32 from_tile_id;
+        U32 state;
+        U32 start_time;
+        U32 dest_time;
+        U32 type;
+        U32 alliance_id;
+
+        bool has_from_name;
+        String from_name;
+
+        bool has_dest_name;
+        String dest_name;
+
+        bool has_color;
+        U32 color;
+
+        bool has_target_alliance_id;
+        U32 target_alliance_id;
+
+        March()
+        : user_id(0)
+        , empire_id(0)
+        , city_id(0)
+        , army_id(0)
+        , dest_province_id(0)
+        , dest_chunk_id(0)
+        , dest_tile_id(0)
+        , from_province_id(0)
+        , from_chunk_id(0)
+        , from_tile_id(0)
+        , state(0)
+        , start_time(0)
+        , dest_time(0)
+        , type(0)
+        , alliance_id(0)
+        , has_from_name(false)
+        , has_dest_name(false)
+        , has_color(false), color(0)
+        , has_target_alliance_id(false), target_alliance_id(0)
+        {}
+
+        void Setup()
+        {
+            user_id = 999;
+            empire_id = 888;
+            city_id = 777;
+            army_id = 666;
+
+            dest_province_id = 555;
+            dest_chunk_id = 444;
+            dest_tile_id = 333;
+
+            from_province_id = 222;
+            from_chunk_id = 111;
+            from_tile_id = 999;
+
+            state = 23;
+            start_time = 2013;
+            dest_time = 2013;
+            type = 42;
+            alliance_id = 888;
+
+            has_from_name = true;
+            from_name = "luolin";
+
+            has_dest_name = true;
+            dest_name = "linluo";
+
+            has_color = true;
+            color = 111;
+
+            has_target_alliance_id = true;
+            target_alliance_id = 789;
+        }
+
+        bool Serialize(ISerializationType& s)
+        {
+            SERIALIZE(s, user_id);
+            SERIALIZE(s, empire_id);
+            SERIALIZE(s, city_id);
+            SERIALIZE(s, army_id);
+
+            SERIALIZE(s, dest_province_id);
+            SERIALIZE(s, dest_chunk_id);
+            SERIALIZE(s, dest_tile_id);
+            SERIALIZE(s, from_province_id);
+            SERIALIZE(s, from_chunk_id);
+            SERIALIZE(s, from_tile_id);
+            SERIALIZE(s, state);
+            SERIALIZE(s, start_time);
+            SERIALIZE(s, dest_time);
+            SERIALIZE(s, type);
+            SERIALIZE(s, alliance_id);
+
+            CONDITIONAL_SERIALIZE(s, has_from_name, from_name);
+            CONDITIONAL_SERIALIZE(s, has_dest_name, dest_name);
+            CONDITIONAL_SERIALIZE(s, has_color, color);
+            CONDITIONAL_SERIALIZE(s, has_target_alliance_id, target_alliance_id);
+
+            return true;
+        }
+    };
+
+    struct Alliance
+    {
+        U32 alliance_id;
+
+        bool has_alliance_name;
+        String alliance_name;
+
+        bool has_alliance_tag;
+        String alliance_tag;
+
+        bool has_alliance_rank;
+        U32 alliance_rank;
+
+        Alliance()
+        : alliance_id(0)
+        , has_alliance_name(false)
+        , has_alliance_tag(false)
+        , has_alliance_rank(false), alliance_rank(0)
+        {}
+
+        void Setup()
+        {
+            alliance_id = 456;
+
+            has_alliance_name = true;
+            alliance_name = "alliance_name";
+
+            has_alliance_tag = true;
+            alliance_tag = "alliance_tag";
+
+            has_alliance_rank = true;
+            alliance_rank = 1234;
+        }
+
+        bool Serialize(ISerializationType& s)
+        {
+            SERIALIZE(s, alliance_id);
+
+            CONDITIONAL_SERIALIZE(s, has_alliance_name, alliance_name);
+            CONDITIONAL_SERIALIZE(s, has_alliance_tag, alliance_tag);
+            CONDITIONAL_SERIALIZE(s, has_alliance_rank, alliance_rank);
+
+            return true;
+        }
+    };
+
+    struct Empire
+    {
+        U64 user_id;
+        U32 empire_id;
+
+        bool has_empire_name;
+        String empire_name;
+
+        bool has_empire_owner;
+        String empire_owner;
+
+        bool has_empire_portrait;
+        U32 empire_portrait;
+
+        bool has_power;
+        U32 power;
+
+        bool has_alliance_id;
+        U64 alliance_id;
+
+        bool has_title_id;
+        U32 title_id;
+
+        Empire()
+        : user_id(0)
+        , empire_id(0)
+        , has_empire_name(false)
+        , has_empire_owner(false)
+        , has_empire_portrait(false), empire_portrait(0)
+        , has_power(false), power(0)
+        , has_alliance_id(false), alliance_id(0)
+        , has_title_id(false), title_id(0)
+        {}
+
+        void Setup()
+        {
+            user_id = 666;
+            empire_id = 888;
+
+            has_empire_name = true;
+            empire_name = "empire_name";
+
+            has_empire_owner = true;
+            empire_owner = "empire_owner";
+
+            has_empire_portrait = true;
+            empire_portrait = 4545;
+
+            has_power = true;
+            power = 4567;
+
+            has_alliance_id = true;
+            alliance_id = 1234;
+
+            has_title_id = true;
+            title_id = 444;
+        }
+
+        bool Serialize(ISerializationType& s)
+        {
+            SERIALIZE(s, user_id);
+            SERIALIZE(s, empire_id);
+
+            CONDITIONAL_SERIALIZE(s, has_empire_name, empire_name);
+            CONDITIONAL_SERIALIZE(s, has_empire_owner, empire_owner);
+            CONDITIONAL_SERIALIZE(s, has_empire_portrait, empire_portrait);
+            CONDITIONAL_SERIALIZE(s, has_power, power);
+            CONDITIONAL_SERIALIZE(s, has_alliance_id, alliance_id);
+            CONDITIONAL_SERIALIZE(s, has_title_id, title_id);
+
+            return true;
+        }
+    };
+
+    struct Bounty
+    {
+        String username;
+        U32 bounty;
+        String heroname;
+
+        Bounty()
+        : bounty(0)
+        {}
+
+        void Setup()
+        {
+            username = "luolin";
+            bounty = 1000;
+            heroname = "dejavu";
+        }
+
+        bool Serialize(ISerializationType& s)
+        {
+            SERIALIZE(s, username);
+            SERIALIZE(s, bounty);
+            SERIALIZE(s, heroname);
+
+            return true;
+        }
+    };
+
+    struct Wonder
+    {
+        bool has_wonder_name;
+        String wonder_name;
+
+        bool has_wonder_name_id;
+        U32 wonder_name_id;
+
+        bool has_king_name;
+        String king_name;
+
+        bool has_alliance_id;
+        U64 alliance_id;
+
+        bool has_scout_cost;
+        U32 scout_cost;
+
+        bool has_protection_start_time;
+        U32 protection_start_time;
+
+        Wonder()
+        : has_wonder_name(false)
+        , has_wonder_name_id(false), wonder_name_id(0)
+        , has_king_name(false)
+        , has_alliance_id(false), alliance_id(0)
+        , has_scout_cost(false), scout_cost(0)
+        , has_protection_start_time(false), protection_start_time(0)
+        {}
+
+        void Setup()
+        {
+            has_wonder_name = true;
+            wonder_name = "abc";
+
+            has_wonder_name_id = true;
+            wonder_name_id = 1212;
+
+            has_king_name = true;
+            king_name = "Lin";
+
+            has_alliance_id = true;
+            alliance_id = 12345678;
+
+            has_scout_cost = true;
+            scout_cost = 6789;
+
+            has_protection_start_time = true;
+            protection_start_time = 2013;
+        }
+
+        bool Serialize(ISerializationType& s)
+        {
+            CONDITIONAL_SERIALIZE(s, has_wonder_name, wonder_name);
+            CONDITIONAL_SERIALIZE(s, has_wonder_name_id, wonder_name_id);
+            CONDITIONAL_SERIALIZE(s, has_king_name, king_name);
+            CONDITIONAL_SERIALIZE(s, has_alliance_id, alliance_id);
+            CONDITIONAL_SERIALIZE(s, has_scout_cost, scout_cost);
+            CONDITIONAL_SERIALIZE(s, has_protection_start_time, protection_start_time);
+
+            return true;
+        }
+    };
+
+    struct Army
+    {
+        U64 user_id;
+        U32 empire_id;
+        U32 city_id;
+        U32 army_id;
+
+        bool has_scout_cost;
+        U32 scout_cost;
+
+        bool has_army_load;
+        U32 army_load;
+
+        Army()
+        : user_id(0)
+        , empire_id(0)
+        , city_id(0)
+        , army_id(0)
+        , has_scout_cost(false), scout_cost(0)
+        , has_army_load(false), army_load(0)
+        {}
+
+        void Setup()
+        {
+            user_id = 12345678;
+            empire_id = 1234;
+            city_id = 4321;
+            army_id = 1122;
+
+            has_scout_cost = true;
+            scout_cost = 9999;
+
+            has_army_load = true;
+            army_load = 7777;
+        }
+
+        bool Serialize(ISerializationType& s)
+        {
+            SERIALIZE(s, user_id);
+            SERIALIZE(s, empire_id);
+            SERIALIZE(s, city_id);
+            SERIALIZE(s, army_id);
+
+            CONDITIONAL_SERIALIZE(s, has_scout_cost, scout_cost);
+            CONDITIONAL_SERIALIZE(s, has_army_load, army_load);
+
+            return true;
+        }
+    };
+
+    struct City
+    {
+        U64 user_id;
+        U32 empire_id;
+        U32 city_id;
+
+        bool has_scout_cost;
+        U32 scout_cost;
+
+        bool has_city_name;
+        String city_name;
+
+        bool has_city_level;
+        U32 city_level;
+
+        bool has_truce;
+        bool truce;
+
+        bool has_last_state;
+        U32 last_state;
+
+        bool has_state_timestamp;
+        U32 state_timestamp;
+
+        bool has_bounties;
+        std::deque<Bounty> bounties;
+
+        City()
+        : user_id(0)
+        , empire_id(0)
+        , city_id(0)
+        , has_scout_cost(false), scout_cost(0)
+        , has_city_name(false)
+        , has_city_level(false), city_level(0)
+        , has_truce(false), truce(false)
+        , has_last_state(false), last_state(0)
+        , has_state_timestamp(false), state_timestamp(0)
+        , has_bounties(false)
+        {}
+
+        void Setup()
+        {
+            user_id = 1234;
+            empire_id = 8888;
+            city_id = 4567;
+
+            has_scout_cost = true;
+            scout_cost = 55;
+
+            has_city_level = true;
+            city_level = 33;
+
+            has_truce = true;
+            truce = false;
+
+            has_last_state = true;
+            last_state = 666;
+
+            has_state_timestamp = true;
+            state_timestamp = 5656;
+
+            has_bounties = true;
+            bounties.resize(10);
+            for (auto& bounty : bounties)
+            {
+                bounty.Setup();
+            }
+        }
+
+        bool Serialize(ISerializationType& s)
+        {
+            SERIALIZE(s, user_id);
+            SERIALIZE(s, empire_id);
+            SERIALIZE(s, city_id);
+
+            CONDITIONAL_SERIALIZE(s, has_scout_cost, scout_cost);
+            CONDITIONAL_SERIALIZE(s, has_city_name, city_name);
+            CONDITIONAL_SERIALIZE(s, has_city_level, city_level);
+            CONDITIONAL_SERIALIZE(s, has_truce, truce);
+            CONDITIONAL_SERIALIZE(s, has_last_state, last_state);
+            CONDITIONAL_SERIALIZE(s, has_state_timestamp, state_timestamp);
+
+            CONDITIONAL_SERIALIZE(s, has_bounties, bounties);
+
+            return true;
+        }
+    };
+
+    struct Tile
+    {
+        U32 id;
+
+        bool has_overlay;
+        U32 overlay;
+
+        bool has_city;
+        City city;
+
+        bool has_army;
+        Army army;
+
+        bool has_wonder;
+        Wonder wonder;
+
+        // resource tile information
+        bool has_r_level;
+        U32 r_level;
+
+        bool has_r_amount;
+        U32 r_amount;
+
+        bool has_r_gather_start_time;
+        U32 r_gather_start_time;
+
+        bool has_add_drain_rate;
+        U32 add_drain_rate;
+
+        Tile()
+        : id(0)
+        , has_overlay(false), overlay(0)
+        , has_city(false)
+        , has_army(false)
+        , has_wonder(false)
+        , has_r_level(false), r_level(0)
+        , has_r_amount(false), r_amount(0)
+        , has_r_gather_start_time(false), r_gather_start_time(0)
+        , has_add_drain_rate(false), add_drain_rate(0)
+        {}
+
+        void Setup()
+        {
+            id = 333;
+
+            has_overlay = true;
+            overlay = 1;
+
+            has_city = true;
+            city.Setup();
+
+            has_army = true;
+            army.Setup();
+
+            has_wonder = true;
+            wonder.Setup();
+
+            has_r_level = true;
+            r_level = 50;
+
+            has_r_amount = true;
+            r_amount = 100;
+
+            has_r_gather_start_time = true;
+            r_gather_start_time = 1000;
+
+            has_add_drain_rate = true;
+            add_drain_rate = 100;
+        }
+
+        bool Serialize(ISerializationType& s)
+        {
+            SERIALIZE(s, id);
+
+            CONDITIONAL_SERIALIZE(s, has_overlay, overlay);
+            CONDITIONAL_SERIALIZE(s, has_city, city);
+            CONDITIONAL_SERIALIZE(s, has_army, army);
+            CONDITIONAL_SERIALIZE(s, has_wonder, wonder);
+            CONDITIONAL_SERIALIZE(s, has_r_level, r_level);
+            CONDITIONAL_SERIALIZE(s, has_r_amount, r_amount);
+            CONDITIONAL_SERIALIZE(s, has_r_gather_start_time, r_gather_start_time);
+            CONDITIONAL_SERIALIZE(s, has_add_drain_rate, add_drain_rate);
+
+            return true;
+        }
+    };
+
+    struct Chunk
+    {
+        U32 p_id;
+        U32 c_id;
+
+        bool has_tiles;
+        std::deque<Tile> tiles;
+
+        Chunk()
+        : p_id(0)
+        , c_id(0)
+        , has_tiles(false)
+        {}
+
+        void Setup()
+        {
+            p_id = 111;
+            c_id = 222;
+
+            has_tiles = true;
+            tiles.resize(10);
+            for (auto& tile : tiles)
+            {
+                tile.Setup();
+            }
+        }
+
+        bool Serialize(ISerializationType& s)
+        {
+            SERIALIZE(s, p_id);
+            SERIALIZE(s, c_id);
+
+            CONDITIONAL_SERIALIZE(s, has_tiles, tiles);
+
+            return true;
+        }
+    };
+
+    bool has_chunks;
+    std::deque<Chunk> chunks;
+
+    bool has_marches;
+    std::deque<March> marches;
+
+    bool has_empires;
+    std::deque<Empire> empires;
+
+    bool has_alliances;
+    std::deque<Alliance> alliances;
+
+    MapData()
+    : has_chunks(false)
+    , has_marches(false)
+    , has_empires(false)
+    , has_alliances(false)
+    {}
+
+    void Setup()
+    {
+        has_chunks = true;
+        chunks.resize(10);
+        for (auto& chunk : chunks)
+        {
+            chunk.Setup();
+        }
+
+        has_marches = true;
+        marches.resize(10);
+        for (auto& march : marches)
+        {
+            march.Setup();
+        }
+
+        has_empires = true;
+        empires.resize(10);
+        for (auto& empire : empires)
+        {
+            empire.Setup();
+        }
+
+        has_alliances = true;
+        alliances.resize(10);
+        for (auto& alliance : alliances)
+        {
+            alliance.Setup();
+        }
+    }
+
+    bool Serialize(ISerializationType& s)
+    {
+        CONDITIONAL_SERIALIZE(s, has_chunks, chunks);
+        CONDITIONAL_SERIALIZE(s, has_marches, marches);
+        CONDITIONAL_SERIALIZE(s, has_empires, empires);
+        CONDITIONAL_SERIALIZE(s, has_alliances, alliances);
+
+        return true;
+    }
+};
+
+#endif
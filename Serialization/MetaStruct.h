@@ -11,6 +11,300 @@
 #include "Variant.h"
 #include "MetadataProcessor.h"
 
+// NB: all the nodes of a tree are allocated from the current arena if any, so a decoded message can live in one arena (see Arena.h)
+
+////////////////////////////////////////////////////////////////////////////////
+// Schema compiled encoding
+//
+// The schema of a Struct is its name, and the names and value types of its fields, in order. Within a MetaSchemaScope, a Struct is
+// encoded as the ID of its schema followed by the bare values of its fields, the names and type indices only going along with the
+// definition of the ID; and an array of Structs of the same schema is encoded column by column, with the schema once for all.
+// The IDs are either pre-shared (MetaSchemaRegistry::Register on both ends, in the same order, before any message), or defined in
+// the messages: the sender refers to a defined ID across messages only once the receiver has acknowledged it back
+// (MetaSchemaRegistry::Acknowledge), and defines it again in each message until then. The receiver acknowledges the IDs defined
+// without any gap, so the definitions only go into the reliable messages (as with StringDictionaryScope); an unreliable one refers
+// to the acknowledged IDs, and has the other schemas inline. For the same reason, the sender commits its scope once the message is
+// sent (Commit); the IDs assigned within a scope that is not committed are taken back.
+// Outside of any scope, the Structs are encoded with all the names and type indices, as they are.
+// NB: a message is measured (SerializationMeasureWrapper) in a scope of its own, since the scope remembers the IDs it has defined
+
+struct MetaSchema
+{
+    static const U8 TYPE_NONE = 0xff; // a field without value
+    static const U32 N_MAX_FIELDS = 1024;
+
+    String name;
+    std::vector<String> fields;
+    std::vector<U8> types; // the type indices of the field values (see Variant::GetIndex)
+
+    bool operator==(const MetaSchema& rhs) const
+    {
+        return name == rhs.name && fields == rhs.fields && types == rhs.types;
+    }
+
+    size_t Hash() const
+    {
+        size_t h = name.hash();
+        for ( size_t i = 0, sz = fields.size(); i < sz; ++i )
+        {
+            h = ( h * 1099511628211ULL ) ^ fields[i].hash() ^ types[i];
+        }
+        return h;
+    }
+
+    // the definition
+    bool Serialize(ISerializationType& s)
+    {
+        SERIALIZE_P(s, name, "unique");
+
+        U32 sz = (U32)fields.size();
+        SERIALIZE(s, sz);
+        if ( s.IsReading() )
+        {
+            if (sz > N_MAX_FIELDS)
+            {
+                return false;
+            }
+            fields.resize(sz);
+            types.resize(sz);
+        }
+
+        for (size_t i = 0; i < sz; ++i)
+        {
+            SERIALIZE_P(s, fields[i], "unique");
+            SERIALIZE(s, types[i]);
+        }
+
+        return true;
+    }
+};
+
+class MetaSchemaRegistry
+{
+public:
+    static const U32 N_MAX_SCHEMAS = 4096; // the schemas past this are defined inline, for the instance only
+
+    MetaSchemaRegistry()
+        : m_acknowledged(0)
+        , m_ndefined(0)
+    {}
+
+    // pre-shares the schema, which is then referred to by ID right away
+    U32 Register(const MetaSchema& schema)
+    {
+        auto it = m_ids.find(schema);
+        if ( it != m_ids.end() )
+        {
+            return it->second;
+        }
+
+        U32 id = (U32)m_ids.size();
+        m_ids.emplace(schema, id);
+        if (m_acknowledged == id)
+        {
+            ++m_acknowledged;
+        }
+
+        Define(id, schema);
+        return id;
+    }
+
+    // sender: the receiver has got the schemas of the IDs below count, so they are referred to by ID from now on
+    void Acknowledge(U32 count)
+    {
+        if ( count > m_acknowledged && count <= m_ids.size() )
+        {
+            m_acknowledged = count;
+        }
+    }
+
+    // receiver: the number of schemas defined so far without any gap, to be acknowledged back to the sender
+    U32 GetNumDefined() const
+    {
+        return m_ndefined;
+    }
+
+private:
+    friend class MetaSchemaScope;
+
+    struct Hash
+    {
+        size_t operator()(const MetaSchema& schema) const
+        {
+            return schema.Hash();
+        }
+    };
+
+    const MetaSchema* Find(U32 id) const
+    {
+        return id < m_defined.size() && m_defined[id] ? &m_schemas[id] : nullptr;
+    }
+
+    // NB: an ID is defined once, and the schemas never move, since the decoding of the values of one may define the others (the
+    // nested Structs)
+    void Define(U32 id, const MetaSchema& schema)
+    {
+        if ( id >= m_schemas.size() )
+        {
+            m_schemas.resize(id + 1);
+            m_defined.resize(id + 1, false);
+        }
+        if (m_defined[id])
+        {
+            return;
+        }
+        m_schemas[id] = schema;
+        m_defined[id] = true;
+
+        while ( m_ndefined < m_defined.size() && m_defined[m_ndefined] )
+        {
+            ++m_ndefined;
+        }
+    }
+
+    // sender
+    std::unordered_map<MetaSchema, U32, Hash> m_ids;
+    U32 m_acknowledged;
+
+    // receiver
+    std::deque<MetaSchema> m_schemas;
+    std::vector<bool> m_defined;
+    U32 m_ndefined;
+};
+
+class MetaSchemaScope
+{
+public:
+    MetaSchemaScope(MetaSchemaRegistry& registry, bool reliable = true)
+        : m_registry(registry)
+        , m_reliable(reliable)
+        , m_defined(false)
+        , m_committed(false)
+        , m_previous( Top() )
+    {
+        Top() = this;
+    }
+
+    ~MetaSchemaScope()
+    {
+        Top() = m_previous;
+
+        if (!m_committed)
+        {
+            // NB: the IDs are assigned in order, so the ones of the scope are the last ones
+            for (auto it = m_added.rbegin(); it != m_added.rend(); ++it)
+            {
+                m_registry.m_ids.erase(*it);
+            }
+        }
+    }
+
+    // sender: the message has been sent, so the IDs assigned within the scope are kept
+    void Commit()
+    {
+        m_committed = true;
+    }
+
+    // the innermost scope of the thread, nullptr if none
+    static MetaSchemaScope* Current()
+    {
+        return Top();
+    }
+
+    // whether any schema has been defined within the scope; for the receiver, an acknowledgement is due
+    bool HasDefinitions() const
+    {
+        return m_defined;
+    }
+
+    // a reference: 1, ID; a definition: 0, 1, ID, schema; otherwise: 0, 0, schema
+    bool Write(ISerializationType& s, const MetaSchema& schema)
+    {
+        auto it = m_registry.m_ids.find(schema);
+        if ( it != m_registry.m_ids.end() && ( it->second < m_registry.m_acknowledged || m_written.count(it->second) ) )
+        {
+            bool known = true;
+            SERIALIZE(s, known);
+            SERIALIZE(s, it->second);
+            return true;
+        }
+
+        bool known = false;
+        bool define = m_reliable && ( it != m_registry.m_ids.end() || m_registry.m_ids.size() < MetaSchemaRegistry::N_MAX_SCHEMAS );
+        SERIALIZE(s, known);
+        SERIALIZE(s, define);
+        if (define)
+        {
+            if ( it == m_registry.m_ids.end() )
+            {
+                it = m_registry.m_ids.emplace( schema, (U32)m_registry.m_ids.size() ).first;
+                m_added.push_back(schema);
+            }
+            SERIALIZE(s, it->second);
+            m_written.insert(it->second);
+            m_defined = true;
+        }
+
+        return const_cast<MetaSchema&>(schema).Serialize(s);
+    }
+
+    // the schema is either one of the registry, or the inline one
+    bool Read(ISerializationType& s, MetaSchema& inlined, const MetaSchema*& schema)
+    {
+        bool known = false;
+        SERIALIZE(s, known);
+
+        U32 id = 0;
+        if (known)
+        {
+            SERIALIZE(s, id);
+            schema = m_registry.Find(id);
+            return schema != nullptr; // NB: only an unacknowledged ID can be missing, which is a protocol error
+        }
+
+        bool define = false;
+        SERIALIZE(s, define);
+        if (define)
+        {
+            SERIALIZE(s, id);
+            if (id >= MetaSchemaRegistry::N_MAX_SCHEMAS)
+            {
+                return false;
+            }
+        }
+
+        if ( !inlined.Serialize(s) )
+        {
+            return false;
+        }
+
+        if (define)
+        {
+            m_registry.Define(id, inlined);
+            m_defined = true;
+        }
+
+        schema = &inlined;
+        return true;
+    }
+
+private:
+    static MetaSchemaScope*& Top()
+    {
+        static thread_local MetaSchemaScope* s_top = nullptr;
+        return s_top;
+    }
+
+    MetaSchemaRegistry& m_registry;
+    const bool m_reliable;
+    bool m_defined;
+    bool m_committed;
+    std::unordered_set<U32> m_written; // sender: the IDs defined in the message so far
+    std::vector<MetaSchema> m_added;   // sender: the schemas assigned an ID within the scope
+
+    MetaSchemaScope* const m_previous;
+};
+
 template <typename TL>
 class Struct;
 
@@ -21,16 +315,16 @@ template <typename... Ts>
 class Field< TypeList<Ts...> >
 {
 public:
-    struct ValueType : Variant< TypeList< Ts..., RecursiveWrapper< Struct< TypeList<Ts...> > >, std::deque< RecursiveWrapper<ValueType> > > >
+    struct ValueType : Variant< TypeList< Ts..., RecursiveWrapper< Struct< TypeList<Ts...> > >, std::deque< RecursiveWrapper<ValueType>, ArenaAllocator< RecursiveWrapper<ValueType> > > > >
     {
-        using Variant< TypeList< Ts..., RecursiveWrapper< Struct< TypeList<Ts...> > >, std::deque< RecursiveWrapper<ValueType> > > >::Variant;
+        using Variant< TypeList< Ts..., RecursiveWrapper< Struct< TypeList<Ts...> > >, std::deque< RecursiveWrapper<ValueType>, ArenaAllocator< RecursiveWrapper<ValueType> > > > >::Variant;
 
-        typedef std::deque< RecursiveWrapper<ValueType> > ArrayType;
+        typedef std::deque< RecursiveWrapper<ValueType>, ArenaAllocator< RecursiveWrapper<ValueType> > > ArrayType;
         typedef Struct< TypeList<Ts...> > StructType;
         
         bool Serialize(ISerializationType& s)
         {
-            return Variant< TypeList< Ts..., RecursiveWrapper< Struct< TypeList<Ts...> > >, std::deque< RecursiveWrapper<ValueType> > > >::Serialize(s);
+            return Variant< TypeList< Ts..., RecursiveWrapper< Struct< TypeList<Ts...> > >, std::deque< RecursiveWrapper<ValueType>, ArenaAllocator< RecursiveWrapper<ValueType> > > > >::Serialize(s);
         }
     };
 
@@ -67,20 +361,33 @@ public:
         return *m_value;
     }
 
+    ValueType& GetValue()
+    {
+        return *m_value;
+    }
+
+    // default constructs the value as the type of the index (see Variant::Reset)
+    ValueType& ResetValue(size_t index)
+    {
+        m_value = ArenaNew<ValueType>();
+        m_value->Reset(index);
+        return *m_value;
+    }
+
     void SetValue(const ValueType& value)
     {
-        m_value.reset( new ValueType(value) );
+        m_value = ArenaNew<ValueType>(value);
     }
 
     void SetValue(ValueType&& value)
     {
-        m_value.reset( new ValueType( std::move(value) ) );
+        m_value = ArenaNew<ValueType>( std::move(value) );
     }
 
     template <typename... Xs>
     void SetValue(Xs&&... xs)
     {
-        m_value.reset( new ValueType( std::forward<Xs>(xs)... ) );
+        m_value = ArenaNew<ValueType>( std::forward<Xs>(xs)... );
     }
 
     template <typename T>
@@ -90,7 +397,7 @@ public:
             typename std::conditional< std::is_same<T, typename ValueType::StructType>::value, RecursiveWrapper<typename ValueType::StructType>, void >::type >::type TT;
 
         static_assert( !std::is_same<TT, void>::value, "Invalid type" );
-        m_value.reset( new ValueType( (TT*)nullptr, (TT*)nullptr ) );
+        m_value = ArenaNew<ValueType>( (TT*)nullptr, (TT*)nullptr );
         return m_value->template Get<TT>();
     }
 
@@ -104,7 +411,7 @@ public:
         {
             if ( s.IsReading() )
             {
-                m_value.reset( new ValueType() );
+                m_value = ArenaNew<ValueType>();
             }
             SERIALIZE(s, *m_value);
         }
@@ -114,7 +421,7 @@ public:
 
 private:
     String m_name;
-    std::unique_ptr<ValueType> m_value;
+    ArenaPtr<ValueType> m_value;
 };
 
 template <typename... Ts>
@@ -122,6 +429,7 @@ class Struct< TypeList<Ts...> >
 {
 public:
     typedef Field< TypeList<Ts...> > FieldType;
+    typedef std::deque< FieldType, ArenaAllocator<FieldType> > FieldsType;
 
     Struct(const String& name = "")
         : m_name(name)
@@ -195,6 +503,12 @@ public:
 
     bool Serialize(ISerializationType& s)
     {
+        MetaSchemaScope* scope = MetaSchemaScope::Current();
+        if (scope)
+        {
+            return SerializeCompiled(s, *scope);
+        }
+
         SERIALIZE_P(s, m_name, "unique");
         SERIALIZE(s, m_fields);
 
@@ -209,15 +523,236 @@ public:
         return true;
     }
 
-    const std::deque<FieldType>& GetFields() const
+    const FieldsType& GetFields() const
     {
         return m_fields;
     }
 
+    MetaSchema GetSchema() const
+    {
+        MetaSchema schema;
+        schema.name = m_name;
+        schema.fields.reserve( m_fields.size() );
+        schema.types.reserve( m_fields.size() );
+        for (const auto& field : m_fields)
+        {
+            schema.fields.push_back( field.GetName() );
+            schema.types.push_back( field.HasValue() ? (U8)field.GetValue().GetIndex() : MetaSchema::TYPE_NONE );
+        }
+        return schema;
+    }
+
+    bool HasSchema(const MetaSchema& schema) const
+    {
+        if ( m_name != schema.name || m_fields.size() != schema.fields.size() )
+        {
+            return false;
+        }
+
+        for ( size_t i = 0, sz = m_fields.size(); i < sz; ++i )
+        {
+            const FieldType& field = m_fields[i];
+            if ( field.GetName() != schema.fields[i] || ( field.HasValue() ? (U8)field.GetValue().GetIndex() : MetaSchema::TYPE_NONE ) != schema.types[i] )
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
 private:
+    typedef typename FieldType::ValueType ValueType;
+    typedef typename ValueType::ArrayType ArrayType;
+
+    // the fields of the schema, with their values default constructed
+    bool Build(const MetaSchema& schema)
+    {
+        m_name = schema.name;
+        m_fields.clear();
+        m_mappings.clear();
+        for ( size_t i = 0, sz = schema.fields.size(); i < sz; ++i )
+        {
+            FieldType& field = AddField( schema.fields[i] );
+            if (schema.types[i] != MetaSchema::TYPE_NONE)
+            {
+                field.ResetValue( schema.types[i] );
+            }
+        }
+
+        return m_fields.size() == schema.fields.size(); // NB: the names of the fields are unique
+    }
+
+    bool SerializeCompiled(ISerializationType& s, MetaSchemaScope& scope)
+    {
+        if ( !s.IsReading() )
+        {
+            MetaSchema schema = GetSchema();
+            return scope.Write(s, schema) && SerializeValues(s, scope, schema);
+        }
+
+        MetaSchema inlined;
+        const MetaSchema* schema = nullptr;
+        if ( !scope.Read(s, inlined, schema) )
+        {
+            return false;
+        }
+
+        return Build(*schema) && SerializeValues(s, scope, *schema);
+    }
+
+    bool SerializeValues(ISerializationType& s, MetaSchemaScope& scope, const MetaSchema& schema)
+    {
+        for ( size_t i = 0, sz = schema.types.size(); i < sz; ++i )
+        {
+            if ( schema.types[i] != MetaSchema::TYPE_NONE && !SerializeValue( s, scope, m_fields[i].GetValue() ) )
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // the value without its type index, which goes with the schema
+    struct CompiledSerializer
+    {
+        ISerializationType& s;
+        MetaSchemaScope& scope;
+        bool r;
+
+        CompiledSerializer(ISerializationType& s_, MetaSchemaScope& scope_)
+            : s(s_)
+            , scope(scope_)
+            , r(false)
+        {
+        }
+
+        template <typename T>
+        void operator()(T& t)
+        {
+            r = ::Serialize(s, t);
+        }
+
+        void operator()(Struct& t)
+        {
+            r = t.SerializeCompiled(s, scope);
+        }
+
+        void operator()(ArrayType& a)
+        {
+            r = SerializeArray(s, scope, a);
+        }
+    };
+
+    static bool SerializeValue(ISerializationType& s, MetaSchemaScope& scope, ValueType& v)
+    {
+        CompiledSerializer serializer(s, scope);
+        v.Apply(serializer);
+        return serializer.r;
+    }
+
+    static Struct& Element(ArrayType& a, size_t i)
+    {
+        return static_cast<ValueType&>(a[i]).template Get< RecursiveWrapper<Struct> >();
+    }
+
+    // the arrays of Structs of the same schema go column by column, the others element by element, with their type indices
+    static bool SerializeArray(ISerializationType& s, MetaSchemaScope& scope, ArrayType& a)
+    {
+        U32 sz = (U32)a.size();
+        SERIALIZE(s, sz);
+        if ( s.IsReading() )
+        {
+            a.clear();
+            a.resize(sz);
+        }
+
+        if (sz == 0)
+        {
+            return true;
+        }
+
+        static const size_t STRUCT_INDEX = TypeListTypeIndex< RecursiveWrapper<Struct>, TypeList< Ts..., RecursiveWrapper<Struct>, ArrayType > >::value;
+
+        MetaSchema inlined;
+        bool columnar = false;
+        if ( !s.IsReading() && static_cast<ValueType&>(a[0]).GetIndex() == STRUCT_INDEX )
+        {
+            inlined = Element(a, 0).GetSchema();
+            columnar = true;
+            for ( size_t i = 1; columnar && i < sz; ++i )
+            {
+                columnar = static_cast<ValueType&>(a[i]).GetIndex() == STRUCT_INDEX && Element(a, i).HasSchema(inlined);
+            }
+        }
+        SERIALIZE(s, columnar);
+
+        if (!columnar)
+        {
+            for (size_t i = 0; i < sz; ++i)
+            {
+                ValueType& v = a[i];
+                U8 index = (U8)v.GetIndex();
+                SERIALIZE(s, index);
+                if ( s.IsReading() )
+                {
+                    v.Reset(index);
+                }
+
+                if ( !SerializeValue(s, scope, v) )
+                {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        const MetaSchema* schema = &inlined;
+        if ( s.IsReading() )
+        {
+            if ( !scope.Read(s, inlined, schema) )
+            {
+                return false;
+            }
+
+            for (size_t i = 0; i < sz; ++i)
+            {
+                static_cast<ValueType&>(a[i]).Reset(STRUCT_INDEX);
+                if ( !Element(a, i).Build(*schema) )
+                {
+                    return false;
+                }
+            }
+        }
+        else if ( !scope.Write(s, inlined) )
+        {
+            return false;
+        }
+
+        for ( size_t j = 0, nfields = schema->types.size(); j < nfields; ++j )
+        {
+            if (schema->types[j] == MetaSchema::TYPE_NONE)
+            {
+                continue;
+            }
+
+            for (size_t i = 0; i < sz; ++i)
+            {
+                if ( !SerializeValue( s, scope, Element(a, i).m_fields[j].GetValue() ) )
+                {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
     String m_name; // NB: name of the Struct (type/id), is actually different from a Field name (variable)
-    std::unordered_map<String, size_t> m_mappings; // field name to field index mapping
-    std::deque<FieldType> m_fields; // fields following the order of metadata definition
+    std::unordered_map< String, size_t, std::hash<String>, std::equal_to<String>, ArenaAllocator< std::pair<const String, size_t> > > m_mappings; // field name to field index mapping
+    FieldsType m_fields; // fields following the order of metadata definition
 };
 
 #endif
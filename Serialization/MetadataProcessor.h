@@ -42,4 +42,16 @@ struct IMetadataProcessor
     virtual ~IMetadataProcessor() {}
 };
 
+// The metadata given directly in the C++ code
+struct MetadataProcessorInline : IMetadataProcessor
+{
+    MetadataProcessorInline(const Elements& elements_)
+        : elements(elements_)
+    {}
+
+    const Elements& Retrieve() const { return elements; }
+
+    Elements elements;
+};
+
 #endif
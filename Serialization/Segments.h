@@ -0,0 +1,374 @@
+//
+//  Segments.h
+//  SerializationFramework
+//
+//  Created by Lin Luo on 05/01/2015.
+//
+
+#ifndef SerializationFramework_Segments_h
+#define SerializationFramework_Segments_h
+
+#include "Serialization.h"
+
+#include <thread>
+#include <condition_variable>
+
+////////////////////////////////////////////////////////////////////////////////
+// Segmented serialization
+//
+// A large serialization (e.g. the chunks of a map snapshot, or the objects sent to a newly connected client) is split into segments
+// independent of each other, each with a bit stream and a clone of the policies of its own (DataPolicyContainer::Setup), reset at
+// the start of the segment, so the stateful policies (e.g. UniqueStringPolicy) only ever refer within the segment. The segments are
+// encoded, and decoded, in parallel on a SegmentPool, and concatenated behind a small index:
+//     U32 the number of segments, U32 the size of each segment in bytes, then the segments, each from a byte boundary
+// NB: the segments run on the threads of the pool, so the thread local scopes of the caller (e.g. StringDictionaryScope, DeltaScope,
+// ArenaScope) do not extend to them; and the Strings are reference counted without any synchronization, so the segments should not
+// copy the same (shared, not interned) Strings at once
+
+// A fixed set of threads running the tasks of a batch in parallel, the calling thread included
+class SegmentPool
+{
+public:
+    SegmentPool(size_t nthreads = std::thread::hardware_concurrency())
+        : m_task(nullptr)
+        , m_ntasks(0)
+        , m_next(0)
+        , m_ndone(0)
+        , m_generation(0)
+        , m_stopping(false)
+    {
+        for (size_t i = 1; i < nthreads; ++i)
+        {
+            m_threads.emplace_back( [this]() { Work(); } );
+        }
+    }
+
+    ~SegmentPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_all();
+
+        for (auto& thread : m_threads)
+        {
+            thread.join();
+        }
+    }
+
+    SegmentPool(const SegmentPool&) = delete;
+    SegmentPool& operator=(const SegmentPool&) = delete;
+
+    size_t GetNumThreads() const
+    {
+        return m_threads.size() + 1;
+    }
+
+    // runs task(0) ~ task(ntasks - 1), and returns once they are all done
+    // NB: one batch at a time
+    void Run(size_t ntasks, const std::function<void (size_t)>& task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_task = &task;
+            m_ntasks = ntasks;
+            m_next = 0;
+            m_ndone = 0;
+            ++m_generation;
+        }
+        m_wake.notify_all();
+
+        RunTasks();
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait( lock, [this]() { return m_ndone == m_ntasks; } );
+        m_task = nullptr;
+    }
+
+private:
+    void Work()
+    {
+        size_t generation = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait( lock, [&]() { return m_stopping || ( m_generation != generation && m_task ); } );
+                if (m_stopping)
+                {
+                    return;
+                }
+                generation = m_generation;
+            }
+
+            RunTasks();
+        }
+    }
+
+    void RunTasks()
+    {
+        for (;;)
+        {
+            size_t i = 0;
+            const std::function<void (size_t)>* task = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if ( !m_task || m_next >= m_ntasks )
+                {
+                    return;
+                }
+                i = m_next++;
+                task = m_task;
+            }
+
+            (*task)(i);
+
+            bool last = false;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                last = ++m_ndone == m_ntasks;
+            }
+            if (last)
+            {
+                m_done.notify_all();
+            }
+        }
+    }
+
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+
+    const std::function<void (size_t)>* m_task;
+    size_t m_ntasks;
+    size_t m_next;
+    size_t m_ndone;
+    size_t m_generation;
+    bool m_stopping;
+};
+
+// The encoder of the segments, kept around across serializations, so the clones of the policies and the buffers are reused
+template <typename TL>
+class SegmentedOutput;
+
+template <typename... Ts>
+class SegmentedOutput< TypeList<Ts...> >
+{
+public:
+    typedef std::function<bool (ISerialization< TypeList<Ts...> >&)> Segment;
+
+    SegmentedOutput(const DataPolicyContainer< TypeList<Ts...> >& container, SegmentPool* pool = nullptr)
+        : m_container(container)
+        , m_pool(pool)
+    {
+    }
+
+    // the segments are encoded in the order they are added, but run in any order
+    void Add(const Segment& segment)
+    {
+        m_segments.push_back(segment);
+    }
+
+    // encodes the segments added since the last time into the output (replacing its contents), false if any of them fails
+    bool Encode(Buffer& output)
+    {
+        size_t nsegments = m_segments.size();
+        while ( m_slots.size() < nsegments )
+        {
+            m_slots.emplace_back( new Slot(m_container) );
+        }
+
+        std::function<void (size_t)> task = [this](size_t i)
+        {
+            Slot& slot = *m_slots[i];
+            slot.buffer.clear();
+            SerializationOutputWrapper< TypeList<Ts...> > o(slot.container, slot.buffer); // NB: the policies reset
+            slot.ok = m_segments[i]( (SerializationOutput< TypeList<Ts...> >&)o );
+        };
+
+        if (m_pool)
+        {
+            m_pool->Run(nsegments, task);
+        }
+        else
+        {
+            for (size_t i = 0; i < nsegments; ++i)
+            {
+                task(i);
+            }
+        }
+
+        bool ok = true;
+        output.clear();
+        {
+            BitStreamOutput stream(output);
+            stream.Write( (U32)nsegments );
+            for (size_t i = 0; i < nsegments; ++i)
+            {
+                stream.Write( (U32)m_slots[i]->buffer.size() );
+                ok = ok && m_slots[i]->ok;
+            }
+        }
+
+        // NB: the index ends at a byte boundary, the segments are copied over as they are
+        for (size_t i = 0; i < nsegments; ++i)
+        {
+            output.insert( output.end(), m_slots[i]->buffer.begin(), m_slots[i]->buffer.end() );
+        }
+
+        m_segments.clear();
+        return ok;
+    }
+
+private:
+    struct Slot
+    {
+        DataPolicyContainer< TypeList<Ts...> > container;
+        Buffer buffer;
+        bool ok;
+
+        Slot(const DataPolicyContainer< TypeList<Ts...> >& rhs)
+            : ok(false)
+        {
+            container.Setup(rhs);
+        }
+    };
+
+    const DataPolicyContainer< TypeList<Ts...> >& m_container;
+    SegmentPool* const m_pool;
+
+    std::vector<Segment> m_segments;
+    std::vector< std::unique_ptr<Slot> > m_slots;
+};
+
+// The decoder of the segments, read in place out of the input
+template <typename TL>
+class SegmentedInput;
+
+template <typename... Ts>
+class SegmentedInput< TypeList<Ts...> >
+{
+public:
+    typedef std::function<bool (size_t, ISerialization< TypeList<Ts...> >&)> Segment;
+
+    static const U32 N_MAX_SEGMENTS = 65536;
+
+    SegmentedInput(const DataPolicyContainer< TypeList<Ts...> >& container, SegmentPool* pool = nullptr)
+        : m_container(container)
+        , m_pool(pool)
+        , m_data(nullptr)
+    {
+    }
+
+    // reads the index, false if the input does not hold the segments it lists
+    bool Open(const Byte* data, size_t size)
+    {
+        m_offsets.clear();
+
+        BitStreamInput stream(data, size);
+        U32 nsegments = 0;
+        if ( !stream.Read(nsegments) || nsegments > N_MAX_SEGMENTS )
+        {
+            return false;
+        }
+
+        std::vector<U32> sizes(nsegments);
+        for (U32& sz : sizes)
+        {
+            if ( !stream.Read(sz) )
+            {
+                return false;
+            }
+        }
+
+        size_t offset = BITS2BYTES( stream.GetBitOffset() );
+        for (U32 sz : sizes)
+        {
+            if ( offset > size || sz > size - offset )
+            {
+                return false;
+            }
+            m_offsets.push_back(offset);
+            offset += sz;
+        }
+        m_offsets.push_back(offset);
+
+        m_data = data;
+        return true;
+    }
+
+    bool Open(const Buffer& input)
+    {
+        return Open( input.data(), input.size() );
+    }
+
+    size_t GetNumSegments() const
+    {
+        return m_offsets.empty() ? 0 : m_offsets.size() - 1;
+    }
+
+    // decodes each segment with the function, given the index of the segment, false if any of them fails
+    bool Decode(const Segment& segment)
+    {
+        size_t nsegments = GetNumSegments();
+        while ( m_slots.size() < nsegments )
+        {
+            m_slots.emplace_back( new Slot(m_container) );
+        }
+
+        std::function<void (size_t)> task = [&](size_t i)
+        {
+            Slot& slot = *m_slots[i];
+            BitStreamInput stream( m_data + m_offsets[i], m_offsets[i + 1] - m_offsets[i] );
+            SerializationInput< TypeList<Ts...> > input(slot.container, stream); // NB: the policies reset
+            slot.ok = segment(i, input);
+        };
+
+        if (m_pool)
+        {
+            m_pool->Run(nsegments, task);
+        }
+        else
+        {
+            for (size_t i = 0; i < nsegments; ++i)
+            {
+                task(i);
+            }
+        }
+
+        bool ok = true;
+        for (size_t i = 0; i < nsegments; ++i)
+        {
+            ok = ok && m_slots[i]->ok;
+        }
+        return ok;
+    }
+
+private:
+    struct Slot
+    {
+        DataPolicyContainer< TypeList<Ts...> > container;
+        bool ok;
+
+        Slot(const DataPolicyContainer< TypeList<Ts...> >& rhs)
+            : ok(false)
+        {
+            container.Setup(rhs);
+        }
+    };
+
+    const DataPolicyContainer< TypeList<Ts...> >& m_container;
+    SegmentPool* const m_pool;
+
+    const Byte* m_data;
+    std::vector<size_t> m_offsets; // of the segments, and the end of the last one
+    std::vector< std::unique_ptr<Slot> > m_slots;
+};
+
+typedef SegmentedOutput<CoreSerializationTypes> SegmentedOutputType;
+typedef SegmentedInput<CoreSerializationTypes> SegmentedInputType;
+
+#endif
@@ -85,6 +85,7 @@ template <typename T>
 struct IDataPolicy
 {
     typedef std::unique_ptr< IDataPolicy<T> > ptr;
+    typedef T ValueType;
 
     virtual bool Read(const BitStreamInput& stream, T& v, const String& tag) = 0;
     virtual void Write(BitStreamOutput& stream, const T& v, const String& tag) = 0;
@@ -194,6 +195,7 @@ struct DataPolicyDefault<Buffer> : public IDataPolicy<Buffer>
     }
 };
 
+// NB: the elements go through the bulk paths of the bit streams (and the quantization), in place for the contiguous containers
 template < typename T, typename... Xs, template <typename...> class C >
 struct DataPolicyDefault< C<T, Xs...>, typename std::enable_if< std::is_integral<T>::value || std::is_floating_point<T>::value >::type > : public IDataPolicy< C<T, Xs...> >
 {
@@ -205,17 +207,23 @@ struct DataPolicyDefault< C<T, Xs...>, typename std::enable_if< std::is_integral
     virtual bool Read(const BitStreamInput& stream, C<T, Xs...>& c, const String& tag)
     {
         U32 sz = 0;
-        if ( policy_sz.Read(stream, sz, tag) )
+        if ( !policy_sz.Read(stream, sz, tag) )
+        {
+            return false;
+        }
+
+        if ( IsContiguous::value )
         {
             c.resize(sz);
-            for (U32 i = 0; i < sz; ++i)
-            {
-                if ( !policy.Read(stream, c[i], tag) )
-                {
-                    return false;
-                }
-            }
+            return sz == 0 || ReadElements( stream, (T*)&c[0], sz, tag );
+        }
+
+        std::vector<T> elements(sz);
+        if ( !ReadElements( stream, elements.data(), sz, tag ) )
+        {
+            return false;
         }
+        c.assign( elements.begin(), elements.end() );
         return true;
     }
 
@@ -223,11 +231,107 @@ struct DataPolicyDefault< C<T, Xs...>, typename std::enable_if< std::is_integral
     {
         U32 sz = (U32)c.size();
         policy_sz.Write(stream, sz, tag);
-        for (U32 i = 0; i < sz; ++i)
+
+        if ( IsContiguous::value )
+        {
+            WriteElements( stream, sz ? (const T*)&c[0] : nullptr, sz, tag );
+        }
+        else
+        {
+            std::vector<T> elements( c.begin(), c.end() );
+            WriteElements( stream, elements.data(), sz, tag );
+        }
+    }
+
+private:
+    typedef std::is_same< C<T, Xs...>, std::vector<T, Xs...> > IsContiguous;
+
+    // the floating point values are quantized in bulk
+    template <typename X = T>
+    typename std::enable_if< std::is_floating_point<X>::value, bool >::type ReadElements(const BitStreamInput& stream, X v[], size_t sz, const String& tag)
+    {
+        return policy.q.Read(stream, v, sz, tag);
+    }
+
+    template <typename X = T>
+    typename std::enable_if< std::is_floating_point<X>::value >::type WriteElements(BitStreamOutput& stream, const X v[], size_t sz, const String& tag)
+    {
+        policy.q.Write(stream, v, sz, tag);
+    }
+
+    // the integers are of variable lengths, one by one without going through the policy
+    template <typename X = T>
+    typename std::enable_if< std::is_integral<X>::value, bool >::type ReadElements(const BitStreamInput& stream, X v[], size_t sz, const String& tag)
+    {
+        for (size_t i = 0; i < sz; ++i)
+        {
+            if ( !stream.Read(v[i]) )
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template <typename X = T>
+    typename std::enable_if< std::is_integral<X>::value >::type WriteElements(BitStreamOutput& stream, const X v[], size_t sz, const String& tag)
+    {
+        for (size_t i = 0; i < sz; ++i)
+        {
+            stream.Write(v[i]);
+        }
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// PolicyHandle is the interned form of a policy name, so the policies can be looked up by an array index instead of by string
+// The handles are process wide and stable, handle 0 is the empty name (the default policy); SERIALIZE_P interns its policy name once per call site
+
+typedef U32 PolicyHandle;
+
+class PolicyNames
+{
+public:
+    static PolicyHandle Intern(const String& name)
+    {
+        PolicyNames& names = Singleton();
+        std::lock_guard<std::mutex> lock(names.m_mutex);
+
+        auto it = names.m_handles.find(name);
+        if ( it != names.m_handles.end() )
         {
-            policy.Write(stream, c[i], tag);
+            return it->second;
         }
+
+        PolicyHandle handle = (PolicyHandle)names.m_names.size();
+        names.m_names.push_back( String::Intern(name) );
+        names.m_handles.emplace(names.m_names.back(), handle);
+        return handle;
+    }
+
+    static String Name(PolicyHandle handle)
+    {
+        PolicyNames& names = Singleton();
+        std::lock_guard<std::mutex> lock(names.m_mutex);
+        return handle < names.m_names.size() ? names.m_names[handle] : String();
+    }
+
+private:
+    static PolicyNames& Singleton()
+    {
+        static PolicyNames s_singleton;
+        return s_singleton;
+    }
+
+    PolicyNames()
+    {
+        m_names.push_back( String() );
+        m_handles.emplace( String(), 0 );
     }
+
+    std::mutex m_mutex;
+    std::vector<String> m_names;
+    std::unordered_map<String, PolicyHandle> m_handles;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -244,6 +348,7 @@ struct IDataPolicyContainerNode
     virtual void ResetPolicies(T* = 0) = 0;
 
     virtual const typename IDataPolicy<T>::ptr& GetPolicy(const String& name, T* = 0) const = 0;
+    virtual const typename IDataPolicy<T>::ptr& GetPolicy(PolicyHandle handle, T* = 0) const = 0;
 
     virtual void Setup(const IDataPolicyContainerNode& rhs) = 0;
 };
@@ -324,6 +429,8 @@ public:
         }
 
         m_elements.insert( m_elements.end(), elements.begin(), elements.end() ); // NB: duplicates?
+
+        m_resolved.clear(); // NB: the policies and aliases might have changed, the handles are resolved again on demand
     }
 
     virtual void ResetPolicies(T* = 0)
@@ -340,11 +447,11 @@ public:
     {
         if ( !policyName.empty() )
         {
-            String actualName = policyName;
+            const String* actualName = &policyName;
             auto ita = m_aliases.find(policyName);
             if ( ita != m_aliases.end() )
-                actualName = ita->second;
-            auto itp = m_policies.find(actualName);
+                actualName = &ita->second;
+            auto itp = m_policies.find(*actualName);
             if ( itp != m_policies.end() )
                 return itp->second;
         }
@@ -352,6 +459,23 @@ public:
         return m_default;
     }
 
+    // the per field lookup, the name of the handle is resolved at its first use only
+    virtual const typename IDataPolicy<T>::ptr& GetPolicy(PolicyHandle handle, T* = 0) const
+    {
+        if ( handle < m_resolved.size() && m_resolved[handle] )
+        {
+            return *m_resolved[handle];
+        }
+
+        if ( handle >= m_resolved.size() )
+        {
+            m_resolved.resize(handle + 1, nullptr);
+        }
+
+        m_resolved[handle] = &GetPolicy( PolicyNames::Name(handle) ); // NB: the unordered_map nodes are stable
+        return *m_resolved[handle];
+    }
+
 private:
     typedef std::unordered_map< String, typename IDataPolicyContainerNode<T>::Creator > CreatorsRegistry;
     CreatorsRegistry m_creators;
@@ -365,6 +489,8 @@ private:
     IMetadataProcessor::Elements m_elements;
 
     typename IDataPolicy<T>::ptr m_default;
+
+    mutable std::vector<const typename IDataPolicy<T>::ptr*> m_resolved; // indexed by PolicyHandle
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -473,6 +599,7 @@ template <typename T>
 struct ISerializationNode
 {
     virtual bool Serialize(T& v, const String& policy, const String& tag) = 0;
+    virtual bool Serialize(T& v, PolicyHandle policy, const String& tag) = 0;
 };
 
 // The base ISerialization interface which contains all the typed interface nodes
@@ -484,17 +611,16 @@ struct ISerialization< TypeList<Ts...> > : public Scatter< TypeList<Ts...>, ISer
 {
     virtual bool IsReading() const = 0;
 
-protected:
-    virtual BitStreamOutput& GetBitStreamOutputImpl() const = 0;
-    virtual const BitStreamInput& GetBitStreamInputImpl() const = 0;
-
-    virtual DataPolicyContainer< TypeList<Ts...> >& GetDataPolicyContainerImpl() const = 0;
-
-    BitStreamOutput& GetBitStreamOutput() const
-    {
-        return GetBitStreamOutputImpl();
-    }
+    // The structure of the values: where the objects and the arrays of objects begin and end, which the serializations laying the
+    // values out by their structure follow (see FlatSnapshot.h), while the others go through it as it is; the size of an array is
+    // serialized by BeginArray, before the elements (a U32 by default)
+    virtual bool BeginObject() { return true; }
+    virtual bool EndObject() { return true; }
+    virtual bool BeginArray(U32& size) { return ScatterCast<U32>(*this).Serialize( size, String(), String() ); }
+    virtual bool EndArray() { return true; }
 
+    // NB: the input and the policies are also used by the fields that reference the input in place, or are serialized in a nested
+    // serialization of their own (see LazyView.h)
     const BitStreamInput& GetBitStreamInput() const
     {
         return GetBitStreamInputImpl();
@@ -504,6 +630,17 @@ protected:
     {
         return GetDataPolicyContainerImpl();
     }
+
+protected:
+    virtual BitStreamOutput& GetBitStreamOutputImpl() const = 0;
+    virtual const BitStreamInput& GetBitStreamInputImpl() const = 0;
+
+    virtual DataPolicyContainer< TypeList<Ts...> >& GetDataPolicyContainerImpl() const = 0;
+
+    BitStreamOutput& GetBitStreamOutput() const
+    {
+        return GetBitStreamOutputImpl();
+    }
 };
 
 // Typed SerializationOutput implementation node (Inherit)
@@ -518,6 +655,12 @@ struct SerializationNodeOutput< T, TypeList<Ts...>, Base > : public Base
         ScatterCast<T>( Base::GetDataPolicyContainer() ).GetPolicy(policy)->Write( Base::GetBitStreamOutput(), v, tag );
         return true;
     }
+
+    virtual bool Serialize(T& v, PolicyHandle policy, const String& tag)
+    {
+        ScatterCast<T>( Base::GetDataPolicyContainer() ).GetPolicy(policy)->Write( Base::GetBitStreamOutput(), v, tag );
+        return true;
+    }
 };
 
 // Typed SerializationInput implementation node (Inherit)
@@ -531,6 +674,11 @@ struct SerializationNodeInput< T, TypeList<Ts...>, Base > : public Base
     {
         return ScatterCast<T>( Base::GetDataPolicyContainer() ).GetPolicy(policy)->Read( Base::GetBitStreamInput(), v, tag );
     }
+
+    virtual bool Serialize(T& v, PolicyHandle policy, const String& tag)
+    {
+        return ScatterCast<T>( Base::GetDataPolicyContainer() ).GetPolicy(policy)->Read( Base::GetBitStreamInput(), v, tag );
+    }
 };
 
 // The concrete SerializationOutput class which implements all the typed interfaces contained within the ISerialization interface, using SerializationNodeOutput
@@ -606,6 +754,12 @@ static inline bool Serialize(ISerialization< TypeList<Ts...> >& s, T& v, const S
     return ScatterCast<T>(s).Serialize(v, policy, tag);
 }
 
+template <typename T, typename... Ts, typename = typename std::enable_if< TypeListContainsType< T, TypeList<Ts...> >::value >::type >
+static inline bool Serialize(ISerialization< TypeList<Ts...> >& s, T& v, PolicyHandle policy, const String& tag = "")
+{
+    return ScatterCast<T>(s).Serialize(v, policy, tag);
+}
+
 template <typename T, typename TL>
 struct HasSerializeMemberFunction;
 
@@ -623,14 +777,14 @@ struct HasSerializeMemberFunction< T, TypeList<Ts...> >
 template < class C, typename... Ts, typename = typename std::enable_if< !TypeListContainsType< C, TypeList<Ts...> >::value && HasSerializeMemberFunction< C, TypeList<Ts...> >::value >::type >
 static inline bool Serialize(ISerialization< TypeList<Ts...> >& s, C& o)
 {
-    return o.Serialize(s);
+    return s.BeginObject() && o.Serialize(s) && s.EndObject();
 }
 
 template < class C, typename... Ts, template <typename...> class V, typename... Xs, typename = typename std::enable_if< !TypeListContainsType< C, TypeList<Ts...> >::value && !HasSerializeMemberFunction< V<C, Xs...>, TypeList<Ts...> >::value && HasSerializeMemberFunction< C, TypeList<Ts...> >::value >::type >
 static inline bool Serialize(ISerialization< TypeList<Ts...> >& s, V<C, Xs...>& elements)
 {
     U32 sz = (U32)elements.size();
-    if ( !::Serialize(s, sz) )
+    if ( !s.BeginArray(sz) )
     {
         return false;
     }
@@ -642,13 +796,13 @@ static inline bool Serialize(ISerialization< TypeList<Ts...> >& s, V<C, Xs...>&
 
     for ( size_t i = 0; i < elements.size(); ++i )
     {
-        if ( !elements[i].Serialize(s) )
+        if ( !s.BeginObject() || !elements[i].Serialize(s) || !s.EndObject() )
         {
             return false;
         }
     }
 
-    return true;
+    return s.EndArray();
 }
 
 // The wrapper class for SerializationOutput
@@ -664,6 +818,12 @@ public:
         , m_output(container, m_stream, reset)
     {}
 
+    // streamed to the sink, a chunk at a time (see BitStreamOutput)
+    SerializationOutputWrapper(DataPolicyContainer< TypeList<Ts...> >& container, IBitStreamSink& sink, size_t chunkSize = N_CHUNK, bool reset = true)
+        : m_stream(sink, chunkSize)
+        , m_output(container, m_stream, reset)
+    {}
+
     ~SerializationOutputWrapper() {}
 
     operator SerializationOutput< TypeList<Ts...> >&()
@@ -671,6 +831,24 @@ public:
         return m_output;
     }
 
+    // brings the buffer up to date with everything serialized so far (see BitStreamOutput::Flush)
+    void Flush()
+    {
+        m_stream.Flush();
+    }
+
+    // makes room for nbits more bits up front (see BitStreamOutput::Reserve)
+    void Reserve(size_t nbits)
+    {
+        m_stream.Reserve(nbits);
+    }
+
+    // ends the stream to the sink, false if the sink has failed (see BitStreamOutput::Close)
+    bool Close()
+    {
+        return m_stream.Close();
+    }
+
 private:
     BitStreamOutput m_stream;
     SerializationOutput< TypeList<Ts...> > m_output;
@@ -689,6 +867,18 @@ public:
         , m_input(container, m_stream, reset)
     {}
 
+    // over the bytes in place, e.g. a memory mapped file
+    SerializationInputWrapper(DataPolicyContainer< TypeList<Ts...> >& container, const Byte* data, size_t size, bool reset = true)
+        : m_stream(data, size)
+        , m_input(container, m_stream, reset)
+    {}
+
+    // streamed from the source, a chunk at a time (see BitStreamInput)
+    SerializationInputWrapper(DataPolicyContainer< TypeList<Ts...> >& container, IBitStreamSource& source, size_t chunkSize = N_CHUNK, bool reset = true)
+        : m_stream(source, chunkSize)
+        , m_input(container, m_stream, reset)
+    {}
+
     ~SerializationInputWrapper() {}
 
     operator SerializationInput< TypeList<Ts...> >&()
@@ -701,6 +891,60 @@ private:
     SerializationInput< TypeList<Ts...> > m_input;
 };
 
+// The measuring counterpart of SerializationOutputWrapper, which runs the same serialization over a counting stream to find out its size
+// NB: the policies go through the same writes, so the stateful ones are affected just like with a real output (reset by default)
+template <typename TL>
+class SerializationMeasureWrapper;
+
+template <typename... Ts>
+class SerializationMeasureWrapper< TypeList<Ts...> >
+{
+public:
+    SerializationMeasureWrapper(DataPolicyContainer< TypeList<Ts...> >& container, bool reset = true)
+        : m_stream()
+        , m_output(container, m_stream, reset)
+    {}
+
+    ~SerializationMeasureWrapper() {}
+
+    operator SerializationOutput< TypeList<Ts...> >&()
+    {
+        return m_output;
+    }
+
+    size_t GetNumBits() const
+    {
+        return m_stream.GetBitOffset();
+    }
+
+private:
+    BitStreamOutput m_stream;
+    SerializationOutput< TypeList<Ts...> > m_output;
+};
+
+// Learns the serialized sizes of the kinds of messages (keyed by K), so their buffers can be reserved up front
+// The hint of a key is a high water mark of the sizes, which decays by 1/8 per update, following the sizes down slowly
+template <typename K>
+class SerializationSizeHints
+{
+public:
+    // the hinted size in bits, 0 if unknown
+    size_t Get(const K& key) const
+    {
+        auto it = m_hints.find(key);
+        return it != m_hints.end() ? it->second : 0;
+    }
+
+    void Update(const K& key, size_t nbits)
+    {
+        size_t& hint = m_hints[key];
+        hint = std::max( nbits, hint - hint / 8 );
+    }
+
+private:
+    std::unordered_map<K, size_t> m_hints;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // Typedefs ...
 typedef TypeList<String, Buffer, F64, F32, I64, U64, I32, U32, I16, U16, I8, U8, bool> CoreSerializationTypes;
@@ -712,6 +956,7 @@ typedef DataPolicyContainerPreload<CoreSerializationTypes> DataPolicyContainerPr
 
 typedef SerializationOutputWrapper<CoreSerializationTypes> SerializationOutputWrapperType;
 typedef SerializationInputWrapper<CoreSerializationTypes> SerializationInputWrapperType;
+typedef SerializationMeasureWrapper<CoreSerializationTypes> SerializationMeasureWrapperType;
 
 ////////////////////////////////////////////////////////////////////////////////
 // Macros ...
@@ -719,8 +964,12 @@ typedef SerializationInputWrapper<CoreSerializationTypes> SerializationInputWrap
 #define SERIALIZE(s, value) do { if ( !::Serialize(s, value) ) return false; } while (0)
 #define CONDITIONAL_SERIALIZE(s, cond, value) do { SERIALIZE(s, cond); if (cond) { SERIALIZE(s, value); } } while (0)
 
-#define SERIALIZE_P(s, value, policy) do { if ( !::Serialize(s, value, policy) ) return false; } while (0)
-#define CONDITIONAL_SERIALIZE_P(s, cond, value, policy) do { SERIALIZE(s, cond); if (cond) { SERIALIZE(s, value, policy); } } while (0)
+// NB: the policy name is interned once per call site, so it has to be the same for every call (e.g. a literal)
+#define SERIALIZE_P(s, value, policy) do { static const PolicyHandle s_policy = PolicyNames::Intern(policy); if ( !::Serialize(s, value, s_policy) ) return false; } while (0)
+#define CONDITIONAL_SERIALIZE_P(s, cond, value, policy) do { SERIALIZE(s, cond); if (cond) { SERIALIZE_P(s, value, policy); } } while (0)
+
+// the tag goes along to the policy, e.g. to select the axis of a vector component (same as the policy, it has to be the same for every call)
+#define SERIALIZE_PT(s, value, policy, tag) do { static const PolicyHandle s_policy = PolicyNames::Intern(policy); static const String s_tag(tag); if ( !::Serialize(s, value, s_policy, s_tag) ) return false; } while (0)
 
 #define CAT(a, b) CAT_I(a ## b)
 #define CAT_I(x) x
@@ -767,6 +1016,6 @@ static bool StaticLoad##_##className##_##policyName()
     DataPolicyContainerPreloadType::Singleton().LoadPolicies(processor);                                    \
     return true;                                                                                            \
 }                                                                                                           \
-static bool s_loaded##_className##_##policyName = StaticLoad##_##className##_##policyName()
+static bool s_loaded##_##className##_##policyName = StaticLoad##_##className##_##policyName()
 
 #endif
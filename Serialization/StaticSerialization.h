@@ -0,0 +1,298 @@
+//
+//  StaticSerialization.h
+//  SerializationFramework
+//
+//  Created by Lin Luo on 05/01/2015.
+//
+
+#ifndef SerializationFramework_StaticSerialization_h
+#define SerializationFramework_StaticSerialization_h
+
+#include "Serialization.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// The statically dispatched serialization, for the hot paths where the data policies are known at compile time
+// The policies are given as a list of data policy classes, each of them serves the fields of its ValueType; the other fields go with
+// DataPolicyDefault. The policies are called non-virtually, so serializing a field boils down to the inlined bit stream operations.
+// The policies referred to by name (SERIALIZE_P, metadata driven) are still looked up in the optional DataPolicyContainer
+//
+// A class serializable with both the dynamic and the static serializations has a templated Serialize member:
+//     template <typename S> bool Serialize(S& s) { SERIALIZE(s, m_x); ... return true; }
+
+// The policy instances of a static serialization, selected by the value type
+template <typename... Ps>
+class StaticDataPolicies
+{
+public:
+    // the index of the policy for T, sizeof...(Ps) if there is none
+    template <typename T>
+    struct Index
+    {
+        static const size_t value = TypeListTypeIndex< T, TypeList<typename Ps::ValueType...> >::value;
+    };
+
+    // the policy class for T
+    template <typename T, typename... Qs>
+    struct Policy
+    {
+        typedef DataPolicyDefault<T> type;
+    };
+
+    template <typename T, typename Q, typename... Qs>
+    struct Policy<T, Q, Qs...>
+    {
+        typedef typename std::conditional< std::is_same<typename Q::ValueType, T>::value, Q, typename Policy<T, Qs...>::type >::type type;
+    };
+
+    template <typename T>
+    typename Policy<T, Ps...>::type& Get()
+    {
+        return Get<T>( std::integral_constant< bool, (Index<T>::value < sizeof...(Ps)) >() );
+    }
+
+    void Reset()
+    {
+        Resetter<0>::Apply(m_policies);
+    }
+
+private:
+    template <typename T>
+    typename Policy<T, Ps...>::type& Get(std::true_type)
+    {
+        return std::get< Index<T>::value >(m_policies);
+    }
+
+    template <typename T>
+    typename Policy<T, Ps...>::type& Get(std::false_type)
+    {
+        static DataPolicyDefault<T> s_default; // NB: the default policies are stateless
+        return s_default;
+    }
+
+    template <size_t I, typename = void>
+    struct Resetter
+    {
+        static void Apply(std::tuple<Ps...>& policies)
+        {
+            std::get<I>(policies).Reset();
+            Resetter<I + 1>::Apply(policies);
+        }
+    };
+
+    template <typename X>
+    struct Resetter<sizeof...(Ps), X>
+    {
+        static void Apply(std::tuple<Ps...>&) {}
+    };
+
+    std::tuple<Ps...> m_policies;
+};
+
+template <typename... Ps>
+class StaticSerializationOutput
+{
+public:
+    StaticSerializationOutput(BitStreamOutput& output, DataPolicyContainerType* container = nullptr, bool reset = true)
+        : m_output(output)
+        , m_container(container)
+    {
+        if (reset && m_container)
+        {
+            m_container->ResetPolicies();
+        }
+    }
+
+    bool IsReading() const { return false; }
+
+    template <typename T>
+    bool Serialize(T& v)
+    {
+        Write( m_policies.template Get<T>(), v );
+        return true;
+    }
+
+    // NB: only the core serialization types can have the named policies
+    template <typename T>
+    bool Serialize(T& v, const String& policy, const String& tag = "")
+    {
+        if ( policy.empty() || !m_container )
+        {
+            return Serialize(v);
+        }
+
+        ScatterCast<T>(*m_container).GetPolicy(policy)->Write(m_output, v, tag);
+        return true;
+    }
+
+    template <typename T>
+    bool Serialize(T& v, PolicyHandle policy, const String& tag = "")
+    {
+        if ( policy == 0 || !m_container )
+        {
+            return Serialize(v);
+        }
+
+        ScatterCast<T>(*m_container).GetPolicy(policy)->Write(m_output, v, tag);
+        return true;
+    }
+
+private:
+    template <typename P, typename T>
+    void Write(P& policy, const T& v)
+    {
+        policy.P::Write( m_output, v, String() ); // NB: the qualified call is never virtual
+    }
+
+    BitStreamOutput& m_output;
+    DataPolicyContainerType* const m_container;
+    StaticDataPolicies<Ps...> m_policies;
+};
+
+template <typename... Ps>
+class StaticSerializationInput
+{
+public:
+    StaticSerializationInput(const BitStreamInput& input, DataPolicyContainerType* container = nullptr, bool reset = true)
+        : m_input(input)
+        , m_container(container)
+    {
+        if (reset && m_container)
+        {
+            m_container->ResetPolicies();
+        }
+    }
+
+    bool IsReading() const { return true; }
+
+    template <typename T>
+    bool Serialize(T& v)
+    {
+        return Read( m_policies.template Get<T>(), v );
+    }
+
+    template <typename T>
+    bool Serialize(T& v, const String& policy, const String& tag = "")
+    {
+        if ( policy.empty() || !m_container )
+        {
+            return Serialize(v);
+        }
+
+        return ScatterCast<T>(*m_container).GetPolicy(policy)->Read(m_input, v, tag);
+    }
+
+    template <typename T>
+    bool Serialize(T& v, PolicyHandle policy, const String& tag = "")
+    {
+        if ( policy == 0 || !m_container )
+        {
+            return Serialize(v);
+        }
+
+        return ScatterCast<T>(*m_container).GetPolicy(policy)->Read(m_input, v, tag);
+    }
+
+private:
+    template <typename P, typename T>
+    bool Read(P& policy, T& v)
+    {
+        return policy.P::Read( m_input, v, String() );
+    }
+
+    const BitStreamInput& m_input;
+    DataPolicyContainerType* const m_container;
+    StaticDataPolicies<Ps...> m_policies;
+};
+
+template <typename S>
+struct IsStaticSerialization
+{
+    static const bool value = false;
+};
+
+template <typename... Ps>
+struct IsStaticSerialization< StaticSerializationOutput<Ps...> >
+{
+    static const bool value = true;
+};
+
+template <typename... Ps>
+struct IsStaticSerialization< StaticSerializationInput<Ps...> >
+{
+    static const bool value = true;
+};
+
+template <typename C, typename S>
+struct HasStaticSerializeMemberFunction
+{
+    template <class X> static char Test( decltype( std::declval<X&>().Serialize( std::declval<S&>() ) )* );
+    template <class X> static long Test(...);
+
+    static const bool value = sizeof( Test<C>(0) ) == sizeof(char);
+};
+
+// a container whose elements serialize themselves
+template <typename T, typename S>
+struct HasStaticSerializableElements
+{
+    static const bool value = false;
+};
+
+template < class C, typename... Xs, template <typename...> class V, typename S >
+struct HasStaticSerializableElements< V<C, Xs...>, S >
+{
+    static const bool value = HasStaticSerializeMemberFunction<C, S>::value;
+};
+
+// Helper functions for the SERIALIZE macros, the counterparts of the ones taking ISerialization
+template <typename S, typename T>
+static inline typename std::enable_if< IsStaticSerialization<S>::value && !HasStaticSerializeMemberFunction<T, S>::value && !HasStaticSerializableElements<T, S>::value, bool >::type
+Serialize(S& s, T& v)
+{
+    return s.Serialize(v);
+}
+
+template <typename S, typename T>
+static inline typename std::enable_if< IsStaticSerialization<S>::value, bool >::type Serialize(S& s, T& v, const String& policy, const String& tag = "")
+{
+    return s.Serialize(v, policy, tag);
+}
+
+template <typename S, typename T>
+static inline typename std::enable_if< IsStaticSerialization<S>::value, bool >::type Serialize(S& s, T& v, PolicyHandle policy, const String& tag = "")
+{
+    return s.Serialize(v, policy, tag);
+}
+
+template <typename S, class C>
+static inline typename std::enable_if< IsStaticSerialization<S>::value && HasStaticSerializeMemberFunction<C, S>::value, bool >::type Serialize(S& s, C& o)
+{
+    return o.Serialize(s);
+}
+
+template < typename S, class C, typename... Xs, template <typename...> class V >
+static inline typename std::enable_if< IsStaticSerialization<S>::value && HasStaticSerializeMemberFunction<C, S>::value, bool >::type Serialize(S& s, V<C, Xs...>& elements)
+{
+    U32 sz = (U32)elements.size();
+    if ( !::Serialize(s, sz) )
+    {
+        return false;
+    }
+
+    if ( s.IsReading() )
+    {
+        elements.resize(sz);
+    }
+
+    for ( size_t i = 0; i < elements.size(); ++i )
+    {
+        if ( !elements[i].Serialize(s) )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,283 @@
+//
+//  StringDictionary.h
+//  SerializationFramework
+//
+//  Created by Lin Luo on 05/01/2015.
+//
+
+#ifndef SerializationFramework_StringDictionary_h
+#define SerializationFramework_StringDictionary_h
+
+#include "Serialization.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// A string dictionary shared by the two ends of a connection, across the messages
+//
+// Each end holds one StringDictionary per direction; the serialization of a message is wrapped in a StringDictionaryScope on it, and
+// within the scope, the strings serialized with the dictionary policy (or UniqueStringPolicy) are sent in full along with the ID
+// they are assigned, then referred to by the ID alone in the following messages. The definitions only go into the reliable messages,
+// so they all get there eventually, but possibly in another order than they were serialized (e.g. by priority); the sender thus
+// only refers to the IDs acknowledged back by the receiver (StringDictionary::Acknowledge), and keeps defining the others. The
+// receiver acknowledges the IDs defined without any gap, so the sender commits its scope once the message is sent (Commit); the
+// IDs assigned within a scope that is not committed (e.g. the serialization has failed) are taken back, as they never get there.
+// An unreliable message has its undefined strings in full, and queues them to be defined by a reliable one (HasPending and
+// SerializePending), so the strings only ever sent unreliably (e.g. the signature of a per tick update) get their IDs all the same.
+// Outside of any scope, the strings are serialized as they are.
+
+class StringDictionary
+{
+public:
+    static const U32 N_MAX_STRINGS = 4096;  // the strings past this go in full
+    static const size_t N_MAX_LENGTH = 256; // the longer strings go in full
+
+    StringDictionary()
+        : m_acknowledged(0)
+        , m_ndefined(0)
+    {}
+
+    // sender: the receiver has got the strings of the IDs below count, so they are referred to by ID from now on
+    void Acknowledge(U32 count)
+    {
+        if ( count > m_acknowledged && count <= m_ids.size() )
+        {
+            m_acknowledged = count;
+        }
+    }
+
+    // receiver: the number of strings defined so far without any gap, to be acknowledged back to the sender
+    U32 GetNumDefined() const
+    {
+        return m_ndefined;
+    }
+
+    // sender: whether any string of the unreliable messages is waiting to be defined (see StringDictionaryScope::SerializePending)
+    bool HasPending() const
+    {
+        return !m_pending.empty();
+    }
+
+private:
+    friend class StringDictionaryScope;
+
+    // sender
+    std::unordered_map<String, U32> m_ids;
+    U32 m_acknowledged;
+    std::vector<String> m_pending; // the strings met undefined by the unreliable messages
+
+    // receiver, the undefined IDs are the empty strings
+    std::vector<String> m_strings;
+    U32 m_ndefined;
+};
+
+class StringDictionaryScope
+{
+public:
+    StringDictionaryScope(StringDictionary& dictionary, bool reliable = true)
+        : m_dictionary(dictionary)
+        , m_reliable(reliable)
+        , m_defined(false)
+        , m_committed(false)
+        , m_previous( Top() )
+    {
+        Top() = this;
+    }
+
+    ~StringDictionaryScope()
+    {
+        Top() = m_previous;
+
+        if (!m_committed)
+        {
+            // NB: the IDs are assigned in order, so the ones of the scope are the last ones
+            for (auto it = m_added.rbegin(); it != m_added.rend(); ++it)
+            {
+                m_dictionary.m_ids.erase(*it);
+            }
+        }
+    }
+
+    // sender: the message has been sent, so the IDs assigned within the scope are kept
+    void Commit()
+    {
+        m_committed = true;
+    }
+
+    // the innermost scope of the thread, nullptr if none
+    static StringDictionaryScope* Current()
+    {
+        return Top();
+    }
+
+    // whether any string has been defined within the scope; for the receiver, an acknowledgement is due
+    bool HasDefinitions() const
+    {
+        return m_defined;
+    }
+
+    // a reference: 1, ID; a definition: 0, 1, ID, string; otherwise: 0, 0, string
+    void Write(BitStreamOutput& stream, const String& s)
+    {
+        auto it = m_dictionary.m_ids.find(s);
+        if ( it != m_dictionary.m_ids.end() && it->second < m_dictionary.m_acknowledged )
+        {
+            stream.Write(true);
+            stream.Write(it->second);
+            return;
+        }
+
+        bool define = m_reliable && ( it != m_dictionary.m_ids.end() || Definable(s) );
+
+        stream.Write(false);
+        stream.Write(define);
+        if (define)
+        {
+            if ( it == m_dictionary.m_ids.end() )
+            {
+                it = m_dictionary.m_ids.emplace( s, (U32)m_dictionary.m_ids.size() ).first;
+                m_added.push_back(s);
+            }
+            stream.Write(it->second);
+            m_defined = true;
+        }
+        else if ( !m_reliable && it == m_dictionary.m_ids.end() && Definable(s) )
+        {
+            std::vector<String>& pending = m_dictionary.m_pending;
+            if ( std::find( pending.begin(), pending.end(), s ) == pending.end() )
+            {
+                pending.push_back(s);
+            }
+        }
+        stream.Write(s);
+    }
+
+    // the definitions of the strings queued by the unreliable messages: U32 count, then the strings (each as with Write)
+    // sender: takes the queued strings, within a reliable scope; receiver: defines them
+    bool SerializePending(ISerializationType& s)
+    {
+        std::vector<String> pending;
+        if ( !s.IsReading() )
+        {
+            pending.swap(m_dictionary.m_pending); // NB: the ones of a message never sent are queued again, being taken back
+        }
+
+        U32 count = (U32)pending.size();
+        SERIALIZE(s, count);
+        if ( s.IsReading() )
+        {
+            if (count > StringDictionary::N_MAX_STRINGS)
+            {
+                return false;
+            }
+            pending.resize(count);
+        }
+
+        for (String& string : pending)
+        {
+            SERIALIZE_P(s, string, "dictionary");
+        }
+
+        return true;
+    }
+
+    bool Read(const BitStreamInput& stream, String& s)
+    {
+        std::vector<String>& strings = m_dictionary.m_strings;
+
+        bool known = false;
+        if ( !stream.Read(known) )
+        {
+            return false;
+        }
+
+        U32 id = 0;
+        if (known)
+        {
+            if ( !stream.Read(id) || id >= strings.size() || strings[id].empty() )
+            {
+                return false; // NB: only an unacknowledged ID can be missing, which is a protocol error
+            }
+
+            s = strings[id];
+            return true;
+        }
+
+        bool define = false;
+        if ( !stream.Read(define) || ( define && !stream.Read(id) ) || !stream.Read(s) )
+        {
+            return false;
+        }
+
+        if (define)
+        {
+            if ( id >= StringDictionary::N_MAX_STRINGS || s.empty() )
+            {
+                return false;
+            }
+
+            if ( id >= strings.size() )
+            {
+                strings.resize(id + 1);
+            }
+            strings[id] = s;
+
+            while ( m_dictionary.m_ndefined < strings.size() && !strings[m_dictionary.m_ndefined].empty() )
+            {
+                ++m_dictionary.m_ndefined;
+            }
+            m_defined = true;
+        }
+
+        return true;
+    }
+
+private:
+    bool Definable(const String& s) const
+    {
+        return !s.empty() && s.size() <= StringDictionary::N_MAX_LENGTH && m_dictionary.m_ids.size() < StringDictionary::N_MAX_STRINGS;
+    }
+
+    static StringDictionaryScope*& Top()
+    {
+        static thread_local StringDictionaryScope* s_top = nullptr;
+        return s_top;
+    }
+
+    StringDictionary& m_dictionary;
+    const bool m_reliable;
+    bool m_defined;
+    bool m_committed;
+    std::vector<String> m_added; // sender: the strings assigned an ID within the scope
+
+    StringDictionaryScope* const m_previous;
+};
+
+// The dictionary policy of the strings, e.g. the RMI signatures
+// { "policy", { {"name", "dictionary"}, {"class", "StringDictionaryPolicy"} } }
+class StringDictionaryPolicy : public IDataPolicy<String>
+{
+public:
+    StringDictionaryPolicy(const IMetadataProcessor::Elements& elements)
+    {
+    }
+
+    virtual bool Read(const BitStreamInput& stream, String& s, const String& tag) override
+    {
+        StringDictionaryScope* scope = StringDictionaryScope::Current();
+        return scope ? scope->Read(stream, s) : stream.Read(s);
+    }
+
+    virtual void Write(BitStreamOutput& stream, const String& s, const String& tag) override
+    {
+        StringDictionaryScope* scope = StringDictionaryScope::Current();
+        if (scope)
+        {
+            scope->Write(stream, s);
+        }
+        else
+        {
+            stream.Write(s);
+        }
+    }
+};
+
+#endif
@@ -122,6 +122,8 @@ struct TypeListFindConvertibleType< T, TypeList<> >
     typedef void Type;
 };
 
+// Invokes f.operator()<T>() for the i-th type T of the list (nothing if out of range), in constant time: through a table of the
+// instantiations for each type, indexed directly, rather than comparing i against each type in turn
 template <typename TL>
 struct TypeListApplyAt;
 
@@ -131,19 +133,24 @@ struct TypeListApplyAt< TypeList<Ts...> >
     template <typename F>
     void operator()(size_t i, F& f)
     {
-        if (i == 0)
+        typedef void (*Function)(F&);
+        static const Function s_functions[] = { &Invoke<Ts, F>... }; // NB: constant initialized, no guard
+
+        if ( i < sizeof...(Ts) )
         {
+            s_functions[i](f);
+        }
+    }
+
+private:
+    template <typename T, typename F>
+    static void Invoke(F& f)
+    {
 #ifdef _MSC_VER
-            f.operator()< typename TypeList<Ts...>::Head >(); // NB: MSVC seems to be non-standard conforming here - "template" keyword is required!
+        f.operator()<T>(); // NB: MSVC seems to be non-standard conforming here - "template" keyword is required!
 #else
-            f.template operator()< typename TypeList<Ts...>::Head >();
+        f.template operator()<T>();
 #endif
-        }
-        else
-        {
-            TypeListApplyAt< typename TypeList<Ts...>::Tail > next;
-            next(i - 1, f);
-        }
     }
 };
 
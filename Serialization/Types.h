@@ -12,6 +12,7 @@
 #include <cstring>
 
 #include <map>
+#include <algorithm>
 #include <set>
 #include <list>
 #include <tuple>
@@ -19,6 +20,8 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <mutex>
+#include <atomic>
 #include <limits>
 #include <functional>
 #include <type_traits>
@@ -31,7 +31,7 @@ public:
         Q quantized = 0;
         if ( stream.Read(quantized, m_nbits) )
         {
-            v = m_mn + (T)( (double)quantized / m_qmx * (m_mx - m_mn) );
+            v = Dequantize(quantized);
             return true;
         }
 
@@ -40,20 +40,60 @@ public:
 
     void Write(BitStreamOutput& stream, T v, const String& tag) const
     {
-        if( v < m_mn)
+        stream.Write(Quantize(v), m_nbits);
+    }
+
+    // the bulk versions, the same encoding as one by one; the values go through a block at a time, so the loops can be vectorized
+    bool Read(const BitStreamInput& stream, T v[], size_t count, const String& tag) const
+    {
+        Q block[N_BLOCK];
+        for (size_t i = 0; i < count; i += N_BLOCK)
         {
-            v = m_mn;
+            size_t n = count - i < N_BLOCK ? count - i : N_BLOCK; // NB: not std::min, which would bind (odr-use) N_BLOCK
+            if ( !stream.ReadBatch(block, n, m_nbits) )
+            {
+                return false;
+            }
+
+            for (size_t j = 0; j < n; ++j)
+            {
+                v[i + j] = Dequantize(block[j]);
+            }
         }
-        else if( v > m_mx )
+
+        return true;
+    }
+
+    void Write(BitStreamOutput& stream, const T v[], size_t count, const String& tag) const
+    {
+        Q block[N_BLOCK];
+        for (size_t i = 0; i < count; i += N_BLOCK)
         {
-            v = m_mx;
-        }
+            size_t n = count - i < N_BLOCK ? count - i : N_BLOCK; // NB: not std::min, which would bind (odr-use) N_BLOCK
+            for (size_t j = 0; j < n; ++j)
+            {
+                block[j] = Quantize(v[i + j]);
+            }
 
-        Q quantized = (Q)( (double)(v - m_mn) / (m_mx - m_mn) * m_qmx );
-        stream.Write(quantized, m_nbits);
+            stream.WriteBatch(block, n, m_nbits);
+        }
     }
-    
+
 private:
+    static const size_t N_BLOCK = 256;
+
+    Q Quantize(T v) const
+    {
+        v = v < m_mn ? m_mn : v > m_mx ? m_mx : v;
+        double q = (double)(v - m_mn) / (m_mx - m_mn) * m_qmx;
+        return sizeof(Q) < 8 ? (Q)(I64)q : (Q)q; // NB: the same for the narrower Qs, but through a signed conversion, which vectorizes
+    }
+
+    T Dequantize(Q quantized) const
+    {
+        return m_mn + (T)( (double)quantized / m_qmx * (m_mx - m_mn) );
+    }
+
     const T m_mn;
     const T m_mx;
     const size_t m_nbits;
@@ -11,7 +11,9 @@
 #include "Types.h"
 #include "TypeList.h"
 #include "Serialization.h"
+#include "Arena.h"
 
+// NB: the wrapped values are allocated from the current arena if any (see Arena.h)
 template <typename T>
 class RecursiveWrapper
 {
@@ -19,12 +21,12 @@ public:
     typedef T Type;
 
     RecursiveWrapper()
-        : m_value( new T() )
+        : m_value( ArenaNew<T>() )
     {
     }
 
     RecursiveWrapper(const RecursiveWrapper& rhs)
-        : m_value( new T(*rhs.m_value) )
+        : m_value( ArenaNew<T>(*rhs.m_value) )
     {
     }
 
@@ -34,18 +36,18 @@ public:
     }
 
     RecursiveWrapper(const T& t)
-        : m_value( new T(t) )
+        : m_value( ArenaNew<T>(t) )
     {
     }
 
     RecursiveWrapper(T&& t)
-        : m_value( new T( std::move(t) ) )
+        : m_value( ArenaNew<T>( std::move(t) ) )
     {
     }
 
     RecursiveWrapper& operator=(const RecursiveWrapper& rhs)
     {
-        m_value.reset( new T(*rhs.m_value) );
+        m_value = ArenaNew<T>(*rhs.m_value);
         return *this;
     }
 
@@ -57,13 +59,13 @@ public:
 
     RecursiveWrapper& operator=(const T& t)
     {
-        m_value.reset( new T(t) );
+        m_value = ArenaNew<T>(t);
         return *this;
     }
 
     RecursiveWrapper& operator=(T&& t)
     {
-        m_value.reset( new T( std::move(t) ) );
+        m_value = ArenaNew<T>( std::move(t) );
         return *this;
     }
 
@@ -84,7 +86,7 @@ public:
     }
 
 private:
-    std::unique_ptr<T> m_value;
+    ArenaPtr<T> m_value;
 };
 
 template <typename T>
@@ -277,6 +279,26 @@ public:
         return m_index == TypeListTypeIndex< T, TypeList<Ts...> >::value;
     }
 
+    // the index of the type held, the number of types if none
+    size_t GetIndex() const
+    {
+        return m_index;
+    }
+
+    // default constructs the type of the index in place of the value held; an invalid index leaves the Variant empty
+    void Reset(size_t index)
+    {
+        TypeListApplyAt< TypeList<Ts...> > apply;
+
+        Destructor destructor(*this);
+        apply(m_index, destructor);
+
+        m_index = index < TypeListCount< TypeList<Ts...> >::value ? index : TypeListCount< TypeList<Ts...> >::value;
+
+        Constructor constructor(*this);
+        apply(m_index, constructor);
+    }
+
     // NB: ISerialization relies on a different list of types!
     bool Serialize(ISerializationType& s)
     {
@@ -286,18 +308,21 @@ public:
         {
             Destructor destructor(*this);
             apply(m_index, destructor);
+            m_index = TypeListCount< TypeList<Ts...> >::value;
+
+            U8 index = 0;
+            SERIALIZE(s, index);
+            m_index = index < TypeListCount< TypeList<Ts...> >::value ? index : TypeListCount< TypeList<Ts...> >::value;
+
+            // the value is constructed and read in one go, straight from the index read; an invalid one fails, leaving the Variant empty
+            Reader reader(s, *this);
+            apply(m_index, reader);
+            return reader.r;
         }
 
         // NB: it would be insane if we support more than 255 types!
         U8 index = (U8)m_index;
         SERIALIZE(s, index);
-        m_index = index;
-
-        if ( s.IsReading() )
-        {
-            Constructor constructor(*this);
-            apply(m_index, constructor);
-        }
 
         Serializer serializer(s, *this);
         apply(m_index, serializer);
@@ -445,6 +470,29 @@ private:
             r = Serialize<T>();
         }
     };
+
+    struct Reader
+    {
+        ISerializationType& s;
+        Variant< TypeList<Ts...> >& v;
+        bool r;
+
+        Reader(ISerializationType& s_, Variant< TypeList<Ts...> >& v_)
+            : s(s_)
+            , v(v_)
+            , r(false)
+        {
+        }
+
+        template <typename T>
+        void operator()()
+        {
+            new( (T*)&v.m_storage ) T();
+
+            Serializer serializer(s, v);
+            r = serializer.template Serialize<T>();
+        }
+    };
 };
 
 #endif
@@ -9,6 +9,7 @@
 #include <cassert>
 
 #include <chrono>
+#include <random>
 
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
@@ -16,10 +17,23 @@
 #include <lua.hpp>
 
 #include "Serialization.h"
+#include "StaticSerialization.h"
+#include "DeltaPolicy.h"
+#include "StringDictionary.h"
+#include "GeometricQuantization.h"
 #include "Variant.h"
 #include "MetaStruct.h"
+#include "MapData.h"
+#include "Columnar.h"
+#include "LazyView.h"
+#include "ChunkedStream.h"
+#include "FlatSnapshot.h"
+#include "Segments.h"
 
 FORCE_LINK_DATA_POLICY_CLASS(UniqueStringPolicy);
+FORCE_LINK_DATA_POLICY_CLASS(DeltaF32Policy);
+FORCE_LINK_DATA_POLICY_CLASS(BoundedVectorF64Policy);
+FORCE_LINK_DATA_POLICY_CLASS(StringDictionaryPolicy);
 
 static void TestBitStream()
 {
@@ -77,6 +91,8 @@ static void TestBitStream()
         os.Write(i64);
     }
 
+    os.Flush();
+
     BitStreamInput is(buffer);
 
     for (size_t i = 0; i < 1000; ++i)
@@ -108,6 +124,382 @@ static void TestBitStream()
         I64 i64 = 0;
         assert( is.Read(i64) && i64 == C_I64 );
     }
+
+    // Throughput, with a mix resembling the entity snapshots: flags, small counters, quantized components and ids
+    static const size_t N_ITERATIONS = 1000000;
+
+    Buffer bench;
+    size_t nbits = 0;
+
+    {
+        BitStreamOutput bos(bench);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < N_ITERATIONS; ++i)
+        {
+            bos.Write( (i & 1) != 0 );
+            bos.Write( (U8)i );
+            bos.Write( (U16)(i * 7), NBITS_U16 );
+            bos.Write( (I16)(i * 3), NBITS_I16 );
+            bos.Write( (U32)(i * 131), NBITS_U32 );
+            bos.Write( (U32)i );
+            bos.Write( (I64)i - 500000 );
+        }
+        bos.Flush();
+        auto end = std::chrono::high_resolution_clock::now();
+
+        nbits = bos.GetBitOffset();
+        float ns = std::chrono::duration_cast< std::chrono::duration< float, std::nano > >(end - start).count();
+        std::cout << "BitStream write: " << nbits << " bits, " << nbits / ns << " bits/ns, took: " << ns / 1000000.0f << " ms" << std::endl;
+    }
+
+    {
+        BitStreamInput bis(bench);
+
+        U64 checksum = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < N_ITERATIONS; ++i)
+        {
+            bool b = false; U8 u8 = 0; U16 u16 = 0; I16 i16 = 0; U32 u32 = 0; U32 v32 = 0; I64 i64 = 0;
+            bis.Read(b);
+            bis.Read(u8);
+            bis.Read(u16, NBITS_U16);
+            bis.Read(i16, NBITS_I16);
+            bis.Read(u32, NBITS_U32);
+            bis.Read(v32);
+            bis.Read(i64);
+            checksum += b + u8 + u16 + i16 + u32 + v32 + i64;
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+
+        assert( bis.GetBitOffset() == nbits );
+        float ns = std::chrono::duration_cast< std::chrono::duration< float, std::nano > >(end - start).count();
+        std::cout << "BitStream read: " << nbits << " bits, " << nbits / ns << " bits/ns, took: " << ns / 1000000.0f << " ms (checksum " << checksum << ")" << std::endl;
+    }
+}
+
+// The bit packed variable length integers vs. LEB128, on random and small values
+static void TestVarint()
+{
+    static const size_t N_VALUES = 1000000;
+
+    std::mt19937_64 rng(42);
+    std::vector<U64> randoms(N_VALUES), smalls(N_VALUES);
+    for (size_t i = 0; i < N_VALUES; ++i)
+    {
+        randoms[i] = rng() >> (rng() % 64);
+        smalls[i] = rng() % 100;
+    }
+
+    // the extremes and a mix with the bit packed values
+    {
+        Buffer buffer;
+        const U64 extremes[] = { 0, 1, 0x7f, 0x80, 0x3fff, 0x4000, 0xffffffffULL, 0x8000000000000000ULL, ~0ULL };
+        {
+            BitStreamOutput os(buffer);
+            for (U64 u : extremes)
+            {
+                os.Write(true);
+                os.WriteVarint(u);
+                os.Write(u);
+            }
+        }
+
+        BitStreamInput is(buffer);
+        for (U64 u : extremes)
+        {
+            bool b = false;
+            U64 v = 0, w = 0;
+            assert( is.Read(b) && b && is.ReadVarint(v) && v == u && is.Read(w) && w == u );
+        }
+    }
+
+    for (int distribution = 0; distribution < 2; ++distribution)
+    {
+        const std::vector<U64>& values = distribution ? smalls : randoms;
+        const char* name = distribution ? "small" : "random";
+
+        for (int leb128 = 0; leb128 < 2; ++leb128)
+        {
+            Buffer buffer;
+
+            auto start = std::chrono::high_resolution_clock::now();
+            {
+                BitStreamOutput os(buffer);
+                for (U64 u : values)
+                {
+                    if (leb128)
+                    {
+                        os.WriteVarint(u);
+                    }
+                    else
+                    {
+                        os.Write(u);
+                    }
+                }
+            }
+            float wms = std::chrono::duration_cast< std::chrono::duration< float, std::ratio<1, 1000> > >(std::chrono::high_resolution_clock::now() - start).count();
+
+            U64 checksum = 0;
+            start = std::chrono::high_resolution_clock::now();
+            {
+                BitStreamInput is(buffer);
+                for (size_t i = 0; i < N_VALUES; ++i)
+                {
+                    U64 u = 0;
+                    bool ok = leb128 ? is.ReadVarint(u) : is.Read(u);
+                    assert( ok && u == values[i] );
+                    checksum += u;
+                }
+            }
+            float rms = std::chrono::duration_cast< std::chrono::duration< float, std::ratio<1, 1000> > >(std::chrono::high_resolution_clock::now() - start).count();
+
+            std::cout << (leb128 ? "LEB128" : "Bit packed") << " integers, " << name << ": " << (float)BYTES2BITS(buffer.size()) / N_VALUES << " bits/value, write: " << wms << " ms, read: " << rms << " ms (checksum " << checksum << ")" << std::endl;
+        }
+    }
+}
+
+// The containers of numbers go in bulk, with the same encoding as their elements one by one
+template <typename C>
+static void TestBulkArray(const char* name, const C& c, bool aligned)
+{
+    typedef typename C::value_type T;
+
+    DataPolicyDefault<C> bulk;
+    DataPolicyDefault<T> element;
+    DataPolicyDefault<U32> size;
+
+    auto elapsed = [](std::chrono::high_resolution_clock::time_point start)
+    {
+        return std::chrono::duration_cast< std::chrono::duration< float, std::ratio<1, 1000> > >(std::chrono::high_resolution_clock::now() - start).count();
+    };
+
+    Buffer one, all;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    {
+        BitStreamOutput os(one);
+        if (!aligned) os.Write(true);
+        size.Write(os, (U32)c.size(), "");
+        for (const auto& v : c)
+        {
+            element.Write(os, v, "");
+        }
+    }
+    float oneWrite = elapsed(start);
+
+    start = std::chrono::high_resolution_clock::now();
+    {
+        BitStreamOutput os(all);
+        if (!aligned) os.Write(true);
+        bulk.Write(os, c, "");
+    }
+    float allWrite = elapsed(start);
+
+    assert( one == all );
+
+    C in;
+    start = std::chrono::high_resolution_clock::now();
+    {
+        BitStreamInput is(one);
+        bool b = false;
+        U32 sz = 0;
+        if (!aligned) is.Read(b);
+        size.Read(is, sz, "");
+        in.resize(sz);
+        for (auto& v : in)
+        {
+            element.Read(is, v, "");
+        }
+    }
+    float oneRead = elapsed(start);
+
+    C bin;
+    start = std::chrono::high_resolution_clock::now();
+    {
+        BitStreamInput is(all);
+        bool b = false;
+        if (!aligned) is.Read(b);
+        assert( bulk.Read(is, bin, "") );
+    }
+    float allRead = elapsed(start);
+
+    assert( in == bin && bin.size() == c.size() );
+
+    std::cout << "Bulk " << name << (aligned ? "" : " (unaligned)") << ": " << c.size() << " elements, write: " << oneWrite << " -> " << allWrite << " ms, read: " << oneRead << " -> " << allRead << " ms" << std::endl;
+}
+
+static void TestBulkArrays()
+{
+    static const size_t N_ELEMENTS = 1000000;
+
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<F32> uniform(-1000.0f, 1000.0f);
+
+    std::vector<F32> f32s(N_ELEMENTS);
+    std::vector<F64> f64s(N_ELEMENTS);
+    std::vector<U16> u16s(N_ELEMENTS);
+    for (size_t i = 0; i < N_ELEMENTS; ++i)
+    {
+        f32s[i] = uniform(rng);
+        f64s[i] = uniform(rng) * 1000.0;
+        u16s[i] = (U16)rng();
+    }
+
+    TestBulkArray("std::vector<F32>", f32s, true);
+    TestBulkArray("std::vector<F32>", f32s, false);
+    TestBulkArray("std::vector<F64>", f64s, true);
+    TestBulkArray("std::deque<F32>", std::deque<F32>(f32s.begin(), f32s.end()), false);
+    TestBulkArray("std::vector<U16>", u16s, true);
+    TestBulkArray("std::vector<F32> (empty)", std::vector<F32>(), true);
+}
+
+// The batches of fixed width integers, 1 to 32 bits per value, against the values one by one; they have to be the same bits
+template <typename U>
+static void TestBatch(const std::vector<U>& values, size_t nbits, bool report)
+{
+    auto elapsed = [](std::chrono::high_resolution_clock::time_point start)
+    {
+        return std::chrono::duration_cast< std::chrono::duration< float, std::ratio<1, 1000> > >(std::chrono::high_resolution_clock::now() - start).count();
+    };
+
+    Buffer one, batch;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    {
+        BitStreamOutput os(one);
+        os.Write(true); // NB: off the byte boundary
+        for (U u : values)
+        {
+            os.Write(u, nbits);
+        }
+    }
+    float oneWrite = elapsed(start);
+
+    start = std::chrono::high_resolution_clock::now();
+    {
+        BitStreamOutput os(batch);
+        os.Write(true);
+        os.WriteBatch(values.data(), values.size(), nbits);
+    }
+    float batchWrite = elapsed(start);
+
+    assert( one == batch );
+
+    std::vector<U> in(values.size()), bin(values.size());
+    bool b = false;
+
+    start = std::chrono::high_resolution_clock::now();
+    {
+        BitStreamInput is(one);
+        is.Read(b);
+        for (U& u : in)
+        {
+            is.Read(u, nbits);
+        }
+    }
+    float oneRead = elapsed(start);
+
+    start = std::chrono::high_resolution_clock::now();
+    {
+        BitStreamInput is(batch);
+        is.Read(b);
+        assert( is.ReadBatch(bin.data(), bin.size(), nbits) );
+
+        U padding = 0; // NB: past the end, only the padding bits of the last byte are there
+        size_t total = 1 + values.size() * nbits;
+        assert( is.ReadBatch(&padding, 1, nbits) == (BITS2BOUNDARY(total) - total >= nbits) );
+    }
+    float batchRead = elapsed(start);
+
+    assert( in == bin );
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        assert( bin[i] == (nbits < sizeof(U) * 8 ? values[i] & (((U64)1 << nbits) - 1) : values[i]) );
+    }
+
+    if (report)
+    {
+        std::cout << "Batch " << nbits << " bits: write: " << values.size() / oneWrite / 1000.0f << " -> " << values.size() / batchWrite / 1000.0f
+                  << " Mvalues/s, read: " << values.size() / oneRead / 1000.0f << " -> " << values.size() / batchRead / 1000.0f << " Mvalues/s" << std::endl;
+    }
+}
+
+static void TestBatchPacking()
+{
+    static const size_t N_VALUES = 1000000;
+
+    std::mt19937_64 rng(11);
+    std::vector<U32> u32s(N_VALUES);
+    std::vector<U64> u64s(1001);
+    std::vector<U16> u16s(1001);
+    for (size_t i = 0; i < N_VALUES; ++i)
+    {
+        u32s[i] = (U32)rng();
+    }
+    for (size_t i = 0; i < u64s.size(); ++i)
+    {
+        u64s[i] = rng();
+        u16s[i] = (U16)rng();
+    }
+
+    for (size_t nbits = 1; nbits <= 32; ++nbits)
+    {
+        TestBatch(u32s, nbits, true);
+    }
+
+    // the scalar kernels, and the odd counts
+    for (size_t nbits : {1, 7, 13, 16})
+    {
+        TestBatch(u16s, nbits, false);
+    }
+    for (size_t nbits : {3, 33, 40, 63, 64})
+    {
+        TestBatch(u64s, nbits, false);
+    }
+    TestBatch(std::vector<U32>(u32s.begin(), u32s.begin() + 67), 21, false);
+}
+
+// The inline, shared and interned strings, which have to behave the same
+static void TestString()
+{
+    const char* longText = "a string long enough to go into the shared buffer";
+
+    String empty, small("position"), shared(longText), copy(shared);
+    assert( empty.empty() && empty.size() == 0 && *empty.c_str() == '\0' );
+    assert( small.size() == 8 && small == "position" && small == String("position") && !(small == String("positio")) );
+    assert( shared.size() == strlen(longText) && shared == longText && copy.data() == shared.data() );
+    assert( String( std::string(String::N_SMALL, 'x').c_str() ).size() == String::N_SMALL );
+    assert( std::hash<String>()(small) == String::Hash("position", 8) );
+
+    String moved( std::move(copy) );
+    assert( copy.empty() && moved == shared );
+
+    // the interned strings share one buffer, and still compare equal to the others
+    String interned = String::Intern(shared);
+    String again = String::Intern( String(longText) );
+    assert( interned.interned() && again.data() == interned.data() && interned == shared && shared == interned );
+    assert( String::Intern(small) == small && !String::Intern(small).interned() );
+
+    // decoding them allocates nothing: the inline ones are built in place, the interned ones are found in the table
+    Buffer buffer;
+    {
+        BitStreamOutput os(buffer);
+        os.Write(small);
+        os.Write(shared);
+        os.Write( String("another string long enough, not interned") );
+        os.Write(empty);
+    }
+
+    BitStreamInput is(buffer);
+    String s0, s1, s2, s3("not empty");
+    assert( is.Read(s0) && is.Read(s1) && is.Read(s2) && is.Read(s3) );
+    assert( s0 == small && s1.interned() && s1.data() == interned.data() && !s2.interned() && s2 == "another string long enough, not interned" && s3.empty() );
+
+    std::unordered_map<String, int> map;
+    map[interned] = 1;
+    map[small] = 2;
+    assert( map[s1] == 1 && map[s0] == 2 && map.size() == 2 );
 }
 
 struct TestMetaDataProcessor : public IMetadataProcessor
@@ -198,6 +590,7 @@ static void TestSerialization()
     DataPolicyContainerType container;
     SerializationOutputWrapperType output(container, buffer);
     s.Serialize(output);
+    output.Flush();
 
     s.Reset();
 
@@ -205,707 +598,1331 @@ static void TestSerialization()
     s.Serialize(input);
 }
 
-////////////////////////////////////////////////////////////////////////////////////
-// MapData below is the C++ serializable representation
-// In real world use case, this is constructed by parsing a PHP zval (zend_parse_parameter), Python PyObject (PyArg_ParseTuple), or Lua State on their respective C API side
-// There should be a PHP/Python/Lua version of the MapData represented in their respective native (PHP/Python/Lua/Etc.) format, and translated to the C++ MapData here
-//
-// Taking PHP as an example:
-//
-// A PHP C (zend) extension is created which expose two functions to the PHP code (this is probably *not* legal PHP code):
-//
-// $BinaryBlob = EncodeMapData($MapData);
-// $MapData = DecodeMapData($BinaryBlob);
-//
-// where $MapData is a native PHP construct which follows the MapData C++ definition (this is the translation protocol between PHP and C++)
-// The implementation of the C zend extension would carry the form similar to:
-// PHP_FUNCTION(EncodeMapData): which parses the PHP zval and convert it to C++ MapData for serialization
-// PHP_FUNCTION(DecodeMapData): which constructs a C++ MapData from a binary stream, and convert to a PHP variable.
-// And note that there is only one shared serialization code path, which means that the binary stream is conmpact and efficient to encode/decode
-
-// For demonstration purposes below, we just use the Setup function to feed some fake data in
-struct MapData
+// NB: the timings are in the benchmarks (SerializationBenchmark)
+static void TestMapDataSerialization()
 {
-    struct March
-    {
-        U64 user_id;
-        U32 empire_id;
-        U32 city_id;
-        U32 army_id;
-
-        U32 dest_province_id;
-        U32 dest_chunk_id;
-        U32 dest_tile_id;
-        U32 from_province_id;
-        U32 from_chunk_id;
-        U32 from_tile_id;
-        U32 state;
-        U32 start_time;
-        U32 dest_time;
-        U32 type;
-        U32 alliance_id;
-
-        bool has_from_name;
-        String from_name;
-
-        bool has_dest_name;
-        String dest_name;
-
-        bool has_color;
-        U32 color;
-
-        bool has_target_alliance_id;
-        U32 target_alliance_id;
-
-        March()
-        : user_id(0)
-        , empire_id(0)
-        , city_id(0)
-        , army_id(0)
-        , dest_province_id(0)
-        , dest_chunk_id(0)
-        , dest_tile_id(0)
-        , from_province_id(0)
-        , from_chunk_id(0)
-        , from_tile_id(0)
-        , state(0)
-        , start_time(0)
-        , dest_time(0)
-        , type(0)
-        , alliance_id(0)
-        , has_from_name(false)
-        , has_dest_name(false)
-        , has_color(false), color(0)
-        , has_target_alliance_id(false), target_alliance_id(0)
-        {}
-
-        void Setup()
-        {
-            user_id = 999;
-            empire_id = 888;
-            city_id = 777;
-            army_id = 666;
-
-            dest_province_id = 555;
-            dest_chunk_id = 444;
-            dest_tile_id = 333;
-
-            from_province_id = 222;
-            from_chunk_id = 111;
-            from_tile_id = 999;
-
-            state = 23;
-            start_time = 2013;
-            dest_time = 2013;
-            type = 42;
-            alliance_id = 888;
-
-            has_from_name = true;
-            from_name = "luolin";
-
-            has_dest_name = true;
-            dest_name = "linluo";
-
-            has_color = true;
-            color = 111;
-
-            has_target_alliance_id = true;
-            target_alliance_id = 789;
-        }
-
-        bool Serialize(ISerializationType& s)
-        {
-            SERIALIZE(s, user_id);
-            SERIALIZE(s, empire_id);
-            SERIALIZE(s, city_id);
-            SERIALIZE(s, army_id);
-
-            SERIALIZE(s, dest_province_id);
-            SERIALIZE(s, dest_chunk_id);
-            SERIALIZE(s, dest_tile_id);
-            SERIALIZE(s, from_province_id);
-            SERIALIZE(s, from_chunk_id);
-            SERIALIZE(s, from_tile_id);
-            SERIALIZE(s, state);
-            SERIALIZE(s, start_time);
-            SERIALIZE(s, dest_time);
-            SERIALIZE(s, type);
-            SERIALIZE(s, alliance_id);
-
-            CONDITIONAL_SERIALIZE(s, has_from_name, from_name);
-            CONDITIONAL_SERIALIZE(s, has_dest_name, dest_name);
-            CONDITIONAL_SERIALIZE(s, has_color, color);
-            CONDITIONAL_SERIALIZE(s, has_target_alliance_id, target_alliance_id);
-
-            return true;
-        }
-    };
+    Buffer buffer;
 
-    struct Alliance
-    {
-        U32 alliance_id;
+    // Sender / Encoder side ... 
+    DataPolicyContainerType container;
+    SerializationOutputWrapperType output(container, buffer);
 
-        bool has_alliance_name;
-        String alliance_name;
+    MapData md_out;
+    md_out.Setup();
 
-        bool has_alliance_tag;
-        String alliance_tag;
+    md_out.Serialize(output);
+    output.Flush();
 
-        bool has_alliance_rank;
-        U32 alliance_rank;
+    // Receiver / Decoder side ...
+    SerializationInputWrapperType input(container, buffer);
 
-        Alliance()
-        : alliance_id(0)
-        , has_alliance_name(false)
-        , has_alliance_tag(false)
-        , has_alliance_rank(false), alliance_rank(0)
-        {}
+    MapData md_in;
+    bool ok = md_in.Serialize(input);
+    assert(ok);
 
-        void Setup()
-        {
-            alliance_id = 456;
+    // the decoded MapData encodes back into the same bytes
+    Buffer again;
+    SerializationOutputWrapperType output_again(container, again);
+    md_in.Serialize(output_again);
+    output_again.Flush();
 
-            has_alliance_name = true;
-            alliance_name = "alliance_name";
+    assert( again == buffer );
+    std::cout << "Encoded MapData into " << buffer.size() << " bytes" << std::endl;
+}
+
+// The MapData snapshot laid out flat, read in place out of the mapped file: the root is a table of has_chunks, chunks, has_marches,
+// marches, ..., a march that of user_id, empire_id, ..., alliance_id, has_from_name, from_name, ...
+static void TestFlatSnapshot()
+{
+    static const char* const PATH = "MapData.flat";
+
+    MapData md_out;
+    md_out.Setup();
+    md_out.marches[5].from_name = "somewhere.far.beyond.the.inline.length";
 
-            has_alliance_tag = true;
-            alliance_tag = "alliance_tag";
+    Buffer image;
+    {
+        FlatSnapshotOutputType output(image);
+        bool ok = output.Write(md_out);
+        assert( ok && image.size() % 8 == 0 );
+    }
+    {
+        FileSink sink(PATH);
+        bool ok = sink.Write( image.data(), image.size() );
+        assert(ok);
+    }
 
-            has_alliance_rank = true;
-            alliance_rank = 1234;
+    {
+        MappedFile file(PATH);
+        FlatSnapshot snapshot;
+        FlatArray marches;
+        FlatTable march;
+        bool has_marches = false, has_from_name = false;
+        U64 user_id = 0;
+        U32 alliance_id = 0;
+        BytesView from_name;
+        bool ok = file.IsOpen() && snapshot.Open( file.data(), file.size() ) && snapshot.GetRoot().Get(2, has_marches) && snapshot.GetRoot().Get(3, marches)
+            && marches.Get(5, march) && march.Get(0, user_id) && march.Get(14, alliance_id) && march.Get(15, has_from_name) && march.Get(16, from_name);
+        assert( ok && has_marches && marches.size() == 10 && user_id == 999 && alliance_id == 888 && has_from_name );
+        assert( from_name == md_out.marches[5].from_name && from_name.data[from_name.size] == '\0' );
+
+        // out of range
+        assert( !marches.Get(10, march) && !march.Get( march.GetNumSlots(), user_id ) );
+
+        FlatSnapshotInputType input;
+        MapData md_in;
+        ok = input.Open( file.data(), file.size() ) && input.Read(md_in);
+        assert(ok);
+
+        // the same as the original, as far as the bit stream goes
+        DataPolicyContainerType container;
+        Buffer expected, actual;
+        {
+            SerializationOutputWrapperType output(container, expected);
+            md_out.Serialize(output);
+        }
+        {
+            SerializationOutputWrapperType output(container, actual);
+            md_in.Serialize(output);
         }
+        assert( actual == expected );
+    }
+    remove(PATH);
+
+    // a damaged image is rejected, however it is damaged
+    {
+        Buffer truncated( image.begin(), image.end() - 8 );
+        FlatSnapshot snapshot;
+        assert( !snapshot.Open( truncated.data(), truncated.size() ) );
+
+        Buffer damaged(image);
+        damaged[4] ^= 0x40; // the root offset
+        assert( !snapshot.Open( damaged.data(), damaged.size() ) );
 
-        bool Serialize(ISerializationType& s)
+        srand(5);
+        for (size_t i = 0; i < 1000; ++i)
         {
-            SERIALIZE(s, alliance_id);
+            Buffer corrupted(image);
+            corrupted[ FlatSnapshot::N_HEADER + rand() % (corrupted.size() - FlatSnapshot::N_HEADER) ] ^= (Byte)( 1 << (rand() % 8) );
+            FlatSnapshotInputType input;
+            MapData md;
+            input.Open( corrupted.data(), corrupted.size() ) && input.Read(md); // NB: either way, it does not read out of the image
+        }
+    }
+
+    std::cout << "Flat MapData: " << image.size() << " bytes" << std::endl;
+}
 
-            CONDITIONAL_SERIALIZE(s, has_alliance_name, alliance_name);
-            CONDITIONAL_SERIALIZE(s, has_alliance_tag, alliance_tag);
-            CONDITIONAL_SERIALIZE(s, has_alliance_rank, alliance_rank);
+// The MapData snapshot streamed through the windows of a few hundred bytes, to a chain of chunks and to a file, and back
+static void TestChunkedStream()
+{
+    static const size_t N_WINDOW = 256;
+    static const char* const PATH = "MapData.snapshot";
 
-            return true;
+    DataPolicyContainerType container;
+
+    MapData md_out;
+    md_out.Setup();
+
+    Buffer buffer;
+    {
+        SerializationOutputWrapperType output(container, buffer);
+        md_out.Serialize(output);
+    }
+
+    auto check = [&](MapData& md_in)
+    {
+        Buffer again;
+        {
+            SerializationOutputWrapperType output(container, again);
+            md_in.Serialize(output);
         }
+        assert( again == buffer );
     };
 
-    struct Empire
+    // the chain gets the same bytes
+    ChunkChain chain(N_WINDOW);
     {
-        U64 user_id;
-        U32 empire_id;
+        SerializationOutputWrapperType output(container, chain, N_WINDOW);
+        md_out.Serialize(output);
+        bool ok = output.Close();
+        assert( ok && chain.GetNumBytes() == buffer.size() );
+    }
+    size_t nchunks = chain.GetNumChunks();
+    {
+        SerializationInputWrapperType input(container, chain, N_WINDOW);
+        MapData md_in;
+        bool ok = md_in.Serialize(input);
+        assert( ok && chain.GetNumBytes() == 0 );
+        check(md_in);
+    }
 
-        bool has_empire_name;
-        String empire_name;
+    // to a file, read back through a window and mapped
+    {
+        FileSink sink(PATH);
+        SerializationOutputWrapperType output(container, sink, N_WINDOW);
+        md_out.Serialize(output);
+        bool ok = sink.IsOpen() && output.Close();
+        assert(ok);
+    }
+    {
+        FileSource source(PATH);
+        SerializationInputWrapperType input(container, source, N_WINDOW);
+        MapData md_in;
+        bool ok = source.IsOpen() && md_in.Serialize(input);
+        assert(ok);
+        check(md_in);
+    }
+    {
+        MappedFile file(PATH);
+        assert( file.IsOpen() && file.size() == buffer.size() );
+        SerializationInputWrapperType input( container, file.data(), file.size() );
+        MapData md_in;
+        bool ok = md_in.Serialize(input);
+        assert(ok);
+        check(md_in);
+    }
+    remove(PATH);
 
-        bool has_empire_owner;
-        String empire_owner;
+    // a truncated stream fails to decode, and a failing sink is reported
+    {
+        ChunkChain truncated(N_WINDOW);
+        truncated.Write( buffer.data(), buffer.size() / 2 );
+        SerializationInputWrapperType input(container, truncated, N_WINDOW);
+        MapData md_in;
+        bool ok = md_in.Serialize(input);
+        assert(!ok);
+    }
+    {
+        struct FailingSink : public IBitStreamSink
+        {
+            virtual bool Write(const Byte data[], size_t nbytes) override { return false; }
+        } sink;
+        SerializationOutputWrapperType output(container, sink, N_WINDOW);
+        md_out.Serialize(output);
+        bool ok = output.Close();
+        assert(!ok);
+    }
 
-        bool has_empire_portrait;
-        U32 empire_portrait;
+    std::cout << "Streamed MapData of " << buffer.size() << " bytes through a " << N_WINDOW << " bytes window, into " << nchunks << " chunks" << std::endl;
+}
 
-        bool has_power;
-        U32 power;
+// The map chunks encoded as independent segments on a pool, each with the names of its owners through the stateful unique policy,
+// which only ever refers back within the segment; decoded in parallel (in any order), and the same bytes as encoded sequentially
+static void TestSegments()
+{
+    static const size_t N_SEGMENTS = 16;
+    static const size_t N_NAMES = 50;
 
-        bool has_alliance_id;
-        U64 alliance_id;
+    DataPolicyContainerType container;
+    container.Setup( DataPolicyContainerPreloadType::Singleton().Retrieve() );
+    const PolicyHandle unique = PolicyNames::Intern("unique");
 
-        bool has_title_id;
-        U32 title_id;
+    SegmentPool pool(4);
 
-        Empire()
-        : user_id(0)
-        , empire_id(0)
-        , has_empire_name(false)
-        , has_empire_owner(false)
-        , has_empire_portrait(false), empire_portrait(0)
-        , has_power(false), power(0)
-        , has_alliance_id(false), alliance_id(0)
-        , has_title_id(false), title_id(0)
-        {}
+    std::vector<MapData::Chunk> chunks(N_SEGMENTS);
+    std::vector< std::vector<String> > names(N_SEGMENTS);
+    for (size_t i = 0; i < N_SEGMENTS; ++i)
+    {
+        chunks[i].Setup();
+        chunks[i].c_id = (U32)i;
+        for (size_t j = 0; j < N_NAMES; ++j)
+        {
+            char name[64];
+            snprintf( name, sizeof(name), "The owner of the chunk #%zu, the %zuth", i, j % 3 );
+            names[i].push_back(name);
+        }
+    }
 
-        void Setup()
+    auto add = [&](SegmentedOutputType& output)
+    {
+        for (size_t i = 0; i < N_SEGMENTS; ++i)
         {
-            user_id = 666;
-            empire_id = 888;
+            output.Add( [&, i](ISerializationType& s)
+            {
+                SERIALIZE(s, chunks[i]);
+                for (auto& name : names[i])
+                {
+                    if ( !::Serialize(s, name, unique) )
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            } );
+        }
+    };
 
-            has_empire_name = true;
-            empire_name = "empire_name";
+    Buffer parallel, sequential;
+    {
+        SegmentedOutputType output(container, &pool);
+        add(output);
+        bool ok = output.Encode(parallel);
+        assert(ok);
+
+        // the clones of the policies are reused, and reset for each segment
+        add(output);
+        Buffer again;
+        ok = output.Encode(again);
+        assert( ok && again == parallel );
+    }
+    {
+        SegmentedOutputType output(container);
+        add(output);
+        bool ok = output.Encode(sequential);
+        assert( ok && sequential == parallel );
+    }
 
-            has_empire_owner = true;
-            empire_owner = "empire_owner";
+    SegmentedInputType input(container, &pool);
+    bool ok = input.Open(parallel);
+    assert( ok && input.GetNumSegments() == N_SEGMENTS );
 
-            has_empire_portrait = true;
-            empire_portrait = 4545;
+    std::vector<MapData::Chunk> chunks_in(N_SEGMENTS);
+    std::vector< std::vector<String> > names_in(N_SEGMENTS, std::vector<String>(N_NAMES));
+    ok = input.Decode( [&](size_t i, ISerializationType& s)
+    {
+        SERIALIZE(s, chunks_in[i]);
+        for (auto& name : names_in[i])
+        {
+            if ( !::Serialize(s, name, unique) )
+            {
+                return false;
+            }
+        }
+        return true;
+    } );
+    assert( ok && names_in == names );
+    for (size_t i = 0; i < N_SEGMENTS; ++i)
+    {
+        assert( chunks_in[i].c_id == i && chunks_in[i].tiles.size() == chunks[i].tiles.size() );
+    }
 
-            has_power = true;
-            power = 4567;
+    // a truncated input, or an index listing more than the input holds, fails to open
+    ok = input.Open( parallel.data(), parallel.size() - 1 );
+    assert(!ok);
+    ok = input.Open( parallel.data(), 3 );
+    assert(!ok);
+    Buffer corrupted(parallel);
+    corrupted[0] = 0xff;
+    ok = input.Open(corrupted);
+    assert(!ok);
+
+    std::cout << "Encoded " << N_SEGMENTS << " segments of map chunks into " << parallel.size() << " bytes on " << pool.GetNumThreads() << " threads" << std::endl;
+}
 
-            has_alliance_id = true;
-            alliance_id = 1234;
+// A large map snapshot, row by row vs. column by column; the marches have sequential IDs and timestamps, states in runs and a few
+// types, and the chunks have their tiles (nested, so they go to the outside columns)
+template <typename C>
+static double TestColumnarRecords(const char* name, const C& records)
+{
+    static const size_t N_DECODES = 100;
 
-            has_title_id = true;
-            title_id = 444;
-        }
+    DataPolicyContainerType container;
+    Buffer rows, columns;
+    {
+        SerializationOutputWrapperType output(container, rows);
+        ISerializationType& s = output;
+        ::Serialize( s, const_cast<C&>(records) );
+    }
+    {
+        Columnar<C> columnar(records);
+        SerializationOutputWrapperType output(container, columns);
+        columnar.Serialize(output);
+    }
 
-        bool Serialize(ISerializationType& s)
+    float ms[2] = {};
+    for (int columnar = 0; columnar < 2; ++columnar)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < N_DECODES; ++i)
         {
-            SERIALIZE(s, user_id);
-            SERIALIZE(s, empire_id);
+            Columnar<C> decoded;
+            bool ok = false;
+            if (columnar)
+            {
+                SerializationInputWrapperType input(container, columns);
+                ok = decoded.Serialize(input);
+            }
+            else
+            {
+                SerializationInputWrapperType input(container, rows);
+                ISerializationType& s = input;
+                ok = ::Serialize( s, static_cast<C&>(decoded) );
+            }
+            assert(ok);
+
+            if (i == 0)
+            {
+                Buffer again;
+                SerializationOutputWrapperType output(container, again);
+                ISerializationType& s = output;
+                ::Serialize( s, static_cast<C&>(decoded) );
+                output.Flush();
+                assert( again == rows );
+            }
+        }
+        ms[columnar] = std::chrono::duration_cast< std::chrono::duration< float, std::ratio<1, 1000> > >(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    std::cout << "Columnar " << name << ": " << records.size() << " records, rows: " << rows.size() << " bytes, decoded " << N_DECODES << " times in " << ms[0] << " ms, columns: " << columns.size() << " bytes, decoded in " << ms[1] << " ms" << std::endl;
+    return (double)columns.size() / rows.size();
+}
+
+// The same record in two builds, laid out differently (another member order, a member added), serialized in the same order
+struct Waypoint
+{
+    U32 id;
+    String name;
+    F64 x, y;
+
+    bool Serialize(ISerializationType& s)
+    {
+        SERIALIZE(s, id);
+        SERIALIZE(s, name);
+        SERIALIZE(s, x);
+        SERIALIZE(s, y);
+        return true;
+    }
+};
+
+struct WaypointRelaid
+{
+    F64 y;
+    bool visited;
+    String name;
+    F64 x;
+    U32 id;
+
+    bool Serialize(ISerializationType& s)
+    {
+        SERIALIZE(s, id);
+        SERIALIZE(s, name);
+        SERIALIZE(s, x);
+        SERIALIZE(s, y);
+        return true;
+    }
+};
 
-            CONDITIONAL_SERIALIZE(s, has_empire_name, empire_name);
-            CONDITIONAL_SERIALIZE(s, has_empire_owner, empire_owner);
-            CONDITIONAL_SERIALIZE(s, has_empire_portrait, empire_portrait);
-            CONDITIONAL_SERIALIZE(s, has_power, power);
-            CONDITIONAL_SERIALIZE(s, has_alliance_id, alliance_id);
-            CONDITIONAL_SERIALIZE(s, has_title_id, title_id);
+static void TestColumnar()
+{
+    static const size_t N_MARCHES = 2000;
+    static const size_t N_CHUNKS = 32;
+    static const char* const NAMES[] = { "luolin", "linluo", "dejavu", "harbour" };
+
+    srand(11);
 
-            return true;
+    std::deque<MapData::March> marches(N_MARCHES);
+    for (size_t i = 0; i < N_MARCHES; ++i)
+    {
+        MapData::March& march = marches[i];
+        march.user_id = 100000000 + i * 17;
+        march.empire_id = 5000 + (U32)i / 8;
+        march.city_id = 20000 + (U32)i;
+        march.army_id = 300000 + (U32)i;
+        march.dest_province_id = 1 + rand() % 4;
+        march.dest_chunk_id = rand() % 1024;
+        march.dest_tile_id = rand() % 4096;
+        march.from_province_id = march.dest_province_id;
+        march.from_chunk_id = rand() % 1024;
+        march.from_tile_id = rand() % 4096;
+        march.state = (U32)(i / 64) % 5;
+        march.start_time = 1420070400 + (U32)i * 3;
+        march.dest_time = march.start_time + 60 + rand() % 600;
+        march.type = rand() % 6;
+        march.alliance_id = 700 + rand() % 20;
+        march.has_from_name = true;
+        march.from_name = NAMES[ rand() % 4 ];
+        march.has_color = i % 3 == 0;
+        march.color = 0xff0000 >> (i % 3);
+    }
+
+    std::deque<MapData::Chunk> chunks(N_CHUNKS);
+    for (size_t i = 0; i < N_CHUNKS; ++i)
+    {
+        MapData::Chunk& chunk = chunks[i];
+        chunk.p_id = 1;
+        chunk.c_id = (U32)i;
+        chunk.has_tiles = true;
+        chunk.tiles.resize(64);
+        for (size_t j = 0; j < chunk.tiles.size(); ++j)
+        {
+            MapData::Tile& tile = chunk.tiles[j];
+            tile.id = (U32)(i * 64 + j);
+            tile.has_overlay = rand() % 8 == 0;
+            tile.overlay = 1 + rand() % 3;
+            tile.has_r_level = rand() % 4 == 0;
+            tile.r_level = 1 + rand() % 10;
         }
-    };
+    }
 
-    struct Bounty
+    double marchesRatio = TestColumnarRecords("marches", marches);
+    double chunksRatio = TestColumnarRecords("chunks", chunks);
+    assert( marchesRatio < 0.5 && chunksRatio < 1.0 );
+
+    // the columns do not depend on the layout of the records
     {
-        String username;
-        U32 bounty;
-        String heroname;
+        Columnar< std::vector<Waypoint> > waypoints(100);
+        for (size_t i = 0; i < waypoints.size(); ++i)
+        {
+            waypoints[i].id = (U32)i;
+            waypoints[i].name = NAMES[i % 4];
+            waypoints[i].x = (F64)i * 0.5;
+            waypoints[i].y = -(F64)i;
+        }
 
-        Bounty()
-        : bounty(0)
-        {}
+        DataPolicyContainerType container;
+        Buffer buffer;
+        {
+            SerializationOutputWrapperType output(container, buffer);
+            waypoints.Serialize(output);
+        }
 
-        void Setup()
+        Columnar< std::vector<WaypointRelaid> > decoded;
+        SerializationInputWrapperType input(container, buffer);
+        bool ok = decoded.Serialize(input);
+        assert( ok && decoded.size() == waypoints.size() );
+        for (size_t i = 0; i < decoded.size(); ++i)
         {
-            username = "luolin";
-            bounty = 1000;
-            heroname = "dejavu";
+            const WaypointRelaid& w = decoded[i];
+            assert( w.id == waypoints[i].id && w.name == waypoints[i].name && w.x == waypoints[i].x && w.y == waypoints[i].y );
         }
+    }
 
-        bool Serialize(ISerializationType& s)
+    // the empty containers, and a truncated one
+    {
+        Columnar< std::deque<MapData::March> > empty, decoded;
+        Buffer buffer;
         {
-            SERIALIZE(s, username);
-            SERIALIZE(s, bounty);
-            SERIALIZE(s, heroname);
+            DataPolicyContainerType container;
+            SerializationOutputWrapperType output(container, buffer);
+            empty.Serialize(output);
+        }
 
-            return true;
+        DataPolicyContainerType container;
+        SerializationInputWrapperType input(container, buffer);
+        bool ok = decoded.Serialize(input);
+        assert( ok && decoded.empty() );
+
+        Columnar< std::deque<MapData::March> > some(marches);
+        Buffer truncated;
+        {
+            SerializationOutputWrapperType output(container, truncated);
+            some.Serialize(output);
         }
-    };
+        truncated.resize( truncated.size() / 2 );
 
-    struct Wonder
+        SerializationInputWrapperType input_truncated(container, truncated);
+        ok = decoded.Serialize(input_truncated);
+        assert( !ok );
+    }
+}
+
+// An entity snapshot, serializable with both the dynamic and the static serializations
+struct EntitySnapshot
+{
+    U32 id;
+    bool moving;
+    F32 x, y, z;
+    I16 yaw;
+    U8 state;
+    U16 health;
+
+    template <typename S>
+    bool Serialize(S& s)
     {
-        bool has_wonder_name;
-        String wonder_name;
+        SERIALIZE(s, id);
+        SERIALIZE(s, moving);
+        SERIALIZE(s, x);
+        SERIALIZE(s, y);
+        SERIALIZE(s, z);
+        SERIALIZE(s, yaw);
+        SERIALIZE(s, state);
+        SERIALIZE(s, health);
+        return true;
+    }
+};
 
-        bool has_wonder_name_id;
-        U32 wonder_name_id;
+// the yaw in degrees fits into 10 bits
+struct SnapshotYawPolicy : public IDataPolicy<I16>
+{
+    virtual bool Read(const BitStreamInput& stream, I16& yaw, const String& tag) override
+    {
+        return stream.Read(yaw, 10);
+    }
+
+    virtual void Write(BitStreamOutput& stream, const I16& yaw, const String& tag) override
+    {
+        stream.Write(yaw, 10);
+    }
+};
 
-        bool has_king_name;
-        String king_name;
+static void TestStaticSerialization()
+{
+    static const size_t N_SNAPSHOTS = 100000;
+
+    std::vector<EntitySnapshot> snapshots(N_SNAPSHOTS);
+    for (size_t i = 0; i < N_SNAPSHOTS; ++i)
+    {
+        EntitySnapshot& e = snapshots[i];
+        e.id = (U32)(i * 7919);
+        e.moving = (i % 3) != 0;
+        e.x = (F32)i * 0.25f - 1000.0f;
+        e.y = (F32)(i % 100) * 0.5f;
+        e.z = -(F32)i * 0.125f;
+        e.yaw = (I16)(i % 360) - 180;
+        e.state = (U8)(i % 5);
+        e.health = (U16)(i % 1000);
+    }
 
-        bool has_alliance_id;
-        U64 alliance_id;
+    auto elapsed = [](std::chrono::high_resolution_clock::time_point start)
+    {
+        return std::chrono::duration_cast< std::chrono::duration< float, std::ratio<1, 1000> > >(std::chrono::high_resolution_clock::now() - start).count();
+    };
 
-        bool has_scout_cost;
-        U32 scout_cost;
+    // 1. the dynamic serialization, the policies are looked up and called virtually for each field
+    Buffer dynamic;
+    {
+        DataPolicyContainerType container;
+        SerializationOutputWrapperType output(container, dynamic);
+        ISerializationType& s = output;
 
-        bool has_protection_start_time;
-        U32 protection_start_time;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (auto& e : snapshots)
+        {
+            e.Serialize(s);
+        }
+        output.Flush();
+        std::cout << "Dynamic serialization: encoded " << N_SNAPSHOTS << " snapshots into " << dynamic.size() << " bytes, took: " << elapsed(start) << " ms" << std::endl;
+    }
 
-        Wonder()
-        : has_wonder_name(false)
-        , has_wonder_name_id(false), wonder_name_id(0)
-        , has_king_name(false)
-        , has_alliance_id(false), alliance_id(0)
-        , has_scout_cost(false), scout_cost(0)
-        , has_protection_start_time(false), protection_start_time(0)
-        {}
+    {
+        DataPolicyContainerType container;
+        SerializationInputWrapperType input(container, dynamic);
+        ISerializationType& s = input;
 
-        void Setup()
+        EntitySnapshot e;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < N_SNAPSHOTS; ++i)
         {
-            has_wonder_name = true;
-            wonder_name = "abc";
+            assert( e.Serialize(s) && e.id == snapshots[i].id );
+        }
+        std::cout << "Dynamic serialization: decoded " << N_SNAPSHOTS << " snapshots, took: " << elapsed(start) << " ms" << std::endl;
+    }
 
-            has_wonder_name_id = true;
-            wonder_name_id = 1212;
+    // 2. the static serialization with the default policies, the same encoding
+    Buffer fixed;
+    {
+        BitStreamOutput stream(fixed);
+        StaticSerializationOutput<> s(stream);
 
-            has_king_name = true;
-            king_name = "Lin";
+        auto start = std::chrono::high_resolution_clock::now();
+        for (auto& e : snapshots)
+        {
+            e.Serialize(s);
+        }
+        stream.Flush();
+        std::cout << "Static serialization: encoded " << N_SNAPSHOTS << " snapshots into " << fixed.size() << " bytes, took: " << elapsed(start) << " ms" << std::endl;
+    }
 
-            has_alliance_id = true;
-            alliance_id = 12345678;
+    assert( fixed == dynamic );
 
-            has_scout_cost = true;
-            scout_cost = 6789;
+    {
+        BitStreamInput stream(fixed);
+        StaticSerializationInput<> s(stream);
 
-            has_protection_start_time = true;
-            protection_start_time = 2013;
+        EntitySnapshot e;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < N_SNAPSHOTS; ++i)
+        {
+            assert( e.Serialize(s) && e.id == snapshots[i].id );
         }
+        std::cout << "Static serialization: decoded " << N_SNAPSHOTS << " snapshots, took: " << elapsed(start) << " ms" << std::endl;
+    }
 
-        bool Serialize(ISerializationType& s)
+    // 3. the static serialization with a custom policy for the I16 fields
+    Buffer custom;
+    {
+        BitStreamOutput stream(custom);
+        StaticSerializationOutput<SnapshotYawPolicy> s(stream);
+        for (auto& e : snapshots)
         {
-            CONDITIONAL_SERIALIZE(s, has_wonder_name, wonder_name);
-            CONDITIONAL_SERIALIZE(s, has_wonder_name_id, wonder_name_id);
-            CONDITIONAL_SERIALIZE(s, has_king_name, king_name);
-            CONDITIONAL_SERIALIZE(s, has_alliance_id, alliance_id);
-            CONDITIONAL_SERIALIZE(s, has_scout_cost, scout_cost);
-            CONDITIONAL_SERIALIZE(s, has_protection_start_time, protection_start_time);
+            e.Serialize(s);
+        }
+    }
+
+    {
+        BitStreamInput stream(custom);
+        StaticSerializationInput<SnapshotYawPolicy> s(stream);
 
-            return true;
+        for (size_t i = 0; i < N_SNAPSHOTS; ++i)
+        {
+            EntitySnapshot e;
+            assert( e.Serialize(s) );
+
+            const EntitySnapshot& o = snapshots[i];
+            assert( e.id == o.id && e.moving == o.moving && e.yaw == o.yaw && e.state == o.state && e.health == o.health );
+            assert( std::fabs(e.x - o.x) < 0.01f && std::fabs(e.y - o.y) < 0.01f && std::fabs(e.z - o.z) < 0.01f );
         }
-    };
 
-    struct Army
+        std::cout << "Static serialization with the yaw policy: " << N_SNAPSHOTS << " snapshots in " << custom.size() << " bytes" << std::endl;
+    }
+}
+
+// The state of an entity in the delta compression simulation, sent either in full or delta compressed
+struct SceneEntity
+{
+    F32 x, y, z;
+    F32 yaw;
+    U16 health;
+
+    SceneEntity() : x(0.0f), y(0.0f), z(0.0f), yaw(0.0f), health(100) {}
+
+    bool Serialize(ISerializationType& s)
     {
-        U64 user_id;
-        U32 empire_id;
-        U32 city_id;
-        U32 army_id;
+        SERIALIZE(s, x);
+        SERIALIZE(s, y);
+        SERIALIZE(s, z);
+        SERIALIZE(s, yaw);
+        SERIALIZE(s, health);
+        return true;
+    }
 
-        bool has_scout_cost;
-        U32 scout_cost;
+    bool SerializeDelta(ISerializationType& s)
+    {
+        SERIALIZE_P(s, x, "delta");
+        SERIALIZE_P(s, y, "delta");
+        SERIALIZE_P(s, z, "delta");
+        SERIALIZE_P(s, yaw, "delta");
+        SERIALIZE_P(s, health, "delta");
+        return true;
+    }
+};
+
+// 200 entities, a fraction of them moving at a time, sent every tick over a lossy link; the receiver acknowledges the latest
+// snapshot of each entity, with the acknowledgements arriving a few ticks later (and getting lost as well)
+static void TestDeltaCompression()
+{
+    static const size_t N_ENTITIES = 200;
+    static const size_t N_TICKS = 600;
+    static const size_t ACK_DELAY = 3; // in ticks
+    static const int LOSS_PERCENT = 10;
+
+    DataPolicyContainerType container;
+    container.Setup( DataPolicyContainerPreloadType::Singleton().Retrieve() );
+
+    std::vector<SceneEntity> scene(N_ENTITIES), replica(N_ENTITIES);
+    std::vector<DeltaContext> senders(N_ENTITIES), receivers(N_ENTITIES);
+    std::deque< std::vector<U32> > acks;
+
+    for (size_t i = 0; i < N_ENTITIES; ++i)
+    {
+        scene[i].x = (F32)(i % 20) * 10.0f;
+        scene[i].z = (F32)(i / 20) * 10.0f;
+    }
 
-        bool has_army_load;
-        U32 army_load;
+    srand(42);
 
-        Army()
-        : user_id(0)
-        , empire_id(0)
-        , city_id(0)
-        , army_id(0)
-        , has_scout_cost(false), scout_cost(0)
-        , has_army_load(false), army_load(0)
-        {}
+    size_t nbytesFull = 0, nbytesDelta = 0, nreceived = 0;
+
+    for (size_t tick = 0; tick < N_TICKS; ++tick)
+    {
+        // 1. simulate, ~1/4 of the entities walk around, a few get hurt
+        for (size_t i = 0; i < N_ENTITIES; ++i)
+        {
+            SceneEntity& e = scene[i];
+            if ( (i + tick / 50) % 4 == 0 )
+            {
+                e.yaw = std::fmod( e.yaw + (F32)(rand() % 11 - 5), 360.0f );
+                e.x += std::cos(e.yaw * 0.0174533f) * 0.1f;
+                e.z += std::sin(e.yaw * 0.0174533f) * 0.1f;
+            }
+            if ( rand() % 100 == 0 && e.health > 0 )
+            {
+                e.health -= 1;
+            }
+        }
+
+        // 2. the acknowledgements of a few ticks ago arrive
+        if ( acks.size() > ACK_DELAY )
+        {
+            if ( rand() % 100 >= LOSS_PERCENT )
+            {
+                for (size_t i = 0; i < N_ENTITIES; ++i)
+                {
+                    senders[i].Acknowledge( acks.front()[i] );
+                }
+            }
+            acks.pop_front();
+        }
+
+        // 3. the full snapshot, for comparison
+        {
+            Buffer buffer;
+            SerializationOutputWrapperType output(container, buffer);
+            for (auto& e : scene)
+            {
+                e.Serialize(output);
+            }
+            output.Flush();
+            nbytesFull += buffer.size();
+        }
+
+        // 4. the delta compressed snapshot against the acknowledged baselines
+        Buffer buffer;
+        {
+            SerializationOutputWrapperType output(container, buffer);
+            for (size_t i = 0; i < N_ENTITIES; ++i)
+            {
+                DeltaScope scope(senders[i], false);
+                scene[i].SerializeDelta(output);
+            }
+            output.Flush();
+            nbytesDelta += buffer.size();
+        }
 
-        void Setup()
+        if ( rand() % 100 < LOSS_PERCENT )
         {
-            user_id = 12345678;
-            empire_id = 1234;
-            city_id = 4321;
-            army_id = 1122;
+            acks.push_back( acks.empty() ? std::vector<U32>(N_ENTITIES, 0) : acks.back() );
+            continue;
+        }
 
-            has_scout_cost = true;
-            scout_cost = 9999;
+        // 5. the receiver decodes against its own copies of the baselines
+        {
+            SerializationInputWrapperType input(container, buffer);
+            for (size_t i = 0; i < N_ENTITIES; ++i)
+            {
+                DeltaScope scope(receivers[i], true);
+                assert( replica[i].SerializeDelta(input) );
 
-            has_army_load = true;
-            army_load = 7777;
+                assert( std::fabs(replica[i].x - scene[i].x) < 0.001f && std::fabs(replica[i].z - scene[i].z) < 0.001f );
+                assert( std::fabs(replica[i].yaw - scene[i].yaw) < 0.001f && replica[i].health == scene[i].health );
+            }
+            ++nreceived;
         }
 
-        bool Serialize(ISerializationType& s)
+        std::vector<U32> latest(N_ENTITIES);
+        for (size_t i = 0; i < N_ENTITIES; ++i)
         {
-            SERIALIZE(s, user_id);
-            SERIALIZE(s, empire_id);
-            SERIALIZE(s, city_id);
-            SERIALIZE(s, army_id);
+            latest[i] = receivers[i].GetLatestSequence();
+        }
+        acks.push_back( std::move(latest) );
+    }
 
-            CONDITIONAL_SERIALIZE(s, has_scout_cost, scout_cost);
-            CONDITIONAL_SERIALIZE(s, has_army_load, army_load);
+    // the deltas wrap around, so the full range of the 64 bit values goes through, however far apart
+    {
+        const U64 us[] = { 0, 0xffffffffffffffffULL, 1, 0x8000000000000000ULL, 0x7fffffffffffffffULL, 0 };
+        const I64 is[] = { 0, std::numeric_limits<I64>::min(), std::numeric_limits<I64>::max(), -1, std::numeric_limits<I64>::min(), 0 };
+        DeltaContext sender, receiver;
+        for (size_t k = 0; k < sizeof(us) / sizeof(us[0]); ++k)
+        {
+            U64 u = us[k];
+            I64 i = is[k];
+            Buffer buffer;
+            {
+                SerializationOutputWrapperType output(container, buffer);
+                DeltaScope scope(sender, false);
+                ISerializationType& s = output;
+                ::Serialize(s, u, "delta");
+                ::Serialize(s, i, "delta");
+            }
 
-            return true;
+            U64 u_in = 0;
+            I64 i_in = 0;
+            {
+                SerializationInputWrapperType input(container, buffer);
+                DeltaScope scope(receiver, true);
+                ISerializationType& s = input;
+                bool ok = ::Serialize(s, u_in, "delta") && ::Serialize(s, i_in, "delta");
+                assert( ok && u_in == u && i_in == i );
+            }
+            sender.Acknowledge( receiver.GetLatestSequence() );
         }
-    };
+    }
 
-    struct City
-    {
-        U64 user_id;
-        U32 empire_id;
-        U32 city_id;
+    std::cout << "Delta compression: " << N_ENTITIES << " entities, " << N_TICKS << " ticks (" << nreceived << " received), full: " << nbytesFull / N_TICKS << " bytes/tick, delta: " << nbytesDelta / N_TICKS << " bytes/tick" << std::endl;
+}
 
-        bool has_scout_cost;
-        U32 scout_cost;
+// An RMI like message, the signature going through the string dictionary
+struct Invocation
+{
+    String signature;
+    U32 arg;
+
+    Invocation() : arg(0) {}
 
-        bool has_city_name;
-        String city_name;
+    bool Serialize(ISerializationType& s)
+    {
+        SERIALIZE_P(s, signature, "dictionary");
+        SERIALIZE(s, arg);
+        return true;
+    }
+};
 
-        bool has_city_level;
-        U32 city_level;
+// Invocations of a handful of methods over a connection: the reliable ones get there late and out of order, the unreliable ones
+// right away or never; the receiver acknowledges its dictionary back, with the acknowledgements arriving late (and getting lost)
+static void TestStringDictionary()
+{
+    static const size_t N_MESSAGES = 2000;
+    static const size_t DELAY = 4; // in messages
+    static const int LOSS_PERCENT = 10;
+
+    static const char* const SIGNATURES[] = {
+        "void Entity::UpdatePhysics(const Vector3&, const Vector3&, F64)",
+        "void Entity::SetAutonomous(bool)",
+        "void Entity::Test(const String&, I32)",
+        "void Avatar::Move(F64, F64, F64, F64)",
+        "void Avatar::Say(const String&)",
+        "void Inventory::Add(U32, U32)",
+    };
+    static const size_t N_SIGNATURES = sizeof(SIGNATURES) / sizeof(SIGNATURES[0]);
 
-        bool has_truce;
-        bool truce;
+    DataPolicyContainerType container;
+    container.Setup( DataPolicyContainerPreloadType::Singleton().Retrieve() );
 
-        bool has_last_state;
-        U32 last_state;
+    StringDictionary sender, receiver;
+    std::deque<Buffer> reliables;
+    std::deque<U32> acks;
 
-        bool has_state_timestamp;
-        U32 state_timestamp;
+    srand(7);
 
-        bool has_bounties;
-        std::deque<Bounty> bounties;
+    auto receive = [&](const Buffer& buffer, const Invocation& expected)
+    {
+        StringDictionaryScope scope(receiver);
+        SerializationInputWrapperType input(container, buffer);
 
-        City()
-        : user_id(0)
-        , empire_id(0)
-        , city_id(0)
-        , has_scout_cost(false), scout_cost(0)
-        , has_city_name(false)
-        , has_city_level(false), city_level(0)
-        , has_truce(false), truce(false)
-        , has_last_state(false), last_state(0)
-        , has_state_timestamp(false), state_timestamp(0)
-        , has_bounties(false)
-        {}
+        Invocation invocation;
+        bool ok = invocation.Serialize(input);
+        assert( ok && invocation.signature == expected.signature && invocation.arg == expected.arg );
 
-        void Setup()
+        if ( scope.HasDefinitions() )
         {
-            user_id = 1234;
-            empire_id = 8888;
-            city_id = 4567;
+            acks.push_back( receiver.GetNumDefined() );
+        }
+    };
 
-            has_scout_cost = true;
-            scout_cost = 55;
+    std::deque<Invocation> pending; // the reliable invocations in flight, along with reliables
+    size_t nbytesFirst = 0, nbytesLast = 0, nbytesPlain = 0;
 
-            has_city_level = true;
-            city_level = 33;
+    for (size_t i = 0; i < N_MESSAGES; ++i)
+    {
+        Invocation invocation;
+        invocation.signature = SIGNATURES[ rand() % N_SIGNATURES ];
+        invocation.arg = (U32)i;
+        bool reliable = rand() % 4 != 0;
 
-            has_truce = true;
-            truce = false;
+        Buffer buffer;
+        {
+            StringDictionaryScope scope(sender, reliable);
+            SerializationOutputWrapperType output(container, buffer);
+            invocation.Serialize(output);
+            output.Flush();
+            scope.Commit();
+        }
 
-            has_last_state = true;
-            last_state = 666;
+        {
+            Buffer plain;
+            SerializationOutputWrapperType output(container, plain);
+            invocation.Serialize(output);
+            output.Flush();
+            nbytesPlain += plain.size();
+        }
 
-            has_state_timestamp = true;
-            state_timestamp = 5656;
+        if ( i < N_MESSAGES / 10 )
+        {
+            nbytesFirst += buffer.size();
+        }
+        else if ( i >= N_MESSAGES - N_MESSAGES / 10 )
+        {
+            nbytesLast += buffer.size();
+        }
 
-            has_bounties = true;
-            bounties.resize(10);
-            for (auto& bounty : bounties)
+        if (reliable)
+        {
+            // NB: swapped with the previous one every now and then
+            reliables.push_back( std::move(buffer) );
+            pending.push_back(invocation);
+            if ( reliables.size() > 1 && rand() % 3 == 0 )
             {
-                bounty.Setup();
+                std::swap( reliables[reliables.size() - 1], reliables[reliables.size() - 2] );
+                std::swap( pending[pending.size() - 1], pending[pending.size() - 2] );
             }
         }
-
-        bool Serialize(ISerializationType& s)
+        else if ( rand() % 100 >= LOSS_PERCENT )
         {
-            SERIALIZE(s, user_id);
-            SERIALIZE(s, empire_id);
-            SERIALIZE(s, city_id);
-
-            CONDITIONAL_SERIALIZE(s, has_scout_cost, scout_cost);
-            CONDITIONAL_SERIALIZE(s, has_city_name, city_name);
-            CONDITIONAL_SERIALIZE(s, has_city_level, city_level);
-            CONDITIONAL_SERIALIZE(s, has_truce, truce);
-            CONDITIONAL_SERIALIZE(s, has_last_state, last_state);
-            CONDITIONAL_SERIALIZE(s, has_state_timestamp, state_timestamp);
-
-            CONDITIONAL_SERIALIZE(s, has_bounties, bounties);
-
-            return true;
+            receive(buffer, invocation);
         }
-    };
-
-    struct Tile
-    {
-        U32 id;
-
-        bool has_overlay;
-        U32 overlay;
 
-        bool has_city;
-        City city;
-
-        bool has_army;
-        Army army;
+        if ( reliables.size() > DELAY )
+        {
+            receive( reliables.front(), pending.front() );
+            reliables.pop_front();
+            pending.pop_front();
+        }
 
-        bool has_wonder;
-        Wonder wonder;
+        if ( acks.size() > DELAY )
+        {
+            if ( rand() % 100 >= LOSS_PERCENT )
+            {
+                sender.Acknowledge( acks.front() );
+            }
+            acks.pop_front();
+        }
+    }
 
-        // resource tile information
-        bool has_r_level;
-        U32 r_level;
+    assert( receiver.GetNumDefined() == N_SIGNATURES );
 
-        bool has_r_amount;
-        U32 r_amount;
+    // the ID defined by a message never sent is taken back, so the next definition gets it, leaving no gap at the receiver
+    {
+        {
+            Buffer unsent;
+            StringDictionaryScope scope(sender);
+            SerializationOutputWrapperType output(container, unsent);
+            Invocation invocation;
+            invocation.signature = "void Entity::Unsent()";
+            invocation.Serialize(output);
+        }
 
-        bool has_r_gather_start_time;
-        U32 r_gather_start_time;
+        Buffer buffer;
+        Invocation invocation;
+        invocation.signature = "void Entity::Sent()";
+        {
+            StringDictionaryScope scope(sender);
+            SerializationOutputWrapperType output(container, buffer);
+            invocation.Serialize(output);
+            output.Flush();
+            scope.Commit();
+        }
+        receive(buffer, invocation);
+        assert( receiver.GetNumDefined() == N_SIGNATURES + 1 );
+    }
 
-        bool has_add_drain_rate;
-        U32 add_drain_rate;
+    // a string only ever sent unreliably goes in full, is queued to be defined by a reliable message, then referred to by ID
+    {
+        Invocation invocation;
+        invocation.signature = "void Entity::Tick(F64)";
 
-        Tile()
-        : id(0)
-        , has_overlay(false), overlay(0)
-        , has_city(false)
-        , has_army(false)
-        , has_wonder(false)
-        , has_r_level(false), r_level(0)
-        , has_r_amount(false), r_amount(0)
-        , has_r_gather_start_time(false), r_gather_start_time(0)
-        , has_add_drain_rate(false), add_drain_rate(0)
-        {}
+        auto send = [&]()
+        {
+            Buffer buffer;
+            StringDictionaryScope scope(sender, false);
+            SerializationOutputWrapperType output(container, buffer);
+            invocation.Serialize(output);
+            output.Flush();
+            scope.Commit();
+            return buffer;
+        };
+
+        Buffer first = send();
+        receive(first, invocation);
+        assert( sender.HasPending() );
+
+        Buffer definitions;
+        {
+            StringDictionaryScope scope(sender);
+            SerializationOutputWrapperType output(container, definitions);
+            bool ok = scope.SerializePending(output);
+            output.Flush();
+            assert(ok);
+            scope.Commit();
+        }
+        assert( !sender.HasPending() );
 
-        void Setup()
         {
-            id = 333;
+            StringDictionaryScope scope(receiver);
+            SerializationInputWrapperType input(container, definitions);
+            bool ok = scope.SerializePending(input);
+            assert( ok && scope.HasDefinitions() );
+        }
+        sender.Acknowledge( receiver.GetNumDefined() );
 
-            has_overlay = true;
-            overlay = 1;
+        Buffer last = send();
+        receive(last, invocation);
+        assert( !sender.HasPending() && last.size() + invocation.signature.size() <= first.size() );
+    }
 
-            has_city = true;
-            city.Setup();
+    // a reference to a string never defined is rejected
+    {
+        Buffer buffer;
+        {
+            StringDictionaryScope scope(sender);
+            SerializationOutputWrapperType output(container, buffer);
+            Invocation invocation;
+            invocation.signature = SIGNATURES[0];
+            invocation.Serialize(output);
+            output.Flush();
+            scope.Commit();
+        }
 
-            has_army = true;
-            army.Setup();
+        StringDictionary empty;
+        StringDictionaryScope scope(empty);
+        SerializationInputWrapperType input(container, buffer);
+        Invocation invocation;
+        bool ok = invocation.Serialize(input);
+        assert( !ok );
+    }
 
-            has_wonder = true;
-            wonder.Setup();
+    size_t n = N_MESSAGES / 10;
+    std::cout << "String dictionary: " << N_MESSAGES << " invocations of " << N_SIGNATURES << " methods, plain: " << nbytesPlain / N_MESSAGES << " bytes/message, first " << n << ": " << nbytesFirst / n << " bytes/message, last " << n << ": " << nbytesLast / n << " bytes/message" << std::endl;
+}
 
-            has_r_level = true;
-            r_level = 50;
+// A batch of invocations routed by its destination, which is all the router looks at
+struct Envelope
+{
+    U32 destination;
+    String sender;
+    Buffer attachment;
+    Lazy< std::vector<Invocation> > invocations;
 
-            has_r_amount = true;
-            r_amount = 100;
+    Envelope() : destination(0) {}
 
-            has_r_gather_start_time = true;
-            r_gather_start_time = 1000;
+    bool Serialize(ISerializationType& s)
+    {
+        SERIALIZE(s, destination);
+        SERIALIZE(s, sender);
+        SERIALIZE(s, attachment);
+        SERIALIZE(s, invocations);
+        return true;
+    }
+};
 
-            has_add_drain_rate = true;
-            add_drain_rate = 100;
-        }
+static void TestLazyView()
+{
+    static const size_t N_INVOCATIONS = 200;
+    static const size_t N_ROUNDS = 2000;
 
-        bool Serialize(ISerializationType& s)
-        {
-            SERIALIZE(s, id);
+    DataPolicyContainerType container;
+    container.Setup( DataPolicyContainerPreloadType::Singleton().Retrieve() );
 
-            CONDITIONAL_SERIALIZE(s, has_overlay, overlay);
-            CONDITIONAL_SERIALIZE(s, has_city, city);
-            CONDITIONAL_SERIALIZE(s, has_army, army);
-            CONDITIONAL_SERIALIZE(s, has_wonder, wonder);
-            CONDITIONAL_SERIALIZE(s, has_r_level, r_level);
-            CONDITIONAL_SERIALIZE(s, has_r_amount, r_amount);
-            CONDITIONAL_SERIALIZE(s, has_r_gather_start_time, r_gather_start_time);
-            CONDITIONAL_SERIALIZE(s, has_add_drain_rate, add_drain_rate);
+    Envelope envelope;
+    envelope.destination = 42;
+    envelope.sender = "zone-server-0007.cluster-east";
+    envelope.attachment.resize(1000);
+    for (size_t i = 0; i < envelope.attachment.size(); ++i)
+    {
+        envelope.attachment[i] = (Byte)(i * 7);
+    }
 
-            return true;
-        }
-    };
+    std::vector<Invocation> invocations(N_INVOCATIONS);
+    for (size_t i = 0; i < N_INVOCATIONS; ++i)
+    {
+        invocations[i].signature = i % 2 ? "void Avatar::Move(F64, F64, F64, F64)" : "void Avatar::Say(const String&)";
+        invocations[i].arg = (U32)i;
+    }
+    envelope.invocations = invocations;
 
-    struct Chunk
+    Buffer buffer;
     {
-        U32 p_id;
-        U32 c_id;
+        SerializationOutputWrapperType output(container, buffer);
+        envelope.Serialize(output);
+    }
 
-        bool has_tiles;
-        std::deque<Tile> tiles;
+    // the view reads the destination and the sender in place, and skips over the rest without decoding it
+    {
+        SerializationViewType view(container, buffer);
+        U32 destination = 0;
+        BytesView sender;
+        Lazy< std::vector<Invocation> > lazy;
+        bool ok = view.Read(destination) && view.Read(sender) && view.Skip<Buffer>() && view.Read(lazy);
+        assert( ok && destination == 42 && sender == envelope.sender && sender.data > buffer.data() && sender.data < buffer.data() + buffer.size() );
+        assert( !lazy.IsDecoded() && lazy.GetBytes().data + lazy.GetBytes().size == buffer.data() + buffer.size() );
+
+        const std::vector<Invocation>& decoded = lazy.Get(container);
+        assert( lazy.IsDecoded() && decoded.size() == N_INVOCATIONS && decoded[1].signature == invocations[1].signature && decoded.back().arg == N_INVOCATIONS - 1 );
+    }
 
-        Chunk()
-        : p_id(0)
-        , c_id(0)
-        , has_tiles(false)
-        {}
+    // an envelope relayed without ever decoding its invocations goes out as it came in
+    {
+        SerializationInputWrapperType input(container, buffer);
+        Envelope relayed;
+        bool ok = relayed.Serialize(input);
+        assert( ok && !relayed.invocations.IsDecoded() && relayed.attachment == envelope.attachment );
 
-        void Setup()
+        Buffer again;
         {
-            p_id = 111;
-            c_id = 222;
-
-            has_tiles = true;
-            tiles.resize(10);
-            for (auto& tile : tiles)
-            {
-                tile.Setup();
-            }
+            SerializationOutputWrapperType output(container, again);
+            relayed.Serialize(output);
         }
+        assert( again == buffer );
+    }
 
-        bool Serialize(ISerializationType& s)
+    // decoded after the serialization it has been read from, and its container, are gone
+    {
+        Envelope received;
         {
-            SERIALIZE(s, p_id);
-            SERIALIZE(s, c_id);
-
-            CONDITIONAL_SERIALIZE(s, has_tiles, tiles);
-
-            return true;
+            DataPolicyContainerType reader;
+            reader.Setup( DataPolicyContainerPreloadType::Singleton().Retrieve() );
+            SerializationInputWrapperType input(reader, buffer);
+            bool ok = received.Serialize(input);
+            assert( ok && !received.invocations.IsDecoded() );
         }
-    };
-
-    bool has_chunks;
-    std::deque<Chunk> chunks;
-
-    bool has_marches;
-    std::deque<March> marches;
 
-    bool has_empires;
-    std::deque<Empire> empires;
-
-    bool has_alliances;
-    std::deque<Alliance> alliances;
-
-    MapData()
-    : has_chunks(false)
-    , has_marches(false)
-    , has_empires(false)
-    , has_alliances(false)
-    {}
+        bool ok = received.invocations.Decode(container);
+        assert( ok && received.invocations.Get(container).size() == N_INVOCATIONS );
+    }
 
-    void Setup()
+    // truncated: the view does not read past the end, and the invocations cut short do not decode
     {
-        has_chunks = true;
-        chunks.resize(10);
-        for (auto& chunk : chunks)
-        {
-            chunk.Setup();
-        }
+        Buffer truncated( buffer.begin(), buffer.begin() + buffer.size() / 2 );
+        SerializationViewType view(container, truncated);
+        U32 destination = 0;
+        bool ok = view.Read(destination) && view.Skip<String>() && view.Skip<Buffer>() && view.Skip< Lazy< std::vector<Invocation> > >();
+        assert( !ok );
 
-        has_marches = true;
-        marches.resize(10);
-        for (auto& march : marches)
+        Buffer cut;
         {
-            march.Setup();
+            SerializationOutputWrapperType output(container, cut);
+            ISerializationType& s = output;
+            Buffer blob = envelope.invocations.GetBytes().ToBuffer(); // NB: empty, the envelope has never been read
+            {
+                BitStreamOutput stream(blob);
+                SerializationOutput<CoreSerializationTypes> nested(container, stream, false);
+                ::Serialize(nested, invocations);
+            }
+            blob.resize( blob.size() / 2 );
+            ::Serialize(s, envelope.destination);
+            ::Serialize(s, envelope.sender);
+            ::Serialize(s, envelope.attachment);
+            ::Serialize(s, blob);
         }
+        SerializationInputWrapperType input(container, cut);
+        Envelope shortened;
+        ok = shortened.Serialize(input);
+        assert( ok && !shortened.invocations.Decode(container) );
+    }
 
-        has_empires = true;
-        empires.resize(10);
-        for (auto& empire : empires)
+    double full = 0.0, lazy = 0.0;
+    size_t sum = 0;
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < N_ROUNDS; ++i)
         {
-            empire.Setup();
+            SerializationInputWrapperType input(container, buffer);
+            Envelope decoded;
+            decoded.Serialize(input);
+            sum += decoded.destination + decoded.invocations.Get(container).size();
         }
-
-        has_alliances = true;
-        alliances.resize(10);
-        for (auto& alliance : alliances)
+        full = std::chrono::duration<double, std::micro>( std::chrono::high_resolution_clock::now() - start ).count() / N_ROUNDS;
+    }
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < N_ROUNDS; ++i)
         {
-            alliance.Setup();
+            SerializationViewType view(container, buffer);
+            U32 destination = 0;
+            view.Read(destination);
+            sum += destination;
         }
+        lazy = std::chrono::duration<double, std::micro>( std::chrono::high_resolution_clock::now() - start ).count() / N_ROUNDS;
     }
 
+    std::cout << "Lazy view: " << buffer.size() << " bytes/envelope, full decode: " << full << " us, destination only: " << lazy << " us (" << sum % 10 << ")" << std::endl;
+}
+
+// A pose quantized with the geometric policies, if they are defined
+struct Pose
+{
+    F64 x, y, z;
+    F64 yaw;
+    F32 qx, qy, qz, qw;
+
     bool Serialize(ISerializationType& s)
     {
-        CONDITIONAL_SERIALIZE(s, has_chunks, chunks);
-        CONDITIONAL_SERIALIZE(s, has_marches, marches);
-        CONDITIONAL_SERIALIZE(s, has_empires, empires);
-        CONDITIONAL_SERIALIZE(s, has_alliances, alliances);
-
+        SERIALIZE_PT(s, x, "position", "X");
+        SERIALIZE_PT(s, y, "position", "Y");
+        SERIALIZE_PT(s, z, "position", "Z");
+        SERIALIZE_P(s, yaw, "yaw");
+        SERIALIZE_PT(s, qx, "rotation", "X");
+        SERIALIZE_PT(s, qy, "rotation", "Y");
+        SERIALIZE_PT(s, qz, "rotation", "Z");
+        SERIALIZE_PT(s, qw, "rotation", "W");
         return true;
     }
 };
 
-static void TestMapDataSerialization()
+static void TestGeometricQuantization()
 {
-    Buffer buffer;
+    typedef IMetadataProcessor::Element Element;
 
-    // Sender / Encoder side ... 
-    DataPolicyContainerType container;
-    SerializationOutputWrapperType output(container, buffer);
+    Element position = { "policy", { {"name", "position"}, {"class", "BoundedVectorF64Policy"} }, {
+        { "X", { {"min", "-4096"}, {"max", "4096"}, {"nbits", "22"} } },
+        { "Y", { {"min", "-256"}, {"max", "256"}, {"nbits", "16"} } },
+        { "Z", { {"min", "-4096"}, {"max", "4096"}, {"nbits", "22"} } },
+    } };
+    Element yaw = { "policy", { {"name", "yaw"}, {"class", "AngleF64Policy"} }, { { "angle", { {"min", "0"}, {"max", "360"}, {"nbits", "10"} } } } };
+    Element rotation = { "policy", { {"name", "rotation"}, {"class", "QuaternionF32Policy"} }, { { "quaternion", { {"nbits", "10"} } } } };
 
-    MapData md_out;
-    md_out.Setup();
+    DataPolicyContainerType quantized;
+    quantized.Setup( DataPolicyContainerPreloadType::Singleton().Retrieve() );
+    quantized.LoadPolicies( MetadataProcessorInline( {position, yaw, rotation} ) );
+
+    DataPolicyContainerType plain;
 
+    static const size_t N_POSES = 1000;
+
+    std::vector<Pose> poses(N_POSES);
+    for (size_t i = 0; i < N_POSES; ++i)
     {
-        auto start = std::chrono::high_resolution_clock::now();
-        md_out.Serialize(output);
-        auto end = std::chrono::high_resolution_clock::now();
+        Pose& p = poses[i];
+        p.x = (F64)i * 6.91 - 3000.0;
+        p.y = (F64)(i % 50) * 0.77 - 20.0;
+        p.z = 2500.0 - (F64)i * 3.17;
+        p.yaw = (F64)i * 13.7 - 720.0; // NB: wraps around many times
+
+        F32 angle = (F32)i * 0.01f, c = std::cos(angle / 2), s = std::sin(angle / 2);
+        F32 ax = 0.48f, ay = -0.6f, az = 0.64f; // unit axis
+        p.qx = ax * s;
+        p.qy = ay * s;
+        p.qz = az * s;
+        p.qw = c;
+    }
 
-        std::cout << "Encoded MapData into " << buffer.size() << " bytes, took: " << std::chrono::duration_cast< std::chrono::duration< float, std::ratio<1, 1000> > >(end - start).count() << " ms" << std::endl;
+    Buffer full, compact;
+    {
+        SerializationOutputWrapperType output(plain, full);
+        for (auto& p : poses)
+        {
+            p.Serialize(output);
+        }
+    }
+    {
+        SerializationOutputWrapperType output(quantized, compact);
+        for (auto& p : poses)
+        {
+            p.Serialize(output);
+        }
     }
 
-    // Receiver / Decoder side ...
-    SerializationInputWrapperType input(container, buffer);
+    SerializationInputWrapperType input(quantized, compact);
+    for (size_t i = 0; i < N_POSES; ++i)
+    {
+        Pose p;
+        assert( p.Serialize(input) );
 
-    MapData md_in;
+        const Pose& o = poses[i];
+        assert( std::fabs(p.x - o.x) < 0.01 && std::fabs(p.y - o.y) < 0.01 && std::fabs(p.z - o.z) < 0.01 );
 
-    {
-        auto start = std::chrono::high_resolution_clock::now();
-        md_in.Serialize(input);
-        auto end = std::chrono::high_resolution_clock::now();
+        F64 dyaw = std::fmod( std::fabs(p.yaw - o.yaw), 360.0 );
+        assert( std::min(dyaw, 360.0 - dyaw) < 0.5 );
+
+        F32 dot = std::fabs( p.qx * o.qx + p.qy * o.qy + p.qz * o.qz + p.qw * o.qw ); // NB: q and -q are the same rotation
+        assert( dot > 0.9999f );
+    }
 
-        std::cout << "Decoded MapData from " << buffer.size() << " bytes, took: " << std::chrono::duration_cast< std::chrono::duration< float, std::ratio<1, 1000> > >(end - start).count() << " ms" << std::endl;
+    // the angles take up to 63 bits, more is clamped
+    {
+        AngleQuantization<F64> q(0.0, 360.0, 64);
+        Buffer b;
+        {
+            BitStreamOutput os(b);
+            q.Write(os, 123.25, String());
+        }
+        BitStreamInput is(b);
+        F64 angle = 0.0;
+        bool ok = q.Read(is, angle, String());
+        assert( ok && b.size() == 8 && std::fabs(angle - 123.25) < 1e-9 );
     }
+
+    std::cout << "Geometric quantization: " << N_POSES << " poses, default policies: " << BYTES2BITS(full.size()) / N_POSES << " bits/pose, quantized: " << BYTES2BITS(compact.size()) / N_POSES << " bits/pose" << std::endl;
 }
 
 struct Visitor
@@ -962,6 +1979,7 @@ static void TestVariant()
     SerializationOutputWrapperType output(container, buffer);
     v.Serialize(output);
     ser.Serialize(output);
+    output.Flush();
 
     // Receiver / Decoder side ...
     SerializationInputWrapperType input(container, buffer);
@@ -981,6 +1999,30 @@ static void TestVariant()
     std::vector<V> vv;
     vv.push_back(123);
     vv.push_back("world");
+
+    // each of the types round trips, and an invalid index fails to decode, leaving the Variant empty
+    std::vector<V> values = { V("text"), V((I64)-5), V(3.5), V(true) };
+    Buffer b;
+    {
+        SerializationOutputWrapperType o(container, b);
+        for (auto& value : values)
+        {
+            value.Serialize(o);
+        }
+        U8 invalid = 200;
+        ::Serialize( (ISerializationType&)o, invalid );
+    }
+    SerializationInputWrapperType i(container, b);
+    std::vector<V> decoded(values.size(), V("overwritten"));
+    for (size_t k = 0; k < decoded.size(); ++k)
+    {
+        bool ok = decoded[k].Serialize(i);
+        assert( ok && decoded[k].GetIndex() == k );
+    }
+    assert( decoded[0].Get<String>() == "text" && decoded[1].Get<I64>() == -5 && decoded[2].Get<F64>() == 3.5 && decoded[3].Get<bool>() );
+    V invalid = "overwritten";
+    bool ok = invalid.Serialize(i);
+    assert( !ok && invalid.GetIndex() == TypeListCount<VariantTypes>::value );
 }
 
 class ValuePrinter
@@ -1080,6 +2122,7 @@ static void TestMetaStruct()
     container.Setup( DataPolicyContainerPreloadType::Singleton().Retrieve() );
     SerializationOutputWrapperType output(container, buffer);
     mapdata.Serialize(output);
+    output.Flush();
 
     // Receiver / Decoder side ...
     SerializationInputWrapperType input(container, buffer);
@@ -1088,6 +2131,288 @@ static void TestMetaStruct()
 
     // Print the data
     PrintStruct(mapdata_in);
+
+    // Schema compiled, the schemas go along with the first message, then by ID once acknowledged; the Tile and Cell arrays go by column
+    {
+        MetaSchemaRegistry sender, receiver;
+        Buffer compiled[2];
+
+        for (int acknowledged = 0; acknowledged < 2; ++acknowledged)
+        {
+            Buffer& b = compiled[acknowledged];
+            {
+                MetaSchemaScope scope(sender);
+                SerializationOutputWrapperType o(container, b);
+                mapdata.Serialize(o);
+                o.Flush();
+                scope.Commit();
+            }
+
+            S s;
+            {
+                MetaSchemaScope scope(receiver);
+                SerializationInputWrapperType in(container, b);
+                bool ok = s.Serialize(in);
+                assert( ok && scope.HasDefinitions() == !acknowledged );
+            }
+
+            Buffer plain;
+            SerializationOutputWrapperType o(container, plain);
+            s.Serialize(o);
+            o.Flush();
+            assert( plain == buffer );
+
+            sender.Acknowledge( receiver.GetNumDefined() );
+        }
+
+        // an unreliable message defines nothing, so a lost one leaves no gap at the receiver
+        {
+            MetaSchemaRegistry unreliable, other;
+            Buffer b;
+            {
+                MetaSchemaScope scope(unreliable, false);
+                SerializationOutputWrapperType o(container, b);
+                mapdata.Serialize(o);
+            }
+            MetaSchemaScope scope(other);
+            SerializationInputWrapperType in(container, b);
+            S s;
+            bool ok = s.Serialize(in);
+            assert( ok && !scope.HasDefinitions() && other.GetNumDefined() == 0 );
+        }
+
+        // the IDs are unknown to another receiver
+        {
+            MetaSchemaRegistry other;
+            MetaSchemaScope scope(other);
+            SerializationInputWrapperType in(container, compiled[1]);
+            S s;
+            bool ok = s.Serialize(in);
+            assert( !ok );
+        }
+
+        // a nested Struct defining a new ID while its outer one, referred to by ID, is being decoded
+        {
+            MetaSchemaRegistry nested_sender, nested_receiver;
+            for (int i = 0; i < 2; ++i)
+            {
+                S outer("Outer");
+                S inner("Inner");
+                if (i == 0)
+                {
+                    inner.AddField("x").SetValue((I64)-1);
+                }
+                else
+                {
+                    inner.AddField("y").SetValue("abc");
+                }
+                outer.AddField("inner").SetValue( S::FieldType::ValueType( std::move(inner) ) );
+                outer.AddField("a").SetValue((U32)1);
+                outer.AddField("b").SetValue((U32)2);
+
+                Buffer b;
+                {
+                    MetaSchemaScope scope(nested_sender);
+                    SerializationOutputWrapperType o(container, b);
+                    outer.Serialize(o);
+                    o.Flush();
+                    scope.Commit();
+                }
+
+                S s;
+                {
+                    MetaSchemaScope scope(nested_receiver);
+                    SerializationInputWrapperType in(container, b);
+                    bool ok = s.Serialize(in);
+                    assert(ok);
+                }
+
+                Buffer plain[2];
+                {
+                    SerializationOutputWrapperType o(container, plain[0]);
+                    outer.Serialize(o);
+                    o.Flush();
+                }
+                {
+                    SerializationOutputWrapperType o(container, plain[1]);
+                    s.Serialize(o);
+                    o.Flush();
+                }
+                assert( plain[0] == plain[1] );
+
+                nested_sender.Acknowledge( nested_receiver.GetNumDefined() );
+            }
+            assert( nested_receiver.GetNumDefined() == 3 );
+        }
+
+        // the ID defined by a message never sent is taken back, so the next definition gets it, leaving no gap at the receiver
+        {
+            MetaSchemaRegistry rollback_sender, rollback_receiver;
+            {
+                Buffer unsent;
+                MetaSchemaScope scope(rollback_sender);
+                SerializationOutputWrapperType o(container, unsent);
+                S unsent_s("Unsent");
+                unsent_s.AddField("a").SetValue((U32)1);
+                unsent_s.Serialize(o);
+            }
+
+            Buffer b;
+            S sent("Sent");
+            sent.AddField("b").SetValue((U32)2);
+            {
+                MetaSchemaScope scope(rollback_sender);
+                SerializationOutputWrapperType o(container, b);
+                sent.Serialize(o);
+                o.Flush();
+                scope.Commit();
+            }
+
+            MetaSchemaScope scope(rollback_receiver);
+            SerializationInputWrapperType in(container, b);
+            S s;
+            bool ok = s.Serialize(in);
+            assert( ok && rollback_receiver.GetNumDefined() == 1 );
+        }
+
+        std::cout << "Schema compiled MetaStruct: " << buffer.size() << " bytes plain, " << compiled[0].size() << " bytes with the schemas, " << compiled[1].size() << " bytes once acknowledged" << std::endl;
+    }
+
+    // As a flat snapshot, read in place: a field is a table of its name, whether it has a value and the value, a value that of its
+    // type index and the value, with the Structs and the elements of the arrays wrapped in a table of their own (RecursiveWrapper)
+    {
+        Buffer image;
+        FlatSnapshotOutputType o(image);
+        bool ok = o.Write(mapdata);
+        assert(ok);
+
+        FlatSnapshot snapshot;
+        FlatArray fields, chunks;
+        FlatTable field, value, wrapper, chunk;
+        BytesView name;
+        U32 c_id = 0;
+        ok = snapshot.Open( image.data(), image.size() ) && snapshot.GetRoot().Get(1, fields) && fields.Get(0, field)
+            && field.Get(2, value) && value.Get(1, chunks) && chunks.Get(2, wrapper) && wrapper.Get(0, value)
+            && value.Get(1, wrapper) && wrapper.Get(0, chunk) && chunk.Get(0, name) && chunk.Get(1, fields)
+            && fields.Get(1, field) && field.Get(2, value) && value.Get(1, c_id);
+        assert( ok && name == String("Chunk") && c_id == 2002 );
+
+        S s;
+        FlatSnapshotInputType in;
+        ok = in.Open( image.data(), image.size() ) && in.Read(s);
+        assert(ok);
+
+        Buffer plain;
+        SerializationOutputWrapperType out(container, plain);
+        s.Serialize(out);
+        out.Flush();
+        assert( plain == buffer );
+        std::cout << "Flat MetaStruct: " << image.size() << " bytes" << std::endl;
+    }
+
+    // Encoding speed, the policy of the names is resolved by its interned handle (SERIALIZE_P)
+    static const size_t N_ENCODES = 10000;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < N_ENCODES; ++i)
+    {
+        Buffer b;
+        SerializationOutputWrapperType o(container, b);
+        mapdata.Serialize(o);
+        o.Flush();
+    }
+    std::cout << "Encoded MetaStruct " << N_ENCODES << " times, took: " << std::chrono::duration_cast< std::chrono::duration< float, std::ratio<1, 1000> > >(std::chrono::high_resolution_clock::now() - start).count() << " ms" << std::endl;
+
+    // Measured up front, the encoding goes into an exactly sized buffer
+    {
+        SerializationMeasureWrapperType measure(container);
+        mapdata.Serialize(measure);
+        size_t nbits = measure.GetNumBits();
+
+        Buffer b;
+        SerializationOutputWrapperType o(container, b);
+        o.Reserve(nbits);
+        const Byte* data = b.data();
+        mapdata.Serialize(o);
+        o.Flush();
+
+        assert( b.data() == data && b.size() == BITS2BYTES(nbits) && b == buffer );
+        std::cout << "Measured MetaStruct: " << nbits << " bits" << std::endl;
+    }
+
+    SerializationSizeHints<String> hints;
+    const String key = mapdata.GetName();
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < N_ENCODES; ++i)
+    {
+        Buffer b;
+        SerializationOutputWrapperType o(container, b);
+        o.Reserve( hints.Get(key) );
+        mapdata.Serialize(o);
+        o.Flush();
+        hints.Update( key, BYTES2BITS(b.size()) );
+    }
+    std::cout << "Encoded MetaStruct " << N_ENCODES << " times with the size hints, took: " << std::chrono::duration_cast< std::chrono::duration< float, std::ratio<1, 1000> > >(std::chrono::high_resolution_clock::now() - start).count() << " ms" << std::endl;
+
+    // Decoding speed, with the nodes from the heap vs. from an arena, which is reset after each message
+    static const size_t N_DECODES = 10000;
+    Arena arena;
+
+    for (int fromArena = 0; fromArena < 2; ++fromArena)
+    {
+        start = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < N_DECODES; ++i)
+        {
+            {
+                ArenaScope scope( fromArena ? &arena : nullptr );
+                S s;
+                SerializationInputWrapperType in(container, buffer);
+                s.Serialize(in);
+
+                if (i == 0)
+                {
+                    Buffer b;
+                    SerializationOutputWrapperType o(container, b);
+                    s.Serialize(o);
+                    o.Flush();
+                    assert( b == buffer );
+                    if (fromArena)
+                    {
+                        std::cout << "Decoded MetaStruct into " << arena.GetNumBytes() << " bytes of arena" << std::endl;
+                    }
+                }
+            }
+            arena.Reset();
+        }
+        std::cout << "Decoded MetaStruct " << N_DECODES << " times " << (fromArena ? "into an arena" : "from the heap") << ", took: " << std::chrono::duration_cast< std::chrono::duration< float, std::ratio<1, 1000> > >(std::chrono::high_resolution_clock::now() - start).count() << " ms" << std::endl;
+    }
+
+    // The per field cost of the policy lookup, by name vs. by handle
+    static const size_t N_FIELDS = 1000000;
+    String name("Tile");
+    const PolicyHandle unique = PolicyNames::Intern("unique");
+
+    for (int byHandle = 0; byHandle < 2; ++byHandle)
+    {
+        Buffer b;
+        SerializationOutputWrapperType o(container, b);
+        ISerializationType& s = o;
+
+        start = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < N_FIELDS; ++i)
+        {
+            if (byHandle)
+            {
+                ::Serialize(s, name, unique);
+            }
+            else
+            {
+                ::Serialize(s, name, "unique");
+            }
+        }
+        o.Flush();
+        std::cout << "Serialized " << N_FIELDS << " fields with the policy " << (byHandle ? "handle" : "name") << ", took: " << std::chrono::duration_cast< std::chrono::duration< float, std::ratio<1, 1000> > >(std::chrono::high_resolution_clock::now() - start).count() << " ms" << std::endl;
+    }
 }
 
 /////////////////////////////////////////////////////////////////////
@@ -1195,6 +2520,7 @@ static int l_mzmmp_encode(lua_State* L)
         container.Setup( DataPolicyContainerPreloadType::Singleton().Retrieve() );
         SerializationOutputWrapperType output(container, buffer);
         s.Serialize(output);
+        output.Flush();
 
         lua_pushlstring( L, (char*)buffer.data(), buffer.size() );
 
@@ -1293,6 +2619,8 @@ static int l_mzmmp_decode(lua_State* L)
         container.Setup( DataPolicyContainerPreloadType::Singleton().Retrieve() );
         SerializationInputWrapperType input(container, buffer);
 
+        Arena arena; // NB: the decoded message is thrown away as a whole
+        ArenaScope scope(arena);
         S s;
         s.Serialize(input);
 
@@ -1416,6 +2744,7 @@ static PyObject* Py_mzmmp_encode(PyObject* self, PyObject* args)
     container.Setup( DataPolicyContainerPreloadType::Singleton().Retrieve() );
     SerializationOutputWrapperType output(container, buffer);
     s.Serialize(output);
+    output.Flush();
 
     return PyBytes_FromStringAndSize( (char*)buffer.data(), buffer.size() );
 }
@@ -1523,6 +2852,8 @@ static PyObject* Py_mzmmp_decode(PyObject* self, PyObject* args)
     container.Setup( DataPolicyContainerPreloadType::Singleton().Retrieve() );
     SerializationInputWrapperType input(container, buffer);
 
+    Arena arena; // NB: the decoded message is thrown away as a whole
+    ArenaScope scope(arena);
     S s;
     s.Serialize(input);
 
@@ -1572,10 +2903,36 @@ int main(int argc, const char * argv[])
 {
     TestBitStream();
 
+    TestVarint();
+
+    TestBulkArrays();
+
+    TestBatchPacking();
+
+    TestString();
+
     TestSerialization();
 
     TestMapDataSerialization();
 
+    TestChunkedStream();
+
+    TestFlatSnapshot();
+
+    TestSegments();
+
+    TestColumnar();
+
+    TestStaticSerialization();
+
+    TestDeltaCompression();
+
+    TestStringDictionary();
+
+    TestLazyView();
+
+    TestGeometricQuantization();
+
     TestVariant();
 
     TestMetaStruct();
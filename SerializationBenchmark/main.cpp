@@ -0,0 +1,706 @@
+//
+//  main.cpp
+//  SerializationBenchmark
+//
+//  Created by Lin Luo on 05/01/2015.
+//
+//  The benchmarks of the serialization framework, from the bit stream primitives up to the whole messages
+//
+//  Each benchmark is calibrated and warmed up, then timed over N_RUNS runs; it reports the median time per operation, and the
+//  bytes encoded / decoded and the heap allocations per operation. The output is one tab separated line per benchmark, under a
+//  header line, so the results of two commits can be diffed (or loaded as TSV):
+//      SerializationBenchmark [filter] > results.tsv
+//  where only the benchmarks whose names contain the filter are run.
+//
+//  Built from this file and the data policies, by the SerializationBenchmark target of the project, or e.g.
+//      c++ -std=gnu++11 -O2 -I../Serialization -I../Netran -I../Distributed main.cpp ../Serialization/DP_*.cpp -o SerializationBenchmark
+//
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+
+#include <chrono>
+#include <random>
+
+#include "Serialization.h"
+#include "UniformQuantization.h"
+#include "Variant.h"
+#include "MetaStruct.h"
+#include "MapData.h"
+#include "Columnar.h"
+#include "ChunkedStream.h"
+#include "FlatSnapshot.h"
+#include "DistributedObjectSystem.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// The heap allocations, counted by replacing the global operator new
+
+static size_t s_nallocs = 0;
+
+void* operator new(size_t size)
+{
+    ++s_nallocs;
+    void* p = std::malloc(size ? size : 1);
+    if (!p)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static const size_t N_RUNS = 5;
+static const float MIN_CALIBRATION_MS = 10.0f;
+static const float TARGET_RUN_MS = 50.0f;
+
+static const char* s_filter = nullptr;
+
+static volatile U64 s_sink = 0; // NB: the results of the operations go here, so they cannot be optimized away
+
+static float ElapsedNanoseconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast< std::chrono::duration< float, std::nano > >(std::chrono::steady_clock::now() - start).count();
+}
+
+// runs op, which returns the bytes it has encoded or decoded, and reports the cost per call
+template <typename F>
+static void Run(const char* name, F&& op)
+{
+    if ( s_filter && !std::strstr(name, s_filter) )
+    {
+        return;
+    }
+
+    // calibration, which doubles as the warm up: the iterations of a run, so it takes about TARGET_RUN_MS
+    size_t niterations = 1;
+    for (;;)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < niterations; ++i)
+        {
+            s_sink += op();
+        }
+
+        float ns = ElapsedNanoseconds(start);
+        if ( ns >= MIN_CALIBRATION_MS * 1000000.0f )
+        {
+            niterations = std::max( (size_t)1, (size_t)(niterations * (TARGET_RUN_MS * 1000000.0f / ns)) );
+            break;
+        }
+        niterations *= 2;
+    }
+
+    float runs[N_RUNS];
+    size_t nbytes = 0;
+    size_t nallocs = 0;
+    for (size_t run = 0; run < N_RUNS; ++run)
+    {
+        size_t nallocs0 = s_nallocs;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < niterations; ++i)
+        {
+            nbytes += op();
+        }
+        runs[run] = ElapsedNanoseconds(start) / niterations;
+        nallocs += s_nallocs - nallocs0;
+    }
+
+    std::sort(runs, runs + N_RUNS);
+    s_sink += nbytes;
+
+    std::cout << name << "\t" << niterations << "\t" << runs[N_RUNS / 2] << "\t" << runs[0] << "\t" << runs[N_RUNS - 1]
+              << "\t" << (float)nbytes / (niterations * N_RUNS) << "\t" << (float)nallocs / (niterations * N_RUNS) << std::endl;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// BitStream primitives, 1024 values per operation
+
+static const size_t N_VALUES = 1024;
+
+static void BenchmarkBitStream()
+{
+    std::mt19937_64 rng(1);
+    std::vector<U32> u32s(N_VALUES);
+    std::vector<U64> u64s(N_VALUES);
+    for (size_t i = 0; i < N_VALUES; ++i)
+    {
+        u32s[i] = (U32)rng() & 0x1ffff;
+        u64s[i] = rng() >> (rng() % 64);
+    }
+
+    Buffer buffer;
+    std::vector<U32> u32s_in(N_VALUES);
+
+    Run("bitstream.write.17bits", [&]()
+    {
+        buffer.clear();
+        BitStreamOutput os(buffer);
+        for (U32 u : u32s)
+        {
+            os.Write(u, 17);
+        }
+        os.Flush();
+        return buffer.size();
+    });
+
+    Run("bitstream.read.17bits", [&]()
+    {
+        BitStreamInput is(buffer);
+        for (U32& u : u32s_in)
+        {
+            is.Read(u, 17);
+        }
+        return buffer.size();
+    });
+
+    Run("bitstream.write.batch.17bits", [&]()
+    {
+        buffer.clear();
+        BitStreamOutput os(buffer);
+        os.WriteBatch(u32s.data(), N_VALUES, 17);
+        os.Flush();
+        return buffer.size();
+    });
+
+    Run("bitstream.read.batch.17bits", [&]()
+    {
+        BitStreamInput is(buffer);
+        is.ReadBatch(u32s_in.data(), N_VALUES, 17);
+        return buffer.size();
+    });
+
+    Run("varint.write.bitpacked", [&]()
+    {
+        buffer.clear();
+        BitStreamOutput os(buffer);
+        for (U64 u : u64s)
+        {
+            os.Write(u);
+        }
+        os.Flush();
+        return buffer.size();
+    });
+
+    Run("varint.read.bitpacked", [&]()
+    {
+        BitStreamInput is(buffer);
+        U64 u = 0;
+        for (size_t i = 0; i < N_VALUES; ++i)
+        {
+            is.Read(u);
+        }
+        s_sink += u;
+        return buffer.size();
+    });
+
+    Run("varint.write.leb128", [&]()
+    {
+        buffer.clear();
+        BitStreamOutput os(buffer);
+        for (U64 u : u64s)
+        {
+            os.WriteVarint(u);
+        }
+        os.Flush();
+        return buffer.size();
+    });
+
+    Run("varint.read.leb128", [&]()
+    {
+        BitStreamInput is(buffer);
+        U64 u = 0;
+        for (size_t i = 0; i < N_VALUES; ++i)
+        {
+            is.ReadVarint(u);
+        }
+        s_sink += u;
+        return buffer.size();
+    });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Strings, 256 per operation: the inline ones, and the longer ones, shared or interned
+
+static void BenchmarkString()
+{
+    const String small("position");
+    const String shared("Avatar::MoveTowardsTheTarget, not interned");
+    const String interned = String::Intern( String("Avatar::MoveTowardsTheTarget") );
+    std::vector<String> strings_in(256);
+
+    struct Case
+    {
+        const char* write;
+        const char* read;
+        const String& s;
+    };
+
+    const Case cases[] = { { "string.write.small", "string.read.small", small }, { "string.write.shared", "string.read.shared", shared }, { "string.write.interned", "string.read.interned", interned } };
+    for (const Case& c : cases)
+    {
+        Buffer buffer;
+
+        Run(c.write, [&]()
+        {
+            buffer.clear();
+            BitStreamOutput os(buffer);
+            for (size_t i = 0; i < strings_in.size(); ++i)
+            {
+                os.Write(c.s);
+            }
+            os.Flush();
+            return buffer.size();
+        });
+
+        Run(c.read, [&]()
+        {
+            BitStreamInput is(buffer);
+            for (String& s : strings_in)
+            {
+                is.Read(s);
+            }
+            return buffer.size();
+        });
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// UniformQuantization of F32s in [-1000, 1000] to 20 bits, 1024 values per operation
+
+static void BenchmarkQuantization()
+{
+    std::mt19937 rng(2);
+    std::uniform_real_distribution<F32> uniform(-1000.0f, 1000.0f);
+    std::vector<F32> values(N_VALUES), values_in(N_VALUES);
+    for (F32& v : values)
+    {
+        v = uniform(rng);
+    }
+
+    const UniformQuantization<F32, U32> q(-1000.0f, 1000.0f, 20);
+    Buffer buffer;
+
+    Run("quantization.write", [&]()
+    {
+        buffer.clear();
+        BitStreamOutput os(buffer);
+        for (F32 v : values)
+        {
+            q.Write(os, v, String());
+        }
+        os.Flush();
+        return buffer.size();
+    });
+
+    Run("quantization.read", [&]()
+    {
+        BitStreamInput is(buffer);
+        for (F32& v : values_in)
+        {
+            q.Read(is, v, String());
+        }
+        return buffer.size();
+    });
+
+    Run("quantization.write.bulk", [&]()
+    {
+        buffer.clear();
+        BitStreamOutput os(buffer);
+        q.Write(os, values.data(), N_VALUES, String());
+        os.Flush();
+        return buffer.size();
+    });
+
+    Run("quantization.read.bulk", [&]()
+    {
+        BitStreamInput is(buffer);
+        q.Read(is, values_in.data(), N_VALUES, String());
+        return buffer.size();
+    });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// UniqueStringPolicy, 256 names out of 32 distinct ones per operation
+
+static void BenchmarkUniqueString()
+{
+    std::vector<String> names;
+    for (size_t i = 0; i < 256; ++i)
+    {
+        names.push_back( String( ( "entity_name_" + std::to_string(i % 32) ).c_str() ) );
+    }
+    std::vector<String> names_in( names.size() );
+
+    DataPolicyContainerType container;
+    container.Setup( DataPolicyContainerPreloadType::Singleton().Retrieve() );
+    const PolicyHandle unique = PolicyNames::Intern("unique");
+    Buffer buffer;
+
+    Run("unique.write", [&]()
+    {
+        buffer.clear();
+        SerializationOutputWrapperType o(container, buffer);
+        ISerializationType& s = o;
+        for (String& name : names)
+        {
+            ::Serialize(s, name, unique);
+        }
+        o.Flush();
+        return buffer.size();
+    });
+
+    Run("unique.read", [&]()
+    {
+        SerializationInputWrapperType i(container, buffer);
+        ISerializationType& s = i;
+        for (String& name : names_in)
+        {
+            ::Serialize(s, name, unique);
+        }
+        return buffer.size();
+    });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Variant dispatch, 1024 values spread over all the core types per operation
+
+typedef Variant<CoreSerializationTypes> CoreVariant;
+
+struct VariantSum
+{
+    U64 sum;
+
+    template <typename T>
+    void operator()(const T& t)
+    {
+        sum += (U64)t;
+    }
+
+    void operator()(const String& s)
+    {
+        sum += s.size();
+    }
+
+    void operator()(const Buffer& b)
+    {
+        sum += b.size();
+    }
+};
+
+static void BenchmarkVariant()
+{
+    std::vector<CoreVariant> values(N_VALUES), values_in(N_VALUES);
+    for (size_t i = 0; i < N_VALUES; ++i)
+    {
+        values[i].Reset( i % TypeListCount<CoreSerializationTypes>::value );
+    }
+
+    DataPolicyContainerType container;
+    Buffer buffer;
+
+    Run("variant.copy", [&]()
+    {
+        for (size_t i = 0; i < N_VALUES; ++i)
+        {
+            values_in[i] = static_cast<const CoreVariant&>(values[i]); // NB: a non const lvalue binds to the converting assignment
+        }
+        return 0;
+    });
+
+    Run("variant.visit", [&]()
+    {
+        VariantSum visitor = { 0 };
+        for (const CoreVariant& value : values)
+        {
+            value.ConstApply(visitor);
+        }
+        s_sink += visitor.sum;
+        return 0;
+    });
+
+    Run("variant.encode", [&]()
+    {
+        buffer.clear();
+        SerializationOutputWrapperType o(container, buffer);
+        for (CoreVariant& value : values)
+        {
+            value.Serialize(o);
+        }
+        o.Flush();
+        return buffer.size();
+    });
+
+    Run("variant.decode", [&]()
+    {
+        SerializationInputWrapperType i(container, buffer);
+        for (CoreVariant& value : values_in)
+        {
+            value.Serialize(i);
+        }
+        return buffer.size();
+    });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// The whole messages
+
+typedef Struct< TypeList<String, I64, F64, bool> > S;
+
+// the same tree as the one of TestMetaStruct
+static void SetupMetaStruct(S& mapdata)
+{
+    auto& chunks = mapdata.AddField("chunks").SetValue<S::FieldType::ValueType::ArrayType>();
+    for (size_t i = 0; i < 4; ++i)
+    {
+        S chunk("Chunk");
+        chunk.AddField("p_id").SetValue((U32)1000 + (U32)i);
+        chunk.AddField("c_id").SetValue((U32)2000 + (U32)i);
+
+        auto& tiles = chunk.AddField("tiles").SetValue<S::FieldType::ValueType::ArrayType>();
+        for (size_t j = 0; j < 4; ++j)
+        {
+            S tile("Tile");
+            tile.AddField("id").SetValue((U32)1000 + (U32)i*10 + (U32)j);
+            tile.AddField("nm").SetValue("abc");
+
+            tiles.push_back( S::FieldType::ValueType( std::move(tile) ) );
+        }
+        chunks.push_back( S::FieldType::ValueType( std::move(chunk) ) );
+    }
+
+    auto& cells = mapdata.AddField("cells").SetValue<S::FieldType::ValueType::ArrayType>();
+    for (size_t i = 0; i < 4; ++i)
+    {
+        S::FieldType::ValueType::ArrayType row;
+        for (size_t j = 0; j < 4; ++j)
+        {
+            S cell("Cell");
+            cell.AddField("a").SetValue((U32)1000 + (U32)i*10 + (U32)j);
+            row.push_back( S::FieldType::ValueType( std::move(cell) ) );
+        }
+        cells.push_back( S::FieldType::ValueType( std::move(row) ) );
+    }
+}
+
+// the arguments of a remote method, as serialized by the RMI
+struct Avatar
+{
+    bool Move(U32 id, F32 x, F32 y, F32 z, const String& zone, bool running)
+    {
+        return true;
+    }
+};
+
+typedef decltype(&Avatar::Move) AvatarMove;
+
+static void BenchmarkMessages()
+{
+    DataPolicyContainerType container;
+    container.Setup( DataPolicyContainerPreloadType::Singleton().Retrieve() );
+    Buffer buffer;
+
+    MapData mapdata;
+    mapdata.Setup();
+
+    Run("mapdata.encode", [&]()
+    {
+        buffer.clear();
+        SerializationOutputWrapperType o(container, buffer);
+        mapdata.Serialize(o);
+        o.Flush();
+        return buffer.size();
+    });
+
+    Run("mapdata.decode", [&]()
+    {
+        SerializationInputWrapperType i(container, buffer);
+        MapData md;
+        md.Serialize(i);
+        return buffer.size();
+    });
+
+    // the flat snapshot: a cold start is opening the image and reading a field of a march, against decoding it all (mapdata.decode)
+    Buffer image;
+
+    Run("mapdata.flat.write", [&]()
+    {
+        FlatSnapshotOutputType o(image);
+        o.Write(mapdata);
+        return image.size();
+    });
+
+    Run("mapdata.flat.read", [&]()
+    {
+        FlatSnapshotInputType i;
+        MapData md;
+        i.Open( image.data(), image.size() ) && i.Read(md);
+        return image.size();
+    });
+
+    static const char* const PATH = "MapData.snapshot";
+    {
+        FileSink sink(PATH);
+        sink.Write( image.data(), image.size() );
+    }
+
+    Run("mapdata.flat.mapped.open", [&]()
+    {
+        MappedFile file(PATH);
+        FlatSnapshot snapshot;
+        FlatArray marches;
+        FlatTable march;
+        U64 user_id = 0;
+        snapshot.Open( file.data(), file.size() ) && snapshot.GetRoot().Get(3, marches) && marches.Get(5, march) && march.Get(0, user_id);
+        return user_id == 999 ? file.size() : 0;
+    });
+    remove(PATH);
+
+    Columnar< std::deque<MapData::Chunk> > chunks(mapdata.chunks);
+
+    Run("mapdata.chunks.columnar.encode", [&]()
+    {
+        buffer.clear();
+        SerializationOutputWrapperType o(container, buffer);
+        chunks.Serialize(o);
+        o.Flush();
+        return buffer.size();
+    });
+
+    Run("mapdata.chunks.columnar.decode", [&]()
+    {
+        SerializationInputWrapperType i(container, buffer);
+        Columnar< std::deque<MapData::Chunk> > c;
+        c.Serialize(i);
+        return buffer.size();
+    });
+
+    S metastruct("MapData");
+    SetupMetaStruct(metastruct);
+
+    Run("metastruct.encode", [&]()
+    {
+        buffer.clear();
+        SerializationOutputWrapperType o(container, buffer);
+        metastruct.Serialize(o);
+        o.Flush();
+        return buffer.size();
+    });
+
+    Run("metastruct.decode", [&]()
+    {
+        SerializationInputWrapperType i(container, buffer);
+        S s;
+        s.Serialize(i);
+        return buffer.size();
+    });
+
+    Arena arena;
+    Run("metastruct.decode.arena", [&]()
+    {
+        {
+            ArenaScope scope(arena);
+            SerializationInputWrapperType i(container, buffer);
+            S s;
+            s.Serialize(i);
+        }
+        arena.Reset();
+        return buffer.size();
+    });
+
+    // the schemas are defined by a first message, and acknowledged
+    MetaSchemaRegistry sender, receiver;
+    for (int acknowledged = 0; acknowledged < 2; ++acknowledged)
+    {
+        {
+            MetaSchemaScope scope(sender);
+            buffer.clear();
+            SerializationOutputWrapperType o(container, buffer);
+            metastruct.Serialize(o);
+            o.Flush();
+            scope.Commit();
+        }
+        {
+            MetaSchemaScope scope(receiver);
+            SerializationInputWrapperType i(container, buffer);
+            S s;
+            s.Serialize(i);
+        }
+        sender.Acknowledge( receiver.GetNumDefined() );
+    }
+
+    Run("metastruct.encode.compiled", [&]()
+    {
+        MetaSchemaScope scope(sender);
+        buffer.clear();
+        SerializationOutputWrapperType o(container, buffer);
+        metastruct.Serialize(o);
+        o.Flush();
+        return buffer.size();
+    });
+
+    Run("metastruct.decode.compiled", [&]()
+    {
+        MetaSchemaScope scope(receiver);
+        SerializationInputWrapperType i(container, buffer);
+        S s;
+        s.Serialize(i);
+        return buffer.size();
+    });
+
+    Distributed::MemberFunctionTraits<AvatarMove>::As args( 42, 1.5f, -2.5f, 100.0f, String("harbour"), true );
+    Distributed::MemberFunctionTraits<AvatarMove>::As args_in;
+
+    Run("rmi.arguments.encode", [&]()
+    {
+        buffer.clear();
+        SerializationOutputWrapperType o(container, buffer);
+        Distributed::ArgumentsSerializer<AvatarMove>(o, args)();
+        o.Flush();
+        return buffer.size();
+    });
+
+    Run("rmi.arguments.decode", [&]()
+    {
+        SerializationInputWrapperType i(container, buffer);
+        Distributed::ArgumentsSerializer<AvatarMove>(i, args_in)();
+        return buffer.size();
+    });
+}
+
+int main(int argc, const char * argv[])
+{
+    s_filter = argc > 1 ? argv[1] : nullptr;
+
+    std::cout << "name\titerations\tns/op\tmin ns/op\tmax ns/op\tbytes/op\tallocs/op" << std::endl;
+
+    BenchmarkBitStream();
+
+    BenchmarkString();
+
+    BenchmarkQuantization();
+
+    BenchmarkUniqueString();
+
+    BenchmarkVariant();
+
+    BenchmarkMessages();
+
+    return 0;
+}